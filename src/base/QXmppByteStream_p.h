@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPBYTESTREAM_P_H
+#define QXMPPBYTESTREAM_P_H
+
+#include <QCryptographicHash>
+#include <QString>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppTransferManager and QXmppServerProxy65 classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// Returns the DST.ADDR used by the SOCKS5 bytestream \a sid between
+/// \a initiatorJid and \a targetJid, as defined by XEP-0065.
+
+inline QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QString str = sid + initiatorJid + targetJid;
+    hash.addData(str.toLatin1());
+    return hash.result().toHex();
+}
+
+/// Returns the amount of data a bytestream limited to \a rate bytes per
+/// second copies at once, which is also the size of its token bucket.
+/// It is never smaller than \a minimum.
+
+inline qint64 rateQuantum(qint64 rate, qint64 minimum)
+{
+    return qMax(minimum, rate / 20);
+}
+
+#endif
@@ -261,6 +261,20 @@ QXmppCodec::~QXmppCodec()
 {
 }
 
+/// Reads the encoded data of the packet which follows a lost packet,
+/// and writes samples reconstructing the lost packet to the output stream.
+///
+/// Codecs which carry redundant data, such as Opus with in-band FEC,
+/// should reimplement this method. The default implementation does
+/// nothing and returns 0.
+
+qint64 QXmppCodec::decodeRedundant(QDataStream &input, QDataStream &output)
+{
+    Q_UNUSED(input);
+    Q_UNUSED(output);
+    return 0;
+}
+
 QXmppVideoDecoder::~QXmppVideoDecoder()
 {
 }
@@ -404,10 +418,11 @@ QXmppOpusCodec::QXmppOpusCodec(int clockrate, int channels):
     encoder = opus_encoder_create(clockrate, channels, OPUS_APPLICATION_VOIP, &error);
 
     if (encoder || error == OPUS_OK) {
-        // Add some options for error correction.
-        opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
+        // In-band FEC and DTX are only enabled if the remote party asks
+        // for them, see setParameters().
+        opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(0));
         opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(20));
-        opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+        opus_encoder_ctl(encoder, OPUS_SET_DTX(0));
 #ifdef OPUS_SET_PREDICTION_DISABLED
         opus_encoder_ctl(encoder, OPUS_SET_PREDICTION_DISABLED(1));
 #endif
@@ -450,6 +465,24 @@ QXmppOpusCodec::~QXmppOpusCodec()
     }
 }
 
+/// Configures the encoder using the remote party's format parameters,
+/// as described by RFC 7587.
+///
+/// If "useinbandfec" is 1, forward error correction data for the previous
+/// frame is included in each packet. If "usedtx" is 1, discontinuous
+/// transmission is used and no data is output during silence.
+///
+/// \param parameters
+
+void QXmppOpusCodec::setParameters(const QMap<QString, QString> &parameters)
+{
+    if (!encoder)
+        return;
+
+    opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(parameters.value("useinbandfec") == "1"));
+    opus_encoder_ctl(encoder, OPUS_SET_DTX(parameters.value("usedtx") == "1"));
+}
+
 qint64 QXmppOpusCodec::encode(QDataStream &input, QDataStream &output)
 {
     // Read an audio frame.
@@ -477,8 +510,9 @@ qint64 QXmppOpusCodec::encode(QDataStream &input, QDataStream &output)
 
     if (length < 1)
         qWarning() << "Opus encoding error:" << opus_strerror(length);
-    else
-        // Write the encoded stream to the output.
+    else if (length > 2)
+        // Write the encoded stream to the output. Packets of 2 bytes or
+        // less are silence which does not need to be transmitted (DTX).
         output.writeRawData(opus_buffer.constData(), length);
 
     // Remove the frame from the sample buffer.
@@ -501,13 +535,12 @@ qint64 QXmppOpusCodec::decode(QDataStream &input, QDataStream &output)
     // Audio frame is nSamples at maximum, so
     QByteArray pcm_buffer(nSamples * nChannels * 2, 0);
 
-    // The last argumment must be 1 to enable FEC, but I don't why it results
-    // in a SIGSEV.
+    // The frame size is expressed in samples per channel, not bytes.
     int samples = opus_decode(decoder,
                               (uchar *) opus_buffer.constData(),
                               length,
                               (opus_int16 *) pcm_buffer.data(),
-                              pcm_buffer.size(),
+                              nSamples,
                               0);
 
     if (samples < 1) {
@@ -522,6 +555,42 @@ qint64 QXmppOpusCodec::decode(QDataStream &input, QDataStream &output)
     return samples;
 }
 
+qint64 QXmppOpusCodec::decodeRedundant(QDataStream &input, QDataStream &output)
+{
+    QByteArray opus_buffer(input.device()->bytesAvailable(), 0);
+    int length = input.readRawData(opus_buffer.data(), opus_buffer.size());
+
+    if (length < 1)
+        return 0;
+
+    // The lost frame is assumed to have the same duration as this one.
+    const int frameSize = opus_packet_get_nb_samples((uchar *) opus_buffer.constData(),
+                                                     length,
+                                                     sampleRate);
+    if (frameSize < 1 || frameSize > nSamples)
+        return 0;
+
+    // Decode the FEC data of the previous frame, if the packet contains
+    // none Opus falls back to packet loss concealment.
+    QByteArray pcm_buffer(frameSize * nChannels * 2, 0);
+    int samples = opus_decode(decoder,
+                              (uchar *) opus_buffer.constData(),
+                              length,
+                              (opus_int16 *) pcm_buffer.data(),
+                              frameSize,
+                              1);
+
+    if (samples < 1) {
+        qWarning() << "Opus FEC decoding error:" << opus_strerror(samples);
+
+        return 0;
+    }
+
+    output.writeRawData(pcm_buffer.constData(), samples * nChannels * 2);
+
+    return samples;
+}
+
 int QXmppOpusCodec::readWindow(int bufferSize)
 {
     // WARNING: We are expecting 2 bytes signed samples, but this is wrong since
@@ -676,7 +745,7 @@ QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacket &pa
     QList<QXmppVideoFrame> frames;
 
     // theora deframing: draft-ietf-avt-rtp-theora-00
-    QDataStream stream(packet.payload());
+    QDataStream stream(QByteArray::fromRawData(packet.payloadData(), packet.payloadSize()));
     quint32 theora_header;
     stream >> theora_header;
 
@@ -1104,6 +1173,11 @@ public:
 
     vpx_codec_ctx_t codec;
     QByteArray packetBuffer;
+    quint16 sequence;
+
+    // The last decoded frame. Its buffer is written to in place as long as
+    // the caller no longer holds a reference to it.
+    QXmppVideoFrame framePool;
 };
 
 bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame)
@@ -1123,15 +1197,19 @@ bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFra
     vpx_image_t *img;
     while ((img = vpx_codec_get_frame(&codec, &iter))) {
         if (img->fmt == VPX_IMG_FMT_I420) {
-            if (!frame->isValid()) {
+            const QSize size(img->d_w, img->d_h);
+            if (framePool.size() != size) {
                 const int bytes = img->d_w * img->d_h * 3 / 2;
 
-                *frame = QXmppVideoFrame(bytes,
-                    QSize(img->d_w, img->d_h),
+                framePool = QXmppVideoFrame(bytes,
+                    size,
                     img->d_w,
                     QXmppVideoFrame::Format_YUV420P);
             }
-            uchar *output = frame->bits();
+
+            // QXmppVideoFrame is implicitly shared, writing to the pooled
+            // frame only allocates if the previous frame is still in use.
+            uchar *output = framePool.bits();
 
             for (int i = 0; i < 3; ++i) {
                 uchar *input = img->planes[i];
@@ -1142,6 +1220,7 @@ bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFra
                     output += img->d_w / div;
                 }
             }
+            *frame = framePool;
         } else {
             qWarning("Vpx decoder received an unsupported frame format: %d", img->fmt);
         }
@@ -1153,15 +1232,24 @@ bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFra
 QXmppVpxDecoder::QXmppVpxDecoder()
 {
     d = new QXmppVpxDecoderPrivate;
+    d->sequence = 0;
     vpx_codec_flags_t flags = 0;
 
     // Enable FEC if codec support it.
     if (vpx_codec_get_caps(vpx_codec_vp8_dx()) & VPX_CODEC_CAP_ERROR_CONCEALMENT)
         flags |= VPX_CODEC_USE_ERROR_CONCEALMENT;
 
+    // Set the decoding threads number to use, the encoder splits frames
+    // into token partitions which can be decoded in parallel.
+    vpx_codec_dec_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    const int nThreads = QThread::idealThreadCount();
+    if (nThreads > 1)
+        cfg.threads = nThreads - 1;
+
     if (vpx_codec_dec_init(&d->codec,
                            vpx_codec_vp8_dx(),
-                           NULL,
+                           &cfg,
                            flags) != VPX_CODEC_OK) {
         qWarning("Vpx decoder could not be initialised");
     }
@@ -1185,7 +1273,7 @@ QXmppVideoFormat QXmppVpxDecoder::format() const
 QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacket &packet)
 {
     QList<QXmppVideoFrame> frames;
-    const QByteArray payload = packet.payload();
+    const QByteArray payload = QByteArray::fromRawData(packet.payloadData(), packet.payloadSize());
 
     // vp8 deframing: http://tools.ietf.org/html/draft-westin-payload-vp8-00
     QDataStream stream(payload);
@@ -1205,7 +1293,7 @@ QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacket &packe
 #endif
 
     QXmppVideoFrame frame;
-    static quint16 sequence = 0;
+    quint16 &sequence = d->sequence;
 
     // If the incoming packet sequence is wrong discard all packets until a
     // complete keyframe arrives.
@@ -1316,9 +1404,10 @@ QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
 
 QXmppVpxEncoder::~QXmppVpxEncoder()
 {
-    vpx_codec_destroy(&d->codec);
-    if (d->imageBuffer)
+    if (d->imageBuffer) {
+        vpx_codec_destroy(&d->codec);
         vpx_img_free(d->imageBuffer);
+    }
     delete d;
 }
 
@@ -1329,6 +1418,12 @@ bool QXmppVpxEncoder::setFormat(const QXmppVideoFormat &format)
         qWarning("Vpx encoder does not support the given format");
         return false;
     }
+    if (d->imageBuffer) {
+        vpx_codec_destroy(&d->codec);
+        vpx_img_free(d->imageBuffer);
+        d->imageBuffer = 0;
+    }
+
     d->cfg.g_w = format.frameSize().width();
     d->cfg.g_h = format.frameSize().height();
     if (vpx_codec_enc_init(&d->codec, vpx_codec_vp8_cx(), &d->cfg, 0) != VPX_CODEC_OK) {
@@ -1336,6 +1431,19 @@ bool QXmppVpxEncoder::setFormat(const QXmppVideoFormat &format)
         return false;
     }
 
+    // Split the frames into token partitions so that the remote decoder
+    // can make use of multiple threads.
+    if (d->cfg.g_threads > 0) {
+        int partitions;
+        if (d->cfg.g_threads >= 7)
+            partitions = VP8_EIGHT_TOKENPARTITION;
+        else if (d->cfg.g_threads >= 3)
+            partitions = VP8_FOUR_TOKENPARTITION;
+        else
+            partitions = VP8_TWO_TOKENPARTITION;
+        vpx_codec_control(&d->codec, VP8E_SET_TOKEN_PARTITIONS, partitions);
+    }
+
     d->imageBuffer = vpx_img_alloc(NULL, VPX_IMG_FMT_I420,
             format.frameSize().width(), format.frameSize().height(), 1);
     return true;
@@ -49,6 +49,8 @@ public:
     /// Reads encoded data from the input stream, decodes it and writes the
     /// decoded samples to the output stream.
     virtual qint64 decode(QDataStream &input, QDataStream &output) = 0;
+
+    virtual qint64 decodeRedundant(QDataStream &input, QDataStream &output);
 };
 
 /// \internal
@@ -122,8 +124,11 @@ public:
     QXmppOpusCodec(int clockrate, int channels);
     ~QXmppOpusCodec();
 
+    void setParameters(const QMap<QString, QString> &parameters);
+
     qint64 encode(QDataStream &input, QDataStream &output);
     qint64 decode(QDataStream &input, QDataStream &output);
+    qint64 decodeRedundant(QDataStream &input, QDataStream &output);
 
 private:
     OpusEncoder *encoder;
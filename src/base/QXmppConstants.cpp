@@ -116,22 +116,33 @@ const char* ns_media_element = "urn:xmpp:media-element";
 const char* ns_attention = "urn:xmpp:attention:0";
 // XEP-0231: Bits of Binary
 const char* ns_bob = "urn:xmpp:bob";
+// XEP-0234: Jingle File Transfer
+const char* ns_jingle_file_transfer = "urn:xmpp:jingle:apps:file-transfer:5";
 // XEP-0249: Direct MUC Invitations
 const char* ns_conference = "jabber:x:conference";
 // XEP-0280: Message Carbons
 const char* ns_carbons = "urn:xmpp:carbons:2";
 // XEP-0297: Stanza Forwarding
 const char* ns_forwarding = "urn:xmpp:forward:0";
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+const char* ns_hashes = "urn:xmpp:hashes:2";
+const char* ns_hash_sha256 = "urn:xmpp:hash-function-text-names:sha-256";
 // XEP-0308: Last Message Correction
 const char* ns_message_correct = "urn:xmpp:message-correct:0";
 // XEP-0313: Message Archive Management
 const char* ns_mam = "urn:xmpp:mam:1";
 // XEP-0319: Last User Interaction in Presence
 const char* ns_idle = "urn:xmpp:idle:1";
+// XEP-0334: Message Processing Hints
+const char* ns_message_processing_hints = "urn:xmpp:hints";
 // XEP-0333: Chat Markers
 const char* ns_chat_markers = "urn:xmpp:chat-markers:0";
+// XEP-0338: Jingle Grouping Framework
+const char* ns_jingle_grouping = "urn:xmpp:jingle:apps:grouping:0";
 // XEP-0352: Client State Indication
 const char* ns_csi = "urn:xmpp:csi:0";
+// XEP-0363: HTTP File Upload
+const char* ns_http_upload = "urn:xmpp:http:upload:0";
 // XEP-0369: Mediated Information eXchange (MIX)
 const char* ns_mix = "urn:xmpp:mix:core:0";
 const char* ns_mix_create_channel = "urn:xmpp:mix:core:0#create-channel";
@@ -128,22 +128,33 @@ extern const char* ns_media_element;
 extern const char* ns_attention;
 // XEP-0231: Bits of Binary
 extern const char* ns_bob;
+// XEP-0234: Jingle File Transfer
+extern const char* ns_jingle_file_transfer;
 // XEP-0249: Direct MUC Invitations
 extern const char* ns_conference;
 // XEP-0280: Message Carbons
 extern const char* ns_carbons;
 // XEP-0297: Stanza Forwarding
 extern const char* ns_forwarding;
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+extern const char* ns_hashes;
+extern const char* ns_hash_sha256;
 // XEP-0308: Last Message Correction
 extern const char* ns_message_correct;
 // XEP-0313: Message Archive Management
 extern const char* ns_mam;
 // XEP-0319: Last User Interaction in Presence
 extern const char* ns_idle;
+// XEP-0334: Message Processing Hints
+extern const char* ns_message_processing_hints;
 // XEP-0333: Char Markers
 extern const char* ns_chat_markers;
+// XEP-0338: Jingle Grouping Framework
+extern const char* ns_jingle_grouping;
 // XEP-0352: Client State Indication
 extern const char* ns_csi;
+// XEP-0363: HTTP File Upload
+extern const char* ns_http_upload;
 // XEP-0369: Mediated Information eXchange (MIX)
 extern const char* ns_mix;
 extern const char* ns_mix_create_channel;
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QMimeDatabase>
+
+#include "QXmppConstants_p.h"
+#include "QXmppHttpUploadIq.h"
+
+// Returns true if the slot may carry the PUT header \a name, as the
+// specification only allows a few headers to prevent abuse by the service.
+static bool isAllowedPutHeader(const QString &name)
+{
+    return name == QLatin1String("Authorization") ||
+           name == QLatin1String("Cookie") ||
+           name == QLatin1String("Expires");
+}
+
+QXmppHttpUploadRequestIq::QXmppHttpUploadRequestIq()
+    : QXmppIq(QXmppIq::Get)
+    , m_size(0)
+{
+}
+
+/// Returns the MIME type of the file.
+///
+
+QMimeType QXmppHttpUploadRequestIq::contentType() const
+{
+    return m_contentType;
+}
+
+/// Sets the MIME type of the file.
+///
+/// \param type
+
+void QXmppHttpUploadRequestIq::setContentType(const QMimeType &type)
+{
+    m_contentType = type;
+}
+
+/// Returns the name of the file, without its path.
+///
+
+QString QXmppHttpUploadRequestIq::fileName() const
+{
+    return m_fileName;
+}
+
+/// Sets the name of the file, without its path.
+///
+/// \param fileName
+
+void QXmppHttpUploadRequestIq::setFileName(const QString &fileName)
+{
+    m_fileName = fileName;
+}
+
+/// Returns the size of the file in bytes.
+///
+
+qint64 QXmppHttpUploadRequestIq::size() const
+{
+    return m_size;
+}
+
+/// Sets the size of the file in bytes.
+///
+/// \param size
+
+void QXmppHttpUploadRequestIq::setSize(qint64 size)
+{
+    m_size = size;
+}
+
+/// \cond
+bool QXmppHttpUploadRequestIq::isHttpUploadRequestIq(const QDomElement &element)
+{
+    const QDomElement requestElement = element.firstChildElement("request");
+    return requestElement.namespaceURI() == ns_http_upload;
+}
+
+void QXmppHttpUploadRequestIq::parseElementFromChild(const QDomElement &element)
+{
+    const QDomElement requestElement = element.firstChildElement("request");
+    m_fileName = requestElement.attribute("filename");
+    m_size = requestElement.attribute("size").toLongLong();
+    if (requestElement.hasAttribute("content-type"))
+        m_contentType = QMimeDatabase().mimeTypeForName(requestElement.attribute("content-type"));
+    else
+        m_contentType = QMimeType();
+}
+
+void QXmppHttpUploadRequestIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement("request");
+    writer->writeAttribute("xmlns", ns_http_upload);
+    writer->writeAttribute("filename", m_fileName);
+    writer->writeAttribute("size", QString::number(m_size));
+    if (m_contentType.isValid())
+        writer->writeAttribute("content-type", m_contentType.name());
+    writer->writeEndElement();
+}
+/// \endcond
+
+/// Returns the URL from which the file can be downloaded.
+///
+
+QUrl QXmppHttpUploadSlotIq::getUrl() const
+{
+    return m_getUrl;
+}
+
+/// Sets the URL from which the file can be downloaded.
+///
+/// \param getUrl
+
+void QXmppHttpUploadSlotIq::setGetUrl(const QUrl &getUrl)
+{
+    m_getUrl = getUrl;
+}
+
+/// Returns the headers to send with the PUT request.
+///
+
+QMap<QString, QString> QXmppHttpUploadSlotIq::putHeaders() const
+{
+    return m_putHeaders;
+}
+
+/// Sets the headers to send with the PUT request.
+///
+/// Only the Authorization, Cookie and Expires headers are kept.
+///
+/// \param putHeaders
+
+void QXmppHttpUploadSlotIq::setPutHeaders(const QMap<QString, QString> &putHeaders)
+{
+    m_putHeaders.clear();
+    foreach (const QString &name, putHeaders.keys())
+        if (isAllowedPutHeader(name))
+            m_putHeaders.insert(name, putHeaders.value(name));
+}
+
+/// Returns the URL to which the file is uploaded.
+///
+
+QUrl QXmppHttpUploadSlotIq::putUrl() const
+{
+    return m_putUrl;
+}
+
+/// Sets the URL to which the file is uploaded.
+///
+/// \param putUrl
+
+void QXmppHttpUploadSlotIq::setPutUrl(const QUrl &putUrl)
+{
+    m_putUrl = putUrl;
+}
+
+/// \cond
+bool QXmppHttpUploadSlotIq::isHttpUploadSlotIq(const QDomElement &element)
+{
+    const QDomElement slotElement = element.firstChildElement("slot");
+    return slotElement.namespaceURI() == ns_http_upload;
+}
+
+void QXmppHttpUploadSlotIq::parseElementFromChild(const QDomElement &element)
+{
+    const QDomElement slotElement = element.firstChildElement("slot");
+    const QDomElement putElement = slotElement.firstChildElement("put");
+    m_getUrl = QUrl::fromEncoded(slotElement.firstChildElement("get").attribute("url").toUtf8());
+    m_putUrl = QUrl::fromEncoded(putElement.attribute("url").toUtf8());
+
+    m_putHeaders.clear();
+    QDomElement headerElement = putElement.firstChildElement("header");
+    while (!headerElement.isNull()) {
+        const QString name = headerElement.attribute("name");
+        if (isAllowedPutHeader(name))
+            m_putHeaders.insert(name, headerElement.text());
+        headerElement = headerElement.nextSiblingElement("header");
+    }
+}
+
+void QXmppHttpUploadSlotIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement("slot");
+    writer->writeAttribute("xmlns", ns_http_upload);
+
+    writer->writeStartElement("put");
+    writer->writeAttribute("url", QString::fromUtf8(m_putUrl.toEncoded()));
+    foreach (const QString &name, m_putHeaders.keys()) {
+        writer->writeStartElement("header");
+        writer->writeAttribute("name", name);
+        writer->writeCharacters(m_putHeaders.value(name));
+        writer->writeEndElement();
+    }
+    writer->writeEndElement();
+
+    writer->writeStartElement("get");
+    writer->writeAttribute("url", QString::fromUtf8(m_getUrl.toEncoded()));
+    writer->writeEndElement();
+
+    writer->writeEndElement();
+}
+/// \endcond
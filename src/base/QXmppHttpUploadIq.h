@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPHTTPUPLOADIQ_H
+#define QXMPPHTTPUPLOADIQ_H
+
+#include <QMap>
+#include <QMimeType>
+#include <QUrl>
+
+#include "QXmppIq.h"
+
+/// \brief The QXmppHttpUploadRequestIq class represents a request for an
+/// upload slot as defined by XEP-0363: HTTP File Upload.
+///
+/// \ingroup Stanzas
+
+class QXMPP_EXPORT QXmppHttpUploadRequestIq : public QXmppIq
+{
+public:
+    QXmppHttpUploadRequestIq();
+
+    QMimeType contentType() const;
+    void setContentType(const QMimeType &type);
+
+    QString fileName() const;
+    void setFileName(const QString &fileName);
+
+    qint64 size() const;
+    void setSize(qint64 size);
+
+    static bool isHttpUploadRequestIq(const QDomElement &element);
+
+protected:
+    /// \cond
+    void parseElementFromChild(const QDomElement &element);
+    void toXmlElementFromChild(QXmlStreamWriter *writer) const;
+    /// \endcond
+
+private:
+    QMimeType m_contentType;
+    QString m_fileName;
+    qint64 m_size;
+};
+
+/// \brief The QXmppHttpUploadSlotIq class represents an upload slot as
+/// defined by XEP-0363: HTTP File Upload.
+///
+/// The file is uploaded with an HTTP PUT request to putUrl(), then it can
+/// be downloaded from getUrl().
+///
+/// \ingroup Stanzas
+
+class QXMPP_EXPORT QXmppHttpUploadSlotIq : public QXmppIq
+{
+public:
+    QUrl getUrl() const;
+    void setGetUrl(const QUrl &getUrl);
+
+    QMap<QString, QString> putHeaders() const;
+    void setPutHeaders(const QMap<QString, QString> &putHeaders);
+
+    QUrl putUrl() const;
+    void setPutUrl(const QUrl &putUrl);
+
+    static bool isHttpUploadSlotIq(const QDomElement &element);
+
+protected:
+    /// \cond
+    void parseElementFromChild(const QDomElement &element);
+    void toXmlElementFromChild(QXmlStreamWriter *writer) const;
+    /// \endcond
+
+private:
+    QUrl m_getUrl;
+    QMap<QString, QString> m_putHeaders;
+    QUrl m_putUrl;
+};
+
+#endif
@@ -28,7 +28,7 @@
 #include "QXmppConstants_p.h"
 #include "QXmppIbbIq.h"
 
-QXmppIbbOpenIq::QXmppIbbOpenIq() : QXmppIq(QXmppIq::Set), m_block_size(1024)
+QXmppIbbOpenIq::QXmppIbbOpenIq() : QXmppIq(QXmppIq::Set), m_block_size(1024), m_stanza_type(IqStanza)
 {
 
 }
@@ -43,6 +43,16 @@ void QXmppIbbOpenIq::setBlockSize( long block_size )
     m_block_size = block_size;
 }
 
+QXmppIbbOpenIq::StanzaType QXmppIbbOpenIq::stanzaType() const
+{
+    return m_stanza_type;
+}
+
+void QXmppIbbOpenIq::setStanzaType( StanzaType stanzaType )
+{
+    m_stanza_type = stanzaType;
+}
+
 QString QXmppIbbOpenIq::sid() const
 {
    return  m_sid;
@@ -65,6 +75,7 @@ void QXmppIbbOpenIq::parseElementFromChild(const QDomElement &element)
     QDomElement openElement = element.firstChildElement("open");
     m_sid = openElement.attribute( "sid" );
     m_block_size = openElement.attribute( "block-size" ).toLong();
+    m_stanza_type = openElement.attribute( "stanza" ) == "message" ? MessageStanza : IqStanza;
 }
 
 void QXmppIbbOpenIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -73,6 +84,8 @@ void QXmppIbbOpenIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeAttribute( "xmlns",ns_ibb);
     writer->writeAttribute( "sid",m_sid);
     writer->writeAttribute( "block-size",QString::number(m_block_size) );
+    if (m_stanza_type == MessageStanza)
+        writer->writeAttribute( "stanza","message" );
     writer->writeEndElement();
 }
 /// \endcond
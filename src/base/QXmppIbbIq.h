@@ -30,11 +30,21 @@
 class QXmppIbbOpenIq: public QXmppIq
 {
 public:
+    /// This enum is used to describe the stanzas carrying the data.
+    enum StanzaType
+    {
+        IqStanza,       ///< Data is sent in IQ stanzas, each acknowledged.
+        MessageStanza   ///< Data is sent in message stanzas, without acknowledgement.
+    };
+
     QXmppIbbOpenIq();
 
     long blockSize() const;
     void setBlockSize( long block_size );
 
+    StanzaType stanzaType() const;
+    void setStanzaType( StanzaType stanzaType );
+
     QString sid() const;
     void setSid( const QString &sid );
 
@@ -48,6 +58,7 @@ protected:
 
 private:
     long m_block_size;
+    StanzaType m_stanza_type;
     QString m_sid;
 };
 
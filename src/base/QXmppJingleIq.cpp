@@ -156,6 +156,7 @@ public:
     QString senders;
 
     QString descriptionMedia;
+    bool descriptionRtcpMux;
     quint32 descriptionSsrc;
     QString descriptionType;
     QString transportType;
@@ -166,12 +167,20 @@ public:
     QString transportFingerprintHash;
     QString transportFingerprintSetup;
 
+    QString fileName;
+    qint64 fileSize;
+    QString fileDescription;
+    QByteArray fileSha256;
+
     QList<QXmppJinglePayloadType> payloadTypes;
+    QList<QXmppJingleRtpCryptoElement> rtpCryptoElements;
     QList<QXmppJingleCandidate> transportCandidates;
 };
 
 QXmppJingleIqContentPrivate::QXmppJingleIqContentPrivate()
-    : descriptionSsrc(0)
+    : descriptionRtcpMux(false)
+    , descriptionSsrc(0)
+    , fileSize(0)
 {
 }
 
@@ -272,6 +281,39 @@ void QXmppJingleIq::Content::setPayloadTypes(const QList<QXmppJinglePayloadType>
     d->payloadTypes = payloadTypes;
 }
 
+/// Returns the crypto elements used to negotiate SRTP keys.
+
+QList<QXmppJingleRtpCryptoElement> QXmppJingleIq::Content::rtpCryptoElements() const
+{
+    return d->rtpCryptoElements;
+}
+
+/// Sets the crypto elements used to negotiate SRTP keys.
+///
+/// \param cryptoElements
+
+void QXmppJingleIq::Content::setRtpCryptoElements(const QList<QXmppJingleRtpCryptoElement> &cryptoElements)
+{
+    d->rtpCryptoElements = cryptoElements;
+}
+
+/// Returns true if RTP and RTCP packets can be sent on a single
+/// component, as defined by RFC 5761.
+
+bool QXmppJingleIq::Content::isRtpMultiplexingSupported() const
+{
+    return d->descriptionRtcpMux;
+}
+
+/// Sets whether RTP and RTCP packets can be sent on a single component.
+///
+/// \param supported
+
+void QXmppJingleIq::Content::setRtpMultiplexingSupported(bool supported)
+{
+    d->descriptionRtcpMux = supported;
+}
+
 void QXmppJingleIq::Content::addTransportCandidate(const QXmppJingleCandidate &candidate)
 {
     d->transportType = ns_jingle_ice_udp;
@@ -363,6 +405,70 @@ void QXmppJingleIq::Content::setTransportFingerprintSetup(const QString &setup)
     d->transportFingerprintSetup = setup;
 }
 
+/// Returns the name of the offered file.
+///
+/// This is used for file transfers as defined in XEP-0234.
+
+QString QXmppJingleIq::Content::fileName() const
+{
+    return d->fileName;
+}
+
+/// Sets the name of the offered file.
+///
+/// This is used for file transfers as defined in XEP-0234.
+
+void QXmppJingleIq::Content::setFileName(const QString &name)
+{
+    d->descriptionType = ns_jingle_file_transfer;
+    d->fileName = name;
+}
+
+/// Returns the size of the offered file in bytes.
+
+qint64 QXmppJingleIq::Content::fileSize() const
+{
+    return d->fileSize;
+}
+
+/// Sets the size of the offered file in bytes.
+
+void QXmppJingleIq::Content::setFileSize(qint64 size)
+{
+    d->descriptionType = ns_jingle_file_transfer;
+    d->fileSize = size;
+}
+
+/// Returns the human-readable description of the offered file.
+
+QString QXmppJingleIq::Content::fileDescription() const
+{
+    return d->fileDescription;
+}
+
+/// Sets the human-readable description of the offered file.
+
+void QXmppJingleIq::Content::setFileDescription(const QString &description)
+{
+    d->descriptionType = ns_jingle_file_transfer;
+    d->fileDescription = description;
+}
+
+/// Returns the SHA-256 hash of the offered file.
+
+QByteArray QXmppJingleIq::Content::fileSha256() const
+{
+    return d->fileSha256;
+}
+
+/// Sets the SHA-256 hash of the offered file.
+
+void QXmppJingleIq::Content::setFileSha256(const QByteArray &hash)
+{
+    d->descriptionType = ns_jingle_file_transfer;
+    d->fileSha256 = hash;
+}
+
 /// \cond
 void QXmppJingleIq::Content::parse(const QDomElement &element)
 {
@@ -376,6 +482,7 @@ void QXmppJingleIq::Content::parse(const QDomElement &element)
     d->descriptionType = descriptionElement.namespaceURI();
     d->descriptionMedia = descriptionElement.attribute("media");
     d->descriptionSsrc = descriptionElement.attribute("ssrc").toULong();
+    d->descriptionRtcpMux = !descriptionElement.firstChildElement("rtcp-mux").isNull();
     QDomElement child = descriptionElement.firstChildElement("payload-type");
     while (!child.isNull())
     {
@@ -384,6 +491,27 @@ void QXmppJingleIq::Content::parse(const QDomElement &element)
         d->payloadTypes << payload;
         child = child.nextSiblingElement("payload-type");
     }
+    child = descriptionElement.firstChildElement("encryption").firstChildElement("crypto");
+    while (!child.isNull()) {
+        QXmppJingleRtpCryptoElement crypto;
+        crypto.parse(child);
+        d->rtpCryptoElements << crypto;
+        child = child.nextSiblingElement("crypto");
+    }
+
+    // XEP-0234
+    QDomElement fileElement = descriptionElement.firstChildElement("file");
+    if (d->descriptionType == ns_jingle_file_transfer && !fileElement.isNull()) {
+        d->fileName = fileElement.firstChildElement("name").text();
+        d->fileSize = fileElement.firstChildElement("size").text().toLongLong();
+        d->fileDescription = fileElement.firstChildElement("desc").text();
+        child = fileElement.firstChildElement("hash");
+        while (!child.isNull()) {
+            if (child.namespaceURI() == ns_hashes && child.attribute("algo") == QLatin1String("sha-256"))
+                d->fileSha256 = QByteArray::fromBase64(child.text().toLatin1());
+            child = child.nextSiblingElement("hash");
+        }
+    }
 
     // transport
     QDomElement transportElement = element.firstChildElement("transport");
@@ -428,6 +556,31 @@ void QXmppJingleIq::Content::toXml(QXmlStreamWriter *writer) const
             writer->writeAttribute("ssrc", QString::number(d->descriptionSsrc));
         foreach (const QXmppJinglePayloadType &payload, d->payloadTypes)
             payload.toXml(writer);
+        if (!d->rtpCryptoElements.isEmpty()) {
+            writer->writeStartElement("encryption");
+            foreach (const QXmppJingleRtpCryptoElement &crypto, d->rtpCryptoElements)
+                crypto.toXml(writer);
+            writer->writeEndElement();
+        }
+        if (d->descriptionRtcpMux)
+            writer->writeEmptyElement("rtcp-mux");
+
+        // XEP-0234
+        if (d->descriptionType == ns_jingle_file_transfer) {
+            writer->writeStartElement("file");
+            helperToXmlAddTextElement(writer, "name", d->fileName);
+            if (d->fileSize > 0)
+                helperToXmlAddTextElement(writer, "size", QString::number(d->fileSize));
+            helperToXmlAddTextElement(writer, "desc", d->fileDescription);
+            if (!d->fileSha256.isEmpty()) {
+                writer->writeStartElement("hash");
+                writer->writeAttribute("xmlns", ns_hashes);
+                writer->writeAttribute("algo", "sha-256");
+                writer->writeCharacters(d->fileSha256.toBase64());
+                writer->writeEndElement();
+            }
+            writer->writeEndElement();
+        }
         writer->writeEndElement();
     }
 
@@ -527,6 +680,8 @@ bool QXmppJingleIq::Content::parseSdp(const QString &sdp)
                 d->transportUser = attrValue;
             } else if (attrName == "ice-pwd") {
                 d->transportPassword = attrValue;
+            } else if (attrName == "rtcp-mux") {
+                d->descriptionRtcpMux = true;
             } else if (attrName == "setup") {
                 d->transportFingerprintSetup = attrValue;
             } else if (attrName == "ssrc") {
@@ -614,6 +769,8 @@ QString QXmppJingleIq::Content::toSdp() const
     sdp << QString("m=%1 %2 RTP/AVP%3").arg(d->descriptionMedia, QString::number(localRtpPort), payloads);
     sdp << QString("c=%1").arg(addressToSdp(localRtpAddress));
     sdp += attrs;
+    if (d->descriptionRtcpMux)
+        sdp << QString("a=rtcp-mux");
 
     // transport
     foreach (const QXmppJingleCandidate &candidate, d->transportCandidates)
@@ -700,6 +857,7 @@ public:
     QXmppJingleIqPrivate();
 
     QXmppJingleIq::Action action;
+    QStringList bundledContents;
     QString initiator;
     QString responder;
     QString sid;
@@ -762,6 +920,23 @@ void QXmppJingleIq::setAction(QXmppJingleIq::Action action)
     d->action = action;
 }
 
+/// Returns the names of the contents which share a single transport,
+/// as defined by the BUNDLE semantics of XEP-0338.
+
+QStringList QXmppJingleIq::bundledContents() const
+{
+    return d->bundledContents;
+}
+
+/// Sets the names of the contents which share a single transport.
+///
+/// \param names
+
+void QXmppJingleIq::setBundledContents(const QStringList &names)
+{
+    d->bundledContents = names;
+}
+
 /// Adds an element to the IQ's content elements.
 
 void QXmppJingleIq::addContent(const QXmppJingleIq::Content &content)
@@ -894,6 +1069,21 @@ void QXmppJingleIq::parseElementFromChild(const QDomElement &element)
     QDomElement reasonElement = jingleElement.firstChildElement("reason");
     d->reason.parse(reasonElement);
 
+    // XEP-0338: Jingle Grouping Framework
+    d->bundledContents.clear();
+    QDomElement groupElement = jingleElement.firstChildElement("group");
+    while (!groupElement.isNull()) {
+        if (groupElement.namespaceURI() == ns_jingle_grouping &&
+            groupElement.attribute("semantics") == QLatin1String("BUNDLE")) {
+            QDomElement child = groupElement.firstChildElement("content");
+            while (!child.isNull()) {
+                d->bundledContents << child.attribute("name");
+                child = child.nextSiblingElement("content");
+            }
+        }
+        groupElement = groupElement.nextSiblingElement("group");
+    }
+
     // ringing
     QDomElement ringingElement = jingleElement.firstChildElement("ringing");
     d->ringing = (ringingElement.namespaceURI() == ns_jingle_rtp_info);
@@ -911,6 +1101,19 @@ void QXmppJingleIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
         content.toXml(writer);
     d->reason.toXml(writer);
 
+    // XEP-0338: Jingle Grouping Framework
+    if (!d->bundledContents.isEmpty()) {
+        writer->writeStartElement("group");
+        writer->writeAttribute("xmlns", ns_jingle_grouping);
+        writer->writeAttribute("semantics", "BUNDLE");
+        foreach (const QString &name, d->bundledContents) {
+            writer->writeStartElement("content");
+            writer->writeAttribute("name", name);
+            writer->writeEndElement();
+        }
+        writer->writeEndElement();
+    }
+
     // ringing
     if (d->ringing) {
         writer->writeStartElement("ringing");
@@ -1453,3 +1656,131 @@ bool QXmppJinglePayloadType::operator==(const QXmppJinglePayloadType &other) con
                other.d->clockrate == d->clockrate &&
                other.d->name.toLower() == d->name.toLower();
 }
+
+class QXmppJingleRtpCryptoElementPrivate : public QSharedData
+{
+public:
+    QXmppJingleRtpCryptoElementPrivate();
+
+    int tag;
+    QString cryptoSuite;
+    QString keyParams;
+    QString sessionParams;
+};
+
+QXmppJingleRtpCryptoElementPrivate::QXmppJingleRtpCryptoElementPrivate()
+    : tag(0)
+{
+}
+
+QXmppJingleRtpCryptoElement::QXmppJingleRtpCryptoElement()
+    : d(new QXmppJingleRtpCryptoElementPrivate())
+{
+}
+
+/// Constructs a copy of other.
+///
+/// \param other
+
+QXmppJingleRtpCryptoElement::QXmppJingleRtpCryptoElement(const QXmppJingleRtpCryptoElement &other)
+    : d(other.d)
+{
+}
+
+QXmppJingleRtpCryptoElement::~QXmppJingleRtpCryptoElement()
+{
+}
+
+/// Assigns the other crypto element to this one.
+///
+/// \param other
+
+QXmppJingleRtpCryptoElement& QXmppJingleRtpCryptoElement::operator=(const QXmppJingleRtpCryptoElement& other)
+{
+    d = other.d;
+    return *this;
+}
+
+/// Returns the tag which identifies the crypto element in an answer.
+
+int QXmppJingleRtpCryptoElement::tag() const
+{
+    return d->tag;
+}
+
+/// Sets the tag which identifies the crypto element in an answer.
+///
+/// \param tag
+
+void QXmppJingleRtpCryptoElement::setTag(int tag)
+{
+    d->tag = tag;
+}
+
+/// Returns the crypto suite, for instance "AES_CM_128_HMAC_SHA1_80".
+
+QString QXmppJingleRtpCryptoElement::cryptoSuite() const
+{
+    return d->cryptoSuite;
+}
+
+/// Sets the crypto suite, for instance "AES_CM_128_HMAC_SHA1_80".
+///
+/// \param cryptoSuite
+
+void QXmppJingleRtpCryptoElement::setCryptoSuite(const QString &cryptoSuite)
+{
+    d->cryptoSuite = cryptoSuite;
+}
+
+/// Returns the key parameters, for instance "inline:<base64 key and salt>".
+
+QString QXmppJingleRtpCryptoElement::keyParams() const
+{
+    return d->keyParams;
+}
+
+/// Sets the key parameters, for instance "inline:<base64 key and salt>".
+///
+/// \param keyParams
+
+void QXmppJingleRtpCryptoElement::setKeyParams(const QString &keyParams)
+{
+    d->keyParams = keyParams;
+}
+
+/// Returns the optional session parameters.
+
+QString QXmppJingleRtpCryptoElement::sessionParams() const
+{
+    return d->sessionParams;
+}
+
+/// Sets the optional session parameters.
+///
+/// \param sessionParams
+
+void QXmppJingleRtpCryptoElement::setSessionParams(const QString &sessionParams)
+{
+    d->sessionParams = sessionParams;
+}
+
+/// \cond
+void QXmppJingleRtpCryptoElement::parse(const QDomElement &element)
+{
+    d->tag = element.attribute("tag").toInt();
+    d->cryptoSuite = element.attribute("crypto-suite");
+    d->keyParams = element.attribute("key-params");
+    d->sessionParams = element.attribute("session-params");
+}
+
+void QXmppJingleRtpCryptoElement::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement("crypto");
+    helperToXmlAddAttribute(writer, "crypto-suite", d->cryptoSuite);
+    helperToXmlAddAttribute(writer, "key-params", d->keyParams);
+    helperToXmlAddAttribute(writer, "session-params", d->sessionParams);
+    helperToXmlAddAttribute(writer, "tag", QString::number(d->tag));
+    writer->writeEndElement();
+}
+/// \endcond
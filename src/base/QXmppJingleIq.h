@@ -32,6 +32,7 @@ class QXmppJingleCandidatePrivate;
 class QXmppJingleIqContentPrivate;
 class QXmppJingleIqPrivate;
 class QXmppJinglePayloadTypePrivate;
+class QXmppJingleRtpCryptoElementPrivate;
 
 /// \brief The QXmppJinglePayloadType class represents a payload type
 /// as specified by XEP-0167: Jingle RTP Sessions and RFC 5245.
@@ -146,6 +147,41 @@ private:
     QSharedDataPointer<QXmppJingleCandidatePrivate> d;
 };
 
+/// \brief The QXmppJingleRtpCryptoElement class represents a "crypto" element
+/// used to negotiate SRTP keys as specified by XEP-0167: Jingle RTP Sessions
+/// and RFC 4568 (SDES).
+///
+
+class QXMPP_EXPORT QXmppJingleRtpCryptoElement
+{
+public:
+    QXmppJingleRtpCryptoElement();
+    QXmppJingleRtpCryptoElement(const QXmppJingleRtpCryptoElement &other);
+    ~QXmppJingleRtpCryptoElement();
+
+    QXmppJingleRtpCryptoElement& operator=(const QXmppJingleRtpCryptoElement &other);
+
+    int tag() const;
+    void setTag(int tag);
+
+    QString cryptoSuite() const;
+    void setCryptoSuite(const QString &cryptoSuite);
+
+    QString keyParams() const;
+    void setKeyParams(const QString &keyParams);
+
+    QString sessionParams() const;
+    void setSessionParams(const QString &sessionParams);
+
+    /// \cond
+    void parse(const QDomElement &element);
+    void toXml(QXmlStreamWriter *writer) const;
+    /// \endcond
+
+private:
+    QSharedDataPointer<QXmppJingleRtpCryptoElementPrivate> d;
+};
+
 /// \brief The QXmppJingleIq class represents an IQ used for initiating media
 /// sessions as specified by XEP-0166: Jingle.
 ///
@@ -207,6 +243,12 @@ public:
         QList<QXmppJinglePayloadType> payloadTypes() const;
         void setPayloadTypes(const QList<QXmppJinglePayloadType> &payloadTypes);
 
+        QList<QXmppJingleRtpCryptoElement> rtpCryptoElements() const;
+        void setRtpCryptoElements(const QList<QXmppJingleRtpCryptoElement> &cryptoElements);
+
+        bool isRtpMultiplexingSupported() const;
+        void setRtpMultiplexingSupported(bool supported);
+
         void addTransportCandidate(const QXmppJingleCandidate &candidate);
         QList<QXmppJingleCandidate> transportCandidates() const;
         void setTransportCandidates(const QList<QXmppJingleCandidate> &candidates);
@@ -227,6 +269,19 @@ public:
         QString transportFingerprintSetup() const;
         void setTransportFingerprintSetup(const QString &setup);
 
+        // XEP-0234: Jingle File Transfer
+        QString fileName() const;
+        void setFileName(const QString &name);
+
+        qint64 fileSize() const;
+        void setFileSize(qint64 size);
+
+        QString fileDescription() const;
+        void setFileDescription(const QString &description);
+
+        QByteArray fileSha256() const;
+        void setFileSha256(const QByteArray &hash);
+
         /// \cond
         void parse(const QDomElement &element);
         void toXml(QXmlStreamWriter *writer) const;
@@ -296,6 +351,10 @@ public:
     Action action() const;
     void setAction(Action action);
 
+    // XEP-0338: Jingle Grouping Framework
+    QStringList bundledContents() const;
+    void setBundledContents(const QStringList &names);
+
     void addContent(const Content &content);
     QList<Content> contents() const;
     void setContents(const QList<Content> &contents);
@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QTimer>
+#include <QtEndian>
+
+#include "QXmppReliableChannel_p.h"
+
+// The packet types are chosen so that they can be told apart from STUN,
+// DTLS, TURN and RTP packets when they share an ICE component (RFC 7983).
+static const quint8 DataPacket = 0xc0;
+static const quint8 AckPacket = 0xc1;
+static const quint8 FinFlag = 0x01;
+
+static const int DataHeaderSize = 12;
+static const int AckHeaderSize = 16;
+static const int SackBits = 32;
+
+static const int initialWindow = 4;
+static const int initialRto = 1000;
+static const int minimumRto = 200;
+static const int maximumRto = 60000;
+
+// Written data which has already been segmented is dropped from the send
+// buffer once this many bytes have accumulated.
+static const int compactThreshold = 65536;
+
+struct QXmppReliableSegment
+{
+    QByteArray payload;
+    bool fin;
+    bool lost;
+};
+
+struct QXmppReliableReceived
+{
+    QByteArray payload;
+    bool fin;
+};
+
+class QXmppReliableChannelPrivate
+{
+public:
+    QXmppReliableChannelPrivate(QXmppReliableChannel *qq);
+
+    void handleAck(quint32 ack, quint32 echo, quint32 sack, quint16 window);
+    void handleData(quint32 seq, quint32 stamp, bool fin, const QByteArray &payload);
+    void restartTimer();
+    void sendAck(quint32 stamp);
+    void sendSegments();
+    void transmit(quint32 seq, QXmppReliableSegment &segment);
+    int outstanding() const;
+    int window() const;
+
+    QElapsedTimer clock;
+    QTimer *retransmitTimer;
+
+    // sender
+    QByteArray sendBuffer;
+    int sendOffset;
+    qint64 inFlightBytes;
+    QMap<quint32, QXmppReliableSegment> inFlight;
+    int lostSegments;
+    quint32 nextSequence;
+    quint32 unacknowledged;
+    bool finishRequested;
+    bool finSent;
+    bool finished;
+
+    // congestion control
+    double cwnd;
+    int ssthresh;
+    int remoteWindow;
+    int duplicateAcks;
+    bool recovering;
+    quint32 recover;
+    int srtt;
+    int rttvar;
+    int rto;
+
+    // receiver
+    QByteArray readBuffer;
+    QMap<quint32, QXmppReliableReceived> reorder;
+    quint32 expectedSequence;
+    bool remoteFinished;
+
+private:
+    QXmppReliableChannel *q;
+};
+
+QXmppReliableChannelPrivate::QXmppReliableChannelPrivate(QXmppReliableChannel *qq)
+    : retransmitTimer(0)
+    , sendOffset(0)
+    , inFlightBytes(0)
+    , lostSegments(0)
+    , nextSequence(0)
+    , unacknowledged(0)
+    , finishRequested(false)
+    , finSent(false)
+    , finished(false)
+    , cwnd(initialWindow)
+    , ssthresh(QXmppReliableChannel::ReceiveWindow)
+    , remoteWindow(QXmppReliableChannel::ReceiveWindow)
+    , duplicateAcks(0)
+    , recovering(false)
+    , recover(0)
+    , srtt(-1)
+    , rttvar(0)
+    , rto(initialRto)
+    , expectedSequence(0)
+    , remoteFinished(false)
+    , q(qq)
+{
+    clock.start();
+}
+
+void QXmppReliableChannelPrivate::handleAck(quint32 ack, quint32 echo, quint32 sack, quint16 window)
+{
+    remoteWindow = window;
+
+    // update the round-trip time estimate as described by RFC 6298,
+    // the echoed timestamp identifies the transmission being acknowledged
+    const int sample = qMax(0, int(quint32(clock.elapsed()) - echo));
+    if (srtt < 0) {
+        srtt = sample;
+        rttvar = sample / 2;
+    } else {
+        rttvar = (3 * rttvar + qAbs(srtt - sample)) / 4;
+        srtt = (7 * srtt + sample) / 8;
+    }
+    rto = qBound(minimumRto, srtt + qMax(1, 4 * rttvar), maximumRto);
+
+    qint64 acknowledgedBytes = 0;
+    int acknowledgedSegments = 0;
+
+    // segments held out of order by the receiver are never discarded,
+    // so they can leave the retransmission queue
+    for (int i = 0; i < SackBits; ++i) {
+        if (sack & (1u << i)) {
+            QMap<quint32, QXmppReliableSegment>::iterator it = inFlight.find(ack + 1 + i);
+            if (it != inFlight.end()) {
+                acknowledgedBytes += it->payload.size();
+                ++acknowledgedSegments;
+                if (it->lost)
+                    --lostSegments;
+                inFlight.erase(it);
+            }
+        }
+    }
+
+    if (ack > unacknowledged) {
+        QMap<quint32, QXmppReliableSegment>::iterator it = inFlight.begin();
+        while (it != inFlight.end() && it.key() < ack) {
+            acknowledgedBytes += it->payload.size();
+            ++acknowledgedSegments;
+            if (it->lost)
+                --lostSegments;
+            it = inFlight.erase(it);
+        }
+        unacknowledged = ack;
+        duplicateAcks = 0;
+
+        if (recovering) {
+            if (ack > recover) {
+                recovering = false;
+                cwnd = ssthresh;
+            } else if (!inFlight.isEmpty() && inFlight.begin().key() == ack && !inFlight.begin()->lost) {
+                // partial acknowledgement, the next hole was lost too
+                transmit(ack, inFlight.begin().value());
+            }
+        } else if (cwnd < ssthresh) {
+            cwnd += acknowledgedSegments;
+        } else {
+            cwnd += double(acknowledgedSegments) / cwnd;
+        }
+        restartTimer();
+    } else if (ack == unacknowledged && !inFlight.isEmpty()) {
+        ++duplicateAcks;
+        if (duplicateAcks == 3 && !recovering) {
+            // fast retransmit
+            ssthresh = qMax(outstanding() / 2, 2);
+            cwnd = ssthresh + 3;
+            recovering = true;
+            recover = nextSequence - 1;
+            if (inFlight.begin().key() == ack && !inFlight.begin()->lost)
+                transmit(ack, inFlight.begin().value());
+        } else if (recovering) {
+            cwnd += 1;
+        }
+    }
+    cwnd = qMin(cwnd, double(QXmppReliableChannel::ReceiveWindow));
+
+    inFlightBytes -= acknowledgedBytes;
+    if (acknowledgedBytes)
+        emit q->bytesWritten(acknowledgedBytes);
+
+    if (finSent && !finished && inFlight.isEmpty()) {
+        finished = true;
+        retransmitTimer->stop();
+        emit q->finished();
+        return;
+    }
+
+    sendSegments();
+}
+
+void QXmppReliableChannelPrivate::handleData(quint32 seq, quint32 stamp, bool fin, const QByteArray &payload)
+{
+    if (seq >= expectedSequence && seq - expectedSequence < quint32(QXmppReliableChannel::ReceiveWindow)
+        && !remoteFinished) {
+        QXmppReliableReceived received;
+        received.payload = payload;
+        received.fin = fin;
+        reorder.insert(seq, received);
+
+        // deliver the segments which are now in order
+        bool delivered = false;
+        QMap<quint32, QXmppReliableReceived>::iterator it = reorder.begin();
+        while (it != reorder.end() && it.key() == expectedSequence) {
+            readBuffer.append(it->payload);
+            delivered = delivered || !it->payload.isEmpty();
+            remoteFinished = it->fin;
+            ++expectedSequence;
+            it = reorder.erase(it);
+        }
+
+        sendAck(stamp);
+        if (delivered)
+            emit q->readyRead();
+        if (remoteFinished)
+            emit q->readChannelFinished();
+        return;
+    }
+
+    // duplicate or out of window, acknowledge anyway
+    sendAck(stamp);
+}
+
+void QXmppReliableChannelPrivate::restartTimer()
+{
+    if (inFlight.isEmpty())
+        retransmitTimer->stop();
+    else
+        retransmitTimer->start(rto);
+}
+
+void QXmppReliableChannelPrivate::sendAck(quint32 stamp)
+{
+    quint32 sack = 0;
+    QMap<quint32, QXmppReliableReceived>::const_iterator it = reorder.constBegin();
+    while (it != reorder.constEnd() && it.key() <= expectedSequence + SackBits) {
+        sack |= 1u << (it.key() - expectedSequence - 1);
+        ++it;
+    }
+
+    QByteArray datagram(AckHeaderSize, 0);
+    uchar *ptr = reinterpret_cast<uchar*>(datagram.data());
+    ptr[0] = AckPacket;
+    qToBigEndian(quint16(QXmppReliableChannel::ReceiveWindow - reorder.size()), ptr + 2);
+    qToBigEndian(expectedSequence, ptr + 4);
+    qToBigEndian(stamp, ptr + 8);
+    qToBigEndian(sack, ptr + 12);
+    emit q->sendDatagram(datagram);
+}
+
+void QXmppReliableChannelPrivate::sendSegments()
+{
+    while (outstanding() < window()) {
+        // segments lost after a retransmission timeout go first
+        if (lostSegments) {
+            QMap<quint32, QXmppReliableSegment>::iterator it = inFlight.begin();
+            while (!it->lost)
+                ++it;
+            it->lost = false;
+            --lostSegments;
+            transmit(it.key(), it.value());
+            continue;
+        }
+
+        const int available = sendBuffer.size() - sendOffset;
+        if (!available && (!finishRequested || finSent))
+            break;
+
+        const int size = qMin(available, int(QXmppReliableChannel::MaximumSegmentSize));
+        QXmppReliableSegment segment;
+        segment.payload = sendBuffer.mid(sendOffset, size);
+        segment.fin = finishRequested && size == available;
+        segment.lost = false;
+        sendOffset += size;
+        inFlightBytes += size;
+        finSent = segment.fin;
+
+        const quint32 seq = nextSequence++;
+        transmit(seq, inFlight.insert(seq, segment).value());
+        if (!retransmitTimer->isActive())
+            retransmitTimer->start(rto);
+    }
+
+    if (sendOffset >= compactThreshold) {
+        sendBuffer.remove(0, sendOffset);
+        sendOffset = 0;
+    }
+}
+
+void QXmppReliableChannelPrivate::transmit(quint32 seq, QXmppReliableSegment &segment)
+{
+    QByteArray datagram(DataHeaderSize + segment.payload.size(), 0);
+    uchar *ptr = reinterpret_cast<uchar*>(datagram.data());
+    ptr[0] = DataPacket;
+    ptr[1] = segment.fin ? FinFlag : 0;
+    qToBigEndian(seq, ptr + 4);
+    qToBigEndian(quint32(clock.elapsed()), ptr + 8);
+    memcpy(ptr + DataHeaderSize, segment.payload.constData(), segment.payload.size());
+    emit q->sendDatagram(datagram);
+}
+
+int QXmppReliableChannelPrivate::outstanding() const
+{
+    return inFlight.size() - lostSegments;
+}
+
+int QXmppReliableChannelPrivate::window() const
+{
+    return qMax(1, qMin(int(cwnd), remoteWindow));
+}
+
+/// Constructs a new reliable channel.
+///
+/// \param parent
+
+QXmppReliableChannel::QXmppReliableChannel(QObject *parent)
+    : QIODevice(parent)
+{
+    d = new QXmppReliableChannelPrivate(this);
+    d->retransmitTimer = new QTimer(this);
+    d->retransmitTimer->setSingleShot(true);
+
+    bool check;
+    Q_UNUSED(check);
+
+    check = connect(d->retransmitTimer, SIGNAL(timeout()),
+                    this, SLOT(retransmitTimeout()));
+    Q_ASSERT(check);
+
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+/// Destroys the reliable channel.
+
+QXmppReliableChannel::~QXmppReliableChannel()
+{
+    delete d;
+}
+
+qint64 QXmppReliableChannel::bytesAvailable() const
+{
+    return QIODevice::bytesAvailable() + d->readBuffer.size();
+}
+
+/// Returns the number of bytes which have been written but not yet
+/// acknowledged by the remote party.
+
+qint64 QXmppReliableChannel::bytesToWrite() const
+{
+    return d->sendBuffer.size() - d->sendOffset + d->inFlightBytes;
+}
+
+bool QXmppReliableChannel::isSequential() const
+{
+    return true;
+}
+
+/// Returns the congestion window, in segments.
+
+int QXmppReliableChannel::congestionWindow() const
+{
+    return d->window();
+}
+
+/// Returns the smoothed round-trip time in milliseconds, or -1 if no
+/// acknowledgement was received yet.
+
+int QXmppReliableChannel::roundTripTime() const
+{
+    return d->srtt;
+}
+
+/// Marks the end of the outgoing stream once all the data written so far
+/// has been sent.
+///
+/// The finished() signal is emitted when the remote party acknowledges it.
+
+void QXmppReliableChannel::finish()
+{
+    if (d->finishRequested)
+        return;
+
+    d->finishRequested = true;
+    d->sendSegments();
+}
+
+/// Returns true if the end of the outgoing stream was acknowledged.
+
+bool QXmppReliableChannel::isFinished() const
+{
+    return d->finished;
+}
+
+/// Handles a datagram received from the transport.
+///
+/// \param datagram
+
+void QXmppReliableChannel::datagramReceived(const QByteArray &datagram)
+{
+    const uchar *ptr = reinterpret_cast<const uchar*>(datagram.constData());
+    if (datagram.size() >= DataHeaderSize && ptr[0] == DataPacket) {
+        d->handleData(qFromBigEndian<quint32>(ptr + 4),
+                      qFromBigEndian<quint32>(ptr + 8),
+                      ptr[1] & FinFlag,
+                      datagram.mid(DataHeaderSize));
+    } else if (datagram.size() >= AckHeaderSize && ptr[0] == AckPacket) {
+        d->handleAck(qFromBigEndian<quint32>(ptr + 4),
+                     qFromBigEndian<quint32>(ptr + 8),
+                     qFromBigEndian<quint32>(ptr + 12),
+                     qFromBigEndian<quint16>(ptr + 2));
+    }
+}
+
+qint64 QXmppReliableChannel::readData(char *data, qint64 maxSize)
+{
+    const qint64 size = qMin(maxSize, qint64(d->readBuffer.size()));
+    memcpy(data, d->readBuffer.constData(), size);
+    d->readBuffer.remove(0, size);
+    return size;
+}
+
+qint64 QXmppReliableChannel::writeData(const char *data, qint64 maxSize)
+{
+    if (d->finishRequested) {
+        setErrorString(QLatin1String("Cannot write after the end of the stream"));
+        return -1;
+    }
+
+    d->sendBuffer.append(data, maxSize);
+    d->sendSegments();
+    return maxSize;
+}
+
+void QXmppReliableChannel::retransmitTimeout()
+{
+    if (d->inFlight.isEmpty())
+        return;
+
+    // the whole window is considered lost and is sent again in slow start
+    d->ssthresh = qMax(d->outstanding() / 2, 2);
+    d->cwnd = 1;
+    d->recovering = false;
+    d->duplicateAcks = 0;
+    d->rto = qMin(d->rto * 2, maximumRto);
+
+    QMap<quint32, QXmppReliableSegment>::iterator it;
+    for (it = d->inFlight.begin(); it != d->inFlight.end(); ++it)
+        it->lost = true;
+    d->lostSegments = d->inFlight.size();
+
+    d->sendSegments();
+    d->retransmitTimer->start(d->rto);
+}
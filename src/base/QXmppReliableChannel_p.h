@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRELIABLECHANNEL_P_H
+#define QXMPPRELIABLECHANNEL_P_H
+
+#include <QIODevice>
+
+#include "QXmppGlobal.h"
+
+class QXmppReliableChannelPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppReliableChannel class provides an ordered and reliable byte
+/// stream on top of an unreliable datagram transport, such as an ICE
+/// component.
+///
+/// Data is split into numbered segments which are acknowledged by the
+/// remote party using cumulative and selective acknowledgements. Lost
+/// segments are retransmitted and the sending rate is governed by a
+/// TCP NewReno style congestion window.
+///
+
+class QXMPP_EXPORT QXmppReliableChannel : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    enum {
+        MaximumSegmentSize = 1200,
+        ReceiveWindow = 1024
+    };
+
+    QXmppReliableChannel(QObject *parent = 0);
+    ~QXmppReliableChannel();
+
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+    bool isSequential() const;
+
+    int congestionWindow() const;
+    int roundTripTime() const;
+
+    void finish();
+    bool isFinished() const;
+
+signals:
+    /// \brief This signal is emitted when a datagram needs to be sent.
+    void sendDatagram(const QByteArray &datagram);
+
+    /// \brief This signal is emitted once all the written data and the
+    /// end of the stream have been acknowledged by the remote party.
+    void finished();
+
+public slots:
+    void datagramReceived(const QByteArray &datagram);
+
+protected:
+    /// \cond
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+    /// \endcond
+
+private slots:
+    void retransmitTimeout();
+
+private:
+    QXmppReliableChannelPrivate *d;
+    friend class QXmppReliableChannelPrivate;
+};
+
+#endif
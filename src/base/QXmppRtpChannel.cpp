@@ -24,13 +24,19 @@
 #include <cmath>
 
 #include <QDataStream>
+#include <QHash>
 #include <QMetaType>
+#include <QMutex>
+#include <QThread>
 #include <QTimer>
+#include <QWaitCondition>
+#include <QtEndian>
 
 #include "QXmppCodec_p.h"
 #include "QXmppJingleIq.h"
 #include "QXmppRtpChannel.h"
 #include "QXmppRtpPacket.h"
+#include "QXmppSrtp_p.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
@@ -40,12 +46,74 @@
 //#define QXMPP_DEBUG_RTP_BUFFER
 #define SAMPLE_BYTES 2
 
+// Size of the buffers reserved for outgoing RTP packets.
+#define RTP_MAX_DATAGRAM 1500
+
+class QXmppRtpChannelPrivate
+{
+public:
+    QXmppRtpChannelPrivate();
+
+    quint32 incomingSsrc;
+    QList<QXmppJingleRtpCryptoElement> localCryptoElements;
+    QXmppSrtpContext incomingSrtp;
+    QXmppSrtpContext outgoingSrtp;
+};
+
+QXmppRtpChannelPrivate::QXmppRtpChannelPrivate()
+    : incomingSsrc(0)
+{
+}
+
+// QXmppRtpChannel has no room for a d-pointer without changing its layout,
+// so its private data is kept in a table indexed by channel.
+typedef QHash<const QXmppRtpChannel*, QXmppRtpChannelPrivate*> QXmppRtpChannelPrivateHash;
+Q_GLOBAL_STATIC(QXmppRtpChannelPrivateHash, rtpChannelPrivates)
+Q_GLOBAL_STATIC(QMutex, rtpChannelPrivatesMutex)
+
+static QXmppRtpChannelPrivate *rtpChannelPrivate(const QXmppRtpChannel *channel)
+{
+    QMutexLocker locker(rtpChannelPrivatesMutex());
+    return rtpChannelPrivates()->value(channel);
+}
+
 /// Creates a new RTP channel.
 
 QXmppRtpChannel::QXmppRtpChannel()
     : m_outgoingPayloadNumbered(false)
 {
     m_outgoingSsrc = qrand();
+
+    QXmppRtpChannelPrivate *d = new QXmppRtpChannelPrivate;
+    rtpChannelPrivatesMutex()->lock();
+    rtpChannelPrivates()->insert(this, d);
+    rtpChannelPrivatesMutex()->unlock();
+
+    // offer SRTP for each supported crypto suite, with a random master key
+    const QXmppSrtpContext::CryptoSuite suites[] = {
+        QXmppSrtpContext::AesCm128HmacSha1_80,
+        QXmppSrtpContext::AesCm128HmacSha1_32
+    };
+    for (int i = 0; i < 2; ++i) {
+        const QByteArray key = QXmppSrtpContext::generateMasterKey();
+        if (key.isEmpty()) {
+            qWarning("QXmppRtpChannel could not generate an SRTP master key");
+            break;
+        }
+        QXmppJingleRtpCryptoElement crypto;
+        crypto.setTag(i + 1);
+        crypto.setCryptoSuite(QXmppSrtpContext::suiteToString(suites[i]));
+        crypto.setKeyParams(QLatin1String("inline:") + QString::fromLatin1(key.toBase64()));
+        d->localCryptoElements << crypto;
+    }
+}
+
+QXmppRtpChannel::~QXmppRtpChannel()
+{
+    rtpChannelPrivatesMutex()->lock();
+    QXmppRtpChannelPrivate *d = rtpChannelPrivates()->take(this);
+    rtpChannelPrivatesMutex()->unlock();
+    delete d;
 }
 
 /// Returns the local payload types.
@@ -92,6 +160,125 @@ void QXmppRtpChannel::setRemotePayloadTypes(const QList<QXmppJinglePayloadType>
     payloadTypesChanged();
 }
 
+// Extracts the master key and salt from SDES key parameters of the form
+// "inline:<key||salt>|<lifetime>|<MKI:length>".
+static QByteArray parseInlineKey(const QString &keyParams)
+{
+    if (!keyParams.startsWith(QLatin1String("inline:")))
+        return QByteArray();
+    const QString encoded = keyParams.mid(7).section(QLatin1Char('|'), 0, 0);
+    const QByteArray key = QByteArray::fromBase64(encoded.toLatin1());
+    if (key.size() != QXmppSrtpContext::masterKeyLength())
+        return QByteArray();
+    return key;
+}
+
+/// Returns the local SRTP crypto elements.
+///
+/// Before the remote crypto elements are known, this contains an offer
+/// for every supported crypto suite. Afterwards it contains the single
+/// element which was negotiated, or nothing if SRTP is not in use.
+
+QList<QXmppJingleRtpCryptoElement> QXmppRtpChannel::localCryptoElements() const
+{
+    const QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    return d->localCryptoElements;
+}
+
+/// Sets the remote SRTP crypto elements.
+///
+/// The first remote element whose crypto suite is supported is selected,
+/// and RTP packets are encrypted from then on. If the remote party did not
+/// offer any usable element, RTP packets are sent in the clear.
+///
+/// \param remoteCryptoElements
+
+void QXmppRtpChannel::setRemoteCryptoElements(const QList<QXmppJingleRtpCryptoElement> &remoteCryptoElements)
+{
+    QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    foreach (const QXmppJingleRtpCryptoElement &remoteCrypto, remoteCryptoElements) {
+        // check we support this crypto suite
+        const QXmppSrtpContext::CryptoSuite suite = QXmppSrtpContext::suiteFromString(remoteCrypto.cryptoSuite());
+        const QByteArray remoteKey = parseInlineKey(remoteCrypto.keyParams());
+        if (suite == QXmppSrtpContext::NoCryptoSuite || remoteKey.isEmpty())
+            continue;
+
+        foreach (QXmppJingleRtpCryptoElement localCrypto, d->localCryptoElements) {
+            if (QXmppSrtpContext::suiteFromString(localCrypto.cryptoSuite()) != suite)
+                continue;
+
+            // answer with the remote party's tag
+            localCrypto.setTag(remoteCrypto.tag());
+            d->localCryptoElements = QList<QXmppJingleRtpCryptoElement>() << localCrypto;
+            d->incomingSrtp.setMasterKey(suite, remoteKey);
+            d->outgoingSrtp.setMasterKey(suite, parseInlineKey(localCrypto.keyParams()));
+            return;
+        }
+    }
+
+    if (!remoteCryptoElements.isEmpty())
+        qWarning("QXmppRtpChannel could not negotiate a common crypto suite");
+    d->localCryptoElements.clear();
+    d->incomingSrtp.setMasterKey(QXmppSrtpContext::NoCryptoSuite, QByteArray());
+    d->outgoingSrtp.setMasterKey(QXmppSrtpContext::NoCryptoSuite, QByteArray());
+}
+
+/// Returns true if RTP packets are protected using SRTP.
+
+bool QXmppRtpChannel::isEncrypted() const
+{
+    const QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    return d->outgoingSrtp.cryptoSuite() != QXmppSrtpContext::NoCryptoSuite;
+}
+
+/// \cond
+// Returns true if the datagram is an RTP packet for this channel.
+//
+// If the remote SSRC is known, packets from other sources are ignored,
+// otherwise packets are accepted based on their payload type. When several
+// channels share a transport (BUNDLE), the packets are dispatched by the
+// call, which learns the remote SSRC if needed. The RTP header is not
+// encrypted by SRTP, so this is checked first.
+bool QXmppRtpChannel::isIncomingDatagram(const QByteArray &datagram) const
+{
+    if (datagram.size() < 12)
+        return false;
+
+    // RTCP multiplexed with RTP uses types 192-223, see RFC 5761
+    const quint8 type = quint8(datagram.at(1)) & 0x7f;
+    if (type >= 64 && type < 96)
+        return false;
+
+    const QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    if (d->incomingSsrc)
+        return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(datagram.constData()) + 8) == d->incomingSsrc;
+
+    foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
+        if (payload.id() == type)
+            return true;
+    }
+    return false;
+}
+
+bool QXmppRtpChannel::protectDatagram(QByteArray *datagram)
+{
+    QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    if (d->outgoingSrtp.cryptoSuite() == QXmppSrtpContext::NoCryptoSuite)
+        return true;
+    return d->outgoingSrtp.protect(datagram);
+}
+
+bool QXmppRtpChannel::unprotectDatagram(const QByteArray &datagram, QByteArray *output)
+{
+    QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    if (d->incomingSrtp.cryptoSuite() == QXmppSrtpContext::NoCryptoSuite) {
+        *output = datagram;
+        return true;
+    }
+    return d->incomingSrtp.unprotect(datagram, output);
+}
+/// \endcond
+
 /// Returns the local SSRC.
 
 quint32 QXmppRtpChannel::localSsrc() const
@@ -108,6 +295,27 @@ void QXmppRtpChannel::setLocalSsrc(quint32 ssrc)
     m_outgoingSsrc = ssrc;
 }
 
+/// Returns the remote SSRC, or 0 if it is not known.
+
+quint32 QXmppRtpChannel::remoteSsrc() const
+{
+    const QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    return d->incomingSsrc;
+}
+
+/// Sets the remote SSRC.
+///
+/// If set, incoming packets from other sources are ignored, which makes
+/// it possible for several channels to share a transport.
+///
+/// \param ssrc
+
+void QXmppRtpChannel::setRemoteSsrc(quint32 ssrc)
+{
+    QXmppRtpChannelPrivate *d = rtpChannelPrivate(this);
+    d->incomingSsrc = ssrc;
+}
+
 
 enum CodecId {
     G711u = 0,
@@ -190,8 +398,11 @@ public:
     // position of the head of the incoming buffer, in bytes
     qint64 incomingPos;
     quint16 incomingSequence;
+    QByteArray incomingDatagram;
 
     QByteArray outgoingBuffer;
+    QByteArray outgoingDatagram;
+    QByteArray outgoingPayload;
     quint16 outgoingChunk;
     QXmppCodec *outgoingCodec;
     bool outgoingMarker;
@@ -221,6 +432,12 @@ QXmppRtpAudioChannelPrivate::QXmppRtpAudioChannelPrivate()
     , outgoingTimer(0)
 {
     qRegisterMetaType<QXmppRtpAudioChannel::Tone>("QXmppRtpAudioChannel::Tone");
+
+    // reserve room for outgoing packets, so that the same buffers
+    // can be reused for every packet
+    incomingDatagram.reserve(RTP_MAX_DATAGRAM);
+    outgoingDatagram.reserve(RTP_MAX_DATAGRAM);
+    outgoingPayload.reserve(RTP_MAX_DATAGRAM);
 }
 
 /// Returns the audio codec for the given payload type.
@@ -237,8 +454,11 @@ QXmppCodec *QXmppRtpAudioChannelPrivate::codecForPayloadType(const QXmppJinglePa
         return new QXmppSpeexCodec(payloadType.clockrate());
 #endif
 #ifdef QXMPP_USE_OPUS
-    else if (payloadType.name().toLower() == "opus")
-        return new QXmppOpusCodec(payloadType.clockrate(), payloadType.channels());
+    else if (payloadType.name().toLower() == "opus") {
+        QXmppOpusCodec *codec = new QXmppOpusCodec(payloadType.clockrate(), payloadType.channels());
+        codec->setParameters(payloadType.parameters());
+        return codec;
+    }
 #endif
     return 0;
 }
@@ -265,7 +485,12 @@ QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
     payload.setChannels(1);
     payload.setName("opus");
     payload.setClockrate(8000);
+    QMap<QString, QString> parameters;
+    parameters.insert("useinbandfec", "1");
+    parameters.insert("usedtx", "1");
+    payload.setParameters(parameters);
     m_outgoingPayloadTypes << payload;
+    payload.setParameters(QMap<QString, QString>());
 #endif
 
 #ifdef QXMPP_USE_SPEEX
@@ -331,8 +556,16 @@ void QXmppRtpAudioChannel::close()
 
 void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 {
+    if (!isIncomingDatagram(ba))
+        return;
+
+    if (!unprotectDatagram(ba, &d->incomingDatagram)) {
+        warning("QXmppRtpAudioChannel could not authenticate SRTP packet");
+        return;
+    }
+
     QXmppRtpPacket packet;
-    if (!packet.decode(ba))
+    if (!packet.decode(d->incomingDatagram))
         return;
 
 #ifdef QXMPP_DEBUG_RTP
@@ -346,6 +579,7 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
                 .arg(QString::number(packet.sequence()))
                 .arg(QString::number(d->incomingSequence)));
 #endif
+    const bool previousLost = d->incomingSequence && packet.sequence() == quint16(d->incomingSequence + 2);
     d->incomingSequence = packet.sequence();
 
     // get or create codec
@@ -386,13 +620,28 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 
     // allocate space for new packet
     // FIXME: this is wrong, we want the decoded data size!
-    const qint64 packetLength = packet.payload().size();
+    const qint64 packetLength = packet.payloadSize();
     if (packetOffset + packetLength > d->incomingBuffer.size())
         d->incomingBuffer += QByteArray(packetOffset + packetLength - d->incomingBuffer.size(), 0);
-    QDataStream input(packet.payload());
+    const QByteArray payload = QByteArray::fromRawData(packet.payloadData(), packet.payloadSize());
     QDataStream output(&d->incomingBuffer, QIODevice::WriteOnly);
-    output.device()->seek(packetOffset);
     output.setByteOrder(QDataStream::LittleEndian);
+
+    // if a single packet was lost, try to rebuild it using the redundant
+    // data carried by this packet
+    if (previousLost && packetOffset > 0) {
+        QByteArray recovered;
+        QDataStream recoveredInput(payload);
+        QDataStream recoveredOutput(&recovered, QIODevice::WriteOnly);
+        recoveredOutput.setByteOrder(QDataStream::LittleEndian);
+        if (codec->decodeRedundant(recoveredInput, recoveredOutput) > 0 && recovered.size() <= packetOffset) {
+            output.device()->seek(packetOffset - recovered.size());
+            output.writeRawData(recovered.constData(), recovered.size());
+        }
+    }
+
+    QDataStream input(payload);
+    output.device()->seek(packetOffset);
     codec->decode(input, output);
 
     // check whether we are running late
@@ -501,13 +750,20 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
     }
 
     // create outgoing codec
-    foreach (const QXmppJinglePayloadType &outgoingType, m_outgoingPayloadTypes) {
+    for (int i = 0; i < m_outgoingPayloadTypes.size(); ++i) {
+        const QXmppJinglePayloadType &outgoingType = m_outgoingPayloadTypes[i];
+
         // check for telephony events
         if (outgoingType.name() == "telephone-event") {
             d->outgoingTonesType = outgoingType;
         }
         else if (!d->outgoingCodec) {
-            QXmppCodec *codec = d->codecForPayloadType(outgoingType);
+            // the encoder is configured using the remote party's format
+            // parameters, which describe how it wants to receive data
+            QXmppJinglePayloadType codecType = outgoingType;
+            codecType.setParameters(m_incomingPayloadTypes.value(i).parameters());
+
+            QXmppCodec *codec = d->codecForPayloadType(codecType);
             if (codec) {
                 d->payloadType = outgoingType;
                 d->outgoingCodec = codec;
@@ -634,7 +890,9 @@ void QXmppRtpAudioChannel::writeDatagram()
 #ifdef QXMPP_DEBUG_RTP
             logSent(packet.toString());
 #endif
-            emit sendDatagram(packet.encode());
+            packet.encode(&d->outgoingDatagram);
+            if (protectDatagram(&d->outgoingDatagram))
+                emit sendDatagram(d->outgoingDatagram);
             d->outgoingSequence++;
             d->outgoingStamp += packetTicks;
 
@@ -667,16 +925,25 @@ void QXmppRtpAudioChannel::writeDatagram()
         // encode audio chunk
         QDataStream input(chunk);
         input.setByteOrder(QDataStream::LittleEndian);
-        QByteArray payload;
-        QDataStream output(&payload, QIODevice::WriteOnly);
+        d->outgoingPayload.resize(0);
+        QDataStream output(&d->outgoingPayload, QIODevice::WriteOnly);
         const qint64 packetTicks = d->outgoingCodec->encode(input, output);
-        packet.setPayload(payload);
 
+        if (d->outgoingPayload.isEmpty()) {
+            // the codec is either buffering samples or in discontinuous
+            // transmission, mark the first packet after the silence
+            if (packet.marker() || packetTicks > 0)
+                d->outgoingMarker = true;
+        } else {
+            packet.setPayload(d->outgoingPayload);
 #ifdef QXMPP_DEBUG_RTP
-        logSent(packet.toString());
+            logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
-        d->outgoingSequence++;
+            packet.encode(&d->outgoingDatagram);
+            if (protectDatagram(&d->outgoingDatagram))
+                emit sendDatagram(d->outgoingDatagram);
+            d->outgoingSequence++;
+        }
         d->outgoingStamp += packetTicks;
     }
 
@@ -781,13 +1048,47 @@ int QXmppVideoFrame::width() const
     return m_width;
 }
 
+// Maximum number of frames waiting to be encoded, older frames are dropped
+// when the encoder cannot keep up.
+static const int VIDEO_MAX_PENDING_FRAMES = 2;
+
+// Maximum number of packets waiting to be decoded.
+static const int VIDEO_MAX_PENDING_PACKETS = 512;
+
+class QXmppRtpVideoWorker : public QThread
+{
+public:
+    QXmppRtpVideoWorker(QXmppRtpVideoChannel *channel);
+
+protected:
+    void run();
+
+private:
+    QXmppRtpVideoChannel *m_channel;
+};
+
 class QXmppRtpVideoChannelPrivate
 {
 public:
     QXmppRtpVideoChannelPrivate();
+    void startWorker(QXmppRtpVideoChannel *channel);
+    void stopWorker();
+
+    // codecs, guarded by codecMutex
+    QMutex codecMutex;
     QMap<int, QXmppVideoDecoder*> decoders;
     QXmppVideoEncoder *encoder;
-    QList<QXmppVideoFrame> frames;
+
+    // queues shared with the worker, guarded by queueMutex
+    QMutex queueMutex;
+    QWaitCondition queueCondition;
+    QList<QXmppVideoFrame> incomingFrames;
+    QList<QByteArray> incomingPackets;
+    QList<QXmppVideoFrame> outgoingFrames;
+    QList<QByteArray> outgoingPackets;
+    bool outgoingPending;
+    bool stopping;
+    QXmppRtpVideoWorker *worker;
 
     // local
     QXmppVideoFormat outgoingFormat;
@@ -798,12 +1099,118 @@ public:
 
 QXmppRtpVideoChannelPrivate::QXmppRtpVideoChannelPrivate()
     : encoder(0),
+    outgoingPending(false),
+    stopping(false),
+    worker(0),
     outgoingId(0),
     outgoingSequence(1),
     outgoingStamp(0)
 {
 }
 
+void QXmppRtpVideoChannelPrivate::startWorker(QXmppRtpVideoChannel *channel)
+{
+    if (worker)
+        return;
+
+    stopping = false;
+    worker = new QXmppRtpVideoWorker(channel);
+    worker->start();
+}
+
+void QXmppRtpVideoChannelPrivate::stopWorker()
+{
+    if (!worker)
+        return;
+
+    queueMutex.lock();
+    stopping = true;
+    queueCondition.wakeAll();
+    queueMutex.unlock();
+
+    worker->wait();
+    delete worker;
+    worker = 0;
+}
+
+QXmppRtpVideoWorker::QXmppRtpVideoWorker(QXmppRtpVideoChannel *channel)
+    : m_channel(channel)
+{
+}
+
+/// Encodes and decodes video off the thread which owns the channel.
+
+void QXmppRtpVideoWorker::run()
+{
+    QXmppRtpVideoChannelPrivate *d = m_channel->d;
+    QList<QByteArray> packets;
+    QList<QXmppVideoFrame> decoded;
+    QList<QByteArray> encoded;
+
+    forever {
+        QXmppVideoFrame frame;
+
+        // wait for work
+        d->queueMutex.lock();
+        while (!d->stopping && d->outgoingFrames.isEmpty() && d->incomingPackets.isEmpty())
+            d->queueCondition.wait(&d->queueMutex);
+        if (d->stopping) {
+            d->queueMutex.unlock();
+            return;
+        }
+        packets.swap(d->incomingPackets);
+        if (!d->outgoingFrames.isEmpty())
+            frame = d->outgoingFrames.takeFirst();
+        d->queueMutex.unlock();
+
+        d->codecMutex.lock();
+
+        // decode incoming packets
+        foreach (const QByteArray &ba, packets) {
+            QXmppRtpPacket packet;
+            if (!packet.decode(ba))
+                continue;
+
+            QXmppVideoDecoder *decoder = d->decoders.value(packet.type());
+            if (decoder)
+                decoded << decoder->handlePacket(packet);
+        }
+        packets.clear();
+
+        // encode outgoing frame
+        if (frame.isValid() && d->encoder) {
+            QXmppRtpPacket packet;
+            packet.setMarker(false);
+            packet.setType(d->outgoingId);
+            packet.setSsrc(m_channel->localSsrc());
+            foreach (const QByteArray &payload, d->encoder->handleFrame(frame)) {
+                packet.setSequence(d->outgoingSequence++);
+                packet.setStamp(d->outgoingStamp);
+                packet.setPayload(payload);
+                encoded << packet.encode();
+            }
+            d->outgoingStamp += 1;
+        }
+
+        d->codecMutex.unlock();
+
+        // hand the results back
+        if (!decoded.isEmpty() || !encoded.isEmpty()) {
+            QMutexLocker locker(&d->queueMutex);
+            d->incomingFrames << decoded;
+            decoded.clear();
+            if (!encoded.isEmpty()) {
+                d->outgoingPackets << encoded;
+                encoded.clear();
+                if (!d->outgoingPending) {
+                    d->outgoingPending = true;
+                    QMetaObject::invokeMethod(m_channel, "sendPendingDatagrams", Qt::QueuedConnection);
+                }
+            }
+        }
+    }
+}
+
 /// Constructs a new RTP video channel with the given \a parent.
 
 QXmppRtpVideoChannel::QXmppRtpVideoChannel(QObject *parent)
@@ -845,6 +1252,7 @@ QXmppRtpVideoChannel::QXmppRtpVideoChannel(QObject *parent)
 
 QXmppRtpVideoChannel::~QXmppRtpVideoChannel()
 {
+    d->stopWorker();
     foreach (QXmppVideoDecoder *decoder, d->decoders)
         delete decoder;
     if (d->encoder)
@@ -864,19 +1272,29 @@ void QXmppRtpVideoChannel::close()
 
 void QXmppRtpVideoChannel::datagramReceived(const QByteArray &ba)
 {
+#ifdef QXMPP_DEBUG_RTP
     QXmppRtpPacket packet;
-    if (!packet.decode(ba))
+    if (packet.decode(ba))
+        logReceived(packet.toString());
+#endif
+
+    if (!d->worker || !isIncomingDatagram(ba))
         return;
 
-#ifdef QXMPP_DEBUG_RTP
-    logReceived(packet.toString());
-#endif
+    QByteArray datagram;
+    if (!unprotectDatagram(ba, &datagram)) {
+        warning("QXmppRtpVideoChannel could not authenticate SRTP packet");
+        return;
+    }
 
-    // get codec
-    QXmppVideoDecoder *decoder = d->decoders.value(packet.type());
-    if (!decoder)
+    // queue packet for decoding
+    QMutexLocker locker(&d->queueMutex);
+    if (d->incomingPackets.size() >= VIDEO_MAX_PENDING_PACKETS) {
+        warning("QXmppRtpVideoChannel decoder is lagging, dropping packet");
         return;
-    d->frames << decoder->handlePacket(packet);
+    }
+    d->incomingPackets << datagram;
+    d->queueCondition.wakeOne();
 }
 
 /// Returns the video format used by the encoder.
@@ -900,6 +1318,7 @@ QXmppVideoFormat QXmppRtpVideoChannel::encoderFormat() const
 
 void QXmppRtpVideoChannel::setEncoderFormat(const QXmppVideoFormat &format)
 {
+    QMutexLocker locker(&d->codecMutex);
     if (d->encoder && !d->encoder->setFormat(format))
         return;
     d->outgoingFormat = format;
@@ -920,6 +1339,8 @@ QIODevice::OpenMode QXmppRtpVideoChannel::openMode() const
 /// \cond
 void QXmppRtpVideoChannel::payloadTypesChanged()
 {
+    QMutexLocker locker(&d->codecMutex);
+
     // refresh decoders
     foreach (QXmppVideoDecoder *decoder, d->decoders)
         delete decoder;
@@ -967,19 +1388,27 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
             break;
         }
     }
+
+    // encoding and decoding happen in a worker thread
+    if (!d->decoders.isEmpty() || d->encoder)
+        d->startWorker(this);
 }
 /// \endcond
 
-/// Decodes buffered RTP packets and returns a list of video frames.
+/// Returns the video frames which have been decoded since the last call.
 
 QList<QXmppVideoFrame> QXmppRtpVideoChannel::readFrames()
 {
-    const QList<QXmppVideoFrame> frames = d->frames;
-    d->frames.clear();
+    QList<QXmppVideoFrame> frames;
+    QMutexLocker locker(&d->queueMutex);
+    frames.swap(d->incomingFrames);
     return frames;
 }
 
 /// Encodes a video \a frame and sends RTP packets.
+///
+/// Encoding is performed asynchronously. If the encoder cannot keep up,
+/// the oldest frames which are still waiting to be encoded are dropped.
 
 void QXmppRtpVideoChannel::writeFrame(const QXmppVideoFrame &frame)
 {
@@ -988,19 +1417,30 @@ void QXmppRtpVideoChannel::writeFrame(const QXmppVideoFrame &frame)
         return;
     }
 
-    QXmppRtpPacket packet;
-    packet.setMarker(false);
-    packet.setType(d->outgoingId);
-    packet.setSsrc(localSsrc());
-    foreach (const QByteArray &payload, d->encoder->handleFrame(frame)) {
-        packet.setSequence(d->outgoingSequence++);
-        packet.setStamp(d->outgoingStamp);
-        packet.setPayload(payload);
+    QMutexLocker locker(&d->queueMutex);
+    while (d->outgoingFrames.size() >= VIDEO_MAX_PENDING_FRAMES)
+        d->outgoingFrames.removeFirst();
+    d->outgoingFrames << frame;
+    d->queueCondition.wakeOne();
+}
+
+void QXmppRtpVideoChannel::sendPendingDatagrams()
+{
+    QList<QByteArray> packets;
+    d->queueMutex.lock();
+    packets.swap(d->outgoingPackets);
+    d->outgoingPending = false;
+    d->queueMutex.unlock();
+
+    for (int i = 0; i < packets.size(); ++i) {
+        QByteArray &ba = packets[i];
 #ifdef QXMPP_DEBUG_RTP
-        logSent(packet.toString());
+        QXmppRtpPacket packet;
+        if (packet.decode(ba))
+            logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
+        if (protectDatagram(&ba))
+            emit sendDatagram(ba);
     }
-    d->outgoingStamp += 1;
 }
 
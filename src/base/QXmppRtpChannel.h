@@ -39,6 +39,7 @@ class QXMPP_EXPORT QXmppRtpChannel
 {
 public:
     QXmppRtpChannel();
+    ~QXmppRtpChannel();
 
     /// Closes the RTP channel.
     virtual void close() = 0;
@@ -49,19 +50,32 @@ public:
     QList<QXmppJinglePayloadType> localPayloadTypes();
     void setRemotePayloadTypes(const QList<QXmppJinglePayloadType> &remotePayloadTypes);
 
+    QList<QXmppJingleRtpCryptoElement> localCryptoElements() const;
+    void setRemoteCryptoElements(const QList<QXmppJingleRtpCryptoElement> &remoteCryptoElements);
+    bool isEncrypted() const;
+
     quint32 localSsrc() const;
     void setLocalSsrc(quint32 ssrc);
 
+    quint32 remoteSsrc() const;
+    void setRemoteSsrc(quint32 ssrc);
+
 protected:
     /// \cond
     virtual void payloadTypesChanged() = 0;
 
+    bool isIncomingDatagram(const QByteArray &datagram) const;
+
+    bool protectDatagram(QByteArray *datagram);
+    bool unprotectDatagram(const QByteArray &datagram, QByteArray *output);
+
     QList<QXmppJinglePayloadType> m_incomingPayloadTypes;
     QList<QXmppJinglePayloadType> m_outgoingPayloadTypes;
     bool m_outgoingPayloadNumbered;
     /// \endcond
 
 private:
+    Q_DISABLE_COPY(QXmppRtpChannel)
     quint32 m_outgoingSsrc;
 };
 
@@ -290,8 +304,12 @@ protected:
     void payloadTypesChanged();
     /// \endcond
 
+private slots:
+    void sendPendingDatagrams();
+
 private:
     friend class QXmppRtpVideoChannelPrivate;
+    friend class QXmppRtpVideoWorker;
     QXmppRtpVideoChannelPrivate * d;
 };
 
@@ -21,8 +21,10 @@
  *
  */
 
-#include <QDataStream>
 #include <QSharedData>
+#include <QtEndian>
+
+#include <cstring>
 
 #include "QXmppRtpPacket.h"
 
@@ -45,8 +47,12 @@ public:
     quint16 sequence;
     /// Timestamp.
     quint32 stamp;
-    /// Raw payload data.
+    /// Buffer holding the raw payload data, starting at payloadOffset.
+    ///
+    /// For a decoded packet this is the datagram itself, so that the
+    /// payload does not need to be copied.
     QByteArray payload;
+    int payloadOffset;
 };
 
 QXmppRtpPacketPrivate::QXmppRtpPacketPrivate()
@@ -55,6 +61,7 @@ QXmppRtpPacketPrivate::QXmppRtpPacketPrivate()
     , ssrc(0)
     , sequence(0)
     , stamp(0)
+    , payloadOffset(0)
 {
 }
 
@@ -90,6 +97,8 @@ QXmppRtpPacket& QXmppRtpPacket::operator=(const QXmppRtpPacket& other)
 
 /// Parses an RTP packet.
 ///
+/// The payload is not copied, the packet keeps a shallow copy of \a ba.
+///
 /// \param ba
 
 bool QXmppRtpPacket::decode(const QByteArray &ba)
@@ -98,56 +107,69 @@ bool QXmppRtpPacket::decode(const QByteArray &ba)
         return false;
 
     // fixed header
-    quint8 tmp;
-    QDataStream stream(ba);
-    stream >> tmp;
-    const quint8 cc = (tmp & 0xf);
+    const uchar *ptr = reinterpret_cast<const uchar*>(ba.constData());
+    const quint8 cc = (ptr[0] & 0xf);
     const int hlen = 12 + 4 * cc;
-    if ((tmp >> 6) != RTP_VERSION || ba.size() < hlen)
+    if ((ptr[0] >> 6) != RTP_VERSION || ba.size() < hlen)
         return false;
-    stream >> tmp;
-    d->marker = (tmp >> 7);
-    d->type = tmp & 0x7f;
-    stream >> d->sequence;
-    stream >> d->stamp;
-    stream >> d->ssrc;
+    d->marker = (ptr[1] >> 7);
+    d->type = ptr[1] & 0x7f;
+    d->sequence = qFromBigEndian<quint16>(ptr + 2);
+    d->stamp = qFromBigEndian<quint32>(ptr + 4);
+    d->ssrc = qFromBigEndian<quint32>(ptr + 8);
 
     // contributing source IDs
     d->csrc.clear();
-    quint32 src;
-    for (int i = 0; i < cc; ++i) {
-        stream >> src;
-        d->csrc << src;
-    }
+    for (int i = 0; i < cc; ++i)
+        d->csrc << qFromBigEndian<quint32>(ptr + 12 + 4 * i);
 
     // retrieve payload
-    d->payload = ba.right(ba.size() - hlen);
+    d->payload = ba;
+    d->payloadOffset = hlen;
     return true;
 }
 
 /// Encodes an RTP packet.
 
 QByteArray QXmppRtpPacket::encode() const
+{
+    QByteArray ba;
+    encode(&ba);
+    return ba;
+}
+
+/// Encodes an RTP packet into the given \a buffer.
+///
+/// The buffer is resized to the size of the packet. If the buffer is not
+/// shared and has enough capacity, no memory is allocated, which allows
+/// the caller to reuse the same buffer for every packet.
+///
+/// \param buffer
+
+void QXmppRtpPacket::encode(QByteArray *buffer) const
 {
     Q_ASSERT(d->csrc.size() < 16);
 
+    const int hlen = 12 + 4 * d->csrc.size();
+    const int payloadLength = payloadSize();
+    buffer->resize(hlen + payloadLength);
+
     // fixed header
-    QByteArray ba;
-    ba.resize(d->payload.size() + 12 + 4 * d->csrc.size());
-    QDataStream stream(&ba, QIODevice::WriteOnly);
-    stream << quint8((RTP_VERSION << 6) |
-                     (d->csrc.size() & 0xf));
-    stream << quint8((d->type & 0x7f) | (d->marker << 7));
-    stream << d->sequence;
-    stream << d->stamp;
-    stream << d->ssrc;
+    uchar *ptr = reinterpret_cast<uchar*>(buffer->data());
+    ptr[0] = quint8((RTP_VERSION << 6) | (d->csrc.size() & 0xf));
+    ptr[1] = quint8((d->type & 0x7f) | (d->marker << 7));
+    qToBigEndian(d->sequence, ptr + 2);
+    qToBigEndian(d->stamp, ptr + 4);
+    qToBigEndian(d->ssrc, ptr + 8);
+    ptr += 12;
 
     // contributing source ids
-    foreach (const quint32 &src, d->csrc)
-        stream << src;
+    foreach (const quint32 &src, d->csrc) {
+        qToBigEndian(src, ptr);
+        ptr += 4;
+    }
 
-    stream.writeRawData(d->payload.constData(), d->payload.size());
-    return ba;
+    memcpy(ptr, payloadData(), payloadLength);
 }
 
 QList<quint32> QXmppRtpPacket::csrc() const
@@ -172,12 +194,32 @@ void QXmppRtpPacket::setMarker(bool marker)
 
 QByteArray QXmppRtpPacket::payload() const
 {
+    if (d->payloadOffset)
+        return d->payload.mid(d->payloadOffset);
     return d->payload;
 }
 
 void QXmppRtpPacket::setPayload(const QByteArray &payload)
 {
     d->payload = payload;
+    d->payloadOffset = 0;
+}
+
+/// Returns a pointer to the payload data, without copying it.
+///
+/// The pointer remains valid as long as the packet is not modified
+/// or destroyed.
+
+const char *QXmppRtpPacket::payloadData() const
+{
+    return d->payload.constData() + d->payloadOffset;
+}
+
+/// Returns the size of the payload in bytes.
+
+int QXmppRtpPacket::payloadSize() const
+{
+    return d->payload.size() - d->payloadOffset;
 }
 
 quint32 QXmppRtpPacket::ssrc() const
@@ -229,5 +271,5 @@ QString QXmppRtpPacket::toString() const
         QString::number(d->stamp),
         QString::number(d->marker),
         QString::number(d->type),
-        QString::number(d->payload.size()));
+        QString::number(payloadSize()));
 }
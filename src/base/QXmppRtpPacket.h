@@ -45,6 +45,7 @@ public:
 
     bool decode(const QByteArray &ba);
     QByteArray encode() const;
+    void encode(QByteArray *buffer) const;
     QString toString() const;
 
     QList<quint32> csrc() const;
@@ -55,6 +56,8 @@ public:
 
     QByteArray payload() const;
     void setPayload(const QByteArray &payload);
+    const char *payloadData() const;
+    int payloadSize() const;
 
     quint16 sequence() const;
     void setSequence(quint16 sequence);
@@ -22,6 +22,7 @@
  */
 
 #include <QDataStream>
+#include <QPointer>
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QTimer>
@@ -236,9 +237,21 @@ void QXmppSocksServer::slotNewConnection()
 
     // register socket
     m_states.insert(socket, ConnectState);
+    connect(socket, SIGNAL(disconnected()), this, SLOT(slotDisconnected()));
     connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
 }
 
+void QXmppSocksServer::slotDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !m_states.contains(socket))
+        return;
+
+    // the client went away during the handshake
+    m_states.remove(socket);
+    socket->deleteLater();
+}
+
 void QXmppSocksServer::slotReadyRead()
 {
     QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
@@ -254,7 +267,9 @@ void QXmppSocksServer::slotReadyRead()
             buffer.at(1) + 2 != buffer.size())
         {
             qWarning("QXmppSocksServer received invalid handshake");
+            m_states.remove(socket);
             socket->close();
+            socket->deleteLater();
             return;
         }
 
@@ -277,7 +292,9 @@ void QXmppSocksServer::slotReadyRead()
             buffer[1] = static_cast<unsigned char>(NoAcceptableMethod);
             socket->write(buffer);
 
+            m_states.remove(socket);
             socket->close();
+            socket->deleteLater();
             return;
         }
 
@@ -292,6 +309,7 @@ void QXmppSocksServer::slotReadyRead()
 
     } else if (m_states.value(socket) == CommandState) {
         // disconnect from signals
+        disconnect(socket, SIGNAL(disconnected()), this, SLOT(slotDisconnected()));
         disconnect(socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
 
         // receive command
@@ -302,7 +320,9 @@ void QXmppSocksServer::slotReadyRead()
             buffer.at(2) != 0x00)
         {
             qWarning("QXmppSocksServer received an invalid command");
+            m_states.remove(socket);
             socket->close();
+            socket->deleteLater();
             return;
         }
 
@@ -314,14 +334,21 @@ void QXmppSocksServer::slotReadyRead()
         if (!parseHostAndPort(stream, hostType, hostName, hostPort))
         {
             qWarning("QXmppSocksServer could not parse type/host/port");
+            m_states.remove(socket);
             socket->close();
+            socket->deleteLater();
             return;
         }
 
-        // notify of connection
-        m_states.insert(socket, ReadyState);
+        // notify of connection, the socket now belongs to the receiver
+        m_states.remove(socket);
+        QPointer<QTcpSocket> guard(socket);
         emit newConnection(socket, hostName, hostPort);
 
+        // the receiver may have rejected the connection
+        if (!guard || socket->state() != QAbstractSocket::ConnectedState)
+            return;
+
         // send response
         buffer.resize(3);
         buffer[0] = SocksVersion;
@@ -69,6 +69,7 @@ signals:
     void newConnection(QTcpSocket *socket, QString hostName, quint16 port);
 
 private slots:
+    void slotDisconnected();
     void slotNewConnection();
     void slotReadyRead();
 
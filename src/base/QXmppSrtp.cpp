@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QFile>
+#include <QHash>
+#include <QMessageAuthenticationCode>
+#include <QtEndian>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#include <QRandomGenerator>
+#endif
+
+#include <cstring>
+
+#include "QXmppSrtp_p.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define QXMPP_USE_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+static const int SRTP_MASTER_KEY_LENGTH = 16;
+static const int SRTP_MASTER_SALT_LENGTH = 14;
+static const int SRTP_AUTH_KEY_LENGTH = 20;
+static const int SRTP_REPLAY_WINDOW = 64;
+
+static const quint8 aesSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static inline quint8 aesXtime(quint8 x)
+{
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0x00);
+}
+
+static void aesEncryptBlock(const quint8 *roundKeys, const quint8 *input, quint8 *output)
+{
+    quint8 state[16];
+    quint8 tmp[16];
+
+    for (int i = 0; i < 16; ++i)
+        state[i] = input[i] ^ roundKeys[i];
+
+    for (int round = 1; round <= 10; ++round) {
+        // SubBytes and ShiftRows
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                tmp[4 * c + r] = aesSbox[state[4 * ((c + r) % 4) + r]];
+
+        // MixColumns, except in the last round
+        if (round < 10) {
+            for (int c = 0; c < 4; ++c) {
+                quint8 *col = tmp + 4 * c;
+                const quint8 a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                const quint8 all = a0 ^ a1 ^ a2 ^ a3;
+                col[0] = a0 ^ all ^ aesXtime(a0 ^ a1);
+                col[1] = a1 ^ all ^ aesXtime(a1 ^ a2);
+                col[2] = a2 ^ all ^ aesXtime(a2 ^ a3);
+                col[3] = a3 ^ all ^ aesXtime(a3 ^ a0);
+            }
+        }
+
+        // AddRoundKey
+        for (int i = 0; i < 16; ++i)
+            state[i] = tmp[i] ^ roundKeys[16 * round + i];
+    }
+    memcpy(output, state, 16);
+}
+
+static inline void setCounter(quint8 *counter, quint16 block)
+{
+    counter[14] = quint8(block >> 8);
+    counter[15] = quint8(block & 0xff);
+}
+
+#ifdef QXMPP_USE_AESNI
+__attribute__((target("aes,sse2")))
+static void aesniCounterXor(const quint8 *roundKeys, const quint8 *iv, const quint8 *input, quint8 *output, int length)
+{
+    __m128i keys[11];
+    for (int i = 0; i < 11; ++i)
+        keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys + 16 * i));
+
+    quint8 counter[16];
+    memcpy(counter, iv, 16);
+    quint16 block = (iv[14] << 8) | iv[15];
+
+    // process four blocks at a time to keep the AES unit busy
+    while (length >= 64) {
+        __m128i b[4];
+        for (int j = 0; j < 4; ++j) {
+            setCounter(counter, block++);
+            b[j] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counter)), keys[0]);
+        }
+        for (int r = 1; r < 10; ++r)
+            for (int j = 0; j < 4; ++j)
+                b[j] = _mm_aesenc_si128(b[j], keys[r]);
+        for (int j = 0; j < 4; ++j) {
+            b[j] = _mm_aesenclast_si128(b[j], keys[10]);
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 16 * j));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16 * j), _mm_xor_si128(b[j], data));
+        }
+        input += 64;
+        output += 64;
+        length -= 64;
+    }
+
+    while (length > 0) {
+        setCounter(counter, block++);
+        __m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counter)), keys[0]);
+        for (int r = 1; r < 10; ++r)
+            b = _mm_aesenc_si128(b, keys[r]);
+        b = _mm_aesenclast_si128(b, keys[10]);
+
+        if (length >= 16) {
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_xor_si128(b, data));
+        } else {
+            quint8 keystream[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(keystream), b);
+            for (int i = 0; i < length; ++i)
+                output[i] = input[i] ^ keystream[i];
+        }
+        input += 16;
+        output += 16;
+        length -= 16;
+    }
+}
+#endif
+
+/// Constructs an AES-128 cipher with an all-zero key.
+
+QXmppAesCipher::QXmppAesCipher()
+    : m_hardware(hasHardwareSupport())
+{
+    memset(m_roundKeys, 0, sizeof(m_roundKeys));
+}
+
+/// Sets the 128-bit cipher key and computes the round keys.
+///
+/// \param key
+
+void QXmppAesCipher::setKey(const QByteArray &key)
+{
+    Q_ASSERT(key.size() == 16);
+    memcpy(m_roundKeys, key.constData(), 16);
+
+    quint8 rcon = 0x01;
+    for (int i = 4; i < 44; ++i) {
+        quint8 t[4];
+        memcpy(t, m_roundKeys + 4 * (i - 1), 4);
+        if (i % 4 == 0) {
+            const quint8 first = t[0];
+            t[0] = aesSbox[t[1]] ^ rcon;
+            t[1] = aesSbox[t[2]];
+            t[2] = aesSbox[t[3]];
+            t[3] = aesSbox[first];
+            rcon = aesXtime(rcon);
+        }
+        for (int j = 0; j < 4; ++j)
+            m_roundKeys[4 * i + j] = m_roundKeys[4 * (i - 4) + j] ^ t[j];
+    }
+}
+
+/// Encrypts a single 16-byte block.
+
+void QXmppAesCipher::encryptBlock(const quint8 *input, quint8 *output) const
+{
+    aesEncryptBlock(m_roundKeys, input, output);
+}
+
+/// XORs \a length bytes of \a input with the keystream starting at \a iv,
+/// the last 16 bits of which are used as the block counter.
+///
+/// \a input and \a output may point to the same buffer.
+
+void QXmppAesCipher::counterXor(const quint8 *iv, const quint8 *input, quint8 *output, int length) const
+{
+#ifdef QXMPP_USE_AESNI
+    if (m_hardware) {
+        aesniCounterXor(m_roundKeys, iv, input, output, length);
+        return;
+    }
+#endif
+
+    quint8 counter[16];
+    quint8 keystream[16];
+    memcpy(counter, iv, 16);
+    quint16 block = (iv[14] << 8) | iv[15];
+    while (length > 0) {
+        setCounter(counter, block++);
+        aesEncryptBlock(m_roundKeys, counter, keystream);
+        const int n = qMin(length, 16);
+        for (int i = 0; i < n; ++i)
+            output[i] = input[i] ^ keystream[i];
+        input += n;
+        output += n;
+        length -= n;
+    }
+}
+
+/// Returns true if the CPU provides AES instructions.
+
+bool QXmppAesCipher::hasHardwareSupport()
+{
+#ifdef QXMPP_USE_AESNI
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return (ecx & bit_AES) != 0;
+#endif
+    return false;
+}
+
+// Returns the length of the RTP header, including CSRCs and extension.
+static int rtpHeaderLength(const quint8 *data, int length)
+{
+    if (length < 12 || (data[0] >> 6) != 2)
+        return -1;
+
+    int hlen = 12 + 4 * (data[0] & 0xf);
+    if (data[0] & 0x10) {
+        if (length < hlen + 4)
+            return -1;
+        hlen += 4 + 4 * qFromBigEndian<quint16>(data + hlen + 2);
+    }
+    return (hlen <= length) ? hlen : -1;
+}
+
+class QXmppSrtpContextPrivate
+{
+public:
+    struct StreamState
+    {
+        StreamState()
+            : initialized(false), roc(0), sequence(0), replayWindow(0)
+        {
+        }
+
+        bool initialized;
+        // rollover counter
+        quint32 roc;
+        // highest sequence number
+        quint16 sequence;
+        // bit n is set if the packet n positions before the highest was seen
+        quint64 replayWindow;
+    };
+
+    QXmppSrtpContextPrivate();
+    void authenticate(const quint8 *data, int length, quint32 roc, quint8 *tag);
+    void computeIv(quint32 ssrc, quint64 index, quint8 *iv) const;
+
+    QXmppSrtpContext::CryptoSuite suite;
+    QXmppAesCipher cipher;
+    QMessageAuthenticationCode mac;
+    QByteArray salt;
+    QHash<quint32, StreamState> streams;
+};
+
+QXmppSrtpContextPrivate::QXmppSrtpContextPrivate()
+    : suite(QXmppSrtpContext::NoCryptoSuite)
+    , mac(QCryptographicHash::Sha1)
+{
+}
+
+void QXmppSrtpContextPrivate::authenticate(const quint8 *data, int length, quint32 roc, quint8 *tag)
+{
+    quint8 rocBytes[4];
+    qToBigEndian(roc, rocBytes);
+
+    mac.reset();
+    mac.addData(reinterpret_cast<const char*>(data), length);
+    mac.addData(reinterpret_cast<const char*>(rocBytes), 4);
+    const QByteArray digest = mac.result();
+    memcpy(tag, digest.constData(), QXmppSrtpContext::tagLength(suite));
+}
+
+// IV = (k_s * 2^16) XOR (SSRC * 2^64) XOR (i * 2^16), RFC 3711 section 4.1.1
+void QXmppSrtpContextPrivate::computeIv(quint32 ssrc, quint64 index, quint8 *iv) const
+{
+    memset(iv, 0, 16);
+    memcpy(iv, salt.constData(), SRTP_MASTER_SALT_LENGTH);
+    for (int i = 0; i < 4; ++i)
+        iv[4 + i] ^= quint8(ssrc >> (24 - 8 * i));
+    for (int i = 0; i < 6; ++i)
+        iv[8 + i] ^= quint8(index >> (40 - 8 * i));
+}
+
+/// Constructs an SRTP context without any key.
+
+QXmppSrtpContext::QXmppSrtpContext()
+    : d(new QXmppSrtpContextPrivate)
+{
+}
+
+QXmppSrtpContext::~QXmppSrtpContext()
+{
+    delete d;
+}
+
+/// Returns the crypto suite in use.
+
+QXmppSrtpContext::CryptoSuite QXmppSrtpContext::cryptoSuite() const
+{
+    return d->suite;
+}
+
+/// Sets the crypto suite and the concatenated master key and salt, from
+/// which the session keys are derived.
+///
+/// \param suite
+/// \param keyAndSalt
+
+bool QXmppSrtpContext::setMasterKey(CryptoSuite suite, const QByteArray &keyAndSalt)
+{
+    d->suite = NoCryptoSuite;
+    d->streams.clear();
+    if (suite == NoCryptoSuite || keyAndSalt.size() != masterKeyLength())
+        return false;
+
+    const QByteArray masterKey = keyAndSalt.left(SRTP_MASTER_KEY_LENGTH);
+    const QByteArray masterSalt = keyAndSalt.mid(SRTP_MASTER_KEY_LENGTH);
+    d->cipher.setKey(deriveSessionKey(masterKey, masterSalt, 0x00, SRTP_MASTER_KEY_LENGTH));
+    d->mac.setKey(deriveSessionKey(masterKey, masterSalt, 0x01, SRTP_AUTH_KEY_LENGTH));
+    d->salt = deriveSessionKey(masterKey, masterSalt, 0x02, SRTP_MASTER_SALT_LENGTH);
+    d->suite = suite;
+    return true;
+}
+
+/// Encrypts an RTP packet in place and appends its authentication tag.
+///
+/// If the packet has enough spare capacity, no memory is allocated.
+///
+/// \param packet
+
+bool QXmppSrtpContext::protect(QByteArray *packet)
+{
+    if (d->suite == NoCryptoSuite)
+        return false;
+
+    const int length = packet->size();
+    const int hlen = rtpHeaderLength(reinterpret_cast<const quint8*>(packet->constData()), length);
+    if (hlen < 0)
+        return false;
+
+    // update the rollover counter
+    const quint8 *header = reinterpret_cast<const quint8*>(packet->constData());
+    const quint16 sequence = qFromBigEndian<quint16>(header + 2);
+    const quint32 ssrc = qFromBigEndian<quint32>(header + 8);
+    QXmppSrtpContextPrivate::StreamState &state = d->streams[ssrc];
+    if (state.initialized && sequence < state.sequence && state.sequence - sequence > 0x8000)
+        state.roc++;
+    state.initialized = true;
+    state.sequence = sequence;
+    const quint64 index = (quint64(state.roc) << 16) | sequence;
+
+    // encrypt the payload
+    packet->resize(length + tagLength(d->suite));
+    quint8 *data = reinterpret_cast<quint8*>(packet->data());
+    quint8 iv[16];
+    d->computeIv(ssrc, index, iv);
+    d->cipher.counterXor(iv, data + hlen, data + hlen, length - hlen);
+
+    // append the authentication tag
+    d->authenticate(data, length, state.roc, data + length);
+    return true;
+}
+
+/// Checks the authentication tag of an SRTP packet and writes the
+/// decrypted RTP packet to \a output.
+///
+/// Replayed packets and packets which fail authentication are rejected.
+///
+/// \param packet
+/// \param output
+
+bool QXmppSrtpContext::unprotect(const QByteArray &packet, QByteArray *output)
+{
+    if (d->suite == NoCryptoSuite)
+        return false;
+
+    const quint8 *input = reinterpret_cast<const quint8*>(packet.constData());
+    const int tagLen = tagLength(d->suite);
+    const int length = packet.size() - tagLen;
+    const int hlen = rtpHeaderLength(input, length);
+    if (hlen < 0)
+        return false;
+
+    const quint16 sequence = qFromBigEndian<quint16>(input + 2);
+    const quint32 ssrc = qFromBigEndian<quint32>(input + 8);
+    QXmppSrtpContextPrivate::StreamState state = d->streams.value(ssrc);
+
+    // estimate the rollover counter, RFC 3711 section 3.3.1
+    quint32 roc = state.roc;
+    if (state.initialized) {
+        if (state.sequence < 0x8000) {
+            if (sequence - state.sequence > 0x8000) {
+                if (!state.roc)
+                    return false;
+                roc = state.roc - 1;
+            }
+        } else if (state.sequence - 0x8000 > sequence) {
+            roc = state.roc + 1;
+        }
+    }
+    const quint64 index = (quint64(roc) << 16) | sequence;
+    const quint64 highest = (quint64(state.roc) << 16) | state.sequence;
+
+    // check for replayed packets
+    if (state.initialized && index <= highest) {
+        const quint64 delta = highest - index;
+        if (delta >= SRTP_REPLAY_WINDOW || (state.replayWindow & (quint64(1) << delta)))
+            return false;
+    }
+
+    // check the authentication tag
+    quint8 tag[SRTP_AUTH_KEY_LENGTH];
+    d->authenticate(input, length, roc, tag);
+    quint8 diff = 0;
+    for (int i = 0; i < tagLen; ++i)
+        diff |= tag[i] ^ input[length + i];
+    if (diff)
+        return false;
+
+    // decrypt the payload
+    output->resize(length);
+    quint8 *data = reinterpret_cast<quint8*>(output->data());
+    if (data != input)
+        memcpy(data, input, hlen);
+    quint8 iv[16];
+    d->computeIv(ssrc, index, iv);
+    d->cipher.counterXor(iv, input + hlen, data + hlen, length - hlen);
+
+    // update the replay window
+    if (!state.initialized) {
+        state.initialized = true;
+        state.roc = roc;
+        state.sequence = sequence;
+        state.replayWindow = 1;
+    } else if (index > highest) {
+        const quint64 shift = index - highest;
+        state.replayWindow = (shift < SRTP_REPLAY_WINDOW) ? ((state.replayWindow << shift) | 1) : 1;
+        state.roc = roc;
+        state.sequence = sequence;
+    } else {
+        state.replayWindow |= quint64(1) << (highest - index);
+    }
+    d->streams.insert(ssrc, state);
+    return true;
+}
+
+/// Derives a session key from the master key and salt, as described in
+/// RFC 3711 section 4.3 with a key derivation rate of zero.
+///
+/// \param masterKey
+/// \param masterSalt
+/// \param label
+/// \param length
+
+QByteArray QXmppSrtpContext::deriveSessionKey(const QByteArray &masterKey, const QByteArray &masterSalt, quint8 label, int length)
+{
+    QXmppAesCipher cipher;
+    cipher.setKey(masterKey);
+
+    quint8 iv[16];
+    memset(iv, 0, sizeof(iv));
+    memcpy(iv, masterSalt.constData(), qMin(masterSalt.size(), SRTP_MASTER_SALT_LENGTH));
+    iv[7] ^= label;
+
+    QByteArray key(length, '\0');
+    quint8 *data = reinterpret_cast<quint8*>(key.data());
+    cipher.counterXor(iv, data, data, length);
+    return key;
+}
+
+/// Generates a master key and salt using the operating system's
+/// cryptographically secure random number generator.
+///
+/// Returns an empty byte array if no secure source of randomness is available.
+
+QByteArray QXmppSrtpContext::generateMasterKey()
+{
+    QByteArray key(masterKeyLength(), '\0');
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    QRandomGenerator *generator = QRandomGenerator::system();
+    for (int i = 0; i < key.size(); ++i)
+        key[i] = char(generator->bounded(256));
+    return key;
+#else
+    QFile file(QLatin1String("/dev/urandom"));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered) ||
+        file.read(key.data(), key.size()) != key.size())
+        return QByteArray();
+    return key;
+#endif
+}
+
+/// Returns the length of the concatenated master key and salt.
+
+int QXmppSrtpContext::masterKeyLength()
+{
+    return SRTP_MASTER_KEY_LENGTH + SRTP_MASTER_SALT_LENGTH;
+}
+
+/// Returns the length of the authentication tag for the given suite.
+///
+/// \param suite
+
+int QXmppSrtpContext::tagLength(CryptoSuite suite)
+{
+    switch (suite) {
+    case AesCm128HmacSha1_80:
+        return 10;
+    case AesCm128HmacSha1_32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/// Returns the crypto suite for the given SDES name.
+///
+/// \param name
+
+QXmppSrtpContext::CryptoSuite QXmppSrtpContext::suiteFromString(const QString &name)
+{
+    if (name == QLatin1String("AES_CM_128_HMAC_SHA1_80"))
+        return AesCm128HmacSha1_80;
+    else if (name == QLatin1String("AES_CM_128_HMAC_SHA1_32"))
+        return AesCm128HmacSha1_32;
+    return NoCryptoSuite;
+}
+
+/// Returns the SDES name of the given crypto suite.
+///
+/// \param suite
+
+QString QXmppSrtpContext::suiteToString(CryptoSuite suite)
+{
+    switch (suite) {
+    case AesCm128HmacSha1_80:
+        return QLatin1String("AES_CM_128_HMAC_SHA1_80");
+    case AesCm128HmacSha1_32:
+        return QLatin1String("AES_CM_128_HMAC_SHA1_32");
+    default:
+        return QString();
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSRTP_P_H
+#define QXMPPSRTP_P_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+class QXmppSrtpContextPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppAesCipher class implements the AES-128 block cipher in counter
+/// mode. AES-NI instructions are used when the CPU supports them.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppAesCipher
+{
+public:
+    QXmppAesCipher();
+
+    void setKey(const QByteArray &key);
+    void encryptBlock(const quint8 *input, quint8 *output) const;
+    void counterXor(const quint8 *iv, const quint8 *input, quint8 *output, int length) const;
+
+    static bool hasHardwareSupport();
+
+private:
+    quint8 m_roundKeys[176];
+    bool m_hardware;
+};
+
+/// \internal
+///
+/// The QXmppSrtpContext class protects and unprotects RTP packets for one
+/// direction of a session, as defined by RFC 3711 (SRTP).
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppSrtpContext
+{
+public:
+    enum CryptoSuite {
+        NoCryptoSuite,
+        AesCm128HmacSha1_80,
+        AesCm128HmacSha1_32
+    };
+
+    QXmppSrtpContext();
+    ~QXmppSrtpContext();
+
+    CryptoSuite cryptoSuite() const;
+    bool setMasterKey(CryptoSuite suite, const QByteArray &keyAndSalt);
+
+    bool protect(QByteArray *packet);
+    bool unprotect(const QByteArray &packet, QByteArray *output);
+
+    static QByteArray deriveSessionKey(const QByteArray &masterKey, const QByteArray &masterSalt, quint8 label, int length);
+    static QByteArray generateMasterKey();
+    static int masterKeyLength();
+    static int tagLength(CryptoSuite suite);
+    static CryptoSuite suiteFromString(const QString &name);
+    static QString suiteToString(CryptoSuite suite);
+
+private:
+    Q_DISABLE_COPY(QXmppSrtpContext)
+    QXmppSrtpContextPrivate *d;
+};
+
+#endif
@@ -23,19 +23,57 @@
 
 #define QXMPP_DEBUG_STUN
 
+#include <QAtomicInt>
 #include <QCryptographicHash>
 #include <QDataStream>
+#include <QHash>
 #include <QHostInfo>
+#include <QMessageAuthenticationCode>
 #include <QNetworkInterface>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QSslSocket>
+#include <QThreadStorage>
 #include <QUdpSocket>
 #include <QTimer>
+#include <QtEndian>
 
 #include "QXmppStun_p.h"
 #include "QXmppUtils.h"
 
+#if defined(Q_OS_LINUX)
+#define QXMPP_USE_MMSG
+#define QXMPP_USE_NETLINK
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #define STUN_ID_SIZE 12
 #define STUN_RTO_INTERVAL 500
 #define STUN_RTO_MAX      7
+#define STUN_RTO_RELIABLE 39500
+#define STUN_BUFFER_SIZE  1500
+#define STUN_INTEGRITY_SIZE 20
+
+// Number of datagrams read or written per system call, and size of the
+// pooled receive buffers. Larger datagrams are discarded whichever way
+// they are read.
+#define UDP_BATCH_SIZE    16
+#define UDP_DATAGRAM_SIZE 2048
+
+// First port tried when reserving ports for ICE components.
+#define ICE_PORT_MIN 49152
+
+// Default pacing of ICE connectivity checks (Ta), see RFC 8445 - 14.2.
+#define ICE_CHECK_INTERVAL 50
+
+// Default consent freshness timings, see RFC 7675 - 5.1.
+#define ICE_CONSENT_INTERVAL 5000
+#define ICE_CONSENT_TIMEOUT  30000
 
 static const quint32 STUN_MAGIC = 0x2112A442;
 static const quint16 STUN_HEADER = 20;
@@ -136,15 +174,12 @@ static bool isCompatibleAddress(const QHostAddress &a1, const QHostAddress &a2)
            isIPv6LinkLocalAddress(a1) == isIPv6LinkLocalAddress(a2);
 }
 
-static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &address, quint16 &port, const QByteArray &xorId = QByteArray())
+static bool decodeAddress(const quint8 *value, quint16 a_length, QHostAddress &address, quint16 &port, const QByteArray &xorId = QByteArray())
 {
     if (a_length < 4)
         return false;
-    quint8 reserved, protocol;
-    quint16 rawPort;
-    stream >> reserved;
-    stream >> protocol;
-    stream >> rawPort;
+    const quint8 protocol = value[1];
+    const quint16 rawPort = qFromBigEndian<quint16>(value + 2);
     if (xorId.isEmpty())
         port = rawPort;
     else
@@ -153,8 +188,7 @@ static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &a
     {
         if (a_length != 8)
             return false;
-        quint32 addr;
-        stream >> addr;
+        const quint32 addr = qFromBigEndian<quint32>(value + 4);
         if (xorId.isEmpty())
             address = QHostAddress(addr);
         else
@@ -163,12 +197,12 @@ static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &a
         if (a_length != 20)
             return false;
         Q_IPV6ADDR addr;
-        stream.readRawData((char*)&addr, sizeof(addr));
+        memcpy(&addr, value + 4, sizeof(addr));
         if (!xorId.isEmpty())
         {
-            QByteArray xpad;
-            QDataStream(&xpad, QIODevice::WriteOnly) << STUN_MAGIC;
-            xpad += xorId;
+            quint8 xpad[16];
+            qToBigEndian(STUN_MAGIC, xpad);
+            memcpy(xpad + 4, xorId.constData(), 12);
             for (int i = 0; i < 16; i++)
                 addr[i] ^= xpad[i];
         }
@@ -179,73 +213,152 @@ static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &a
     return true;
 }
 
-static void encodeAddress(QDataStream &stream, quint16 type, const QHostAddress &address, quint16 port, const QByteArray &xorId = QByteArray())
+/// Serializes STUN attributes into a caller-provided buffer.
+///
+/// Writes which do not fit are skipped but still counted, so that size()
+/// returns the number of bytes the complete message requires.
+
+class StunWriter
+{
+public:
+    StunWriter(char *data, int capacity)
+        : m_data(reinterpret_cast<quint8*>(data))
+        , m_capacity(capacity)
+        , m_size(0)
+    {
+    }
+
+    bool isValid() const
+    {
+        return m_size <= m_capacity;
+    }
+
+    int size() const
+    {
+        return m_size;
+    }
+
+    void setBodyLength(quint16 length)
+    {
+        if (m_capacity >= STUN_HEADER)
+            qToBigEndian(length, m_data + 2);
+    }
+
+    void writeUint8(quint8 value)
+    {
+        if (quint8 *ptr = reserve(1))
+            *ptr = value;
+    }
+
+    void writeUint16(quint16 value)
+    {
+        if (quint8 *ptr = reserve(2))
+            qToBigEndian(value, ptr);
+    }
+
+    void writeUint32(quint32 value)
+    {
+        if (quint8 *ptr = reserve(4))
+            qToBigEndian(value, ptr);
+    }
+
+    void writeRaw(const void *data, int length)
+    {
+        if (quint8 *ptr = reserve(length))
+            memcpy(ptr, data, length);
+    }
+
+    void writePadding(int length)
+    {
+        const int padLength = (4 - (length % 4)) % 4;
+        if (quint8 *ptr = reserve(padLength))
+            memset(ptr, 0, padLength);
+    }
+
+    void writeAttribute(quint16 type, const void *data, int length)
+    {
+        writeUint16(type);
+        writeUint16(length);
+        writeRaw(data, length);
+        writePadding(length);
+    }
+
+private:
+    quint8 *reserve(int length)
+    {
+        quint8 *ptr = (m_size + length <= m_capacity) ? m_data + m_size : 0;
+        m_size += length;
+        return ptr;
+    }
+
+    quint8 *m_data;
+    int m_capacity;
+    int m_size;
+};
+
+static void encodeAddress(StunWriter &writer, quint16 type, const QHostAddress &address, quint16 port, const QByteArray &xorId = QByteArray())
 {
     const quint8 reserved = 0;
     if (address.protocol() == QAbstractSocket::IPv4Protocol)
     {
-        stream << type;
-        stream << quint16(8);
-        stream << reserved;
-        stream << quint8(STUN_IPV4);
+        writer.writeUint16(type);
+        writer.writeUint16(8);
+        writer.writeUint8(reserved);
+        writer.writeUint8(STUN_IPV4);
         quint32 addr = address.toIPv4Address();
         if (!xorId.isEmpty())
         {
             port ^= (STUN_MAGIC >> 16);
             addr ^= STUN_MAGIC;
         }
-        stream << port;
-        stream << addr;
+        writer.writeUint16(port);
+        writer.writeUint32(addr);
     } else if (address.protocol() == QAbstractSocket::IPv6Protocol) {
-        stream << type;
-        stream << quint16(20);
-        stream << reserved;
-        stream << quint8(STUN_IPV6);
+        writer.writeUint16(type);
+        writer.writeUint16(20);
+        writer.writeUint8(reserved);
+        writer.writeUint8(STUN_IPV6);
         Q_IPV6ADDR addr = address.toIPv6Address();
         if (!xorId.isEmpty())
         {
             port ^= (STUN_MAGIC >> 16);
-            QByteArray xpad;
-            QDataStream(&xpad, QIODevice::WriteOnly) << STUN_MAGIC;
-            xpad += xorId;
+            quint8 xpad[16];
+            qToBigEndian(STUN_MAGIC, xpad);
+            memcpy(xpad + 4, xorId.constData(), 12);
             for (int i = 0; i < 16; i++)
                 addr[i] ^= xpad[i];
         }
-        stream << port;
-        stream.writeRawData((char*)&addr, sizeof(addr));
+        writer.writeUint16(port);
+        writer.writeRaw(&addr, sizeof(addr));
     } else {
         qWarning("Cannot write STUN attribute for unknown IP version");
     }
 }
 
-static void addAddress(QDataStream &stream, quint16 type, const QHostAddress &host, quint16 port, const QByteArray &xorId = QByteArray())
+static void addAddress(StunWriter &writer, quint16 type, const QHostAddress &host, quint16 port, const QByteArray &xorId = QByteArray())
 {
     if (port && !host.isNull() &&
         (host.protocol() == QAbstractSocket::IPv4Protocol ||
          host.protocol() == QAbstractSocket::IPv6Protocol))
     {
-        encodeAddress(stream, type, host, port, xorId);
+        encodeAddress(writer, type, host, port, xorId);
     }
 }
 
-static void encodeString(QDataStream &stream, quint16 type, const QString &string)
+static void encodeString(StunWriter &writer, quint16 type, const QString &string)
 {
     const QByteArray utf8string = string.toUtf8();
-    stream << type;
-    stream << quint16(utf8string.size());
-    stream.writeRawData(utf8string.data(), utf8string.size());
-    if (utf8string.size() % 4)
-    {
-        const QByteArray padding(4 - (utf8string.size() % 4), 0);
-        stream.writeRawData(padding.data(), padding.size());
-    }
+    writer.writeAttribute(type, utf8string.constData(), utf8string.size());
 }
 
-static void setBodyLength(QByteArray &buffer, qint16 length)
+// Compares two buffers in constant time, so that the comparison does not
+// reveal how many leading bytes match.
+static bool constantTimeEquals(const char *a, const char *b, int length)
 {
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
-    stream.device()->seek(2);
-    stream << length;
+    quint8 diff = 0;
+    for (int i = 0; i < length; ++i)
+        diff |= quint8(a[i]) ^ quint8(b[i]);
+    return !diff;
 }
 
 /// Constructs a new QXmppStunMessage.
@@ -514,6 +627,26 @@ void QXmppStunMessage::setUsername(const QString &username)
 /// \param errors
 
 bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, QStringList *errors)
+{
+    if (key.isEmpty())
+        return decode(buffer, static_cast<QMessageAuthenticationCode*>(0), errors);
+
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha1, key);
+    return decode(buffer, &mac, errors);
+}
+
+/// Decodes a QXmppStunMessage and checks its integrity using the given
+/// HMAC-SHA1 code, which is reset first. This lets the caller reuse one
+/// code for all the messages protected by the same key.
+///
+/// If \a mac is null, the integrity is not checked. Otherwise messages
+/// without a MESSAGE-INTEGRITY attribute are rejected.
+///
+/// \param buffer
+/// \param mac
+/// \param errors
+
+bool QXmppStunMessage::decode(const QByteArray &buffer, QMessageAuthenticationCode *mac, QStringList *errors)
 {
     QStringList silent;
     if (!errors)
@@ -526,12 +659,12 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
     }
 
     // parse STUN header
-    QDataStream stream(buffer);
-    quint16 length;
-    stream >> m_type;
-    stream >> length;
-    stream >> m_cookie;
-    stream.readRawData(m_id.data(), m_id.size());
+    const quint8 *data = reinterpret_cast<const quint8*>(buffer.constData());
+    const quint16 length = qFromBigEndian<quint16>(data + 2);
+    m_type = qFromBigEndian<quint16>(data);
+    m_cookie = qFromBigEndian<quint32>(data + 4);
+    m_id.resize(STUN_ID_SIZE);
+    memcpy(m_id.data(), data + 8, STUN_ID_SIZE);
 
     if (length != buffer.size() - STUN_HEADER)
     {
@@ -540,20 +673,30 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
     }
 
     // parse STUN attributes
+    const quint8 *body = data + STUN_HEADER;
     int done = 0;
     bool after_integrity = false;
     while (done < length)
     {
-        quint16 a_type, a_length;
-        stream >> a_type;
-        stream >> a_length;
+        if (length - done < 4)
+        {
+            *errors << QLatin1String("Received a truncated STUN attribute");
+            return false;
+        }
+        const quint16 a_type = qFromBigEndian<quint16>(body + done);
+        const quint16 a_length = qFromBigEndian<quint16>(body + done + 2);
+        const quint8 *value = body + done + 4;
+        if (a_length > length - done - 4)
+        {
+            *errors << QLatin1String("Received a truncated STUN attribute");
+            return false;
+        }
         const int pad_length = 4 * ((a_length + 3) / 4) - a_length;
 
         // only FINGERPRINT is allowed after MESSAGE-INTEGRITY
         if (after_integrity && a_type != Fingerprint)
         {
             *errors << QString("Skipping attribute %1 after MESSAGE-INTEGRITY").arg(QString::number(a_type));
-            stream.skipRawData(a_length + pad_length);
             done += 4 + a_length + pad_length;
             continue;
         }
@@ -563,7 +706,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // PRIORITY
             if (a_length != sizeof(m_priority))
                 return false;
-            stream >> m_priority;
+            m_priority = qFromBigEndian<quint32>(value);
             m_attributes << Priority;
 
         } else if (a_type == ErrorCode) {
@@ -571,15 +714,10 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // ERROR-CODE
             if (a_length < 4)
                 return false;
-            quint16 reserved;
-            quint8 errorCodeHigh, errorCodeLow;
-            stream >> reserved;
-            stream >> errorCodeHigh;
-            stream >> errorCodeLow;
+            const quint8 errorCodeHigh = value[2];
+            const quint8 errorCodeLow = value[3];
             errorCode = errorCodeHigh * 100 + errorCodeLow;
-            QByteArray phrase(a_length - 4, 0);
-            stream.readRawData(phrase.data(), phrase.size());
-            errorPhrase = QString::fromUtf8(phrase);
+            errorPhrase = QString::fromUtf8(reinterpret_cast<const char*>(value + 4), a_length - 4);
 
         } else if (a_type == UseCandidate) {
 
@@ -593,15 +731,13 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // CHANNEL-NUMBER
             if (a_length != 4)
                 return false;
-            stream >> m_channelNumber;
-            stream.skipRawData(2);
+            m_channelNumber = qFromBigEndian<quint16>(value);
             m_attributes << ChannelNumber;
 
         } else if (a_type == DataAttr) {
 
             // DATA
-            m_data.resize(a_length);
-            stream.readRawData(m_data.data(), m_data.size());
+            m_data = QByteArray(reinterpret_cast<const char*>(value), a_length);
             m_attributes << DataAttr;
 
         } else if (a_type == Lifetime) {
@@ -609,22 +745,19 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // LIFETIME
             if (a_length != sizeof(m_lifetime))
                 return false;
-            stream >> m_lifetime;
+            m_lifetime = qFromBigEndian<quint32>(value);
             m_attributes << Lifetime;
 
         } else if (a_type == Nonce) {
 
             // NONCE
-            m_nonce.resize(a_length);
-            stream.readRawData(m_nonce.data(), m_nonce.size());
+            m_nonce = QByteArray(reinterpret_cast<const char*>(value), a_length);
             m_attributes << Nonce;
 
         } else if (a_type == Realm) {
 
             // REALM
-            QByteArray utf8Realm(a_length, 0);
-            stream.readRawData(utf8Realm.data(), utf8Realm.size());
-            m_realm = QString::fromUtf8(utf8Realm);
+            m_realm = QString::fromUtf8(reinterpret_cast<const char*>(value), a_length);
             m_attributes << Realm;
 
         } else if (a_type == RequestedTransport) {
@@ -632,8 +765,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // REQUESTED-TRANSPORT
             if (a_length != 4)
                 return false;
-            stream >> m_requestedTransport;
-            stream.skipRawData(3);
+            m_requestedTransport = value[0];
             m_attributes << RequestedTransport;
 
         } else if (a_type == ReservationToken) {
@@ -641,30 +773,25 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // RESERVATION-TOKEN
             if (a_length != 8)
                 return false;
-            m_reservationToken.resize(a_length);
-            stream.readRawData(m_reservationToken.data(), m_reservationToken.size());
+            m_reservationToken = QByteArray(reinterpret_cast<const char*>(value), a_length);
             m_attributes << ReservationToken;
 
         } else if (a_type == Software) {
 
             // SOFTWARE
-            QByteArray utf8Software(a_length, 0);
-            stream.readRawData(utf8Software.data(), utf8Software.size());
-            m_software = QString::fromUtf8(utf8Software);
+            m_software = QString::fromUtf8(reinterpret_cast<const char*>(value), a_length);
             m_attributes << Software;
 
         } else if (a_type == Username) {
 
             // USERNAME
-            QByteArray utf8Username(a_length, 0);
-            stream.readRawData(utf8Username.data(), utf8Username.size());
-            m_username = QString::fromUtf8(utf8Username);
+            m_username = QString::fromUtf8(reinterpret_cast<const char*>(value), a_length);
             m_attributes << Username;
 
         } else if (a_type == MappedAddress) {
 
             // MAPPED-ADDRESS
-            if (!decodeAddress(stream, a_length, mappedHost, mappedPort))
+            if (!decodeAddress(value, a_length, mappedHost, mappedPort))
             {
                 *errors << QLatin1String("Bad MAPPED-ADDRESS");
                 return false;
@@ -675,13 +802,13 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // CHANGE-REQUEST
             if (a_length != sizeof(m_changeRequest))
                 return false;
-            stream >> m_changeRequest;
+            m_changeRequest = qFromBigEndian<quint32>(value);
             m_attributes << ChangeRequest;
 
         } else if (a_type == SourceAddress) {
 
             // SOURCE-ADDRESS
-            if (!decodeAddress(stream, a_length, sourceHost, sourcePort))
+            if (!decodeAddress(value, a_length, sourceHost, sourcePort))
             {
                 *errors << QLatin1String("Bad SOURCE-ADDRESS");
                 return false;
@@ -690,7 +817,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == ChangedAddress) {
 
             // CHANGED-ADDRESS
-            if (!decodeAddress(stream, a_length, changedHost, changedPort))
+            if (!decodeAddress(value, a_length, changedHost, changedPort))
             {
                 *errors << QLatin1String("Bad CHANGED-ADDRESS");
                 return false;
@@ -699,7 +826,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == OtherAddress) {
 
             // OTHER-ADDRESS
-            if (!decodeAddress(stream, a_length, otherHost, otherPort))
+            if (!decodeAddress(value, a_length, otherHost, otherPort))
             {
                 *errors << QLatin1String("Bad OTHER-ADDRESS");
                 return false;
@@ -708,7 +835,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == XorMappedAddress) {
 
             // XOR-MAPPED-ADDRESS
-            if (!decodeAddress(stream, a_length, xorMappedHost, xorMappedPort, m_id))
+            if (!decodeAddress(value, a_length, xorMappedHost, xorMappedPort, m_id))
             {
                 *errors << QLatin1String("Bad XOR-MAPPED-ADDRESS");
                 return false;
@@ -717,7 +844,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == XorPeerAddress) {
 
             // XOR-PEER-ADDRESS
-            if (!decodeAddress(stream, a_length, xorPeerHost, xorPeerPort, m_id))
+            if (!decodeAddress(value, a_length, xorPeerHost, xorPeerPort, m_id))
             {
                 *errors << QLatin1String("Bad XOR-PEER-ADDRESS");
                 return false;
@@ -726,7 +853,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == XorRelayedAddress) {
 
             // XOR-RELAYED-ADDRESS
-            if (!decodeAddress(stream, a_length, xorRelayedHost, xorRelayedPort, m_id))
+            if (!decodeAddress(value, a_length, xorRelayedHost, xorRelayedPort, m_id))
             {
                 *errors << QLatin1String("Bad XOR-RELAYED-ADDRESS");
                 return false;
@@ -735,17 +862,22 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == MessageIntegrity) {
 
             // MESSAGE-INTEGRITY
-            if (a_length != 20)
+            if (a_length != STUN_INTEGRITY_SIZE)
                 return false;
-            QByteArray integrity(20, 0);
-            stream.readRawData(integrity.data(), integrity.size());
 
-            // check HMAC-SHA1
-            if (!key.isEmpty())
+            // check HMAC-SHA1 over the header, with the length adjusted
+            // to end after this attribute, and the preceding attributes
+            if (mac)
             {
-                QByteArray copy = buffer.left(STUN_HEADER + done);
-                setBodyLength(copy, done + 24);
-                if (integrity != QXmppUtils::generateHmacSha1(key, copy))
+                quint8 header[STUN_HEADER];
+                memcpy(header, data, STUN_HEADER);
+                qToBigEndian(quint16(done + 24), header + 2);
+
+                mac->reset();
+                mac->addData(reinterpret_cast<const char*>(header), STUN_HEADER);
+                mac->addData(reinterpret_cast<const char*>(body), done);
+                const QByteArray integrity = mac->result();
+                if (!constantTimeEquals(integrity.constData(), reinterpret_cast<const char*>(value), STUN_INTEGRITY_SIZE))
                 {
                     *errors << QLatin1String("Bad message integrity");
                     return false;
@@ -760,13 +892,17 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // FINGERPRINT
             if (a_length != 4)
                 return false;
-            quint32 fingerprint;
-            stream >> fingerprint;
+            const quint32 fingerprint = qFromBigEndian<quint32>(value);
+
+            // check CRC32 over the header, with the length adjusted
+            // to end after this attribute, and the preceding attributes
+            quint8 header[STUN_HEADER];
+            memcpy(header, data, STUN_HEADER);
+            qToBigEndian(quint16(done + 8), header + 2);
 
-            // check CRC32
-            QByteArray copy = buffer.left(STUN_HEADER + done);
-            setBodyLength(copy, done + 8);
-            const quint32 expected = QXmppUtils::generateCrc32(copy) ^ 0x5354554eL;
+            quint32 crc = QXmppUtils::generateCrc32(reinterpret_cast<const char*>(header), STUN_HEADER);
+            crc = QXmppUtils::generateCrc32(reinterpret_cast<const char*>(body), done, crc);
+            const quint32 expected = crc ^ 0x5354554eL;
             if (fingerprint != expected)
             {
                 *errors << QLatin1String("Bad fingerprint");
@@ -781,27 +917,29 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             /// ICE-CONTROLLING
             if (a_length != 8)
                 return false;
-            iceControlling.resize(a_length);
-            stream.readRawData(iceControlling.data(), iceControlling.size());
+            iceControlling = QByteArray(reinterpret_cast<const char*>(value), a_length);
 
          } else if (a_type == IceControlled) {
 
             /// ICE-CONTROLLED
             if (a_length != 8)
                 return false;
-            iceControlled.resize(a_length);
-            stream.readRawData(iceControlled.data(), iceControlled.size());
+            iceControlled = QByteArray(reinterpret_cast<const char*>(value), a_length);
 
         } else {
 
             // Unknown attribute
-            stream.skipRawData(a_length);
             *errors << QString("Skipping unknown attribute %1").arg(QString::number(a_type));
 
         }
-        stream.skipRawData(pad_length);
         done += 4 + a_length + pad_length;
     }
+
+    if (mac && !after_integrity)
+    {
+        *errors << QLatin1String("Missing message integrity");
+        return false;
+    }
     return true;
 }
 
@@ -813,176 +951,197 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
 
 QByteArray QXmppStunMessage::encode(const QByteArray &key, bool addFingerprint) const
 {
-    QByteArray buffer;
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
+    char buffer[STUN_BUFFER_SIZE];
+    const int length = encode(buffer, sizeof(buffer), key, addFingerprint);
+    if (length <= int(sizeof(buffer)))
+        return QByteArray(buffer, length);
+
+    // the message does not fit on the stack, encode it again
+    QByteArray message(length, Qt::Uninitialized);
+    encode(message.data(), message.size(), key, addFingerprint);
+    return message;
+}
+
+/// Encodes the current QXmppStunMessage into the given buffer, optionally
+/// calculating the message integrity attribute using the given key.
+///
+/// Returns the length of the encoded message. If it is larger than
+/// \a capacity, the contents of \a data are undefined and the message
+/// must be encoded again into a large enough buffer.
+///
+/// \param data
+/// \param capacity
+/// \param key
+/// \param addFingerprint
+
+int QXmppStunMessage::encode(char *data, int capacity, const QByteArray &key, bool addFingerprint) const
+{
+    if (key.isEmpty())
+        return encode(data, capacity, static_cast<QMessageAuthenticationCode*>(0), addFingerprint);
+
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha1, key);
+    return encode(data, capacity, &mac, addFingerprint);
+}
+
+/// Encodes the current QXmppStunMessage into the given buffer, optionally
+/// calculating the message integrity attribute using the given HMAC-SHA1
+/// code, which is reset first.
+///
+/// If \a mac is null, no message integrity attribute is added.
+///
+/// \param data
+/// \param capacity
+/// \param mac
+/// \param addFingerprint
+
+int QXmppStunMessage::encode(char *data, int capacity, QMessageAuthenticationCode *mac, bool addFingerprint) const
+{
+    StunWriter writer(data, capacity);
 
     // encode STUN header
-    quint16 length = 0;
-    stream << m_type;
-    stream << length;
-    stream << m_cookie;
-    stream.writeRawData(m_id.data(), m_id.size());
+    writer.writeUint16(m_type);
+    writer.writeUint16(0);
+    writer.writeUint32(m_cookie);
+    writer.writeRaw(m_id.constData(), m_id.size());
 
     // MAPPED-ADDRESS
-    addAddress(stream, MappedAddress, mappedHost, mappedPort);
+    addAddress(writer, MappedAddress, mappedHost, mappedPort);
 
     // CHANGE-REQUEST
     if (m_attributes.contains(ChangeRequest)) {
-        stream << quint16(ChangeRequest);
-        stream << quint16(sizeof(m_changeRequest));
-        stream << m_changeRequest;
+        writer.writeUint16(ChangeRequest);
+        writer.writeUint16(sizeof(m_changeRequest));
+        writer.writeUint32(m_changeRequest);
     }
 
     // SOURCE-ADDRESS
-    addAddress(stream, SourceAddress, sourceHost, sourcePort);
+    addAddress(writer, SourceAddress, sourceHost, sourcePort);
 
     // CHANGED-ADDRESS
-    addAddress(stream, ChangedAddress, changedHost, changedPort);
+    addAddress(writer, ChangedAddress, changedHost, changedPort);
 
     // OTHER-ADDRESS
-    addAddress(stream, OtherAddress, otherHost, otherPort);
+    addAddress(writer, OtherAddress, otherHost, otherPort);
 
     // XOR-MAPPED-ADDRESS
-    addAddress(stream, XorMappedAddress, xorMappedHost, xorMappedPort, m_id);
+    addAddress(writer, XorMappedAddress, xorMappedHost, xorMappedPort, m_id);
 
     // XOR-PEER-ADDRESS
-    addAddress(stream, XorPeerAddress, xorPeerHost, xorPeerPort, m_id);
+    addAddress(writer, XorPeerAddress, xorPeerHost, xorPeerPort, m_id);
 
     // XOR-RELAYED-ADDRESS
-    addAddress(stream, XorRelayedAddress, xorRelayedHost, xorRelayedPort, m_id);
+    addAddress(writer, XorRelayedAddress, xorRelayedHost, xorRelayedPort, m_id);
 
     // ERROR-CODE
     if (errorCode)
     {
-        const quint16 reserved = 0;
-        const quint8 errorCodeHigh = errorCode / 100;
-        const quint8 errorCodeLow = errorCode % 100;
         const QByteArray phrase = errorPhrase.toUtf8();
-        stream << quint16(ErrorCode);
-        stream << quint16(phrase.size() + 4);
-        stream << reserved;
-        stream << errorCodeHigh;
-        stream << errorCodeLow;
-        stream.writeRawData(phrase.data(), phrase.size());
-        if (phrase.size() % 4)
-        {
-            const QByteArray padding(4 - (phrase.size() %  4), 0);
-            stream.writeRawData(padding.data(), padding.size());
-        }
+        writer.writeUint16(ErrorCode);
+        writer.writeUint16(phrase.size() + 4);
+        writer.writeUint16(0);
+        writer.writeUint8(errorCode / 100);
+        writer.writeUint8(errorCode % 100);
+        writer.writeRaw(phrase.constData(), phrase.size());
+        writer.writePadding(phrase.size());
     }
 
     // PRIORITY
     if (m_attributes.contains(Priority))
     {
-        stream << quint16(Priority);
-        stream << quint16(sizeof(m_priority));
-        stream << m_priority;
+        writer.writeUint16(Priority);
+        writer.writeUint16(sizeof(m_priority));
+        writer.writeUint32(m_priority);
     }
 
     // USE-CANDIDATE
     if (useCandidate)
     {
-        stream << quint16(UseCandidate);
-        stream << quint16(0);
+        writer.writeUint16(UseCandidate);
+        writer.writeUint16(0);
     }
 
     // CHANNEL-NUMBER
     if (m_attributes.contains(ChannelNumber)) {
-        stream << quint16(ChannelNumber);
-        stream << quint16(4);
-        stream << m_channelNumber;
-        stream << quint16(0);
+        writer.writeUint16(ChannelNumber);
+        writer.writeUint16(4);
+        writer.writeUint16(m_channelNumber);
+        writer.writeUint16(0);
     }
 
     // DATA
-    if (m_attributes.contains(DataAttr)) {
-        stream << quint16(DataAttr);
-        stream << quint16(m_data.size());
-        stream.writeRawData(m_data.data(), m_data.size());
-        if (m_data.size() % 4) {
-            const QByteArray padding(4 - (m_data.size() %  4), 0);
-            stream.writeRawData(padding.data(), padding.size());
-        }
-    }
+    if (m_attributes.contains(DataAttr))
+        writer.writeAttribute(DataAttr, m_data.constData(), m_data.size());
 
     // LIFETIME
     if (m_attributes.contains(Lifetime)) {
-        stream << quint16(Lifetime);
-        stream << quint16(sizeof(m_lifetime));
-        stream << m_lifetime;
+        writer.writeUint16(Lifetime);
+        writer.writeUint16(sizeof(m_lifetime));
+        writer.writeUint32(m_lifetime);
     }
 
     // NONCE
-    if (m_attributes.contains(Nonce)) {
-        stream << quint16(Nonce);
-        stream << quint16(m_nonce.size());
-        stream.writeRawData(m_nonce.data(), m_nonce.size());
-    }
+    if (m_attributes.contains(Nonce))
+        writer.writeAttribute(Nonce, m_nonce.constData(), m_nonce.size());
 
     // REALM
     if (m_attributes.contains(Realm))
-        encodeString(stream, Realm, m_realm);
+        encodeString(writer, Realm, m_realm);
 
     // REQUESTED-TRANSPORT
     if (m_attributes.contains(RequestedTransport)) {
-        const QByteArray reserved(3, 0);
-        stream << quint16(RequestedTransport);
-        stream << quint16(4);
-        stream << m_requestedTransport;
-        stream.writeRawData(reserved.data(), reserved.size());
+        writer.writeUint16(RequestedTransport);
+        writer.writeUint16(4);
+        writer.writeUint8(m_requestedTransport);
+        writer.writeUint8(0);
+        writer.writeUint16(0);
     }
 
     // RESERVATION-TOKEN
-    if (m_attributes.contains(ReservationToken)) {
-        stream << quint16(ReservationToken);
-        stream << quint16(m_reservationToken.size());
-        stream.writeRawData(m_reservationToken.data(), m_reservationToken.size());
-    }
+    if (m_attributes.contains(ReservationToken))
+        writer.writeAttribute(ReservationToken, m_reservationToken.constData(), m_reservationToken.size());
 
     // SOFTWARE
     if (m_attributes.contains(Software))
-        encodeString(stream, Software, m_software);
+        encodeString(writer, Software, m_software);
 
     // USERNAME
     if (m_attributes.contains(Username))
-        encodeString(stream, Username, m_username);
+        encodeString(writer, Username, m_username);
 
     // ICE-CONTROLLING or ICE-CONTROLLED
     if (!iceControlling.isEmpty())
-    {
-        stream << quint16(IceControlling);
-        stream << quint16(iceControlling.size());
-        stream.writeRawData(iceControlling.data(), iceControlling.size());
-    } else if (!iceControlled.isEmpty()) {
-        stream << quint16(IceControlled);
-        stream << quint16(iceControlled.size());
-        stream.writeRawData(iceControlled.data(), iceControlled.size());
-    }
-
-    // set body length
-    setBodyLength(buffer, buffer.size() - STUN_HEADER);
+        writer.writeAttribute(IceControlling, iceControlling.constData(), iceControlling.size());
+    else if (!iceControlled.isEmpty())
+        writer.writeAttribute(IceControlled, iceControlled.constData(), iceControlled.size());
 
     // MESSAGE-INTEGRITY
-    if (!key.isEmpty())
+    if (mac)
     {
-        setBodyLength(buffer, buffer.size() - STUN_HEADER + 24);
-        QByteArray integrity = QXmppUtils::generateHmacSha1(key, buffer);
-        stream << quint16(MessageIntegrity);
-        stream << quint16(integrity.size());
-        stream.writeRawData(integrity.data(), integrity.size());
+        QByteArray integrity(STUN_INTEGRITY_SIZE, '\0');
+        writer.setBodyLength(writer.size() - STUN_HEADER + 24);
+        if (writer.isValid()) {
+            mac->reset();
+            mac->addData(data, writer.size());
+            integrity = mac->result();
+        }
+        writer.writeAttribute(MessageIntegrity, integrity.constData(), integrity.size());
     }
 
     // FINGERPRINT
     if (addFingerprint)
     {
-        setBodyLength(buffer, buffer.size() - STUN_HEADER + 8);
-        quint32 fingerprint = QXmppUtils::generateCrc32(buffer) ^ 0x5354554eL;
-        stream << quint16(Fingerprint);
-        stream << quint16(sizeof(fingerprint));
-        stream << fingerprint;
+        quint32 fingerprint = 0;
+        writer.setBodyLength(writer.size() - STUN_HEADER + 8);
+        if (writer.isValid())
+            fingerprint = QXmppUtils::generateCrc32(data, writer.size()) ^ 0x5354554eL;
+        writer.writeUint16(Fingerprint);
+        writer.writeUint16(sizeof(fingerprint));
+        writer.writeUint32(fingerprint);
     }
 
-    return buffer;
+    // set body length
+    writer.setBodyLength(writer.size() - STUN_HEADER);
+    return writer.size();
 }
 
 /// If the given packet looks like a STUN message, returns the message
@@ -998,18 +1157,16 @@ quint16 QXmppStunMessage::peekType(const QByteArray &buffer, quint32 &cookie, QB
         return 0;
 
     // parse STUN header
-    QDataStream stream(buffer);
-    quint16 type;
-    quint16 length;
-    stream >> type;
-    stream >> length;
-    stream >> cookie;
+    const quint8 *data = reinterpret_cast<const quint8*>(buffer.constData());
+    const quint16 type = qFromBigEndian<quint16>(data);
+    const quint16 length = qFromBigEndian<quint16>(data + 2);
+    cookie = qFromBigEndian<quint32>(data + 4);
 
     if (length != buffer.size() - STUN_HEADER)
         return 0;
 
     id.resize(STUN_ID_SIZE);
-    stream.readRawData(id.data(), id.size());
+    memcpy(id.data(), data + 8, STUN_ID_SIZE);
     return type;
 }
 
@@ -1107,7 +1264,7 @@ QString QXmppStunMessage::toString() const
 
 QXmppStunTransaction::QXmppStunTransaction(const QXmppStunMessage &request, QObject *receiver)
     : QXmppLoggable(receiver),
-    m_request(request),
+    m_reliable(false),
     m_tries(0)
 {
     bool check;
@@ -1127,8 +1284,7 @@ QXmppStunTransaction::QXmppStunTransaction(const QXmppStunMessage &request, QObj
     check = connect(m_retryTimer, SIGNAL(timeout()),
                     this, SLOT(retry()));
 
-    // send packet immediately
-    m_retryTimer->start(0);
+    start(request);
 }
 
 void QXmppStunTransaction::readStun(const QXmppStunMessage &response)
@@ -1141,6 +1297,33 @@ void QXmppStunTransaction::readStun(const QXmppStunMessage &response)
     }
 }
 
+/// Sets whether the request is sent over a reliable transport, in which
+/// case it is not retransmitted, see RFC 5389 - 7.2.2.
+///
+/// \param reliable
+
+void QXmppStunTransaction::setReliable(bool reliable)
+{
+    m_reliable = reliable;
+}
+
+/// Starts the transaction for the given request, abandoning the previous
+/// request if it is still in progress.
+///
+/// This allows a transaction to be reused for successive requests.
+///
+/// \param request
+
+void QXmppStunTransaction::start(const QXmppStunMessage &request)
+{
+    m_request = request;
+    m_response = QXmppStunMessage();
+    m_tries = 0;
+
+    // send packet immediately
+    m_retryTimer->start(0);
+}
+
 /// Returns the STUN request.
 
 QXmppStunMessage QXmppStunTransaction::request() const
@@ -1157,7 +1340,7 @@ QXmppStunMessage QXmppStunTransaction::response() const
 
 void QXmppStunTransaction::retry()
 {
-    if (m_tries >= STUN_RTO_MAX) {
+    if (m_tries >= STUN_RTO_MAX || (m_reliable && m_tries)) {
         m_response.setType(QXmppStunMessage::Error);
         m_response.errorPhrase = QLatin1String("Request timed out");
         emit finished();
@@ -1166,7 +1349,10 @@ void QXmppStunTransaction::retry()
 
     // resend request
     emit writeStun(m_request);
-    m_retryTimer->start(m_tries ? 2 * m_retryTimer->interval() : STUN_RTO_INTERVAL);
+    if (m_reliable)
+        m_retryTimer->start(STUN_RTO_RELIABLE);
+    else
+        m_retryTimer->start(m_tries ? 2 * m_retryTimer->interval() : STUN_RTO_INTERVAL);
     m_tries++;
 }
 
@@ -1178,6 +1364,8 @@ QXmppTurnAllocation::QXmppTurnAllocation(QObject *parent)
     : QXmppIceTransport(parent),
     m_relayedPort(0),
     m_turnPort(0),
+    m_ignoreSslErrors(false),
+    m_transport(QXmppIceConnection::UdpTurnTransport),
     m_channelNumber(0x4000),
     m_lifetime(600),
     m_state(UnconnectedState)
@@ -1190,6 +1378,27 @@ QXmppTurnAllocation::QXmppTurnAllocation(QObject *parent)
                     this, SLOT(readyRead()));
     Q_ASSERT(check);
 
+    m_tcpSocket = new QSslSocket(this);
+    check = connect(m_tcpSocket, SIGNAL(connected()),
+                    this, SLOT(socketConnected()));
+    Q_ASSERT(check);
+
+    check = connect(m_tcpSocket, SIGNAL(encrypted()),
+                    this, SLOT(socketConnected()));
+    Q_ASSERT(check);
+
+    check = connect(m_tcpSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+                    this, SLOT(socketError(QAbstractSocket::SocketError)));
+    Q_ASSERT(check);
+
+    check = connect(m_tcpSocket, SIGNAL(readyRead()),
+                    this, SLOT(socketReadyRead()));
+    Q_ASSERT(check);
+
+    check = connect(m_tcpSocket, SIGNAL(sslErrors(QList<QSslError>)),
+                    this, SLOT(socketSslErrors(QList<QSslError>)));
+    Q_ASSERT(check);
+
     m_timer = new QTimer(this);
     m_timer->setSingleShot(true);
     check = connect(m_timer, SIGNAL(timeout()),
@@ -1219,6 +1428,18 @@ void QXmppTurnAllocation::connectToHost()
     if (m_state != UnconnectedState)
         return;
 
+    if (m_transport != QXmppIceConnection::UdpTurnTransport) {
+        // the allocate request is sent once the stream is established
+        m_streamBuffer.clear();
+        setState(ConnectingState);
+        if (m_transport == QXmppIceConnection::TlsTurnTransport)
+            m_tcpSocket->connectToHostEncrypted(m_turnHost.toString(), m_turnPort,
+                m_turnName.isEmpty() ? m_turnHost.toString() : m_turnName);
+        else
+            m_tcpSocket->connectToHost(m_turnHost, m_turnPort);
+        return;
+    }
+
     // start listening for UDP
     if (socket->state() == QAbstractSocket::UnconnectedState) {
         if (!socket->bind()) {
@@ -1227,16 +1448,31 @@ void QXmppTurnAllocation::connectToHost()
         }
     }
 
-    // send allocate request
+    // update state
+    setState(ConnectingState);
+    sendAllocate();
+}
+
+/// Sends the allocate request.
+
+void QXmppTurnAllocation::sendAllocate()
+{
+    // the relayed address is always UDP, whatever the transport to the server
     QXmppStunMessage request;
     request.setType(QXmppStunMessage::Allocate | QXmppStunMessage::Request);
     request.setId(QXmppUtils::generateRandomBytes(STUN_ID_SIZE));
     request.setLifetime(m_lifetime);
     request.setRequestedTransport(0x11);
-    m_transactions << new QXmppStunTransaction(request, this);
+    startTransaction(request);
+}
 
-    // update state
-    setState(ConnectingState);
+/// Starts a STUN transaction with the TURN server.
+
+void QXmppTurnAllocation::startTransaction(const QXmppStunMessage &request)
+{
+    QXmppStunTransaction *transaction = new QXmppStunTransaction(request, this);
+    transaction->setReliable(m_transport != QXmppIceConnection::UdpTurnTransport);
+    m_transactions << transaction;
 }
 
 /// Releases the TURN allocation.
@@ -1261,7 +1497,7 @@ void QXmppTurnAllocation::disconnectFromHost()
         request.setRealm(m_realm);
         request.setUsername(m_username);
         request.setLifetime(0);
-        m_transactions << new QXmppStunTransaction(request, this);
+        startTransaction(request);
 
         setState(ClosingState);
     } else {
@@ -1288,28 +1524,96 @@ QXmppJingleCandidate QXmppTurnAllocation::localCandidate(int component) const
 
 void QXmppTurnAllocation::readyRead()
 {
-    QByteArray buffer;
     QHostAddress remoteHost;
     quint16 remotePort;
     while (socket->hasPendingDatagrams()) {
         const qint64 size = socket->pendingDatagramSize();
-        buffer.resize(size);
-        socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
-        handleDatagram(buffer, remoteHost, remotePort);
+        m_buffer.resize(size);
+        socket->readDatagram(m_buffer.data(), m_buffer.size(), &remoteHost, &remotePort);
+        handleDatagram(m_buffer, remoteHost, remotePort);
     }
 }
 
-void QXmppTurnAllocation::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
+/// Splits the stream received from the TURN server into messages, see
+/// RFC 5766 - 11.5. The ChannelData Message.
+
+void QXmppTurnAllocation::socketReadyRead()
+{
+    m_streamBuffer.append(m_tcpSocket->readAll());
+
+    int pos = 0;
+    while (m_streamBuffer.size() - pos >= 4) {
+        const uchar *header = reinterpret_cast<const uchar*>(m_streamBuffer.constData() + pos);
+        const quint16 length = qFromBigEndian<quint16>(header + 2);
+
+        // ChannelData messages are padded to a multiple of 4 bytes over streams
+        int size;
+        if ((header[0] & 0xc0) == 0x40)
+            size = 4 + ((length + 3) & ~3);
+        else
+            size = 20 + length;
+        if (m_streamBuffer.size() - pos < size)
+            break;
+
+        m_buffer.resize(size);
+        memcpy(m_buffer.data(), header, size);
+        pos += size;
+        handleDatagram(m_buffer, m_turnHost, m_turnPort);
+    }
+    m_streamBuffer.remove(0, pos);
+}
+
+void QXmppTurnAllocation::socketConnected()
+{
+    // wait for the TLS handshake to complete
+    if (m_transport == QXmppIceConnection::TlsTurnTransport && !m_tcpSocket->isEncrypted())
+        return;
+
+    if (m_state == ConnectingState && m_transactions.isEmpty())
+        sendAllocate();
+}
+
+void QXmppTurnAllocation::socketError(QAbstractSocket::SocketError error)
+{
+    Q_UNUSED(error);
+    if (m_state == UnconnectedState)
+        return;
+
+    warning(QString("TURN connection failed: %1").arg(m_tcpSocket->errorString()));
+    m_channelTimer->stop();
+    m_channels.clear();
+    foreach (QXmppStunTransaction *transaction, m_transactions)
+        delete transaction;
+    m_transactions.clear();
+    setState(UnconnectedState);
+}
+
+void QXmppTurnAllocation::socketSslErrors(const QList<QSslError> &errors)
+{
+    // log errors
+    warning("SSL errors");
+    for (int i = 0; i < errors.count(); ++i)
+        warning(errors.at(i).errorString());
+
+    // if configured, ignore the errors, otherwise the socket is aborted
+    // and the allocation fails
+    if (m_ignoreSslErrors)
+        m_tcpSocket->ignoreSslErrors();
+}
+
+void QXmppTurnAllocation::handleDatagram(QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
 {
     // demultiplex channel data
     if (buffer.size() >= 4 && (buffer[0] & 0xc0) == 0x40) {
-        QDataStream stream(buffer);
-        quint16 channel, length;
-        stream >> channel;
-        stream >> length;
+        const uchar *header = reinterpret_cast<const uchar*>(buffer.constData());
+        const quint16 channel = qFromBigEndian<quint16>(header);
+        const quint16 length = qFromBigEndian<quint16>(header + 2);
         if (m_state == ConnectedState && m_channels.contains(channel) && length <= buffer.size() - 4) {
-            emit datagramReceived(buffer.mid(4, length), m_channels[channel].first,
-                m_channels[channel].second);
+            // strip the header in place, the receive buffer is reused
+            const Address address = m_channels.value(channel);
+            buffer.remove(0, 4);
+            buffer.truncate(length);
+            emit datagramReceived(buffer, address.first, address.second);
         }
         return;
     }
@@ -1350,7 +1654,7 @@ void QXmppTurnAllocation::refresh()
     request.setNonce(m_nonce);
     request.setRealm(m_realm);
     request.setUsername(m_username);
-    m_transactions << new QXmppStunTransaction(request, this);
+    startTransaction(request);
 }
 
 /// Refresh channel bindings.
@@ -1367,7 +1671,7 @@ void QXmppTurnAllocation::refreshChannels()
         request.setChannelNumber(channel);
         request.xorPeerHost = m_channels[channel].first;
         request.xorPeerPort = m_channels[channel].second;
-        m_transactions << new QXmppStunTransaction(request, this);
+        startTransaction(request);
     }
 }
 
@@ -1407,6 +1711,43 @@ void QXmppTurnAllocation::setServer(const QHostAddress &host, quint16 port)
     m_turnPort = port;
 }
 
+/// Returns the transport used to reach the TURN server.
+
+QXmppIceConnection::TurnTransport QXmppTurnAllocation::transport() const
+{
+    return m_transport;
+}
+
+/// Sets the host \a name of the TURN server, against which its certificate
+/// is verified when using TLS. If it is not set, the certificate is
+/// verified against the server's address.
+///
+/// \note This may only be called prior to calling connectToHost().
+
+void QXmppTurnAllocation::setServerName(const QString &name)
+{
+    m_turnName = name;
+}
+
+/// Sets whether SSL errors, such as an untrusted certificate, should be
+/// ignored when connecting to the TURN server using TLS.
+///
+/// \param ignore
+
+void QXmppTurnAllocation::setIgnoreSslErrors(bool ignore)
+{
+    m_ignoreSslErrors = ignore;
+}
+
+/// Sets the \a transport used to reach the TURN server.
+///
+/// \note This may only be called prior to calling connectToHost().
+
+void QXmppTurnAllocation::setTransport(QXmppIceConnection::TurnTransport transport)
+{
+    m_transport = transport;
+}
+
 /// Sets the \a user used for authentication with the TURN server.
 ///
 /// \param user
@@ -1433,6 +1774,8 @@ void QXmppTurnAllocation::setState(AllocationState state)
         emit connected();
     } else if (m_state == UnconnectedState) {
         m_timer->stop();
+        if (m_transport != QXmppIceConnection::UdpTurnTransport)
+            m_tcpSocket->disconnectFromHost();
         emit disconnected();
     }
 }
@@ -1463,7 +1806,7 @@ void QXmppTurnAllocation::transactionFinished()
         request.setNonce(m_nonce);
         request.setRealm(m_realm);
         request.setUsername(m_username);
-        m_transactions << new QXmppStunTransaction(request, this);
+        startTransaction(request);
         return;
     }
 
@@ -1550,29 +1893,40 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
         request.setChannelNumber(channel);
         request.xorPeerHost = host;
         request.xorPeerPort = port;
-        m_transactions << new QXmppStunTransaction(request, this);
+        startTransaction(request);
 
         // schedule refresh
         if (!m_channelTimer->isActive())
             m_channelTimer->start();
     }
 
-    // send data
-    QByteArray channelData;
-    channelData.reserve(4 + data.size());
-    QDataStream stream(&channelData, QIODevice::WriteOnly);
-    stream << channel;
-    stream << quint16(data.size());
-    stream.writeRawData(data.data(), data.size());
-    if (socket->writeDatagram(channelData, m_turnHost, m_turnPort) == channelData.size())
-        return data.size();
+    // send data as a ChannelData message, which is padded over streams
+    const int length = data.size();
+    const int padding = (m_transport == QXmppIceConnection::UdpTurnTransport) ? 0 : (-length & 3);
+    m_sendBuffer.resize(4 + length + padding);
+    uchar *ptr = reinterpret_cast<uchar*>(m_sendBuffer.data());
+    qToBigEndian(channel, ptr);
+    qToBigEndian(quint16(length), ptr + 2);
+    memcpy(ptr + 4, data.constData(), length);
+    memset(ptr + 4 + length, 0, padding);
+    if (writeToServer(m_sendBuffer.constData(), m_sendBuffer.size()) == m_sendBuffer.size())
+        return length;
     else
         return -1;
 }
 
+qint64 QXmppTurnAllocation::writeToServer(const char *data, qint64 size)
+{
+    if (m_transport == QXmppIceConnection::UdpTurnTransport)
+        return socket->writeDatagram(data, size, m_turnHost, m_turnPort);
+    else
+        return m_tcpSocket->write(data, size);
+}
+
 void QXmppTurnAllocation::writeStun(const QXmppStunMessage &message)
 {
-    socket->writeDatagram(message.encode(m_key), m_turnHost, m_turnPort);
+    const QByteArray data = message.encode(m_key);
+    writeToServer(data.constData(), data.size());
 #ifdef QXMPP_DEBUG_STUN
     logSent(QString("TURN packet to %1 port %2\n%3").arg(
             m_turnHost.toString(),
@@ -1601,19 +1955,19 @@ void QXmppUdpTransport::disconnectFromHost()
     m_socket->close();
 }
 
-QXmppJingleCandidate QXmppUdpTransport::localCandidate(int component) const
+static QXmppJingleCandidate hostCandidate(const QUdpSocket *socket, int component)
 {
     QXmppJingleCandidate candidate;
     candidate.setComponent(component);
     // remove scope ID from IPv6 non-link local addresses
-    QHostAddress addr(m_socket->localAddress());
+    QHostAddress addr(socket->localAddress());
     if (addr.protocol() == QAbstractSocket::IPv6Protocol &&
         !isIPv6LinkLocalAddress(addr)) {
         addr.setScopeId(QString());
     }
     candidate.setHost(addr);
     candidate.setId(QXmppUtils::generateStanzaHash(10));
-    candidate.setPort(m_socket->localPort());
+    candidate.setPort(socket->localPort());
     candidate.setProtocol("udp");
     candidate.setType(QXmppJingleCandidate::HostType);
     candidate.setPriority(candidatePriority(candidate));
@@ -1624,18 +1978,128 @@ QXmppJingleCandidate QXmppUdpTransport::localCandidate(int component) const
     return candidate;
 }
 
+QXmppJingleCandidate QXmppUdpTransport::localCandidate(int component) const
+{
+    return hostCandidate(m_socket, component);
+}
+
 void QXmppUdpTransport::readyRead()
 {
-    QByteArray buffer;
+    // The receive buffer is reused for every datagram, it is only
+    // reallocated if a receiver kept a reference to the previous one.
     QHostAddress remoteHost;
     quint16 remotePort;
     while (m_socket->hasPendingDatagrams()) {
         const qint64 size = m_socket->pendingDatagramSize();
-        buffer.resize(size);
-        m_socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
-        emit datagramReceived(buffer, remoteHost, remotePort);
+        if (size > UDP_DATAGRAM_SIZE) {
+            m_socket->readDatagram(0, 0);
+            warning("Discarding oversized UDP datagram");
+            continue;
+        }
+        m_buffer.resize(size);
+        m_socket->readDatagram(m_buffer.data(), m_buffer.size(), &remoteHost, &remotePort);
+        emit datagramReceived(m_buffer, remoteHost, remotePort);
+
+#ifdef QXMPP_USE_MMSG
+        // QUdpSocket re-enabled its read notifier, drain the rest in batches
+        if (readBatches())
+            return;
+#endif
+    }
+}
+
+#ifdef QXMPP_USE_MMSG
+static bool toSockAddr(const QHostAddress &host, quint16 port, sockaddr_storage *address, socklen_t *length)
+{
+    memset(address, 0, sizeof(*address));
+    if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+        sockaddr_in *sin = reinterpret_cast<sockaddr_in*>(address);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = htonl(host.toIPv4Address());
+        *length = sizeof(sockaddr_in);
+        return true;
+    } else if (host.protocol() == QAbstractSocket::IPv6Protocol && !isIPv6LinkLocalAddress(host)) {
+        const Q_IPV6ADDR addr = host.toIPv6Address();
+        sockaddr_in6 *sin6 = reinterpret_cast<sockaddr_in6*>(address);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        memcpy(&sin6->sin6_addr, &addr, sizeof(addr));
+        *length = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+/// Drains the socket using recvmmsg(), reading up to UDP_BATCH_SIZE
+/// datagrams per system call into pooled buffers.
+///
+/// Returns false if the datagrams need to be read by QUdpSocket instead.
+
+bool QXmppUdpTransport::readBatches()
+{
+    // link-local scope IDs are only handled by QUdpSocket
+    const int fd = int(m_socket->socketDescriptor());
+    if (fd < 0 || isIPv6LinkLocalAddress(m_socket->localAddress()))
+        return false;
+
+    if (m_batch.isEmpty()) {
+        for (int i = 0; i < UDP_BATCH_SIZE; ++i)
+            m_batch << QByteArray();
+    }
+
+    mmsghdr messages[UDP_BATCH_SIZE];
+    iovec vectors[UDP_BATCH_SIZE];
+    sockaddr_storage addresses[UDP_BATCH_SIZE];
+
+    forever {
+        for (int i = 0; i < UDP_BATCH_SIZE; ++i) {
+            // the buffer is only reallocated if a receiver kept a reference to it
+            m_batch[i].resize(UDP_DATAGRAM_SIZE);
+            vectors[i].iov_base = m_batch[i].data();
+            vectors[i].iov_len = UDP_DATAGRAM_SIZE;
+            memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int count = ::recvmmsg(fd, messages, UDP_BATCH_SIZE, MSG_DONTWAIT, 0);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            // a receiver may have closed the socket
+            if (m_socket->state() != QAbstractSocket::BoundState)
+                return true;
+
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                warning("Discarding oversized UDP datagram");
+                continue;
+            }
+
+            const sockaddr *address = reinterpret_cast<const sockaddr*>(&addresses[i]);
+            quint16 remotePort;
+            if (address->sa_family == AF_INET)
+                remotePort = ntohs(reinterpret_cast<const sockaddr_in*>(address)->sin_port);
+            else if (address->sa_family == AF_INET6)
+                remotePort = ntohs(reinterpret_cast<const sockaddr_in6*>(address)->sin6_port);
+            else
+                continue;
+
+            m_batch[i].resize(messages[i].msg_len);
+            emit datagramReceived(m_batch[i], QHostAddress(address), remotePort);
+        }
+
+        if (count < UDP_BATCH_SIZE)
+            return true;
     }
 }
+#endif
 
 qint64 QXmppUdpTransport::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
 {
@@ -1645,27 +2109,356 @@ qint64 QXmppUdpTransport::writeDatagram(const QByteArray &data, const QHostAddre
     return m_socket->writeDatagram(data, remoteHost, port);
 }
 
-class CandidatePair : public QXmppLoggable
-{
-public:
-    enum State {
-        FrozenState,
-        WaitingState,
-        InProgressState,
-        SucceededState,
-        FailedState
-    };
-    CandidatePair(int component, bool controlling, QObject *parent);
-    quint64 priority() const;
-    State state() const;
-    void setState(State state);
-    QString toString() const;
+/// Sends several datagrams to the same destination, using sendmmsg() to
+/// send up to UDP_BATCH_SIZE datagrams per system call where available.
+
+int QXmppUdpTransport::writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port)
+{
+#ifdef QXMPP_USE_MMSG
+    const int fd = int(m_socket->socketDescriptor());
+    sockaddr_storage address;
+    socklen_t addressLength;
+    if (fd >= 0 && toSockAddr(host, port, &address, &addressLength)) {
+        mmsghdr messages[UDP_BATCH_SIZE];
+        iovec vectors[UDP_BATCH_SIZE];
+
+        int sent = 0;
+        while (sent < datagrams.size()) {
+            const int count = qMin(datagrams.size() - sent, UDP_BATCH_SIZE);
+            for (int i = 0; i < count; ++i) {
+                const QByteArray &datagram = datagrams.at(sent + i);
+                vectors[i].iov_base = const_cast<char*>(datagram.constData());
+                vectors[i].iov_len = datagram.size();
+                memset(&messages[i], 0, sizeof(messages[i]));
+                messages[i].msg_hdr.msg_name = &address;
+                messages[i].msg_hdr.msg_namelen = addressLength;
+                messages[i].msg_hdr.msg_iov = &vectors[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
 
-    bool nominated;
-    bool nominating;
-    QXmppJingleCandidate remote;
-    QXmppJingleCandidate reflexive;
-    QXmppIceTransport *transport;
+            const int result = ::sendmmsg(fd, messages, count, 0);
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            sent += result;
+        }
+
+        // send the remaining datagrams through QUdpSocket, which reports errors
+        for (; sent < datagrams.size(); ++sent) {
+            if (writeDatagram(datagrams.at(sent), host, port) < 0)
+                break;
+        }
+        return sent;
+    }
+#endif
+    return QXmppIceTransport::writeDatagrams(datagrams, host, port);
+}
+
+// Returns true if the datagram looks like a STUN message.
+static bool isStunMessage(const QByteArray &buffer)
+{
+    const uchar *data = reinterpret_cast<const uchar*>(buffer.constData());
+    return buffer.size() >= STUN_HEADER && !(data[0] & 0xc0) &&
+        qFromBigEndian<quint32>(data + 4) == STUN_MAGIC;
+}
+
+// Returns the USERNAME attribute of a STUN message, without checking
+// its integrity.
+static QByteArray peekUsername(const QByteArray &buffer)
+{
+    if (!isStunMessage(buffer))
+        return QByteArray();
+
+    const uchar *data = reinterpret_cast<const uchar*>(buffer.constData());
+
+    const int size = qMin(buffer.size(), STUN_HEADER + int(qFromBigEndian<quint16>(data + 2)));
+    int pos = STUN_HEADER;
+    while (pos + 4 <= size) {
+        const quint16 type = qFromBigEndian<quint16>(data + pos);
+        const quint16 length = qFromBigEndian<quint16>(data + pos + 2);
+        pos += 4;
+        if (pos + length > size)
+            break;
+        if (type == 0x0006)
+            return QByteArray(buffer.constData() + pos, length);
+        pos += (length + 3) & ~3;
+    }
+    return QByteArray();
+}
+
+class QXmppIceMultiplexerPrivate
+{
+public:
+    typedef QPair<QHostAddress, quint16> Address;
+    typedef QPair<QUdpSocket*, Address> AddressKey;
+    typedef QPair<QUdpSocket*, QByteArray> UserKey;
+
+    bool hasUser(const QString &user) const;
+
+    QList<QUdpSocket*> sockets;
+    QByteArray buffer;
+
+    // routes by remote address, then by local username fragment
+    QHash<AddressKey, QXmppIceMultiplexedTransport*> transportsByAddress;
+    QHash<UserKey, QXmppIceMultiplexedTransport*> transportsByUser;
+
+    // remote addresses checked by each transport, whose responses are
+    // dispatched until one of them is authenticated
+    QMultiHash<AddressKey, QXmppIceMultiplexedTransport*> transportsByPendingAddress;
+};
+
+// Returns true if the local username fragment is already used to route
+// connectivity checks on the shared sockets.
+bool QXmppIceMultiplexerPrivate::hasUser(const QString &user) const
+{
+    const QByteArray key = user.toUtf8();
+    foreach (QUdpSocket *socket, sockets)
+        if (transportsByUser.contains(qMakePair(socket, key)))
+            return true;
+    return false;
+}
+
+/// Constructs a new multiplexer.
+///
+/// \param parent
+
+QXmppIceMultiplexer::QXmppIceMultiplexer(QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppIceMultiplexerPrivate)
+{
+}
+
+QXmppIceMultiplexer::~QXmppIceMultiplexer()
+{
+    close();
+    delete d;
+}
+
+/// Binds one UDP socket on each of the given \a addresses, using the same
+/// \a port.
+///
+/// If \a port is 0, the port chosen for the first address is used for the
+/// other addresses.
+///
+/// \param addresses
+/// \param port
+
+bool QXmppIceMultiplexer::bind(const QList<QHostAddress> &addresses, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    close();
+    foreach (const QHostAddress &address, addresses) {
+        QUdpSocket *socket = new QUdpSocket(this);
+        if (!socket->bind(address, port)) {
+            warning(QString("Could not bind shared socket on %1 port %2").arg(
+                address.toString(), QString::number(port)));
+            delete socket;
+            close();
+            return false;
+        }
+        check = connect(socket, SIGNAL(readyRead()),
+                        this, SLOT(readyRead()));
+        Q_ASSERT(check);
+        d->sockets << socket;
+
+        // use the same port on all addresses
+        if (!port)
+            port = socket->localPort();
+    }
+    return true;
+}
+
+/// Closes the shared sockets.
+
+void QXmppIceMultiplexer::close()
+{
+    foreach (QUdpSocket *socket, d->sockets)
+        delete socket;
+    d->sockets.clear();
+    d->transportsByAddress.clear();
+    d->transportsByUser.clear();
+    d->transportsByPendingAddress.clear();
+}
+
+void QXmppIceMultiplexer::readyRead()
+{
+    QUdpSocket *socket = qobject_cast<QUdpSocket*>(sender());
+    if (!socket)
+        return;
+
+    QHostAddress remoteHost;
+    quint16 remotePort;
+    while (socket->hasPendingDatagrams()) {
+        const qint64 size = socket->pendingDatagramSize();
+        d->buffer.resize(size);
+        socket->readDatagram(d->buffer.data(), d->buffer.size(), &remoteHost, &remotePort);
+
+        const QXmppIceMultiplexerPrivate::AddressKey addressKey(socket, qMakePair(remoteHost, remotePort));
+        QXmppIceMultiplexedTransport *transport = d->transportsByAddress.value(addressKey);
+        if (transport) {
+            emit transport->datagramReceived(d->buffer, remoteHost, remotePort);
+            continue;
+        }
+
+        // the address is not routed yet, only STUN messages are dispatched
+        if (!isStunMessage(d->buffer))
+            continue;
+
+        // a connectivity check from a new address, the USERNAME is
+        // of the form "local:remote", see RFC 8445 - 7.2.2.
+        const QByteArray username = peekUsername(d->buffer);
+        const int colon = username.indexOf(':');
+        if (colon >= 0) {
+            transport = d->transportsByUser.value(qMakePair(socket, username.left(colon)));
+            if (transport)
+                emit transport->datagramReceived(d->buffer, remoteHost, remotePort);
+            continue;
+        }
+
+        // a response carries no username, let each transport which sent
+        // checks to this address authenticate it
+        foreach (transport, d->transportsByPendingAddress.values(addressKey))
+            emit transport->datagramReceived(d->buffer, remoteHost, remotePort);
+    }
+}
+
+QXmppIceMultiplexedTransport::QXmppIceMultiplexedTransport(QXmppIceMultiplexer *multiplexer, QUdpSocket *socket, const QString &user, QObject *parent)
+    : QXmppIceTransport(parent)
+    , m_multiplexer(multiplexer)
+    , m_socket(socket)
+{
+    setUser(user);
+}
+
+QXmppIceMultiplexedTransport::~QXmppIceMultiplexedTransport()
+{
+    disconnectFromHost();
+}
+
+/// Routes the datagrams received from the given address to this transport.
+///
+/// This must only be called once a connectivity check with this address
+/// was authenticated. An address which is already routed to another
+/// transport is left untouched.
+
+void QXmppIceMultiplexedTransport::addAddress(const QHostAddress &host, quint16 port)
+{
+    if (!m_multiplexer || !m_socket)
+        return;
+
+    const QXmppIceMultiplexerPrivate::Address address(host, port);
+    const QXmppIceMultiplexerPrivate::AddressKey key(m_socket, address);
+    QXmppIceMultiplexedTransport *previous = m_multiplexer->d->transportsByAddress.value(key);
+    if (previous == this)
+        return;
+    if (previous) {
+        warning(QString("Address %1 port %2 is already routed to another transport").arg(
+            host.toString(), QString::number(port)));
+        return;
+    }
+    m_multiplexer->d->transportsByAddress.insert(key, this);
+    m_multiplexer->d->transportsByPendingAddress.remove(key);
+    m_pendingAddresses.removeAll(address);
+    m_addresses << address;
+}
+
+/// Stops routing datagrams to this transport.
+
+void QXmppIceMultiplexedTransport::disconnectFromHost()
+{
+    if (m_multiplexer && m_socket) {
+        foreach (const QXmppIceMultiplexerPrivate::Address &address, m_addresses)
+            m_multiplexer->d->transportsByAddress.remove(qMakePair(m_socket.data(), address));
+        foreach (const QXmppIceMultiplexerPrivate::Address &address, m_pendingAddresses)
+            m_multiplexer->d->transportsByPendingAddress.remove(qMakePair(m_socket.data(), address), this);
+        if (!m_user.isEmpty())
+            m_multiplexer->d->transportsByUser.remove(qMakePair(m_socket.data(), m_user));
+    }
+    m_addresses.clear();
+    m_pendingAddresses.clear();
+    m_user.clear();
+}
+
+QXmppJingleCandidate QXmppIceMultiplexedTransport::localCandidate(int component) const
+{
+    if (!m_socket)
+        return QXmppJingleCandidate();
+    return hostCandidate(m_socket, component);
+}
+
+/// Sets the local username fragment used to route connectivity checks
+/// to this transport.
+///
+/// Returns false if the username fragment is already used by another
+/// transport on the same socket.
+///
+/// \param user
+
+bool QXmppIceMultiplexedTransport::setUser(const QString &user)
+{
+    if (!m_multiplexer || !m_socket)
+        return false;
+
+    const QXmppIceMultiplexerPrivate::UserKey key(m_socket.data(), user.toUtf8());
+    QXmppIceMultiplexedTransport *previous = m_multiplexer->d->transportsByUser.value(key);
+    if (previous && previous != this) {
+        warning(QString("Username fragment %1 is already in use").arg(user));
+        return false;
+    }
+
+    if (!m_user.isEmpty())
+        m_multiplexer->d->transportsByUser.remove(qMakePair(m_socket.data(), m_user));
+    m_user = key.second;
+    m_multiplexer->d->transportsByUser.insert(key, this);
+    return true;
+}
+
+qint64 QXmppIceMultiplexedTransport::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    if (!m_socket)
+        return -1;
+
+    // responses from the remote party carry no username, dispatch them
+    // here until one is authenticated
+    if (m_multiplexer) {
+        const QXmppIceMultiplexerPrivate::Address address(host, port);
+        const QXmppIceMultiplexerPrivate::AddressKey key(m_socket, address);
+        if (!m_multiplexer->d->transportsByAddress.contains(key) &&
+            !m_pendingAddresses.contains(address)) {
+            m_multiplexer->d->transportsByPendingAddress.insert(key, this);
+            m_pendingAddresses << address;
+        }
+    }
+    return m_socket->writeDatagram(data, host, port);
+}
+
+class CandidatePair : public QXmppLoggable
+{
+public:
+    enum State {
+        FrozenState,
+        WaitingState,
+        InProgressState,
+        SucceededState,
+        FailedState
+    };
+    CandidatePair(int component, bool controlling, QObject *parent);
+    ~CandidatePair();
+    QString foundation() const;
+    quint64 priority() const;
+    State state() const;
+    void setState(State state);
+    QString toString() const;
+
+    bool nominated;
+    bool nominating;
+    QXmppJingleCandidate remote;
+    QXmppJingleCandidate reflexive;
+    QXmppIceTransport *transport;
     QXmppStunTransaction *transaction;
 
 private:
@@ -1687,8 +2480,20 @@ CandidatePair::CandidatePair(int component, bool controlling, QObject *parent)
     , transaction(0)
     , m_component(component)
     , m_controlling(controlling)
-    , m_state(WaitingState)
+    , m_state(FrozenState)
+{
+}
+
+CandidatePair::~CandidatePair()
 {
+    // the transaction may be emitting a signal
+    if (transaction)
+        transaction->deleteLater();
+}
+
+QString CandidatePair::foundation() const
+{
+    return transport->localCandidate(m_component).foundation() + QLatin1Char(':') + remote.foundation();
 }
 
 quint64 CandidatePair::priority() const
@@ -1729,44 +2534,97 @@ class QXmppIcePrivate
 {
 public:
     QXmppIcePrivate();
+    QMessageAuthenticationCode *integrityCode(quint16 messageType, bool outgoing) const;
 
+    bool aggressiveNomination;
+    int checkInterval;
+    int consentInterval;
+    int consentTimeout;
     bool iceControlling;
     QString localUser;
     QString localPassword;
     QString remoteUser;
     QString remotePassword;
+
+    // message integrity codes keyed with the passwords, which are
+    // set up once per credential and reset for each message
+    mutable QMessageAuthenticationCode localMac;
+    mutable QMessageAuthenticationCode remoteMac;
     QHostAddress stunHost;
     quint16 stunPort;
     QByteArray tieBreaker;
 };
 
 QXmppIcePrivate::QXmppIcePrivate()
-    : iceControlling(false)
+    : aggressiveNomination(true)
+    , checkInterval(ICE_CHECK_INTERVAL)
+    , consentInterval(ICE_CONSENT_INTERVAL)
+    , consentTimeout(ICE_CONSENT_TIMEOUT)
+    , iceControlling(false)
+    , localMac(QCryptographicHash::Sha1)
+    , remoteMac(QCryptographicHash::Sha1)
     , stunPort(0)
 {
     localUser = QXmppUtils::generateStanzaHash(4);
     localPassword = QXmppUtils::generateStanzaHash(22);
+    localMac.setKey(localPassword.toUtf8());
     tieBreaker = QXmppUtils::generateRandomBytes(8);
 }
 
+/// Returns the code protecting a connectivity check message, which is keyed
+/// with the password of the agent answering the check, or 0 if that password
+/// is not known yet.
+///
+/// \param messageType
+/// \param outgoing
+
+QMessageAuthenticationCode *QXmppIcePrivate::integrityCode(quint16 messageType, bool outgoing) const
+{
+    const bool isResponse = (messageType & 0xFF00) != 0;
+    if (isResponse == outgoing)
+        return localPassword.isEmpty() ? 0 : &localMac;
+    else
+        return remotePassword.isEmpty() ? 0 : &remoteMac;
+}
+
 class QXmppIceComponentPrivate
 {
 public:
     QXmppIceComponentPrivate(int component, QXmppIcePrivate *config, QXmppIceComponent *qq);
+    typedef QPair<QHostAddress, quint16> Address;
+
+    void addPair(CandidatePair *pair);
     bool addRemoteCandidate(const QXmppJingleCandidate &candidate);
+    QXmppStunMessage bindingRequest(bool nominate) const;
+    void checkConsent();
+    void startConsent();
+    void stopConsent();
     CandidatePair* findPair(QXmppStunTransaction *transaction);
+    CandidatePair* findPair(QXmppIceTransport *transport, const QHostAddress &remoteHost, quint16 remotePort);
     void performCheck(CandidatePair *pair, bool nominate);
+    void restart();
+    void scheduleChecks();
+    void triggerCheck(CandidatePair *pair, bool nominate);
+    void unfreezePairs(const QString &foundation = QString());
     void setSockets(QList<QUdpSocket*> sockets);
+    void setTransports(const QList<QXmppIceTransport*> &newTransports);
     void setTurnServer(const QHostAddress &host, quint16 port);
+    void setTurnTransport(QXmppIceConnection::TurnTransport transport);
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
+    void setTurnServerName(const QString &name);
+    void setTurnIgnoreSslErrors(bool ignore);
     void writeStun(const QXmppStunMessage &message, QXmppIceTransport *transport, const QHostAddress &remoteHost, quint16 remotePort);
 
     CandidatePair *activePair;
+    bool checking;
     const int component;
     const QXmppIcePrivate* const config;
     CandidatePair *fallbackPair;
 
+    // during an ICE restart, the active pair is kept until a new pair is selected
+    bool restarting;
+
     QXmppIceConnection::GatheringState gatheringState;
 
     QList<QXmppJingleCandidate> localCandidates;
@@ -1775,30 +2633,50 @@ public:
     QList<QXmppJingleCandidate> remoteCandidates;
 
     QList<CandidatePair*> pairs;
+    QList<CandidatePair*> triggeredPairs;
     QList<QXmppIceTransport*> transports;
     QTimer *timer;
 
+    // indexes of the candidate pairs
+    QMultiHash<Address, CandidatePair*> pairsByAddress;
+    QHash<QXmppStunTransaction*, CandidatePair*> pairsByTransaction;
+    QHash<QByteArray, CandidatePair*> pairsByTransactionId;
+
     // STUN server
     QMap<QXmppStunTransaction*, QXmppIceTransport*> stunTransactions;
+    QHash<QByteArray, QXmppStunTransaction*> stunTransactionIds;
 
     // TURN server
     QXmppTurnAllocation *turnAllocation;
     bool turnConfigured;
 
+    // consent freshness, times are on the scheduler's clock
+    bool consentActive;
+    bool consentExpired;
+    qint64 consentTime;
+    QXmppStunTransaction *consentTransaction;
+    QByteArray consentTransactionId;
+
 private:
     QXmppIceComponent *q;
 };
 
 QXmppIceComponentPrivate::QXmppIceComponentPrivate(int component_, QXmppIcePrivate *config_, QXmppIceComponent *qq)
     : activePair(0)
+    , checking(false)
     , component(component_)
     , config(config_)
     , fallbackPair(0)
+    , restarting(false)
     , gatheringState(QXmppIceConnection::NewGatheringState)
     , peerReflexivePriority(0)
     , timer(0)
     , turnAllocation(0)
     , turnConfigured(false)
+    , consentActive(false)
+    , consentExpired(false)
+    , consentTime(0)
+    , consentTransaction(0)
     , q(qq)
 {
 }
@@ -1828,27 +2706,42 @@ bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &ca
         CandidatePair *pair = new CandidatePair(component, config->iceControlling, q);
         pair->remote = candidate;
         pair->transport = transport;
-        pairs << pair;
+        addPair(pair);
 
         if (!fallbackPair && local.type() == QXmppJingleCandidate::HostType)
             fallbackPair = pair;
     }
 
-    qSort(pairs.begin(), pairs.end(), candidatePairPtrLessThan);
+    unfreezePairs();
+    scheduleChecks();
 
     return true;
 }
 
+void QXmppIceComponentPrivate::addPair(CandidatePair *pair)
+{
+    pairs << pair;
+    qSort(pairs.begin(), pairs.end(), candidatePairPtrLessThan);
+    pairsByAddress.insert(Address(pair->remote.host(), pair->remote.port()), pair);
+}
+
 CandidatePair* QXmppIceComponentPrivate::findPair(QXmppStunTransaction *transaction)
 {
-    foreach (CandidatePair *pair, pairs) {
-        if (pair->transaction == transaction)
-            return pair;
+    return pairsByTransaction.value(transaction);
+}
+
+CandidatePair* QXmppIceComponentPrivate::findPair(QXmppIceTransport *transport, const QHostAddress &remoteHost, quint16 remotePort)
+{
+    QMultiHash<Address, CandidatePair*>::const_iterator it = pairsByAddress.constFind(Address(remoteHost, remotePort));
+    while (it != pairsByAddress.constEnd() && it.key().first == remoteHost && it.key().second == remotePort) {
+        if (it.value()->transport == transport)
+            return it.value();
+        ++it;
     }
     return 0;
 }
 
-void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
+QXmppStunMessage QXmppIceComponentPrivate::bindingRequest(bool nominate) const
 {
     QXmppStunMessage message;
     message.setId(QXmppUtils::generateRandomBytes(STUN_ID_SIZE));
@@ -1857,35 +2750,217 @@ void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
     message.setUsername(QString("%1:%2").arg(config->remoteUser, config->localUser));
     if (config->iceControlling) {
         message.iceControlling = config->tieBreaker;
-        message.useCandidate = true;
+        message.useCandidate = nominate;
     } else {
         message.iceControlled = config->tieBreaker;
     }
+    return message;
+}
+
+// Sends a consent freshness check on the selected pair, or flags consent
+// as lost if no check succeeded in time, see RFC 7675 - 5.1.
+void QXmppIceComponentPrivate::checkConsent()
+{
+    if (!activePair || consentExpired)
+        return;
+
+    QXmppIceConsentScheduler *scheduler = QXmppIceConsentScheduler::instance();
+    const qint64 now = scheduler->now();
+    if (now - consentTime >= config->consentTimeout) {
+        q->warning(QString("ICE consent expired %1").arg(activePair->toString()));
+        consentExpired = true;
+        if (consentTransaction) {
+            consentTransaction->deleteLater();
+            consentTransaction = 0;
+            consentTransactionId.clear();
+        }
+        emit q->consentLost();
+        return;
+    }
+
+    // the previous check may still be retransmitting
+    if (consentTransactionId.isEmpty()) {
+        const QXmppStunMessage message = bindingRequest(false);
+        if (consentTransaction)
+            consentTransaction->start(message);
+        else
+            consentTransaction = new QXmppStunTransaction(message, q);
+        consentTransactionId = message.id();
+    }
+
+    // randomize the interval to avoid synchronized checks
+    const int interval = config->consentInterval * (80 + QXmppUtils::generateRandomInteger(41)) / 100;
+    scheduler->schedule(q, now + interval);
+}
+
+void QXmppIceComponentPrivate::startConsent()
+{
+    QXmppIceConsentScheduler *scheduler = QXmppIceConsentScheduler::instance();
+    consentActive = true;
+    consentExpired = false;
+    consentTime = scheduler->now();
+    scheduler->schedule(q, consentTime + config->consentInterval);
+}
+
+void QXmppIceComponentPrivate::stopConsent()
+{
+    if (consentActive) {
+        QXmppIceConsentScheduler::instance()->unschedule(q);
+        consentActive = false;
+    }
+    if (consentTransaction) {
+        consentTransaction->deleteLater();
+        consentTransaction = 0;
+        consentTransactionId.clear();
+    }
+}
+
+void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
+{
+    const QXmppStunMessage message = bindingRequest(nominate);
     pair->nominating = nominate;
     pair->setState(CandidatePair::InProgressState);
-    pair->transaction = new QXmppStunTransaction(message, q);
+
+    // each pair reuses its transaction for successive checks
+    if (pair->transaction) {
+        pairsByTransactionId.remove(pair->transaction->request().id());
+        pair->transaction->start(message);
+    } else {
+        pair->transaction = new QXmppStunTransaction(message, q);
+        pairsByTransaction.insert(pair->transaction, pair);
+    }
+    pairsByTransactionId.insert(message.id(), pair);
+}
+
+// Discards the candidate pairs and remote candidates to start over with new
+// credentials, see RFC 8445 - 9. ICE Restarts.
+//
+// The selected pair keeps carrying data until a new pair is selected.
+void QXmppIceComponentPrivate::restart()
+{
+    stopConsent();
+    timer->stop();
+
+    // shared sockets route checks using the new username fragment
+    foreach (QXmppIceTransport *transport, transports) {
+        QXmppIceMultiplexedTransport *shared = qobject_cast<QXmppIceMultiplexedTransport*>(transport);
+        if (shared)
+            shared->setUser(config->localUser);
+    }
+
+    foreach (CandidatePair *pair, pairs) {
+        if (pair != activePair) {
+            delete pair;
+        } else if (pair->transaction) {
+            pair->transaction->deleteLater();
+            pair->transaction = 0;
+        }
+    }
+    pairs.clear();
+    triggeredPairs.clear();
+    pairsByAddress.clear();
+    pairsByTransaction.clear();
+    pairsByTransactionId.clear();
+    remoteCandidates.clear();
+    fallbackPair = 0;
+    restarting = (activePair != 0);
+}
+
+// Starts pacing connectivity checks, unless they were not started yet or
+// are already running.
+void QXmppIceComponentPrivate::scheduleChecks()
+{
+    if (!checking || config->remoteUser.isEmpty() || timer->isActive())
+        return;
+    timer->setInterval(config->checkInterval);
+    timer->start();
+}
+
+// Queues a triggered check, which is performed before ordinary checks,
+// see RFC 8445 - 7.3.1.4. Triggered Checks.
+void QXmppIceComponentPrivate::triggerCheck(CandidatePair *pair, bool nominate)
+{
+    pair->nominating = nominate;
+    if (pair->state() != CandidatePair::WaitingState)
+        pair->setState(CandidatePair::WaitingState);
+    if (!triggeredPairs.contains(pair))
+        triggeredPairs << pair;
+    if (!config->remoteUser.isEmpty() && !timer->isActive()) {
+        timer->setInterval(config->checkInterval);
+        timer->start();
+    }
+}
+
+// Moves frozen pairs to the waiting state, see RFC 8445 - 6.1.2.6.
+//
+// If a foundation is given, all the frozen pairs with this foundation are
+// unfrozen. Otherwise, for each foundation which has no pair being checked,
+// the frozen pair with the highest priority is unfrozen.
+void QXmppIceComponentPrivate::unfreezePairs(const QString &foundation)
+{
+    QSet<QString> foundations;
+    if (foundation.isEmpty()) {
+        foreach (CandidatePair *pair, pairs) {
+            if (pair->state() != CandidatePair::FrozenState &&
+                pair->state() != CandidatePair::FailedState)
+                foundations << pair->foundation();
+        }
+    }
+
+    // pairs are sorted by decreasing priority
+    foreach (CandidatePair *pair, pairs) {
+        if (pair->state() != CandidatePair::FrozenState)
+            continue;
+
+        const QString pairFoundation = pair->foundation();
+        if (foundation.isEmpty()) {
+            if (!foundations.contains(pairFoundation)) {
+                pair->setState(CandidatePair::WaitingState);
+                foundations << pairFoundation;
+            }
+        } else if (pairFoundation == foundation) {
+            pair->setState(CandidatePair::WaitingState);
+        }
+    }
 }
 
 void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket*> sockets)
+{
+    QList<QXmppIceTransport*> udpTransports;
+    foreach (QUdpSocket *socket, sockets) {
+        socket->setParent(q);
+        udpTransports << new QXmppUdpTransport(socket, q);
+    }
+    setTransports(udpTransports);
+}
+
+void QXmppIceComponentPrivate::setTransports(const QList<QXmppIceTransport*> &newTransports)
 {
     bool check;
     Q_UNUSED(check);
 
     // clear previous candidates and sockets
     localCandidates.clear();
+    stopConsent();
+    if (activePair && !pairs.contains(activePair))
+        delete activePair;
+    activePair = 0;
+    fallbackPair = 0;
+    restarting = false;
     foreach (CandidatePair *pair, pairs)
         delete pair;
     pairs.clear();
+    triggeredPairs.clear();
+    pairsByAddress.clear();
+    pairsByTransaction.clear();
+    pairsByTransactionId.clear();
     foreach (QXmppIceTransport *transport, transports)
         if (transport != turnAllocation)
             delete transport;
     transports.clear();
 
     // store candidates
-    foreach (QUdpSocket *socket, sockets) {
-        socket->setParent(q);
-
-        QXmppUdpTransport *transport = new QXmppUdpTransport(socket, q);
+    foreach (QXmppIceTransport *transport, newTransports) {
         check = QObject::connect(transport, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)),
                                  q, SLOT(handleDatagram(QByteArray,QHostAddress,quint16)));
         Q_ASSERT(check);
@@ -1899,10 +2974,15 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket*> sockets)
     // start STUN checks
     if (!config->stunHost.isNull() && config->stunPort) {
         stunTransactions.clear();
+        stunTransactionIds.clear();
 
         QXmppStunMessage request;
         request.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
         foreach (QXmppIceTransport *transport, transports) {
+            // shared sockets cannot route the answers of the STUN server
+            if (qobject_cast<QXmppIceMultiplexedTransport*>(transport))
+                continue;
+
             const QXmppJingleCandidate local = transport->localCandidate(component);
             if (!isCompatibleAddress(local.host(), config->stunHost))
                 continue;
@@ -1910,6 +2990,7 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket*> sockets)
             request.setId(QXmppUtils::generateRandomBytes(STUN_ID_SIZE));
             QXmppStunTransaction *transaction = new QXmppStunTransaction(request, q);
             stunTransactions.insert(transaction, transport);
+            stunTransactionIds.insert(request.id(), transaction);
         }
     }
 
@@ -1928,6 +3009,11 @@ void QXmppIceComponentPrivate::setTurnServer(const QHostAddress &host, quint16 p
     turnConfigured = !host.isNull() && port;
 }
 
+void QXmppIceComponentPrivate::setTurnTransport(QXmppIceConnection::TurnTransport transport)
+{
+    turnAllocation->setTransport(transport);
+}
+
 void QXmppIceComponentPrivate::setTurnUser(const QString &user)
 {
     turnAllocation->setUser(user);
@@ -1938,11 +3024,30 @@ void QXmppIceComponentPrivate::setTurnPassword(const QString &password)
     turnAllocation->setPassword(password);
 }
 
+void QXmppIceComponentPrivate::setTurnServerName(const QString &name)
+{
+    turnAllocation->setServerName(name);
+}
+
+void QXmppIceComponentPrivate::setTurnIgnoreSslErrors(bool ignore)
+{
+    turnAllocation->setIgnoreSslErrors(ignore);
+}
+
 void QXmppIceComponentPrivate::writeStun(const QXmppStunMessage &message, QXmppIceTransport *transport, const QHostAddress &address, quint16 port)
 {
-    const QString messagePassword = (message.type() & 0xFF00) ? config->localPassword : config->remotePassword;
-    const QByteArray data = message.encode(messagePassword.toUtf8());
-    transport->writeDatagram(data, address, port);
+    QMessageAuthenticationCode *mac = config->integrityCode(message.type(), true);
+
+    // encode on the stack, the transports copy the data they send
+    char data[STUN_BUFFER_SIZE];
+    const int length = message.encode(data, sizeof(data), mac);
+    if (length <= int(sizeof(data))) {
+        transport->writeDatagram(QByteArray::fromRawData(data, length), address, port);
+    } else {
+        QByteArray buffer(length, Qt::Uninitialized);
+        message.encode(buffer.data(), buffer.size(), mac);
+        transport->writeDatagram(buffer, address, port);
+    }
 #ifdef QXMPP_DEBUG_STUN
     q->logSent(QString("STUN packet to %1 port %2\n%3").arg(
                address.toString(),
@@ -1964,7 +3069,7 @@ QXmppIceComponent::QXmppIceComponent(int component, QXmppIcePrivate *config, QOb
     d = new QXmppIceComponentPrivate(component, config, this);
 
     d->timer = new QTimer(this);
-    d->timer->setInterval(500);
+    d->timer->setInterval(config->checkInterval);
     check = connect(d->timer, SIGNAL(timeout()),
                     this, SLOT(checkCandidates()));
     Q_ASSERT(check);
@@ -1994,6 +3099,9 @@ QXmppIceComponent::QXmppIceComponent(int component, QXmppIcePrivate *config, QOb
 
 QXmppIceComponent::~QXmppIceComponent()
 {
+    d->stopConsent();
+    if (d->activePair && !d->pairs.contains(d->activePair))
+        delete d->activePair;
     foreach (CandidatePair *pair, d->pairs)
         delete pair;
     delete d;
@@ -2009,16 +3117,77 @@ int QXmppIceComponent::component() const
 
 void QXmppIceComponent::checkCandidates()
 {
-    if (d->config->remoteUser.isEmpty())
+    if (d->config->remoteUser.isEmpty()) {
+        d->timer->stop();
         return;
-    debug("Checking remote candidates");
+    }
+
+    const bool aggressive = d->config->iceControlling && d->config->aggressiveNomination;
 
-    foreach (CandidatePair *pair, d->pairs) {
+    // triggered checks take precedence
+    while (!d->triggeredPairs.isEmpty()) {
+        CandidatePair *pair = d->triggeredPairs.takeFirst();
         if (pair->state() == CandidatePair::WaitingState) {
-            d->performCheck(pair, d->config->iceControlling);
-            break;
+            d->performCheck(pair, pair->nominating || aggressive);
+            return;
+        }
+    }
+
+    // with regular nomination, the controlling agent nominates the best
+    // pair once all the pairs with a higher priority have failed
+    if (d->config->iceControlling && !d->config->aggressiveNomination) {
+        bool nominating = false;
+        foreach (CandidatePair *pair, d->pairs) {
+            if (pair->nominating || pair->nominated) {
+                nominating = true;
+                break;
+            }
+        }
+        if (!nominating) {
+            foreach (CandidatePair *pair, d->pairs) {
+                if (pair->state() == CandidatePair::FailedState)
+                    continue;
+                if (pair->state() == CandidatePair::SucceededState) {
+                    debug(QString("ICE nominating pair %1").arg(pair->toString()));
+                    d->performCheck(pair, true);
+                    return;
+                }
+                break;
+            }
         }
     }
+
+    // perform an ordinary check on the waiting pair with the highest
+    // priority, unfreezing a pair if none is waiting
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        foreach (CandidatePair *pair, d->pairs) {
+            if (pair->state() == CandidatePair::WaitingState) {
+                d->performCheck(pair, aggressive);
+                return;
+            }
+        }
+
+        QSet<QString> activeFoundations;
+        foreach (CandidatePair *pair, d->pairs) {
+            if (pair->state() == CandidatePair::InProgressState)
+                activeFoundations << pair->foundation();
+        }
+        bool unfrozen = false;
+        foreach (CandidatePair *pair, d->pairs) {
+            if (pair->state() == CandidatePair::FrozenState &&
+                !activeFoundations.contains(pair->foundation())) {
+                pair->setState(CandidatePair::WaitingState);
+                unfrozen = true;
+                break;
+            }
+        }
+        if (!unfrozen)
+            break;
+    }
+
+    // nothing left to check, the timer is restarted when a check finishes
+    // or new pairs are added
+    d->timer->stop();
 }
 
 /// Stops ICE connectivity checks and closes the underlying sockets.
@@ -2028,19 +3197,26 @@ void QXmppIceComponent::close()
     foreach (QXmppIceTransport *transport, d->transports)
         transport->disconnectFromHost();
     d->turnAllocation->disconnectFromHost();
+    d->checking = false;
     d->timer->stop();
+    d->stopConsent();
+    if (d->activePair && !d->pairs.contains(d->activePair))
+        delete d->activePair;
     d->activePair = 0;
+    d->restarting = false;
 }
 
 /// Starts ICE connectivity checks.
 
 void QXmppIceComponent::connectToHost()
 {
-    if (d->activePair)
+    if (d->activePair && !d->restarting)
         return;
 
-    checkCandidates();
+    d->checking = true;
+    d->timer->setInterval(d->config->checkInterval);
     d->timer->start();
+    checkCandidates();
 }
 
 /// Returns true if ICE negotiation completed, false otherwise.
@@ -2064,45 +3240,52 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         return;
 
     // if this is not a STUN message, emit it
+    //
+    // STUN messages start with two zero bits, whereas RTP and RTCP
+    // packets start with the version number 2, see RFC 5764 - 5.1.2.
     quint32 messageCookie;
     QByteArray messageId;
-    quint16 messageType = QXmppStunMessage::peekType(buffer, messageCookie, messageId);
+    quint16 messageType = 0;
+    if (!buffer.isEmpty() && !(buffer.at(0) & 0xC0))
+        messageType = QXmppStunMessage::peekType(buffer, messageCookie, messageId);
     if (!messageType || messageCookie != STUN_MAGIC)
     {
-        // use this as an opportunity to flag a potential pair
-        foreach (CandidatePair *pair, d->pairs) {
-            if (pair->remote.host() == remoteHost &&
-                pair->remote.port() == remotePort) {
-                d->fallbackPair = pair;
-                break;
+        // once a pair is selected, media is sent to it directly
+        if (!d->activePair) {
+            // use this as an opportunity to flag a potential pair,
+            // preferring the one with the highest priority
+            QMultiHash<QXmppIceComponentPrivate::Address, CandidatePair*>::const_iterator it;
+            it = d->pairsByAddress.constFind(QXmppIceComponentPrivate::Address(remoteHost, remotePort));
+            CandidatePair *bestPair = 0;
+            while (it != d->pairsByAddress.constEnd() && it.key().first == remoteHost && it.key().second == remotePort) {
+                if (!bestPair || it.value()->priority() > bestPair->priority())
+                    bestPair = it.value();
+                ++it;
             }
+            if (bestPair)
+                d->fallbackPair = bestPair;
         }
         emit datagramReceived(buffer);
         return;
     }
 
     // check if it's STUN
-    QXmppStunTransaction *stunTransaction = 0;
-    foreach (QXmppStunTransaction *t, d->stunTransactions.keys()) {
-        if (t->request().id() == messageId &&
-            d->stunTransactions.value(t) == transport) {
-            stunTransaction = t;
-            break;
-        }
-    }
+    QXmppStunTransaction *stunTransaction = d->stunTransactionIds.value(messageId);
+    if (stunTransaction && d->stunTransactions.value(stunTransaction) != transport)
+        stunTransaction = 0;
 
-    // determine password to use
-    QString messagePassword;
+    // determine key to use
+    QMessageAuthenticationCode *mac = 0;
     if (!stunTransaction) {
-        messagePassword = (messageType & 0xFF00) ? d->config->remotePassword : d->config->localPassword;
-        if (messagePassword.isEmpty())
+        mac = d->config->integrityCode(messageType, false);
+        if (!mac)
             return;
     }
 
     // parse STUN message
     QXmppStunMessage message;
     QStringList errors;
-    if (!message.decode(buffer, messagePassword.toUtf8(), &errors)) {
+    if (!message.decode(buffer, mac, &errors)) {
         foreach (const QString &error, errors)
             warning(error);
         return;
@@ -2170,30 +3353,21 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         }
 
         // construct pair
-        foreach (CandidatePair *ptr, d->pairs) {
-            if (ptr->transport == transport
-             && ptr->remote.host() == remoteHost
-             && ptr->remote.port() == remotePort) {
-                pair = ptr;
-                break;
-            }
-        }
+        pair = d->findPair(transport, remoteHost, remotePort);
         if (!pair) {
             pair = new CandidatePair(d->component, d->config->iceControlling, this);
             pair->remote = remoteCandidate;
             pair->transport = transport;
-            d->pairs << pair;
-
-            qSort(d->pairs.begin(), d->pairs.end(), candidatePairPtrLessThan);
+            d->addPair(pair);
         }
 
         switch (pair->state()) {
         case CandidatePair::FrozenState:
         case CandidatePair::WaitingState:
         case CandidatePair::FailedState:
-            // send a triggered connectivity test
-            if (!d->config->remoteUser.isEmpty())
-                d->performCheck(pair, pair->nominating || d->config->iceControlling || message.useCandidate);
+            // queue a triggered connectivity check
+            d->triggerCheck(pair, pair->nominating || message.useCandidate ||
+                            (d->config->iceControlling && d->config->aggressiveNomination));
             break;
         case CandidatePair::InProgressState:
             // FIXME: force retransmit now
@@ -2208,14 +3382,25 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
     } else if (message.messageClass() == QXmppStunMessage::Response
             || message.messageClass() == QXmppStunMessage::Error) {
 
-        // find the pair for this transaction
-        foreach (CandidatePair *ptr, d->pairs) {
-            if (ptr->transaction && ptr->transaction->request().id() == message.id()) {
-                pair = ptr;
-                break;
+        // consent freshness checks
+        if (d->consentTransaction && message.id() == d->consentTransactionId) {
+            // the response must come from the address the check was sent to,
+            // see RFC 7675
+            if (!d->activePair || transport != d->activePair->transport ||
+                remoteHost != d->activePair->remote.host() ||
+                remotePort != d->activePair->remote.port()) {
+                warning(QString("Ignoring consent response from unexpected %1 port %2").arg(
+                    remoteHost.toString(),
+                    QString::number(remotePort)));
+                return;
             }
+            d->consentTransaction->readStun(message);
+            return;
         }
-        if (!pair)
+
+        // find the pair for this transaction
+        pair = d->pairsByTransactionId.value(message.id());
+        if (!pair || !pair->transaction)
             return;
 
         // check remote host and port
@@ -2229,19 +3414,35 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
             return;
         }
 
+        // the response is authenticated, shared sockets can now route the
+        // remote address to this component
+        if (message.messageClass() == QXmppStunMessage::Response) {
+            QXmppIceMultiplexedTransport *shared = qobject_cast<QXmppIceMultiplexedTransport*>(transport);
+            if (shared)
+                shared->addAddress(remoteHost, remotePort);
+        }
+
         pair->transaction->readStun(message);
     }
 
     // signal completion
     if (pair && pair->nominated) {
         d->timer->stop();
-        if (!d->activePair || pair->priority() > d->activePair->priority()) {
+        if (!d->activePair || d->restarting || pair->priority() > d->activePair->priority()) {
             info(QString("ICE pair selected %1 (priority: %2)").arg(
                 pair->toString(), QString::number(pair->priority())));
-            const bool wasConnected = (d->activePair != 0);
+            const bool wasConnected = (d->activePair != 0) && !d->restarting;
+            if (d->restarting) {
+                // the previous pair is no longer referenced
+                if (!d->pairs.contains(d->activePair))
+                    delete d->activePair;
+                d->restarting = false;
+            }
             d->activePair = pair;
-            if (!wasConnected)
+            if (!wasConnected) {
+                d->startConsent();
                 emit connected();
+            }
         }
     }
 }
@@ -2249,7 +3450,16 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
 void QXmppIceComponent::transactionFinished()
 {
     QXmppStunTransaction *transaction = qobject_cast<QXmppStunTransaction*>(sender());
-    transaction->deleteLater();
+
+    // consent freshness checks, the transaction is reused for the next check
+    if (transaction == d->consentTransaction) {
+        if (transaction->response().messageClass() == QXmppStunMessage::Response)
+            d->consentTime = QXmppIceConsentScheduler::instance()->now();
+        else
+            debug(QString("ICE consent check failed (error %1)").arg(transaction->response().errorPhrase));
+        d->consentTransactionId.clear();
+        return;
+    }
 
     // ICE checks
     CandidatePair *pair = d->findPair(transaction);
@@ -2267,19 +3477,29 @@ void QXmppIceComponent::transactionFinished()
                 // outgoing media can flow
                 pair->nominated = true;
             }
+
+            // unfreeze the pairs sharing the same foundation
+            d->unfreezePairs(pair->foundation());
         } else {
             debug(QString("ICE forward check failed %1 (error %2)").arg(
                 pair->toString(),
                 transaction->response().errorPhrase));
             pair->setState(CandidatePair::FailedState);
+            pair->nominating = false;
         }
-        pair->transaction = 0;
+        // the pair keeps its transaction for its next check
+        d->pairsByTransactionId.remove(transaction->request().id());
+        d->scheduleChecks();
         return;
     }
 
     // STUN checks
     QXmppIceTransport *transport = d->stunTransactions.value(transaction);
     if (transport) {
+        transaction->deleteLater();
+        d->stunTransactions.remove(transaction);
+        d->stunTransactionIds.remove(transaction->request().id());
+
         const QXmppStunMessage response = transaction->response();
         if (response.messageClass() == QXmppStunMessage::Response) {
             // determine server-reflexive address
@@ -2293,6 +3513,7 @@ void QXmppIceComponent::transactionFinished()
                 reflexivePort = response.mappedPort;
             } else {
                 warning("STUN server did not provide a reflexive address");
+                updateGatheringState();
                 return;
             }
 
@@ -2300,8 +3521,10 @@ void QXmppIceComponent::transactionFinished()
             foreach (const QXmppJingleCandidate &candidate, d->localCandidates) {
                 if (candidate.host() == reflexiveHost &&
                     candidate.port() == reflexivePort &&
-                    candidate.type() == QXmppJingleCandidate::ServerReflexiveType)
+                    candidate.type() == QXmppJingleCandidate::ServerReflexiveType) {
+                    updateGatheringState();
                     return;
+                }
             }
 
             // add the new local candidate
@@ -2326,7 +3549,6 @@ void QXmppIceComponent::transactionFinished()
             debug(QString("STUN test failed (error %1)").arg(
                 transaction->response().errorPhrase));
         }
-        d->stunTransactions.remove(transaction);
         updateGatheringState();
         return;
     }
@@ -2362,9 +3584,7 @@ static QList<QUdpSocket*> reservePort(const QList<QHostAddress> &addresses, quin
     return sockets;
 }
 
-/// Returns the list of local network addresses.
-
-QList<QHostAddress> QXmppIceComponent::discoverAddresses()
+static QList<QHostAddress> lookupAddresses()
 {
     QList<QHostAddress> addresses;
     foreach (const QNetworkInterface &interface, QNetworkInterface::allInterfaces())
@@ -2398,6 +3618,20 @@ QList<QHostAddress> QXmppIceComponent::discoverAddresses()
     return addresses;
 }
 
+/// Returns the list of local network addresses.
+///
+/// The list is cached and refreshed when the network configuration
+/// changes where the platform reports such changes.
+
+QList<QHostAddress> QXmppIceComponent::discoverAddresses()
+{
+    return QXmppIceNetworkMonitor::instance()->addresses();
+}
+
+// Where the next port reservation starts, so that servers running many
+// sessions do not probe all the ports which are already in use.
+static QAtomicInt nextPort(ICE_PORT_MIN);
+
 /// Tries to bind \a count UDP sockets on each of the given \a addresses.
 ///
 /// The port numbers are chosen so that they are consecutive, starting at
@@ -2414,19 +3648,24 @@ QList<QUdpSocket*> QXmppIceComponent::reservePorts(const QList<QHostAddress> &ad
         return sockets;
 
     const int expectedSize = addresses.size() * count;
-    quint16 port = 49152;
+    int port = nextPort.load();
+    bool wrapped = false;
     while (sockets.size() != expectedSize) {
         // reserve first port (even number)
         if (port % 2)
             port++;
         QList<QUdpSocket*> socketChunk;
-        while (socketChunk.isEmpty() && port <= 65536 - count) {
+        while (socketChunk.isEmpty()) {
+            if (port > 65536 - count) {
+                if (wrapped)
+                    return sockets;
+                port = ICE_PORT_MIN;
+                wrapped = true;
+            }
             socketChunk = reservePort(addresses, port, parent);
             if (socketChunk.isEmpty())
                 port += 2;
         }
-        if (socketChunk.isEmpty())
-            return sockets;
 
         // reserve other ports
         sockets << socketChunk;
@@ -2444,21 +3683,41 @@ QList<QUdpSocket*> QXmppIceComponent::reservePorts(const QList<QHostAddress> &ad
             sockets.clear();
         }
     }
+    nextPort.store(port + 1 < 65536 ? port + 1 : ICE_PORT_MIN);
     return sockets;
 }
 
 /// Sends a data packet to the remote party.
 ///
+/// \note The remote party discards datagrams larger than 2048 bytes if
+/// it uses QXmpp.
+///
 /// \param datagram
 
 qint64 QXmppIceComponent::sendDatagram(const QByteArray &datagram)
 {
     CandidatePair *pair = d->activePair ? d->activePair : d->fallbackPair;
-    if (!pair)
+    if (!pair || d->consentExpired)
         return -1;
     return pair->transport->writeDatagram(datagram, pair->remote.host(), pair->remote.port());
 }
 
+/// Sends several data packets to the remote party, batching system calls
+/// where the platform allows it.
+///
+/// Returns the number of packets which were sent, or -1 if the component
+/// is not connected.
+///
+/// \param datagrams
+
+int QXmppIceComponent::sendDatagrams(const QList<QByteArray> &datagrams)
+{
+    CandidatePair *pair = d->activePair ? d->activePair : d->fallbackPair;
+    if (!pair || d->consentExpired)
+        return -1;
+    return pair->transport->writeDatagrams(datagrams, pair->remote.host(), pair->remote.port());
+}
+
 void QXmppIceComponent::updateGatheringState()
 {
     QXmppIceConnection::GatheringState newGatheringState;
@@ -2480,6 +3739,12 @@ void QXmppIceComponent::writeStun(const QXmppStunMessage &message)
 {
     QXmppStunTransaction *transaction = qobject_cast<QXmppStunTransaction*>(sender());
 
+    // consent freshness checks
+    if (transaction == d->consentTransaction && d->activePair) {
+        d->writeStun(message, d->activePair->transport, d->activePair->remote.host(), d->activePair->remote.port());
+        return;
+    }
+
     // ICE checks
     CandidatePair *pair = d->findPair(transaction);
     if (pair) {
@@ -2510,17 +3775,60 @@ public:
     QTimer *connectTimer;
 
     QXmppIceConnection::GatheringState gatheringState;
+    bool gatheringExpired;
+    QTimer *gatheringTimer;
 
     QHostAddress turnHost;
     quint16 turnPort;
+    QXmppIceConnection::TurnTransport turnTransport;
     QString turnUser;
     QString turnPassword;
+    QString turnServerName;
+    bool turnIgnoreSslErrors;
+
+    QPointer<QXmppIceMultiplexer> multiplexer;
+
+    // the connection is bound to all the local addresses, and gathers
+    // candidates again when they change
+    QList<QHostAddress> boundAddresses;
+    bool followsNetwork;
+    bool networkChanged;
+
+    QString generateLocalUser() const;
 };
 
+static bool sameAddresses(const QList<QHostAddress> &addresses1, const QList<QHostAddress> &addresses2)
+{
+    if (addresses1.size() != addresses2.size())
+        return false;
+    foreach (const QHostAddress &address, addresses1) {
+        if (!addresses2.contains(address))
+            return false;
+    }
+    return true;
+}
+
+// Generates a local username fragment, which must not be used by another
+// connection on the shared sockets, if any.
+QString QXmppIceConnectionPrivate::generateLocalUser() const
+{
+    QString user;
+    do {
+        user = QXmppUtils::generateStanzaHash(4);
+    } while (multiplexer && multiplexer->d->hasUser(user));
+    return user;
+}
+
 QXmppIceConnectionPrivate::QXmppIceConnectionPrivate()
     : connectTimer(NULL)
     , gatheringState(QXmppIceConnection::NewGatheringState)
+    , gatheringExpired(false)
+    , gatheringTimer(NULL)
     , turnPort(0)
+    , turnTransport(QXmppIceConnection::UdpTurnTransport)
+    , turnIgnoreSslErrors(false)
+    , followsNetwork(false)
+    , networkChanged(false)
 {
 }
 
@@ -2541,6 +3849,19 @@ QXmppIceConnection::QXmppIceConnection(QObject *parent)
     check = connect(d->connectTimer, SIGNAL(timeout()),
                     this, SLOT(slotTimeout()));
     Q_ASSERT(check);
+
+    // timer to limit gathering time, disabled by default
+    d->gatheringTimer = new QTimer(this);
+    d->gatheringTimer->setInterval(0);
+    d->gatheringTimer->setSingleShot(true);
+    check = connect(d->gatheringTimer, SIGNAL(timeout()),
+                    this, SLOT(slotGatheringTimeout()));
+    Q_ASSERT(check);
+
+    // watch for network changes
+    check = connect(QXmppIceNetworkMonitor::instance(), SIGNAL(addressesChanged()),
+                    this, SLOT(slotAddressesChanged()));
+    Q_ASSERT(check);
     Q_UNUSED(check);
 }
 
@@ -2575,8 +3896,11 @@ void QXmppIceConnection::addComponent(int component)
 
     QXmppIceComponent *socket = new QXmppIceComponent(component, d, this);
     socket->d->setTurnServer(d->turnHost, d->turnPort);
+    socket->d->setTurnTransport(d->turnTransport);
     socket->d->setTurnUser(d->turnUser);
     socket->d->setTurnPassword(d->turnPassword);
+    socket->d->setTurnServerName(d->turnServerName);
+    socket->d->setTurnIgnoreSslErrors(d->turnIgnoreSslErrors);
 
     check = connect(socket, SIGNAL(localCandidatesChanged()),
                     this, SIGNAL(localCandidatesChanged()));
@@ -2586,6 +3910,10 @@ void QXmppIceConnection::addComponent(int component)
                     this, SLOT(slotConnected()));
     Q_ASSERT(check);
 
+    check = connect(socket, SIGNAL(consentLost()),
+                    this, SIGNAL(consentLost()));
+    Q_ASSERT(check);
+
     check = connect(socket, SIGNAL(gatheringStateChanged()),
                     this, SLOT(slotGatheringStateChanged()));
     Q_ASSERT(check);
@@ -2593,6 +3921,25 @@ void QXmppIceConnection::addComponent(int component)
     d->components[component] = socket;
 }
 
+/// Removes a component from this ICE connection, for instance the RTCP
+/// component once the remote party agreed to multiplex RTCP with RTP.
+///
+/// \param component
+
+void QXmppIceConnection::removeComponent(int component)
+{
+    QXmppIceComponent *socket = d->components.take(component);
+    if (!socket)
+        return;
+
+    socket->disconnect(this);
+    socket->close();
+    socket->deleteLater();
+
+    // the removed component may have been the last one gathering
+    slotGatheringStateChanged();
+}
+
 /// Adds a candidate for one of the remote components.
 ///
 /// \param candidate
@@ -2614,6 +3961,9 @@ void QXmppIceConnection::addRemoteCandidate(const QXmppJingleCandidate &candidat
 
 bool QXmppIceConnection::bind(const QList<QHostAddress> &addresses)
 {
+    d->gatheringExpired = false;
+    d->gatheringTimer->stop();
+
     // reserve ports
     QList<QUdpSocket*> sockets = QXmppIceComponent::reservePorts(addresses, d->components.size());
     if (sockets.isEmpty() && !addresses.isEmpty())
@@ -2628,9 +3978,48 @@ bool QXmppIceConnection::bind(const QList<QHostAddress> &addresses)
         s += addresses.size();
     }
 
+    d->boundAddresses = addresses;
+    d->followsNetwork = sameAddresses(addresses, QXmppIceComponent::discoverAddresses());
+    d->networkChanged = false;
     return true;
 }
 
+/// Binds the single component of this ICE connection to the shared sockets
+/// of a \a multiplexer, instead of reserving its own ports.
+///
+/// Datagrams are dispatched to the connection using the username fragment
+/// of incoming connectivity checks, then the remote address. As the
+/// username fragment does not identify the component, RTP and RTCP must be
+/// multiplexed on a single component (RFC 5761).
+///
+/// \param multiplexer
+
+bool QXmppIceConnection::bind(QXmppIceMultiplexer *multiplexer)
+{
+    if (d->components.size() != 1) {
+        warning("Shared sockets require a single ICE component");
+        return false;
+    }
+
+    d->gatheringExpired = false;
+    d->gatheringTimer->stop();
+
+    // the username fragment routes checks to this connection
+    d->boundAddresses.clear();
+    d->followsNetwork = false;
+    d->networkChanged = false;
+    d->multiplexer = multiplexer;
+    if (multiplexer->d->hasUser(d->localUser))
+        d->localUser = d->generateLocalUser();
+
+    QXmppIceComponent *socket = d->components.first();
+    QList<QXmppIceTransport*> transports;
+    foreach (QUdpSocket *udpSocket, multiplexer->d->sockets)
+        transports << new QXmppIceMultiplexedTransport(multiplexer, udpSocket, d->localUser, socket);
+    socket->d->setTransports(transports);
+    return !transports.isEmpty();
+}
+
 /// Closes the ICE connection.
 
 void QXmppIceConnection::close()
@@ -2644,12 +4033,63 @@ void QXmppIceConnection::close()
 
 void QXmppIceConnection::connectToHost()
 {
-    if (isConnected() || d->connectTimer->isActive())
+    if (d->connectTimer->isActive())
         return;
 
+    bool connecting = false;
+    foreach (QXmppIceComponent *socket, d->components.values()) {
+        if (!socket->isConnected() || socket->d->restarting) {
+            socket->connectToHost();
+            connecting = true;
+        }
+    }
+    if (connecting)
+        d->connectTimer->start();
+}
+
+/// Restarts ICE, for instance after a network change or when consent
+/// was lost.
+///
+/// New local credentials are generated and the remote credentials and
+/// candidates are discarded, so the new ones need to be exchanged with
+/// the remote party before calling connectToHost() again. The local
+/// candidates are kept and, until a new candidate pair is selected, data
+/// keeps flowing on the previously selected pair.
+///
+/// If the local network addresses changed since bind(), as reported by
+/// networkChanged(), the local candidates are gathered again on the new
+/// addresses instead, and the previously selected pair is dropped.
+
+void QXmppIceConnection::restart()
+{
+    info(QString("ICE restarting"));
+    d->connectTimer->stop();
+
+    d->localUser = d->generateLocalUser();
+    d->localPassword = QXmppUtils::generateStanzaHash(22);
+    d->localMac.setKey(d->localPassword.toUtf8());
+    d->remoteUser.clear();
+    d->remotePassword.clear();
+
     foreach (QXmppIceComponent *socket, d->components.values())
-        socket->connectToHost();
-    d->connectTimer->start();
+        socket->d->restart();
+
+    if (d->networkChanged)
+        bind(QXmppIceComponent::discoverAddresses());
+}
+
+void QXmppIceConnection::slotAddressesChanged()
+{
+    if (!d->followsNetwork || d->networkChanged)
+        return;
+
+    const QList<QHostAddress> addresses = QXmppIceComponent::discoverAddresses();
+    if (sameAddresses(addresses, d->boundAddresses))
+        return;
+
+    info(QString("ICE local addresses changed"));
+    d->networkChanged = true;
+    emit networkChanged();
 }
 
 
@@ -2681,6 +4121,113 @@ void QXmppIceConnection::setIceControlling(bool controlling)
     d->iceControlling = controlling;
 }
 
+/// Returns true if aggressive nomination is used when the local party
+/// has the ICE controlling role.
+
+bool QXmppIceConnection::aggressiveNomination() const
+{
+    return d->aggressiveNomination;
+}
+
+/// Sets whether aggressive nomination is used when the local party has
+/// the ICE controlling role. The default is true.
+///
+/// With aggressive nomination, every connectivity check nominates its
+/// candidate pair, so the first pair which succeeds is selected. With
+/// regular nomination, a pair is only nominated once all the pairs with
+/// a higher priority have failed, at the cost of an extra round trip.
+///
+/// \param aggressive
+
+void QXmppIceConnection::setAggressiveNomination(bool aggressive)
+{
+    d->aggressiveNomination = aggressive;
+}
+
+/// Returns the interval in milliseconds between two ordinary connectivity
+/// checks (Ta).
+
+int QXmppIceConnection::checkInterval() const
+{
+    return d->checkInterval;
+}
+
+/// Sets the interval in milliseconds between two ordinary connectivity
+/// checks (Ta). The default is 50 milliseconds.
+///
+/// \note This may only be called prior to calling connectToHost().
+///
+/// \param interval
+
+void QXmppIceConnection::setCheckInterval(int interval)
+{
+    d->checkInterval = qMax(interval, 5);
+}
+
+/// Returns the average interval in milliseconds between two consent
+/// freshness checks once connected.
+
+int QXmppIceConnection::consentInterval() const
+{
+    return d->consentInterval;
+}
+
+/// Sets the average interval in milliseconds between two consent freshness
+/// checks once connected. The default is 5 seconds, each interval is
+/// randomized by +/- 20%.
+///
+/// The checks also keep NAT bindings alive, see RFC 7675.
+///
+/// \param interval
+
+void QXmppIceConnection::setConsentInterval(int interval)
+{
+    d->consentInterval = qMax(interval, 10);
+}
+
+/// Returns the time in milliseconds after which consent is lost if no
+/// consent freshness check succeeded.
+
+int QXmppIceConnection::consentTimeout() const
+{
+    return d->consentTimeout;
+}
+
+/// Sets the time in milliseconds after which consent is lost if no consent
+/// freshness check succeeded. The default is 30 seconds.
+///
+/// When consent is lost, the consentLost() signal is emitted and no more
+/// data packets are sent.
+///
+/// \param timeout
+
+void QXmppIceConnection::setConsentTimeout(int timeout)
+{
+    d->consentTimeout = timeout;
+}
+
+/// Returns the time in milliseconds after which gathering of local
+/// candidates is considered complete, or 0 if there is no such deadline.
+
+int QXmppIceConnection::gatheringTimeout() const
+{
+    return d->gatheringTimer->interval();
+}
+
+/// Sets the time in milliseconds after which gathering of local candidates
+/// is considered complete, even if STUN or TURN servers did not answer yet.
+/// The default is 0, meaning there is no deadline.
+///
+/// Candidates which are gathered after the deadline are still reported
+/// using the localCandidatesChanged() signal.
+///
+/// \param timeout
+
+void QXmppIceConnection::setGatheringTimeout(int timeout)
+{
+    d->gatheringTimer->setInterval(qMax(timeout, 0));
+}
+
 /// Returns the list of local HOST CANDIDATES candidates by iterating
 /// over the available network interfaces.
 
@@ -2713,6 +4260,10 @@ QString QXmppIceConnection::localPassword() const
 void QXmppIceConnection::setRemoteUser(const QString &user)
 {
     d->remoteUser = user;
+
+    // checks may be waiting for the remote credentials
+    foreach (QXmppIceComponent *socket, d->components.values())
+        socket->d->scheduleChecks();
 }
 
 /// Sets the remote password.
@@ -2722,6 +4273,7 @@ void QXmppIceConnection::setRemoteUser(const QString &user)
 void QXmppIceConnection::setRemotePassword(const QString &password)
 {
     d->remotePassword = password;
+    d->remoteMac.setKey(password.toUtf8());
 }
 
 /// Sets the STUN server to use to determine server-reflexive addresses
@@ -2753,6 +4305,52 @@ void QXmppIceConnection::setTurnServer(const QHostAddress &host, quint16 port)
         socket->d->setTurnServer(host, port);
 }
 
+/// Sets the \a transport used to reach the TURN server.
+///
+/// Relaying over TCP or TLS allows calls to succeed on networks which block
+/// UDP, at the cost of head-of-line blocking.
+///
+/// \note This may only be called prior to calling bind().
+
+void QXmppIceConnection::setTurnTransport(QXmppIceConnection::TurnTransport transport)
+{
+    d->turnTransport = transport;
+    foreach (QXmppIceComponent *socket, d->components.values())
+        socket->d->setTurnTransport(transport);
+}
+
+/// Sets the host \a name of the TURN server.
+///
+/// When the TURN server is reached over TLS, its certificate is verified
+/// against this name. If it is not set, the certificate is verified against
+/// the server's address, which usually fails.
+///
+/// \note This may only be called prior to calling bind().
+
+void QXmppIceConnection::setTurnServerName(const QString &name)
+{
+    d->turnServerName = name;
+    foreach (QXmppIceComponent *socket, d->components.values())
+        socket->d->setTurnServerName(name);
+}
+
+/// Sets whether SSL errors, such as an untrusted certificate, should be
+/// ignored when reaching the TURN server over TLS.
+///
+/// By default, the TURN allocation fails if the server's certificate
+/// cannot be verified.
+///
+/// \note This may only be called prior to calling bind().
+///
+/// \param ignore
+
+void QXmppIceConnection::setTurnIgnoreSslErrors(bool ignore)
+{
+    d->turnIgnoreSslErrors = ignore;
+    foreach (QXmppIceComponent *socket, d->components.values())
+        socket->d->setTurnIgnoreSslErrors(ignore);
+}
+
 /// Sets the \a user used for authentication with the TURN server.
 ///
 /// \note This may only be called prior to calling bind().
@@ -2782,7 +4380,7 @@ void QXmppIceConnection::setTurnPassword(const QString &password)
 void QXmppIceConnection::slotConnected()
 {
     foreach (QXmppIceComponent *socket, d->components.values())
-        if (!socket->isConnected())
+        if (!socket->isConnected() || socket->d->restarting)
             return;
     info(QString("ICE negotiation completed"));
     d->connectTimer->stop();
@@ -2802,11 +4400,19 @@ void QXmppIceConnection::slotGatheringStateChanged()
     }
     if (allNew)
         newGatheringState = NewGatheringState;
-    else if (allComplete)
+    else if (allComplete || d->gatheringExpired)
         newGatheringState = CompleteGatheringState;
     else
         newGatheringState = BusyGatheringState;
 
+    // start the gathering deadline
+    if (newGatheringState == BusyGatheringState) {
+        if (d->gatheringTimer->interval() > 0 && !d->gatheringTimer->isActive())
+            d->gatheringTimer->start();
+    } else {
+        d->gatheringTimer->stop();
+    }
+
     if (newGatheringState != d->gatheringState) {
         info(QString("ICE gathering state changed from '%1' to '%2'").arg(
             gathering_states[d->gatheringState],
@@ -2816,6 +4422,13 @@ void QXmppIceConnection::slotGatheringStateChanged()
     }
 }
 
+void QXmppIceConnection::slotGatheringTimeout()
+{
+    info(QString("ICE gathering deadline reached"));
+    d->gatheringExpired = true;
+    slotGatheringStateChanged();
+}
+
 void QXmppIceConnection::slotTimeout()
 {
     warning(QString("ICE negotiation timed out"));
@@ -2824,6 +4437,160 @@ void QXmppIceConnection::slotTimeout()
     emit disconnected();
 }
 
+static QThreadStorage<QXmppIceConsentScheduler*> consentSchedulers;
+
+QXmppIceConsentScheduler::QXmppIceConsentScheduler()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_clock.start();
+
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    check = connect(m_timer, SIGNAL(timeout()),
+                    this, SLOT(timeout()));
+    Q_ASSERT(check);
+}
+
+/// Returns the scheduler for the current thread.
+
+QXmppIceConsentScheduler *QXmppIceConsentScheduler::instance()
+{
+    if (!consentSchedulers.hasLocalData())
+        consentSchedulers.setLocalData(new QXmppIceConsentScheduler);
+    return consentSchedulers.localData();
+}
+
+/// Returns the current time in milliseconds on the scheduler's clock.
+
+qint64 QXmppIceConsentScheduler::now() const
+{
+    return m_clock.elapsed();
+}
+
+/// Schedules a consent freshness check of \a component at \a deadline,
+/// replacing any previously scheduled check.
+///
+/// \param component
+/// \param deadline
+
+void QXmppIceConsentScheduler::schedule(QXmppIceComponent *component, qint64 deadline)
+{
+    if (m_deadlines.contains(component))
+        m_queue.remove(m_deadlines.value(component), component);
+    m_deadlines.insert(component, deadline);
+    m_queue.insert(deadline, component);
+    restartTimer();
+}
+
+/// Cancels the scheduled consent freshness check of \a component.
+///
+/// \param component
+
+void QXmppIceConsentScheduler::unschedule(QXmppIceComponent *component)
+{
+    if (!m_deadlines.contains(component))
+        return;
+    m_queue.remove(m_deadlines.take(component), component);
+    restartTimer();
+}
+
+void QXmppIceConsentScheduler::restartTimer()
+{
+    if (m_queue.isEmpty())
+        m_timer->stop();
+    else
+        m_timer->start(int(qMax(m_queue.firstKey() - now(), qint64(0))));
+}
+
+void QXmppIceConsentScheduler::timeout()
+{
+    const qint64 current = now();
+    while (!m_queue.isEmpty() && m_queue.firstKey() <= current) {
+        QXmppIceComponent *component = m_queue.first();
+        m_queue.erase(m_queue.begin());
+        m_deadlines.remove(component);
+
+        // this may reschedule or destroy the component
+        component->d->checkConsent();
+    }
+    restartTimer();
+}
+
+static QThreadStorage<QXmppIceNetworkMonitor*> networkMonitors;
+
+QXmppIceNetworkMonitor::QXmppIceNetworkMonitor()
+    : m_socket(-1)
+    , m_valid(false)
+{
+#ifdef QXMPP_USE_NETLINK
+    bool check;
+    Q_UNUSED(check);
+
+    // subscribe to link and address changes
+    m_socket = ::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (m_socket >= 0) {
+        sockaddr_nl address;
+        memset(&address, 0, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (::bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            ::close(m_socket);
+            m_socket = -1;
+        }
+    }
+    if (m_socket >= 0) {
+        QSocketNotifier *notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+        check = connect(notifier, SIGNAL(activated(int)),
+                        this, SLOT(readNotifications()));
+        Q_ASSERT(check);
+    }
+#endif
+}
+
+QXmppIceNetworkMonitor::~QXmppIceNetworkMonitor()
+{
+#ifdef QXMPP_USE_NETLINK
+    if (m_socket >= 0)
+        ::close(m_socket);
+#endif
+}
+
+/// Returns the monitor for the current thread.
+
+QXmppIceNetworkMonitor *QXmppIceNetworkMonitor::instance()
+{
+    if (!networkMonitors.hasLocalData())
+        networkMonitors.setLocalData(new QXmppIceNetworkMonitor);
+    return networkMonitors.localData();
+}
+
+/// Returns the list of local network addresses.
+///
+/// Without change notifications, the addresses are looked up every time.
+
+QList<QHostAddress> QXmppIceNetworkMonitor::addresses()
+{
+    if (!m_valid) {
+        m_addresses = lookupAddresses();
+        m_valid = (m_socket >= 0);
+    }
+    return m_addresses;
+}
+
+void QXmppIceNetworkMonitor::readNotifications()
+{
+#ifdef QXMPP_USE_NETLINK
+    // the content of the notifications does not matter, drain them
+    char buffer[4096];
+    while (::recv(m_socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+        ;
+#endif
+    m_valid = false;
+    emit addressesChanged();
+}
+
 QXmppIceTransport::QXmppIceTransport(QObject *parent)
     : QXmppLoggable(parent)
 {
@@ -2832,3 +4599,18 @@ QXmppIceTransport::QXmppIceTransport(QObject *parent)
 QXmppIceTransport::~QXmppIceTransport()
 {
 }
+
+/// Sends several datagrams to the same destination.
+///
+/// Returns the number of datagrams which were sent.
+
+int QXmppIceTransport::writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port)
+{
+    int sent = 0;
+    foreach (const QByteArray &datagram, datagrams) {
+        if (writeDatagram(datagram, host, port) < 0)
+            break;
+        ++sent;
+    }
+    return sent;
+}
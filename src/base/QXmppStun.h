@@ -31,10 +31,12 @@
 
 class CandidatePair;
 class QDataStream;
+class QMessageAuthenticationCode;
 class QUdpSocket;
 class QTimer;
 class QXmppIceComponentPrivate;
 class QXmppIceConnectionPrivate;
+class QXmppIceMultiplexerPrivate;
 class QXmppIcePrivate;
 
 /// \internal
@@ -113,7 +115,10 @@ public:
     void setUsername(const QString &username);
 
     QByteArray encode(const QByteArray &key = QByteArray(), bool addFingerprint = true) const;
+    int encode(char *data, int capacity, const QByteArray &key, bool addFingerprint = true) const;
+    int encode(char *data, int capacity, QMessageAuthenticationCode *mac, bool addFingerprint = true) const;
     bool decode(const QByteArray &buffer, const QByteArray &key = QByteArray(), QStringList *errors = 0);
+    bool decode(const QByteArray &buffer, QMessageAuthenticationCode *mac, QStringList *errors = 0);
     QString toString() const;
     static quint16 peekType(const QByteArray &buffer, quint32 &cookie, QByteArray &id);
 
@@ -172,6 +177,7 @@ public:
     int component() const;
     bool isConnected() const;
     QList<QXmppJingleCandidate> localCandidates() const;
+    int sendDatagrams(const QList<QByteArray> &datagrams);
 
     static QList<QHostAddress> discoverAddresses();
     static QList<QUdpSocket*> reservePorts(const QList<QHostAddress> &addresses, int count, QObject *parent = 0);
@@ -196,6 +202,12 @@ signals:
     /// \brief This signal is emitted when a data packet is received.
     void datagramReceived(const QByteArray &datagram);
 
+    /// \brief This signal is emitted when the remote party stops answering
+    /// consent freshness checks.
+    ///
+    /// No more data packets are sent until ICE is restarted.
+    void consentLost();
+
     /// \internal This signal is emitted when the gathering state of local candidates changes.
     void gatheringStateChanged();
 
@@ -208,6 +220,44 @@ private:
     QXmppIceComponentPrivate *d;
     friend class QXmppIceComponentPrivate;
     friend class QXmppIceConnection;
+    friend class QXmppIceConsentScheduler;
+};
+
+/// \brief The QXmppIceMultiplexer class represents a set of UDP sockets
+/// shared by many ICE connections, for instance on a server handling many
+/// media sessions on a single port.
+///
+/// Incoming datagrams are dispatched to the right connection using the
+/// username fragment of connectivity checks, then the remote address.
+///
+/// \code
+/// QXmppIceMultiplexer *multiplexer = new QXmppIceMultiplexer();
+/// multiplexer->bind(QXmppIceComponent::discoverAddresses(), 3478);
+///
+/// QXmppIceConnection *connection = new QXmppIceConnection();
+/// connection->addComponent(1);
+/// connection->bind(multiplexer);
+/// \endcode
+
+class QXMPP_EXPORT QXmppIceMultiplexer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppIceMultiplexer(QObject *parent = 0);
+    ~QXmppIceMultiplexer();
+
+    bool bind(const QList<QHostAddress> &addresses, quint16 port);
+    void close();
+
+private slots:
+    void readyRead();
+
+private:
+    QXmppIceMultiplexerPrivate *d;
+    friend class QXmppIceConnection;
+    friend class QXmppIceConnectionPrivate;
+    friend class QXmppIceMultiplexedTransport;
 };
 
 /// \brief The QXmppIceConnection class represents a set of UDP sockets
@@ -252,13 +302,37 @@ public:
         CompleteGatheringState
     };
 
+    /// This enum is used to describe how the TURN server is reached.
+    enum TurnTransport
+    {
+        UdpTurnTransport,   ///< STUN and ChannelData messages over UDP.
+        TcpTurnTransport,   ///< STUN and ChannelData messages over TCP.
+        TlsTurnTransport    ///< STUN and ChannelData messages over TLS.
+    };
+
     QXmppIceConnection(QObject *parent = 0);
     ~QXmppIceConnection();
 
     QXmppIceComponent *component(int component);
     void addComponent(int component);
+    void removeComponent(int component);
     void setIceControlling(bool controlling);
 
+    bool aggressiveNomination() const;
+    void setAggressiveNomination(bool aggressive);
+
+    int checkInterval() const;
+    void setCheckInterval(int interval);
+
+    int consentInterval() const;
+    void setConsentInterval(int interval);
+
+    int consentTimeout() const;
+    void setConsentTimeout(int timeout);
+
+    int gatheringTimeout() const;
+    void setGatheringTimeout(int timeout);
+
     QList<QXmppJingleCandidate> localCandidates() const;
     QString localUser() const;
     QString localPassword() const;
@@ -269,10 +343,14 @@ public:
 
     void setStunServer(const QHostAddress &host, quint16 port = 3478);
     void setTurnServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnTransport(TurnTransport transport);
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
+    void setTurnServerName(const QString &name);
+    void setTurnIgnoreSslErrors(bool ignore);
 
     bool bind(const QList<QHostAddress> &addresses);
+    bool bind(QXmppIceMultiplexer *multiplexer);
     bool isConnected() const;
 
     GatheringState gatheringState() const;
@@ -281,6 +359,10 @@ signals:
     /// \brief This signal is emitted once ICE negotiation succeeds.
     void connected();
 
+    /// \brief This signal is emitted when the remote party stops answering
+    /// consent freshness checks for one of the components.
+    void consentLost();
+
     /// \brief This signal is emitted when ICE negotiation fails.
     void disconnected();
 
@@ -290,13 +372,21 @@ signals:
     /// \brief This signal is emitted when the list of local candidates changes.
     void localCandidatesChanged();
 
+    /// \brief This signal is emitted when the local network addresses change.
+    ///
+    /// The local candidates are gathered again by the next restart().
+    void networkChanged();
+
 public slots:
     void close();
     void connectToHost();
+    void restart();
 
 private slots:
+    void slotAddressesChanged();
     void slotConnected();
     void slotGatheringStateChanged();
+    void slotGatheringTimeout();
     void slotTimeout();
 
 private:
@@ -24,8 +24,16 @@
 #ifndef QXMPPSTUN_P_H
 #define QXMPPSTUN_P_H
 
+#include <QAbstractSocket>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QPointer>
+#include <QSslError>
+
 #include "QXmppStun.h"
 
+class QSslSocket;
 class QUdpSocket;
 class QTimer;
 
@@ -54,6 +62,8 @@ public:
     QXmppStunTransaction(const QXmppStunMessage &request, QObject *parent);
     QXmppStunMessage request() const;
     QXmppStunMessage response() const;
+    void setReliable(bool reliable);
+    void start(const QXmppStunMessage &request);
 
 signals:
     void finished();
@@ -69,9 +79,73 @@ private:
     QXmppStunMessage m_request;
     QXmppStunMessage m_response;
     QTimer *m_retryTimer;
+    bool m_reliable;
     int m_tries;
 };
 
+/// \internal
+///
+/// The QXmppIceConsentScheduler class schedules the consent freshness checks
+/// (RFC 7675) of all the ICE components living in a thread, using a single
+/// timer.
+///
+
+class QXMPP_EXPORT QXmppIceConsentScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static QXmppIceConsentScheduler *instance();
+
+    qint64 now() const;
+    void schedule(QXmppIceComponent *component, qint64 deadline);
+    void unschedule(QXmppIceComponent *component);
+
+private slots:
+    void timeout();
+
+private:
+    QXmppIceConsentScheduler();
+    void restartTimer();
+
+    QElapsedTimer m_clock;
+    QTimer *m_timer;
+    QMultiMap<qint64, QXmppIceComponent*> m_queue;
+    QHash<QXmppIceComponent*, qint64> m_deadlines;
+};
+
+/// \internal
+///
+/// The QXmppIceNetworkMonitor class caches the local network addresses of
+/// a thread. On Linux, the cache is refreshed when netlink reports a change
+/// of links or addresses.
+///
+
+class QXMPP_EXPORT QXmppIceNetworkMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    ~QXmppIceNetworkMonitor();
+    static QXmppIceNetworkMonitor *instance();
+
+    QList<QHostAddress> addresses();
+
+signals:
+    /// \brief This signal is emitted when the network configuration changes.
+    void addressesChanged();
+
+private slots:
+    void readNotifications();
+
+private:
+    QXmppIceNetworkMonitor();
+
+    int m_socket;
+    bool m_valid;
+    QList<QHostAddress> m_addresses;
+};
+
 class QXMPP_EXPORT QXmppIceTransport : public QXmppLoggable
 {
     Q_OBJECT
@@ -82,6 +156,7 @@ public:
 
     virtual QXmppJingleCandidate localCandidate(int component) const = 0;
     virtual qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port) = 0;
+    virtual int writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port);
 
 public slots:
     virtual void disconnectFromHost() = 0;
@@ -96,6 +171,9 @@ signals:
 /// The QXmppTurnAllocation class represents a TURN allocation as defined
 /// by RFC 5766 Traversal Using Relays around NAT (TURN).
 ///
+/// The TURN server can be reached over UDP, TCP or TLS, data is always
+/// relayed to peers over UDP using ChannelData messages.
+///
 
 class QXMPP_EXPORT QXmppTurnAllocation : public QXmppIceTransport
 {
@@ -118,6 +196,10 @@ public:
     AllocationState state() const;
 
     void setServer(const QHostAddress &host, quint16 port = 3478);
+    void setServerName(const QString &name);
+    void setIgnoreSslErrors(bool ignore);
+    QXmppIceConnection::TurnTransport transport() const;
+    void setTransport(QXmppIceConnection::TurnTransport transport);
     void setUser(const QString &user);
     void setPassword(const QString &password);
 
@@ -139,14 +221,25 @@ private slots:
     void readyRead();
     void refresh();
     void refreshChannels();
+    void socketConnected();
+    void socketError(QAbstractSocket::SocketError error);
+    void socketReadyRead();
+    void socketSslErrors(const QList<QSslError> &errors);
     void transactionFinished();
     void writeStun(const QXmppStunMessage &message);
 
 private:
-    void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void handleDatagram(QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void sendAllocate();
     void setState(AllocationState state);
+    void startTransaction(const QXmppStunMessage &request);
+    qint64 writeToServer(const char *data, qint64 size);
 
     QUdpSocket *socket;
+    QSslSocket *m_tcpSocket;
+    QByteArray m_buffer;
+    QByteArray m_sendBuffer;
+    QByteArray m_streamBuffer;
     QTimer *m_timer;
     QTimer *m_channelTimer;
     QString m_password;
@@ -155,6 +248,9 @@ private:
     quint16 m_relayedPort;
     QHostAddress m_turnHost;
     quint16 m_turnPort;
+    QString m_turnName;
+    bool m_ignoreSslErrors;
+    QXmppIceConnection::TurnTransport m_transport;
 
     // channels
     typedef QPair<QHostAddress, quint16> Address;
@@ -170,10 +266,44 @@ private:
     QList<QXmppStunTransaction*> m_transactions;
 };
 
+/// \internal
+///
+/// The QXmppIceMultiplexedTransport class represents the use of a socket
+/// shared through a QXmppIceMultiplexer by one ICE component.
+///
+
+class QXMPP_EXPORT QXmppIceMultiplexedTransport : public QXmppIceTransport
+{
+    Q_OBJECT
+
+public:
+    QXmppIceMultiplexedTransport(QXmppIceMultiplexer *multiplexer, QUdpSocket *socket, const QString &user, QObject *parent = 0);
+    ~QXmppIceMultiplexedTransport();
+
+    void addAddress(const QHostAddress &host, quint16 port);
+    bool setUser(const QString &user);
+
+    QXmppJingleCandidate localCandidate(int component) const;
+    qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port);
+
+public slots:
+    void disconnectFromHost();
+
+private:
+    QPointer<QXmppIceMultiplexer> m_multiplexer;
+    QPointer<QUdpSocket> m_socket;
+    QList<QPair<QHostAddress, quint16> > m_addresses;
+    QList<QPair<QHostAddress, quint16> > m_pendingAddresses;
+    QByteArray m_user;
+};
+
 /// \internal
 ///
 /// The QXmppUdpTransport class represents a UDP transport.
 ///
+/// On Linux, datagrams are received and sent in batches using recvmmsg()
+/// and sendmmsg().
+///
 
 class QXMPP_EXPORT QXmppUdpTransport : public QXmppIceTransport
 {
@@ -185,6 +315,7 @@ public:
 
     QXmppJingleCandidate localCandidate(int component) const;
     qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port);
+    int writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port);
 
 public slots:
     void disconnectFromHost();
@@ -193,7 +324,11 @@ private slots:
     void readyRead();
 
 private:
+    bool readBatches();
+
     QUdpSocket *m_socket;
+    QByteArray m_buffer;
+    QList<QByteArray> m_batch;
 };
 
 #endif
@@ -227,10 +227,22 @@ QString QXmppUtils::jidToBareJid(const QString& jid)
 
 quint32 QXmppUtils::generateCrc32(const QByteArray &in)
 {
-    quint32 result = 0xffffffff;
-    for(int n = 0; n < in.size(); ++n)
-        result = (result >> 8) ^ (crctable[(result & 0xff) ^ (quint8)in[n]]);
-    return result ^= 0xffffffff;
+    return generateCrc32(in.constData(), in.size());
+}
+
+/// Calculates the CRC32 checksum for the given data, continuing from the
+/// checksum \a crc of the data which precedes it.
+///
+/// \param data
+/// \param length
+/// \param crc
+
+quint32 QXmppUtils::generateCrc32(const char *data, int length, quint32 crc)
+{
+    quint32 result = crc ^ 0xffffffff;
+    for(int n = 0; n < length; ++n)
+        result = (result >> 8) ^ (crctable[(result & 0xff) ^ (quint8)data[n]]);
+    return result ^ 0xffffffff;
 }
 
 static QByteArray generateHmac(QCryptographicHash::Algorithm algorithm, const QByteArray &key, const QByteArray &text)
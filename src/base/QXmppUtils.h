@@ -57,6 +57,7 @@ public:
     static QString jidToBareJid(const QString& jid);
 
     static quint32 generateCrc32(const QByteArray &input);
+    static quint32 generateCrc32(const char *data, int length, quint32 crc = 0);
     static QByteArray generateHmacMd5(const QByteArray &key, const QByteArray &text);
     static QByteArray generateHmacSha1(const QByteArray &key, const QByteArray &text);
     static int generateRandomInteger(int N);
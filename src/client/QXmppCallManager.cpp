@@ -22,7 +22,9 @@
  */
 
 #include <QDomElement>
+#include <QSet>
 #include <QTimer>
+#include <QtEndian>
 
 #include "QXmppCallManager.h"
 #include "QXmppClient.h"
@@ -48,22 +50,37 @@ public:
         QString creator;
         QString media;
         QString name;
+
+        // RTCP is multiplexed with RTP on a single component, see RFC 5761
+        bool rtcpMux;
+        // the ICE connection of the first stream is shared, see XEP-0338
+        bool bundled;
+        // the payload types offered by the remote party
+        QList<QXmppJinglePayloadType> remotePayloadTypes;
+
+        // ICE state as signalled to and by the remote party
+        QString remoteUser;
+        bool restartPending;
+        QSet<QString> signalledCandidates;
     };
 
     QXmppCallPrivate(QXmppCall *qq);
-    Stream *createStream(const QString &media);
+    QStringList bundledContents() const;
+    Stream *createStream(const QString &media, bool rtcpMux = false, bool bundled = false);
     Stream *findStreamByMedia(const QString &media);
     Stream *findStreamByName(const QString &name);
-    QXmppJingleIq::Content localContent(QXmppCallPrivate::Stream *stream) const;
+    QXmppJingleIq::Content localContent(QXmppCallPrivate::Stream *stream);
 
     void handleAck(const QXmppIq &iq);
     bool handleDescription(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content);
     void handleRequest(const QXmppJingleIq &iq);
     bool handleTransport(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content);
+    void restartIce(QXmppCallPrivate::Stream *stream);
     void setState(QXmppCall::State state);
     bool sendAck(const QXmppJingleIq &iq);
     bool sendInvite();
     bool sendRequest(const QXmppJingleIq &iq);
+    bool sendTransportInfo(QXmppCallPrivate::Stream *stream, const QList<QXmppJingleCandidate> &candidates);
     void terminate(QXmppJingleIq::Reason::Type reasonType);
 
     QXmppCall::Direction direction;
@@ -75,6 +92,7 @@ public:
     QXmppCall::State state;
 
     // Media streams
+    bool bundle;
     bool sendVideo;
     QList<Stream*> streams;
     QIODevice::OpenMode audioMode;
@@ -96,8 +114,11 @@ public:
     quint16 stunPort;
     QHostAddress turnHost;
     quint16 turnPort;
+    QXmppIceConnection::TurnTransport turnTransport;
     QString turnUser;
     QString turnPassword;
+    QString turnServerName;
+    bool turnIgnoreSslErrors;
 
 private:
     QXmppCallManager *q;
@@ -107,6 +128,7 @@ QXmppCallPrivate::QXmppCallPrivate(QXmppCall *qq)
     : direction(QXmppCall::IncomingDirection),
     manager(0),
     state(QXmppCall::ConnectingState),
+    bundle(false),
     sendVideo(false),
     audioMode(QIODevice::NotOpen),
     videoMode(QIODevice::NotOpen),
@@ -115,6 +137,20 @@ QXmppCallPrivate::QXmppCallPrivate(QXmppCall *qq)
     qRegisterMetaType<QXmppCall::State>();
 }
 
+/// Returns the names of the contents sharing a single transport, or an
+/// empty list if the parties did not agree to BUNDLE them.
+
+QStringList QXmppCallPrivate::bundledContents() const
+{
+    QStringList names;
+    if (bundle) {
+        foreach (Stream *stream, streams)
+            if (stream == streams.first() || stream->bundled)
+                names << stream->name;
+    }
+    return names;
+}
+
 QXmppCallPrivate::Stream *QXmppCallPrivate::findStreamByMedia(const QString &media)
 {
     foreach (Stream *stream, streams)
@@ -150,21 +186,63 @@ void QXmppCallPrivate::handleAck(const QXmppIq &ack)
 
 bool QXmppCallPrivate::handleDescription(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content)
 {
+    stream->channel->setRemoteCryptoElements(content.rtpCryptoElements());
     stream->channel->setRemotePayloadTypes(content.payloadTypes());
+    stream->remotePayloadTypes = content.payloadTypes();
     if (!(stream->channel->openMode() & QIODevice::ReadWrite)) {
         q->warning(QString("Remote party %1 did not provide any known %2 payloads for call %3").arg(jid, stream->media, sid));
         return false;
     }
+
+    // the RTCP component is only needed if the remote party does not
+    // multiplex RTCP with RTP
+    if (!stream->bundled) {
+        stream->rtcpMux = content.isRtpMultiplexingSupported();
+        if (stream->rtcpMux)
+            stream->connection->removeComponent(RTCP_COMPONENT);
+    }
+
+    // streams sharing a transport are told apart by their SSRC, if the
+    // remote party did not signal it, it is learnt from incoming packets
+    if (bundle)
+        stream->channel->setRemoteSsrc(content.descriptionSsrc());
+
     q->updateOpenMode();
     return true;
 }
 
 bool QXmppCallPrivate::handleTransport(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content)
 {
-    stream->connection->setRemoteUser(content.transportUser());
-    stream->connection->setRemotePassword(content.transportPassword());
-    foreach (const QXmppJingleCandidate &candidate, content.transportCandidates())
-        stream->connection->addRemoteCandidate(candidate);
+    // the transport of bundled contents is negotiated by the first one
+    if (stream->bundled)
+        return true;
+
+    // new credentials from the remote party signal an ICE restart,
+    // unless they answer a restart we requested
+    bool restarted = false;
+    if (!content.transportUser().isEmpty()) {
+        if (!stream->remoteUser.isEmpty() &&
+            content.transportUser() != stream->remoteUser &&
+            !stream->restartPending) {
+            q->info(QString("Remote party %1 restarted ICE for call %2").arg(jid, sid));
+            stream->connection->restart();
+            restarted = true;
+        }
+        stream->restartPending = false;
+        stream->remoteUser = content.transportUser();
+        stream->connection->setRemoteUser(content.transportUser());
+        stream->connection->setRemotePassword(content.transportPassword());
+    }
+
+    // candidates may be trickled, start checking them immediately
+    foreach (const QXmppJingleCandidate &candidate, content.transportCandidates()) {
+        if (stream->connection->component(candidate.component()))
+            stream->connection->addRemoteCandidate(candidate);
+    }
+
+    // answer the restart with our new credentials
+    if (restarted)
+        sendTransportInfo(stream, stream->connection->localCandidates());
 
     // perform ICE negotiation
     if (!content.transportCandidates().isEmpty())
@@ -186,6 +264,9 @@ void QXmppCallPrivate::handleRequest(const QXmppJingleIq &iq)
         // send ack
         sendAck(iq);
 
+        // check whether the responder agreed to BUNDLE contents
+        bundle = iq.bundledContents().contains(content.name());
+
         // check content description and transport
         QXmppCallPrivate::Stream *stream = findStreamByName(content.name());
         if (!stream ||
@@ -240,7 +321,9 @@ void QXmppCallPrivate::handleRequest(const QXmppJingleIq &iq)
             return;
 
         // create media stream
-        stream = createStream(content.descriptionMedia());
+        stream = createStream(content.descriptionMedia(),
+                              content.isRtpMultiplexingSupported(),
+                              bundle && iq.bundledContents().contains(content.name()));
         if (!stream)
             return;
         stream->creator = content.creator();
@@ -268,6 +351,7 @@ void QXmppCallPrivate::handleRequest(const QXmppJingleIq &iq)
         iq.setType(QXmppIq::Set);
         iq.setAction(QXmppJingleIq::ContentAccept);
         iq.setSid(q->sid());
+        iq.setBundledContents(bundledContents());
         iq.addContent(localContent(stream));
         sendRequest(iq);
 
@@ -287,7 +371,13 @@ void QXmppCallPrivate::handleRequest(const QXmppJingleIq &iq)
     }
 }
 
-QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
+/// Creates a media stream.
+///
+/// If \a rtcpMux is true, the remote party offered to multiplex RTCP with
+/// RTP so no RTCP component is created. If \a bundled is true, the stream
+/// shares the ICE connection of the first stream.
+
+QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media, bool rtcpMux, bool bundled)
 {
     bool check;
     Q_UNUSED(check);
@@ -312,40 +402,70 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
         return 0;
     }
 
-    // ICE connection
-    stream->connection = new QXmppIceConnection(q);
-    stream->connection->setIceControlling(direction == QXmppCall::OutgoingDirection);
-    stream->connection->setStunServer(manager->d->stunHost, manager->d->stunPort);
-    stream->connection->setTurnServer(manager->d->turnHost, manager->d->turnPort);
-    stream->connection->setTurnUser(manager->d->turnUser);
-    stream->connection->setTurnPassword(manager->d->turnPassword);
-    stream->connection->addComponent(RTP_COMPONENT);
-    stream->connection->addComponent(RTCP_COMPONENT);
-    stream->connection->bind(QXmppIceComponent::discoverAddresses());
-
-    // connect signals
-    check = QObject::connect(stream->connection, SIGNAL(localCandidatesChanged()),
-        q, SLOT(localCandidatesChanged()));
-    Q_ASSERT(check);
+    stream->restartPending = false;
+    stream->bundled = bundled && !streams.isEmpty();
+    if (stream->bundled) {
+        stream->connection = streams.first()->connection;
+        stream->rtcpMux = streams.first()->rtcpMux;
+    } else {
+        // offer to multiplex RTCP, unless the remote party already did
+        stream->rtcpMux = true;
+
+        // ICE connection
+        stream->connection = new QXmppIceConnection(q);
+        stream->connection->setIceControlling(direction == QXmppCall::OutgoingDirection);
+        stream->connection->setStunServer(manager->d->stunHost, manager->d->stunPort);
+        stream->connection->setTurnServer(manager->d->turnHost, manager->d->turnPort);
+        stream->connection->setTurnTransport(manager->d->turnTransport);
+        stream->connection->setTurnUser(manager->d->turnUser);
+        stream->connection->setTurnPassword(manager->d->turnPassword);
+        stream->connection->setTurnServerName(manager->d->turnServerName);
+        stream->connection->setTurnIgnoreSslErrors(manager->d->turnIgnoreSslErrors);
+        stream->connection->addComponent(RTP_COMPONENT);
+        if (!rtcpMux)
+            stream->connection->addComponent(RTCP_COMPONENT);
+        stream->connection->bind(QXmppIceComponent::discoverAddresses());
+
+        // connect signals
+        check = QObject::connect(stream->connection, SIGNAL(localCandidatesChanged()),
+            q, SLOT(localCandidatesChanged()));
+        Q_ASSERT(check);
 
-    check = QObject::connect(stream->connection, SIGNAL(connected()),
-        q, SLOT(updateOpenMode()));
-    Q_ASSERT(check);
+        check = QObject::connect(stream->connection, SIGNAL(connected()),
+            q, SLOT(updateOpenMode()));
+        Q_ASSERT(check);
 
-    check = QObject::connect(q, SIGNAL(stateChanged(QXmppCall::State)),
-        q, SLOT(updateOpenMode()));
-    Q_ASSERT(check);
+        check = QObject::connect(q, SIGNAL(stateChanged(QXmppCall::State)),
+            q, SLOT(updateOpenMode()));
+        Q_ASSERT(check);
 
-    check = QObject::connect(stream->connection, SIGNAL(disconnected()),
-        q, SLOT(hangup()));
-    Q_ASSERT(check);
+        check = QObject::connect(stream->connection, SIGNAL(disconnected()),
+            q, SLOT(hangup()));
+        Q_ASSERT(check);
+
+        check = QObject::connect(stream->connection, SIGNAL(consentLost()),
+            q, SLOT(consentLost()));
+        Q_ASSERT(check);
+
+        check = QObject::connect(stream->connection, SIGNAL(networkChanged()),
+            q, SLOT(networkChanged()));
+        Q_ASSERT(check);
+    }
 
     if (channelObject) {
         QXmppIceComponent *rtpComponent = stream->connection->component(RTP_COMPONENT);
 
-        check = QObject::connect(rtpComponent, SIGNAL(datagramReceived(QByteArray)),
-                        channelObject, SLOT(datagramReceived(QByteArray)));
-        Q_ASSERT(check);
+        if (stream->bundled) {
+            // the call dispatches the packets of bundled streams
+            QObject::disconnect(rtpComponent, SIGNAL(datagramReceived(QByteArray)), 0, 0);
+            check = QObject::connect(rtpComponent, SIGNAL(datagramReceived(QByteArray)),
+                            q, SLOT(bundledDatagramReceived(QByteArray)));
+            Q_ASSERT(check);
+        } else {
+            check = QObject::connect(rtpComponent, SIGNAL(datagramReceived(QByteArray)),
+                            channelObject, SLOT(datagramReceived(QByteArray)));
+            Q_ASSERT(check);
+        }
 
         check = QObject::connect(channelObject, SIGNAL(sendDatagram(QByteArray)),
                         rtpComponent, SLOT(sendDatagram(QByteArray)));
@@ -354,7 +474,10 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
     return stream;
 }
 
-QXmppJingleIq::Content QXmppCallPrivate::localContent(QXmppCallPrivate::Stream *stream) const
+/// Returns the content describing a local stream, and marks its local
+/// candidates as signalled.
+
+QXmppJingleIq::Content QXmppCallPrivate::localContent(QXmppCallPrivate::Stream *stream)
 {
     QXmppJingleIq::Content content;
     content.setCreator(stream->creator);
@@ -365,15 +488,32 @@ QXmppJingleIq::Content QXmppCallPrivate::localContent(QXmppCallPrivate::Stream *
     content.setDescriptionMedia(stream->media);
     content.setDescriptionSsrc(stream->channel->localSsrc());
     content.setPayloadTypes(stream->channel->localPayloadTypes());
-
-    // transport
-    content.setTransportUser(stream->connection->localUser());
-    content.setTransportPassword(stream->connection->localPassword());
-    content.setTransportCandidates(stream->connection->localCandidates());
+    content.setRtpCryptoElements(stream->channel->localCryptoElements());
+    content.setRtpMultiplexingSupported(stream->rtcpMux);
+
+    // transport, bundled contents use the transport of the first one
+    if (!stream->bundled) {
+        content.setTransportUser(stream->connection->localUser());
+        content.setTransportPassword(stream->connection->localPassword());
+        content.setTransportCandidates(stream->connection->localCandidates());
+        foreach (const QXmppJingleCandidate &candidate, content.transportCandidates())
+            stream->signalledCandidates << candidate.id();
+    }
 
     return content;
 }
 
+/// Restarts ICE for a stream and sends the new credentials to the remote
+/// party, see RFC 8445 - 9. ICE Restarts.
+
+void QXmppCallPrivate::restartIce(QXmppCallPrivate::Stream *stream)
+{
+    q->info(QString("Restarting ICE for call %1").arg(sid));
+    stream->connection->restart();
+    stream->restartPending = true;
+    sendTransportInfo(stream, stream->connection->localCandidates());
+}
+
 /// Sends an acknowledgement for a Jingle IQ.
 ///
 
@@ -399,6 +539,9 @@ bool QXmppCallPrivate::sendInvite()
     iq.setInitiator(ownJid);
     iq.setSid(sid);
     iq.addContent(localContent(stream));
+
+    // offer to share this content's transport with later contents
+    iq.setBundledContents(QStringList() << stream->name);
     return sendRequest(iq);
 }
 
@@ -411,6 +554,29 @@ bool QXmppCallPrivate::sendRequest(const QXmppJingleIq &iq)
     return manager->client()->sendPacket(iq);
 }
 
+/// Sends a transport-info with the current ICE credentials and the given
+/// local candidates.
+
+bool QXmppCallPrivate::sendTransportInfo(QXmppCallPrivate::Stream *stream, const QList<QXmppJingleCandidate> &candidates)
+{
+    QXmppJingleIq::Content content;
+    content.setCreator(stream->creator);
+    content.setName(stream->name);
+    content.setTransportUser(stream->connection->localUser());
+    content.setTransportPassword(stream->connection->localPassword());
+    content.setTransportCandidates(candidates);
+    foreach (const QXmppJingleCandidate &candidate, candidates)
+        stream->signalledCandidates << candidate.id();
+
+    QXmppJingleIq iq;
+    iq.setTo(jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::TransportInfo);
+    iq.setSid(sid);
+    iq.addContent(content);
+    return sendRequest(iq);
+}
+
 void QXmppCallPrivate::setState(QXmppCall::State newState)
 {
     if (state != newState)
@@ -456,11 +622,14 @@ QXmppCall::QXmppCall(const QString &jid, QXmppCall::Direction direction, QXmppCa
     d->ownJid = parent->client()->configuration().jid();
     d->manager = parent;
 
-    // create audio stream
-    QXmppCallPrivate::Stream *stream = d->createStream(AUDIO_MEDIA);
-    stream->creator = QLatin1String("initiator");
-    stream->name = QLatin1String("voice");
-    d->streams << stream;
+    // create audio stream, for incoming calls this is done once the
+    // offer is known
+    if (direction == OutgoingDirection) {
+        QXmppCallPrivate::Stream *stream = d->createStream(AUDIO_MEDIA);
+        stream->creator = QLatin1String("initiator");
+        stream->name = QLatin1String("voice");
+        d->streams << stream;
+    }
 }
 
 QXmppCall::~QXmppCall()
@@ -487,6 +656,7 @@ void QXmppCall::accept()
         iq.setAction(QXmppJingleIq::SessionAccept);
         iq.setResponder(d->ownJid);
         iq.setSid(d->sid);
+        iq.setBundledContents(d->bundledContents());
         iq.addContent(d->localContent(stream));
         d->sendRequest(iq);
 
@@ -551,6 +721,61 @@ void QXmppCall::terminated()
     d->setState(QXmppCall::FinishedState);
 }
 
+/// Dispatches an RTP packet received on a transport shared by several
+/// streams (BUNDLE).
+///
+/// Packets are told apart using the remote SSRC. If the remote party did
+/// not signal the SSRC of a stream, it is learnt from the first packet
+/// whose payload type belongs to that stream alone. Packets whose payload
+/// type is shared by several such streams are dropped.
+
+void QXmppCall::bundledDatagramReceived(const QByteArray &datagram)
+{
+    if (datagram.size() < 12 || d->streams.isEmpty())
+        return;
+
+    // RTCP multiplexed with RTP uses types 192-223, see RFC 5761
+    const quint8 type = quint8(datagram.at(1)) & 0x7f;
+    if (type >= 64 && type < 96)
+        return;
+    const quint32 ssrc = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(datagram.constData()) + 8);
+
+    QXmppCallPrivate::Stream *target = 0;
+    QList<QXmppCallPrivate::Stream*> candidates;
+    foreach (QXmppCallPrivate::Stream *stream, d->streams) {
+        if (stream->connection != d->streams.first()->connection)
+            continue;
+        const quint32 remoteSsrc = stream->channel->remoteSsrc();
+        if (remoteSsrc) {
+            if (remoteSsrc == ssrc) {
+                target = stream;
+                break;
+            }
+            continue;
+        }
+        foreach (const QXmppJinglePayloadType &payload, stream->remotePayloadTypes) {
+            if (payload.id() == type) {
+                candidates << stream;
+                break;
+            }
+        }
+    }
+
+    if (!target) {
+        if (candidates.size() != 1)
+            return;
+        target = candidates.first();
+        debug(QString("Learnt remote SSRC %1 for %2 stream of call %3").arg(
+            QString::number(ssrc), target->media, d->sid));
+        target->channel->setRemoteSsrc(ssrc);
+    }
+
+    if (target->media == AUDIO_MEDIA)
+        static_cast<QXmppRtpAudioChannel*>(target->channel)->datagramReceived(datagram);
+    else if (target->media == VIDEO_MEDIA)
+        static_cast<QXmppRtpVideoChannel*>(target->channel)->datagramReceived(datagram);
+}
+
 /// Returns the call's direction.
 ///
 
@@ -567,8 +792,49 @@ void QXmppCall::hangup()
     d->terminate(QXmppJingleIq::Reason::None);
 }
 
+/// Restarts ICE when the remote party stops answering consent checks.
+///
+/// Only the initiator, which has the ICE controlling role, restarts ICE so
+/// that both parties do not restart at the same time.
+
+void QXmppCall::consentLost()
+{
+    QXmppIceConnection *conn = qobject_cast<QXmppIceConnection*>(sender());
+    if (d->direction != OutgoingDirection || d->state != ActiveState)
+        return;
+
+    foreach (QXmppCallPrivate::Stream *stream, d->streams) {
+        if (stream->connection == conn) {
+            d->restartIce(stream);
+            break;
+        }
+    }
+}
+
+/// Restarts ICE when the local network addresses change, so that candidates
+/// are gathered on the new addresses.
+///
+/// Unlike a loss of consent, only the local party knows about the change,
+/// so either party restarts ICE.
+
+void QXmppCall::networkChanged()
+{
+    QXmppIceConnection *conn = qobject_cast<QXmppIceConnection*>(sender());
+    if (d->state != ActiveState)
+        return;
+
+    foreach (QXmppCallPrivate::Stream *stream, d->streams) {
+        if (stream->connection == conn) {
+            d->restartIce(stream);
+            break;
+        }
+    }
+}
+
 /// Sends a transport-info to inform the remote party of new local candidates.
 ///
+/// Only the candidates which were not signalled yet are sent, as described
+/// by XEP-0176: Jingle ICE-UDP Transport Method.
 
 void QXmppCall::localCandidatesChanged()
 {
@@ -584,13 +850,13 @@ void QXmppCall::localCandidatesChanged()
     if (!stream)
         return;
 
-    QXmppJingleIq iq;
-    iq.setTo(d->jid);
-    iq.setType(QXmppIq::Set);
-    iq.setAction(QXmppJingleIq::TransportInfo);
-    iq.setSid(d->sid);
-    iq.addContent(d->localContent(stream));
-    d->sendRequest(iq);
+    QList<QXmppJingleCandidate> candidates;
+    foreach (const QXmppJingleCandidate &candidate, conn->localCandidates()) {
+        if (!stream->signalledCandidates.contains(candidate.id()))
+            candidates << candidate;
+    }
+    if (!candidates.isEmpty())
+        d->sendTransportInfo(stream, candidates);
 }
 
 /// Returns the remote party's JID.
@@ -664,7 +930,7 @@ void QXmppCall::startVideo()
     }
 
     // create video stream
-    stream = d->createStream(VIDEO_MEDIA);
+    stream = d->createStream(VIDEO_MEDIA, false, d->bundle);
     stream->creator = (d->direction == QXmppCall::OutgoingDirection) ? QLatin1String("initiator") : QLatin1String("responder");
     stream->name = QLatin1String("webcam");
     d->streams << stream;
@@ -675,6 +941,7 @@ void QXmppCall::startVideo()
     iq.setType(QXmppIq::Set);
     iq.setAction(QXmppJingleIq::ContentAdd);
     iq.setSid(d->sid);
+    iq.setBundledContents(d->bundledContents());
     iq.addContent(d->localContent(stream));
     d->sendRequest(iq);
 }
@@ -695,6 +962,8 @@ void QXmppCall::stopVideo()
 QXmppCallManagerPrivate::QXmppCallManagerPrivate(QXmppCallManager *qq)
     : stunPort(0),
     turnPort(0),
+    turnTransport(QXmppIceConnection::UdpTurnTransport),
+    turnIgnoreSslErrors(false),
     q(qq)
 {
 }
@@ -739,7 +1008,8 @@ QStringList QXmppCallManager::discoveryFeatures() const
         << ns_jingle_rtp        // XEP-0167 : Jingle RTP Sessions
         << ns_jingle_rtp_audio
         << ns_jingle_rtp_video
-        << ns_jingle_ice_udp;    // XEP-0176 : Jingle ICE-UDP Transport Method
+        << ns_jingle_ice_udp    // XEP-0176 : Jingle ICE-UDP Transport Method
+        << ns_jingle_grouping;  // XEP-0338 : Jingle Grouping Framework
 }
 
 bool QXmppCallManager::handleStanza(const QDomElement &element)
@@ -751,6 +1021,17 @@ bool QXmppCallManager::handleStanza(const QDomElement &element)
         {
             QXmppJingleIq jingleIq;
             jingleIq.parse(element);
+
+            // leave sessions which are not calls, such as file transfers,
+            // to other extensions
+            if (jingleIq.action() == QXmppJingleIq::SessionInitiate) {
+                if (jingleIq.contents().isEmpty() ||
+                    jingleIq.contents().first().descriptionMedia() != AUDIO_MEDIA)
+                    return false;
+            } else if (!d->findCall(jingleIq.sid())) {
+                return false;
+            }
+
             _q_jingleIqReceived(jingleIq);
             return true;
         }
@@ -837,6 +1118,34 @@ void QXmppCallManager::setTurnServer(const QHostAddress &host, quint16 port)
     d->turnPort = port;
 }
 
+/// Sets the \a transport used to reach the TURN server, use TCP or TLS
+/// on networks which block UDP.
+
+void QXmppCallManager::setTurnTransport(QXmppIceConnection::TurnTransport transport)
+{
+    d->turnTransport = transport;
+}
+
+/// Sets the host \a name of the TURN server, against which its certificate
+/// is verified when using TLS.
+///
+/// \param name
+
+void QXmppCallManager::setTurnServerName(const QString &name)
+{
+    d->turnServerName = name;
+}
+
+/// Sets whether SSL errors should be ignored when reaching the TURN server
+/// over TLS. By default, the TURN allocation fails on SSL errors.
+///
+/// \param ignore
+
+void QXmppCallManager::setTurnIgnoreSslErrors(bool ignore)
+{
+    d->turnIgnoreSslErrors = ignore;
+}
+
 /// Sets the \a user used for authentication with the TURN server.
 ///
 /// \param user
@@ -901,11 +1210,18 @@ void QXmppCallManager::_q_jingleIqReceived(const QXmppJingleIq &iq)
         call->d->sid = iq.sid();
 
         const QXmppJingleIq::Content content = iq.contents().isEmpty() ? QXmppJingleIq::Content() : iq.contents().first();
-        QXmppCallPrivate::Stream *stream = call->d->findStreamByMedia(content.descriptionMedia());
-        if (!stream)
+        if (content.descriptionMedia() != AUDIO_MEDIA) {
+            delete call;
             return;
+        }
+
+        // create audio stream, without an RTCP component if the initiator
+        // multiplexes RTCP with RTP
+        QXmppCallPrivate::Stream *stream = call->d->createStream(AUDIO_MEDIA, content.isRtpMultiplexingSupported());
         stream->creator = content.creator();
         stream->name = content.name();
+        call->d->streams << stream;
+        call->d->bundle = iq.bundledContents().contains(content.name());
 
         // send ack
         call->d->sendAck(iq);
@@ -30,6 +30,7 @@
 
 #include "QXmppClientExtension.h"
 #include "QXmppLogger.h"
+#include "QXmppStun.h"
 
 class QHostAddress;
 class QXmppCallPrivate;
@@ -123,7 +124,10 @@ public slots:
     void stopVideo();
 
 private slots:
+    void bundledDatagramReceived(const QByteArray &datagram);
+    void consentLost();
     void localCandidatesChanged();
+    void networkChanged();
     void terminated();
     void updateOpenMode();
 
@@ -166,8 +170,11 @@ public:
     ~QXmppCallManager();
     void setStunServer(const QHostAddress &host, quint16 port = 3478);
     void setTurnServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnTransport(QXmppIceConnection::TurnTransport transport);
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
+    void setTurnServerName(const QString &name);
+    void setTurnIgnoreSslErrors(bool ignore);
 
     /// \cond
     QStringList discoveryFeatures() const;
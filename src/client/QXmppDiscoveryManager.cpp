@@ -128,6 +128,8 @@ QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
             features << extension->discoveryFeatures();
     }
 
+    // several extensions may share a feature, such as Jingle
+    features.removeDuplicates();
     iq.setFeatures(features);
 
     // identities
@@ -0,0 +1,803 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+
+#include "QXmppClient.h"
+#include "QXmppConstants_p.h"
+#include "QXmppJingleFileManager.h"
+#include "QXmppJingleFileManager_p.h"
+#include "QXmppReliableChannel_p.h"
+#include "QXmppStun.h"
+#include "QXmppTransferManager_p.h"
+#include "QXmppUtils.h"
+
+static const int FILE_COMPONENT = 1;
+
+// amount of data queued in the reliable channel (256 kB)
+static const qint64 sendWindow = 256 * 1024;
+
+// time during which the receiver keeps acknowledging data once it has
+// verified the file (5 seconds)
+static const int closeDelay = 5000;
+
+class QXmppJingleFileManagerPrivate
+{
+public:
+    QXmppJingleFileManagerPrivate();
+    QXmppJingleFileJob *findJob(const QString &jid, const QString &sid) const;
+
+    QList<QXmppJingleFileJob*> jobs;
+    QHostAddress stunHost;
+    quint16 stunPort;
+    QHostAddress turnHost;
+    quint16 turnPort;
+    QXmppIceConnection::TurnTransport turnTransport;
+    QString turnUser;
+    QString turnPassword;
+    QString turnServerName;
+    bool turnIgnoreSslErrors;
+};
+
+QXmppJingleFileManagerPrivate::QXmppJingleFileManagerPrivate()
+    : stunPort(0),
+    turnPort(0),
+    turnTransport(QXmppIceConnection::UdpTurnTransport),
+    turnIgnoreSslErrors(false)
+{
+}
+
+QXmppJingleFileJob *QXmppJingleFileManagerPrivate::findJob(const QString &jid, const QString &sid) const
+{
+    foreach (QXmppJingleFileJob *job, jobs)
+        if (job->sid() == sid && job->jid() == jid)
+            return job;
+    return 0;
+}
+
+QXmppJingleFileJob::QXmppJingleFileJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppJingleFileManager *manager)
+    : QXmppTransferJob(jid, direction, manager->client(), manager)
+    , m_manager(manager)
+    , m_remoteTerminated(false)
+    , m_sessionStarted(false)
+    , m_terminateSent(false)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->method = QXmppTransferJob::JingleMethod;
+    d->blockSize = 16 * QXmppReliableChannel::MaximumSegmentSize;
+
+    // ICE connection, the initiator is controlling
+    m_connection = new QXmppIceConnection(this);
+    m_connection->setIceControlling(direction == QXmppTransferJob::OutgoingDirection);
+    m_connection->setStunServer(manager->d->stunHost, manager->d->stunPort);
+    m_connection->setTurnServer(manager->d->turnHost, manager->d->turnPort);
+    m_connection->setTurnTransport(manager->d->turnTransport);
+    m_connection->setTurnUser(manager->d->turnUser);
+    m_connection->setTurnPassword(manager->d->turnPassword);
+    m_connection->setTurnServerName(manager->d->turnServerName);
+    m_connection->setTurnIgnoreSslErrors(manager->d->turnIgnoreSslErrors);
+    m_connection->addComponent(FILE_COMPONENT);
+    m_connection->bind(QXmppIceComponent::discoverAddresses());
+
+    check = connect(m_connection, SIGNAL(localCandidatesChanged()),
+                    this, SLOT(_q_localCandidatesChanged()));
+    Q_ASSERT(check);
+
+    check = connect(m_connection, SIGNAL(connected()),
+                    this, SLOT(_q_connected()));
+    Q_ASSERT(check);
+
+    check = connect(m_connection, SIGNAL(disconnected()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+
+    // reliable channel over the ICE component
+    m_channel = new QXmppReliableChannel(this);
+    QXmppIceComponent *component = m_connection->component(FILE_COMPONENT);
+
+    check = connect(component, SIGNAL(datagramReceived(QByteArray)),
+                    m_channel, SLOT(datagramReceived(QByteArray)));
+    Q_ASSERT(check);
+
+    check = connect(m_channel, SIGNAL(sendDatagram(QByteArray)),
+                    component, SLOT(sendDatagram(QByteArray)));
+    Q_ASSERT(check);
+
+    if (direction == QXmppTransferJob::OutgoingDirection) {
+        check = connect(m_channel, SIGNAL(bytesWritten(qint64)),
+                        this, SLOT(_q_sendData()));
+        Q_ASSERT(check);
+
+        check = connect(m_channel, SIGNAL(finished()),
+                        this, SLOT(_q_channelFinished()));
+        Q_ASSERT(check);
+    } else {
+        check = connect(m_channel, SIGNAL(readyRead()),
+                        this, SLOT(_q_receiveData()));
+        Q_ASSERT(check);
+
+        check = connect(m_channel, SIGNAL(readChannelFinished()),
+                        this, SLOT(_q_readChannelFinished()));
+        Q_ASSERT(check);
+    }
+
+    check = connect(this, SIGNAL(stateChanged(QXmppTransferJob::State)),
+                    this, SLOT(_q_stateChanged(QXmppTransferJob::State)));
+    Q_ASSERT(check);
+}
+
+/// Handles the answer to one of our requests, returns false if the
+/// answer is for another job.
+
+bool QXmppJingleFileJob::handleAck(const QXmppIq &iq)
+{
+    if (iq.from() != d->jid || !m_requests.removeOne(iq.id()))
+        return false;
+
+    if (iq.type() == QXmppIq::Error && d->state != QXmppTransferJob::FinishedState) {
+        warning(QString("Remote party %1 refused a request for transfer %2").arg(d->jid, d->sid));
+        m_remoteTerminated = true;
+        terminate(QXmppTransferJob::ProtocolError);
+    }
+    return true;
+}
+
+/// Handles an incoming session-initiate offering a file.
+
+void QXmppJingleFileJob::handleOffer(const QXmppJingleIq &iq)
+{
+    const QXmppJingleIq::Content content = iq.contents().first();
+
+    d->sid = iq.sid();
+    m_contentCreator = content.creator();
+    m_contentName = content.name();
+    m_sessionStarted = true;
+
+    d->fileInfo.setName(content.fileName());
+    d->fileInfo.setSize(content.fileSize());
+    d->fileInfo.setDescription(content.fileDescription());
+    d->fileInfo.setSha256(content.fileSha256());
+
+    sendAck(iq);
+    handleTransport(content);
+}
+
+void QXmppJingleFileJob::handleRequest(const QXmppJingleIq &iq)
+{
+    const QXmppJingleIq::Content content = iq.contents().isEmpty() ? QXmppJingleIq::Content() : iq.contents().first();
+
+    if (iq.action() == QXmppJingleIq::SessionAccept) {
+
+        if (d->direction == QXmppTransferJob::IncomingDirection) {
+            warning("Ignoring Session-Accept for an incoming transfer");
+            return;
+        }
+
+        // send ack
+        sendAck(iq);
+
+        setState(QXmppTransferJob::StartState);
+        handleTransport(content);
+
+    } else if (iq.action() == QXmppJingleIq::TransportInfo) {
+
+        // send ack
+        sendAck(iq);
+
+        handleTransport(content);
+
+    } else if (iq.action() == QXmppJingleIq::SessionTerminate) {
+
+        // send ack
+        sendAck(iq);
+
+        m_remoteTerminated = true;
+        if (d->state == QXmppTransferJob::FinishedState)
+            return;
+
+        info(QString("Remote party %1 terminated transfer %2").arg(d->jid, d->sid));
+        switch (iq.reason().type()) {
+        case QXmppJingleIq::Reason::Success:
+            // the receiver verified the file before our end of stream
+            // was acknowledged
+            if (d->direction == QXmppTransferJob::OutgoingDirection)
+                terminate(QXmppTransferJob::NoError);
+            else
+                terminate(QXmppTransferJob::ProtocolError);
+            break;
+        case QXmppJingleIq::Reason::MediaError:
+            terminate(QXmppTransferJob::FileCorruptError);
+            break;
+        case QXmppJingleIq::Reason::None:
+        case QXmppJingleIq::Reason::Cancel:
+        case QXmppJingleIq::Reason::Decline:
+            terminate(QXmppTransferJob::AbortError);
+            break;
+        default:
+            terminate(QXmppTransferJob::ProtocolError);
+            break;
+        }
+
+    } else {
+
+        // send ack
+        sendAck(iq);
+
+    }
+}
+
+void QXmppJingleFileJob::handleTransport(const QXmppJingleIq::Content &content)
+{
+    if (!content.transportUser().isEmpty()) {
+        m_connection->setRemoteUser(content.transportUser());
+        m_connection->setRemotePassword(content.transportPassword());
+    }
+
+    // candidates may be trickled
+    foreach (const QXmppJingleCandidate &candidate, content.transportCandidates()) {
+        if (m_connection->component(candidate.component()))
+            m_connection->addRemoteCandidate(candidate);
+    }
+
+    // perform ICE negotiation once the transfer was accepted
+    if (d->state != QXmppTransferJob::OfferState && !content.transportCandidates().isEmpty())
+        m_connection->connectToHost();
+}
+
+/// Returns the content describing the file and the local transport, and
+/// marks the local candidates as signalled.
+
+QXmppJingleIq::Content QXmppJingleFileJob::localContent()
+{
+    QXmppJingleIq::Content content;
+    content.setCreator(m_contentCreator);
+    content.setName(m_contentName);
+    content.setSenders(QLatin1String("initiator"));
+
+    // description
+    content.setFileName(d->fileInfo.name());
+    content.setFileSize(d->fileInfo.size());
+    content.setFileDescription(d->fileInfo.description());
+    content.setFileSha256(d->fileInfo.sha256());
+
+    // transport
+    content.setTransportUser(m_connection->localUser());
+    content.setTransportPassword(m_connection->localPassword());
+    content.setTransportCandidates(m_connection->localCandidates());
+    foreach (const QXmppJingleCandidate &candidate, content.transportCandidates())
+        m_signalledCandidates << candidate.id();
+
+    return content;
+}
+
+void QXmppJingleFileJob::sendAck(const QXmppJingleIq &iq)
+{
+    QXmppIq ack;
+    ack.setId(iq.id());
+    ack.setTo(iq.from());
+    ack.setType(QXmppIq::Result);
+    d->client->sendPacket(ack);
+}
+
+/// Hashes the file at \a filePath in a worker thread, then offers it to
+/// the remote party.
+
+void QXmppJingleFileJob::sendOffer(const QString &filePath)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_contentCreator = QLatin1String("initiator");
+    m_contentName = QLatin1String("file");
+
+    d->hasher = new QXmppTransferHasher(filePath, this);
+    check = connect(d->hasher, SIGNAL(finished()),
+                    this, SLOT(_q_hashFinished()));
+    Q_ASSERT(check);
+    d->hasher->start(QThread::LowPriority);
+}
+
+/// Sends a Jingle IQ and adds it to outstanding requests.
+
+void QXmppJingleFileJob::sendRequest(const QXmppJingleIq &iq)
+{
+    m_requests << iq.id();
+    d->client->sendPacket(iq);
+}
+
+void QXmppJingleFileJob::sendTerminate(QXmppJingleIq::Reason::Type reasonType)
+{
+    QXmppJingleIq iq;
+    iq.setTo(d->jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::SessionTerminate);
+    iq.setSid(d->sid);
+    iq.reason().setType(reasonType);
+    sendRequest(iq);
+    m_terminateSent = true;
+}
+
+void QXmppJingleFileJob::_q_channelFinished()
+{
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
+    terminate(QXmppTransferJob::NoError);
+}
+
+void QXmppJingleFileJob::_q_connected()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->state != QXmppTransferJob::StartState)
+        return;
+
+    info(QString("ICE negotiation completed for transfer %1").arg(d->sid));
+    setState(QXmppTransferJob::TransferState);
+
+    if (d->direction == QXmppTransferJob::OutgoingDirection) {
+        check = connect(d->iodevice, SIGNAL(readyRead()),
+                        this, SLOT(_q_sendData()));
+        Q_ASSERT(check);
+
+        _q_sendData();
+    }
+}
+
+void QXmppJingleFileJob::_q_disconnected()
+{
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
+    warning(QString("Could not connect to %1 for transfer %2").arg(d->jid, d->sid));
+    terminate(QXmppTransferJob::ProtocolError);
+}
+
+void QXmppJingleFileJob::_q_hashFinished()
+{
+    QXmppTransferHasher *hasher = d->hasher;
+    if (!hasher)
+        return;
+    d->hasher = 0;
+    hasher->deleteLater();
+
+    if (d->state != QXmppTransferJob::OfferState)
+        return;
+
+    if (hasher->sha256().isEmpty()) {
+        warning(QString("Could not hash %1").arg(d->localFileUrl.toLocalFile()));
+        terminate(QXmppTransferJob::FileAccessError);
+        return;
+    }
+
+    d->fileInfo.setHash(hasher->md5());
+    d->fileInfo.setSha256(hasher->sha256());
+
+    QXmppJingleIq iq;
+    iq.setTo(d->jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::SessionInitiate);
+    iq.setInitiator(d->client->configuration().jid());
+    iq.setSid(d->sid);
+    iq.addContent(localContent());
+    sendRequest(iq);
+    m_sessionStarted = true;
+}
+
+/// Sends the local candidates which were gathered after the session
+/// was initiated or accepted.
+
+void QXmppJingleFileJob::_q_localCandidatesChanged()
+{
+    if (!m_sessionStarted ||
+        d->state == QXmppTransferJob::FinishedState ||
+        (d->direction == QXmppTransferJob::IncomingDirection && d->state == QXmppTransferJob::OfferState))
+        return;
+
+    QList<QXmppJingleCandidate> candidates;
+    foreach (const QXmppJingleCandidate &candidate, m_connection->localCandidates()) {
+        if (!m_signalledCandidates.contains(candidate.id())) {
+            m_signalledCandidates << candidate.id();
+            candidates << candidate;
+        }
+    }
+    if (candidates.isEmpty())
+        return;
+
+    QXmppJingleIq::Content content;
+    content.setCreator(m_contentCreator);
+    content.setName(m_contentName);
+    content.setTransportUser(m_connection->localUser());
+    content.setTransportPassword(m_connection->localPassword());
+    content.setTransportCandidates(candidates);
+
+    QXmppJingleIq iq;
+    iq.setTo(d->jid);
+    iq.setType(QXmppIq::Set);
+    iq.setAction(QXmppJingleIq::TransportInfo);
+    iq.setSid(d->sid);
+    iq.addContent(content);
+    sendRequest(iq);
+}
+
+void QXmppJingleFileJob::_q_readChannelFinished()
+{
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
+    if (d->fileInfo.size() && d->done != d->fileInfo.size())
+        terminate(QXmppTransferJob::FileCorruptError);
+    else if (!d->fileInfo.sha256().isEmpty() && d->sha256.result() != d->fileInfo.sha256())
+        terminate(QXmppTransferJob::FileCorruptError);
+    else
+        terminate(QXmppTransferJob::NoError);
+}
+
+void QXmppJingleFileJob::_q_receiveData()
+{
+    if (d->state == QXmppTransferJob::FinishedState || !d->iodevice)
+        return;
+
+    const QByteArray data = m_channel->readAll();
+    if (d->iodevice->write(data) != data.size()) {
+        warning(QString("Could not write data for transfer %1").arg(d->sid));
+        terminate(QXmppTransferJob::FileAccessError);
+        return;
+    }
+    d->done += data.size();
+    d->sha256.addData(data);
+    emit progress(d->done, d->fileInfo.size());
+}
+
+void QXmppJingleFileJob::_q_sendData()
+{
+    if (d->state != QXmppTransferJob::TransferState)
+        return;
+
+    // keep enough data queued for the congestion window to grow,
+    // without reading the whole file into memory
+    while (m_channel->bytesToWrite() < sendWindow) {
+        d->sendBuffer.resize(d->blockSize);
+        const qint64 length = d->iodevice->read(d->sendBuffer.data(), d->blockSize);
+        if (length < 0) {
+            warning(QString("Could not read data for transfer %1").arg(d->sid));
+            terminate(QXmppTransferJob::FileAccessError);
+            return;
+        } else if (length == 0) {
+            if (d->iodevice->atEnd())
+                m_channel->finish();
+            return;
+        }
+
+        m_channel->write(d->sendBuffer.constData(), length);
+        d->done += length;
+        emit progress(d->done, d->fileInfo.size());
+    }
+}
+
+void QXmppJingleFileJob::_q_stateChanged(QXmppTransferJob::State state)
+{
+    if (state == QXmppTransferJob::StartState && d->direction == QXmppTransferJob::IncomingDirection) {
+
+        // the job was accepted by the local party
+        QXmppJingleIq iq;
+        iq.setTo(d->jid);
+        iq.setType(QXmppIq::Set);
+        iq.setAction(QXmppJingleIq::SessionAccept);
+        iq.setResponder(d->client->configuration().jid());
+        iq.setSid(d->sid);
+        iq.addContent(localContent());
+        sendRequest(iq);
+
+        m_connection->connectToHost();
+
+        // notify user
+        emit m_manager->jobStarted(this);
+
+    } else if (state == QXmppTransferJob::FinishedState) {
+
+        if (m_sessionStarted && !m_remoteTerminated && !m_terminateSent) {
+            QXmppJingleIq::Reason::Type reasonType;
+            switch (d->error) {
+            case QXmppTransferJob::NoError:
+                reasonType = QXmppJingleIq::Reason::Success;
+                break;
+            case QXmppTransferJob::AbortError:
+                reasonType = (d->direction == QXmppTransferJob::IncomingDirection && !d->iodevice) ?
+                    QXmppJingleIq::Reason::Decline : QXmppJingleIq::Reason::Cancel;
+                break;
+            case QXmppTransferJob::FileCorruptError:
+                reasonType = QXmppJingleIq::Reason::MediaError;
+                break;
+            case QXmppTransferJob::FileAccessError:
+                reasonType = QXmppJingleIq::Reason::FailedApplication;
+                break;
+            default:
+                reasonType = QXmppJingleIq::Reason::FailedTransport;
+                break;
+            }
+            sendTerminate(reasonType);
+        }
+
+        // keep acknowledging the end of the stream for a while, in case
+        // our last acknowledgement was lost
+        if (d->direction == QXmppTransferJob::IncomingDirection &&
+            d->error == QXmppTransferJob::NoError &&
+            !m_remoteTerminated)
+            QTimer::singleShot(closeDelay, m_connection, SLOT(close()));
+        else
+            m_connection->close();
+    }
+}
+
+/// Constructs a QXmppJingleFileManager object to handle incoming and
+/// outgoing file transfers.
+
+QXmppJingleFileManager::QXmppJingleFileManager()
+{
+    d = new QXmppJingleFileManagerPrivate;
+}
+
+/// Destroys the QXmppJingleFileManager object.
+
+QXmppJingleFileManager::~QXmppJingleFileManager()
+{
+    delete d;
+}
+
+/// \cond
+QStringList QXmppJingleFileManager::discoveryFeatures() const
+{
+    return QStringList()
+        << ns_jingle                // XEP-0166 : Jingle
+        << ns_jingle_ice_udp        // XEP-0176 : Jingle ICE-UDP Transport Method
+        << ns_jingle_file_transfer; // XEP-0234 : Jingle File Transfer
+}
+
+bool QXmppJingleFileManager::handleStanza(const QDomElement &element)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (element.tagName() != "iq" || !QXmppJingleIq::isJingleIq(element))
+        return false;
+
+    QXmppJingleIq iq;
+    iq.parse(element);
+    if (iq.type() != QXmppIq::Set)
+        return false;
+
+    if (iq.action() == QXmppJingleIq::SessionInitiate) {
+
+        // leave sessions which are not file transfers over ICE-UDP,
+        // such as calls, to other extensions
+        const QXmppJingleIq::Content content = iq.contents().isEmpty() ? QXmppJingleIq::Content() : iq.contents().first();
+        if (content.fileName().isEmpty() || content.transportUser().isEmpty())
+            return false;
+
+        QXmppJingleFileJob *job = new QXmppJingleFileJob(iq.from(), QXmppTransferJob::IncomingDirection, this);
+        job->handleOffer(iq);
+
+        // register job
+        d->jobs << job;
+        check = connect(job, SIGNAL(destroyed(QObject*)),
+                        this, SLOT(_q_jobDestroyed(QObject*)));
+        Q_ASSERT(check);
+
+        check = connect(job, SIGNAL(finished()),
+                        this, SLOT(_q_jobFinished()));
+        Q_ASSERT(check);
+
+        // notify user
+        emit fileReceived(job);
+        return true;
+    }
+
+    // for all other requests, require a valid job
+    QXmppJingleFileJob *job = d->findJob(iq.from(), iq.sid());
+    if (!job)
+        return false;
+
+    job->handleRequest(iq);
+    return true;
+}
+
+void QXmppJingleFileManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(disconnected()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(iqReceived(QXmppIq)),
+                    this, SLOT(_q_iqReceived(QXmppIq)));
+    Q_ASSERT(check);
+}
+/// \endcond
+
+/// Sends the file at \a filePath to a remote party.
+///
+/// The file's hashes are computed in a worker thread, and the transfer
+/// is offered to the remote party once they are known.
+///
+/// Returns 0 if the \a jid is not valid.
+///
+/// \note The recipient's \a jid must be a full JID with a resource, for instance "user@host/resource".
+
+QXmppTransferJob *QXmppJingleFileManager::sendFile(const QString &jid, const QString &filePath, const QString &description)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (QXmppUtils::jidToResource(jid).isEmpty()) {
+        warning("The file recipient's JID must be a full JID");
+        return 0;
+    }
+
+    QFileInfo info(filePath);
+
+    QXmppJingleFileJob *job = new QXmppJingleFileJob(jid, QXmppTransferJob::OutgoingDirection, this);
+    job->d->sid = QXmppUtils::generateStanzaHash();
+    job->d->fileInfo.setDate(info.lastModified());
+    job->d->fileInfo.setName(info.fileName());
+    job->d->fileInfo.setSize(info.size());
+    job->d->fileInfo.setDescription(description);
+    job->setLocalFileUrl(QUrl::fromLocalFile(filePath));
+
+    // register job
+    d->jobs << job;
+    check = connect(job, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(_q_jobDestroyed(QObject*)));
+    Q_ASSERT(check);
+
+    check = connect(job, SIGNAL(finished()),
+                    this, SLOT(_q_jobFinished()));
+    Q_ASSERT(check);
+
+    // notify user
+    emit jobStarted(job);
+
+    // open file
+    QFile *file = new QFile(filePath, job);
+    if (!file->open(QIODevice::ReadOnly)) {
+        warning(QString("Could not read from %1").arg(filePath));
+        job->terminate(QXmppTransferJob::FileAccessError);
+        return job;
+    }
+    job->d->iodevice = file;
+    job->d->deviceIsOwn = true;
+
+    // the file is hashed before the offer is sent
+    job->sendOffer(filePath);
+    return job;
+}
+
+/// Sets the STUN server to use to determine server-reflexive addresses
+/// and ports.
+///
+/// \param host The address of the STUN server.
+/// \param port The port of the STUN server.
+
+void QXmppJingleFileManager::setStunServer(const QHostAddress &host, quint16 port)
+{
+    d->stunHost = host;
+    d->stunPort = port;
+}
+
+/// Sets the TURN server to use to relay packets in double-NAT configurations.
+///
+/// \param host The address of the TURN server.
+/// \param port The port of the TURN server.
+
+void QXmppJingleFileManager::setTurnServer(const QHostAddress &host, quint16 port)
+{
+    d->turnHost = host;
+    d->turnPort = port;
+}
+
+/// Sets the \a transport used to reach the TURN server, use TCP or TLS
+/// on networks which block UDP.
+
+void QXmppJingleFileManager::setTurnTransport(QXmppIceConnection::TurnTransport transport)
+{
+    d->turnTransport = transport;
+}
+
+/// Sets the host \a name of the TURN server, against which its certificate
+/// is verified when using TLS.
+///
+/// \param name
+
+void QXmppJingleFileManager::setTurnServerName(const QString &name)
+{
+    d->turnServerName = name;
+}
+
+/// Sets whether SSL errors should be ignored when reaching the TURN server
+/// over TLS. By default, the TURN allocation fails on SSL errors.
+///
+/// \param ignore
+
+void QXmppJingleFileManager::setTurnIgnoreSslErrors(bool ignore)
+{
+    d->turnIgnoreSslErrors = ignore;
+}
+
+/// Sets the \a user used for authentication with the TURN server.
+///
+/// \param user
+
+void QXmppJingleFileManager::setTurnUser(const QString &user)
+{
+    d->turnUser = user;
+}
+
+/// Sets the \a password used for authentication with the TURN server.
+///
+/// \param password
+
+void QXmppJingleFileManager::setTurnPassword(const QString &password)
+{
+    d->turnPassword = password;
+}
+
+/// Handles disconnection from server.
+
+void QXmppJingleFileManager::_q_disconnected()
+{
+    foreach (QXmppJingleFileJob *job, d->jobs)
+        job->terminate(QXmppTransferJob::AbortError);
+}
+
+/// Handles acknowledgements.
+
+void QXmppJingleFileManager::_q_iqReceived(const QXmppIq &iq)
+{
+    foreach (QXmppJingleFileJob *job, d->jobs)
+        if (job->handleAck(iq))
+            return;
+}
+
+void QXmppJingleFileManager::_q_jobDestroyed(QObject *object)
+{
+    d->jobs.removeAll(static_cast<QXmppJingleFileJob*>(object));
+}
+
+void QXmppJingleFileManager::_q_jobFinished()
+{
+    QXmppTransferJob *job = qobject_cast<QXmppTransferJob *>(sender());
+    if (!job)
+        return;
+
+    emit jobFinished(job);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPJINGLEFILEMANAGER_H
+#define QXMPPJINGLEFILEMANAGER_H
+
+#include "QXmppClientExtension.h"
+#include "QXmppStun.h"
+#include "QXmppTransferManager.h"
+
+class QHostAddress;
+class QXmppIq;
+class QXmppJingleFileManagerPrivate;
+
+/// \brief The QXmppJingleFileManager class provides support for sending and
+/// receiving files over a direct peer-to-peer connection.
+///
+/// Session initiation is performed as described by XEP-0166: Jingle and
+/// XEP-0234: Jingle File Transfer. The connection is established using
+/// XEP-0176: Jingle ICE-UDP Transport Method, which allows transfers
+/// between parties which are both behind NATs, and the file data is sent
+/// reliably over UDP with congestion control.
+///
+/// \note Sending file data over ICE-UDP is not covered by XEP-0234, so
+/// this is only interoperable with other QXmpp clients. Use
+/// QXmppTransferManager to exchange files with other clients.
+///
+/// To make use of this manager, you need to instantiate it and load it into
+/// the QXmppClient instance as follows:
+///
+/// \code
+/// QXmppJingleFileManager *manager = new QXmppJingleFileManager;
+/// client->addExtension(manager);
+/// \endcode
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppJingleFileManager : public QXmppClientExtension
+{
+    Q_OBJECT
+
+public:
+    QXmppJingleFileManager();
+    ~QXmppJingleFileManager();
+
+    void setStunServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnTransport(QXmppIceConnection::TurnTransport transport);
+    void setTurnUser(const QString &user);
+    void setTurnPassword(const QString &password);
+    void setTurnServerName(const QString &name);
+    void setTurnIgnoreSslErrors(bool ignore);
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &element);
+    /// \endcond
+
+signals:
+    /// This signal is emitted when a new file transfer offer is received.
+    ///
+    /// To accept the transfer job, call the job's QXmppTransferJob::accept() method.
+    /// To refuse the transfer job, call the job's QXmppTransferJob::abort() method.
+    void fileReceived(QXmppTransferJob *job);
+
+    /// This signal is emitted whenever a transfer job is started.
+    void jobStarted(QXmppTransferJob *job);
+
+    /// This signal is emitted whenever a transfer job is finished.
+    ///
+    /// \sa QXmppTransferJob::finished()
+    void jobFinished(QXmppTransferJob *job);
+
+public slots:
+    QXmppTransferJob *sendFile(const QString &jid, const QString &filePath, const QString &description = QString());
+
+protected:
+    /// \cond
+    void setClient(QXmppClient* client);
+    /// \endcond
+
+private slots:
+    void _q_disconnected();
+    void _q_iqReceived(const QXmppIq &iq);
+    void _q_jobDestroyed(QObject *object);
+    void _q_jobFinished();
+
+private:
+    QXmppJingleFileManagerPrivate *d;
+    friend class QXmppJingleFileJob;
+};
+
+#endif
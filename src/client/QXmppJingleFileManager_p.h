@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPJINGLEFILEMANAGER_P_H
+#define QXMPPJINGLEFILEMANAGER_P_H
+
+#include <QSet>
+#include <QStringList>
+
+#include "QXmppJingleIq.h"
+#include "QXmppTransferManager.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppJingleFileManager class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class QXmppIceConnection;
+class QXmppJingleFileManager;
+class QXmppReliableChannel;
+
+/// \internal
+///
+/// The QXmppJingleFileJob class represents a file transfer negotiated
+/// using XEP-0234: Jingle File Transfer, whose data is carried by a
+/// QXmppReliableChannel over an ICE connection.
+///
+
+class QXmppJingleFileJob : public QXmppTransferJob
+{
+    Q_OBJECT
+
+public:
+    QXmppJingleFileJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppJingleFileManager *manager);
+
+    bool handleAck(const QXmppIq &iq);
+    void handleOffer(const QXmppJingleIq &iq);
+    void handleRequest(const QXmppJingleIq &iq);
+    void sendOffer(const QString &filePath);
+
+private slots:
+    void _q_channelFinished();
+    void _q_connected();
+    void _q_disconnected();
+    void _q_hashFinished();
+    void _q_localCandidatesChanged();
+    void _q_readChannelFinished();
+    void _q_receiveData();
+    void _q_sendData();
+    void _q_stateChanged(QXmppTransferJob::State state);
+
+private:
+    QXmppJingleIq::Content localContent();
+    void handleTransport(const QXmppJingleIq::Content &content);
+    void sendAck(const QXmppJingleIq &iq);
+    void sendRequest(const QXmppJingleIq &iq);
+    void sendTerminate(QXmppJingleIq::Reason::Type reasonType);
+
+    QXmppJingleFileManager *m_manager;
+    QXmppIceConnection *m_connection;
+    QXmppReliableChannel *m_channel;
+    QString m_contentCreator;
+    QString m_contentName;
+    bool m_remoteTerminated;
+    bool m_sessionStarted;
+    bool m_terminateSent;
+    QStringList m_requests;
+    QSet<QString> m_signalledCandidates;
+};
+
+#endif
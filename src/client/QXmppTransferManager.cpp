@@ -28,14 +28,18 @@
 #include <QHash>
 #include <QHostAddress>
 #include <QNetworkInterface>
+#include <QSslSocket>
 #include <QTime>
 #include <QTimer>
 #include <QUrl>
 
 #include "QXmppByteStreamIq.h"
+#include "QXmppByteStream_p.h"
 #include "QXmppClient.h"
 #include "QXmppConstants_p.h"
 #include "QXmppIbbIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPingIq.h"
 #include "QXmppSocks.h"
 #include "QXmppStreamInitiationIq_p.h"
 #include "QXmppStun.h"
@@ -43,15 +47,76 @@
 #include "QXmppTransferManager_p.h"
 #include "QXmppUtils.h"
 
+#if defined(Q_OS_LINUX)
+#define QXMPP_USE_SENDFILE
+#include <errno.h>
+#include <sys/sendfile.h>
+#endif
+
 // time to try to connect to a SOCKS host (7 seconds)
 const int socksTimeout = 7000;
 
-static QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
+// delay before trying the next SOCKS host in parallel (250 ms)
+const int socksStagger = 250;
+
+// size of the chunks read when hashing a file (4 MiB)
+const qint64 hashChunkSize = 4 * 1024 * 1024;
+
+// largest block size for SOCKS5 bytestreams (1 MiB)
+const int socksMaxBlockSize = 1024 * 1024;
+
+// number of times an in-band data block is resent when the
+// recipient asks us to wait
+const int ibbMaxResends = 3;
+
+// number of out-of-order in-band data blocks kept by the recipient
+const quint16 ibbReorderLimit = 256;
+
+// smallest amount of data sent at once by a rate-limited job (1 KiB)
+const qint64 rateMinQuantum = 1024;
+
+// interval at which rate-limited jobs are resumed (20 ms)
+const int rateInterval = 20;
+
+#ifdef QXMPP_USE_SENDFILE
+// Sends up to \a count bytes from \a device to \a socket without copying
+// them through user space. Returns the number of bytes sent, 0 if the
+// socket cannot accept more data, or -1 if the fast path cannot be used.
+static qint64 sendFileToSocket(QIODevice *device, QTcpSocket *socket, qint64 count)
+{
+    QFile *file = qobject_cast<QFile*>(device);
+    QSslSocket *sslSocket = qobject_cast<QSslSocket*>(socket);
+    if (!file || file->handle() < 0 || file->isSequential() ||
+        (sslSocket && sslSocket->isEncrypted()) ||
+        socket->socketDescriptor() < 0)
+        return -1;
+
+    const qint64 pos = file->pos();
+    off_t offset = pos;
+    const ssize_t sent = ::sendfile(socket->socketDescriptor(), file->handle(), &offset, count);
+    if (sent < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    file->seek(pos + sent);
+    return sent;
+}
+#endif
+
+// Adds the tokens earned since \a stamp to a bucket which is filled
+// at \a rate bytes per second. A negative \a stamp means the bucket
+// was never used and starts full.
+static void refillBucket(qreal &tokens, qint64 &stamp, qint64 rate, qint64 now)
 {
-    QCryptographicHash hash(QCryptographicHash::Sha1);
-    QString str = sid + initiatorJid + targetJid;
-    hash.addData(str.toLatin1());
-    return hash.result().toHex();
+    if (stamp < 0)
+        tokens = rateQuantum(rate, rateMinQuantum);
+    else
+        tokens = qMin(qreal(rateQuantum(rate, rateMinQuantum)), tokens + (now - stamp) * rate / 1000.0);
+    stamp = now;
+}
+
+static bool jobHasHigherPriority(QXmppTransferJob *job1, QXmppTransferJob *job2)
+{
+    return job1->priority() > job2->priority();
 }
 
 class QXmppTransferFileInfoPrivate : public QSharedData
@@ -61,13 +126,22 @@ public:
 
     QDateTime date;
     QByteArray hash;
+    QByteArray sha256;
     QString name;
     QString description;
     qint64 size;
+
+    // XEP-0096: ranged transfers
+    bool rangeSupported;
+    qint64 rangeOffset;
+    qint64 rangeLength;
 };
 
 QXmppTransferFileInfoPrivate::QXmppTransferFileInfoPrivate()
     : size(0)
+    , rangeSupported(false)
+    , rangeOffset(0)
+    , rangeLength(0)
 {
 }
 
@@ -105,6 +179,20 @@ void QXmppTransferFileInfo::setHash(const QByteArray &hash)
     d->hash = hash;
 }
 
+/// Returns the SHA-256 hash of the file, as defined by XEP-0300.
+
+QByteArray QXmppTransferFileInfo::sha256() const
+{
+    return d->sha256;
+}
+
+/// Sets the SHA-256 hash of the file, as defined by XEP-0300.
+
+void QXmppTransferFileInfo::setSha256(const QByteArray &sha256)
+{
+    d->sha256 = sha256;
+}
+
 QString QXmppTransferFileInfo::name() const
 {
     return d->name;
@@ -135,13 +223,64 @@ void QXmppTransferFileInfo::setSize(qint64 size)
     d->size = size;
 }
 
+/// Returns whether the sender supports ranged transfers, which allow
+/// the recipient to resume an interrupted transfer.
+
+bool QXmppTransferFileInfo::isRangeSupported() const
+{
+    return d->rangeSupported;
+}
+
+/// Sets whether the sender supports ranged transfers.
+
+void QXmppTransferFileInfo::setRangeSupported(bool supported)
+{
+    d->rangeSupported = supported;
+}
+
+/// Returns the position in the file at which the recipient wants
+/// the transfer to start.
+
+qint64 QXmppTransferFileInfo::rangeOffset() const
+{
+    return d->rangeOffset;
+}
+
+/// Sets the position in the file at which the recipient wants
+/// the transfer to start.
+
+void QXmppTransferFileInfo::setRangeOffset(qint64 offset)
+{
+    d->rangeOffset = offset;
+}
+
+/// Returns the number of bytes the recipient wants to receive,
+/// or 0 for the rest of the file.
+
+qint64 QXmppTransferFileInfo::rangeLength() const
+{
+    return d->rangeLength;
+}
+
+/// Sets the number of bytes the recipient wants to receive,
+/// or 0 for the rest of the file.
+
+void QXmppTransferFileInfo::setRangeLength(qint64 length)
+{
+    d->rangeLength = length;
+}
+
 bool QXmppTransferFileInfo::isNull() const
 {
     return d->date.isNull()
         && d->description.isEmpty()
         && d->hash.isEmpty()
+        && d->sha256.isEmpty()
         && d->name.isEmpty()
-        && d->size == 0;
+        && d->size == 0
+        && !d->rangeSupported
+        && d->rangeOffset == 0
+        && d->rangeLength == 0;
 }
 
 QXmppTransferFileInfo& QXmppTransferFileInfo::operator=(const QXmppTransferFileInfo &other)
@@ -154,6 +293,7 @@ bool QXmppTransferFileInfo::operator==(const QXmppTransferFileInfo &other) const
 {
     return other.d->size == d->size &&
         other.d->hash == d->hash &&
+        other.d->sha256 == d->sha256 &&
         other.d->name == d->name;
 }
 
@@ -164,6 +304,23 @@ void QXmppTransferFileInfo::parse(const QDomElement &element)
     d->name = element.attribute("name");
     d->size = element.attribute("size").toLongLong();
     d->description = element.firstChildElement("desc").text();
+
+    QDomElement rangeElement = element.firstChildElement("range");
+    d->rangeSupported = !rangeElement.isNull();
+    d->rangeOffset = rangeElement.attribute("offset").toLongLong();
+    d->rangeLength = rangeElement.attribute("length").toLongLong();
+
+    // XEP-0300: Use of Cryptographic Hash Functions in XMPP
+    d->sha256.clear();
+    QDomElement hashElement = element.firstChildElement("hash");
+    while (!hashElement.isNull()) {
+        if (hashElement.namespaceURI() == ns_hashes &&
+            hashElement.attribute("algo") == QLatin1String("sha-256")) {
+            d->sha256 = QByteArray::fromBase64(hashElement.text().toLatin1());
+            break;
+        }
+        hashElement = hashElement.nextSiblingElement("hash");
+    }
 }
 
 void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
@@ -178,64 +335,111 @@ void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
         writer->writeAttribute("name", d->name);
     if (d->size > 0)
         writer->writeAttribute("size", QString::number(d->size));
+    if (!d->sha256.isEmpty()) {
+        writer->writeStartElement("hash");
+        writer->writeAttribute("xmlns", ns_hashes);
+        writer->writeAttribute("algo", "sha-256");
+        writer->writeCharacters(d->sha256.toBase64());
+        writer->writeEndElement();
+    }
     if (!d->description.isEmpty())
         writer->writeTextElement("desc", d->description);
+    if (d->rangeSupported || d->rangeOffset > 0 || d->rangeLength > 0) {
+        writer->writeStartElement("range");
+        if (d->rangeOffset > 0)
+            writer->writeAttribute("offset", QString::number(d->rangeOffset));
+        if (d->rangeLength > 0)
+            writer->writeAttribute("length", QString::number(d->rangeLength));
+        writer->writeEndElement();
+    }
     writer->writeEndElement();
 }
 
-class QXmppTransferJobPrivate
-{
-public:
-    QXmppTransferJobPrivate();
-
-    int blockSize;
-    QXmppClient *client;
-    QXmppTransferJob::Direction direction;
-    qint64 done;
-    QXmppTransferJob::Error error;
-    QCryptographicHash hash;
-    QIODevice *iodevice;
-    QString offerId;
-    QString jid;
-    QUrl localFileUrl;
-    QString sid;
-    QXmppTransferJob::Method method;
-    QString mimeType;
-    QString requestId;
-    QXmppTransferJob::State state;
-    QTime transferStart;
-    bool deviceIsOwn;
-
-    // file meta-data
-    QXmppTransferFileInfo fileInfo;
-
-    // for in-band bytestreams
-    int ibbSequence;
-
-    // for socks5 bytestreams
-    QTcpSocket *socksSocket;
-    QXmppByteStreamIq::StreamHost socksProxy;
-};
-
-QXmppTransferJobPrivate::QXmppTransferJobPrivate()
+QXmppTransferJobPrivate::QXmppTransferJobPrivate(QXmppTransferJob *qq)
     : blockSize(16384),
     client(0),
     direction(QXmppTransferJob::IncomingDirection),
     done(0),
     error(QXmppTransferJob::NoError),
     hash(QCryptographicHash::Md5),
+    sha256(QCryptographicHash::Sha256),
+    hasher(0),
     iodevice(0),
+    rangeOffset(0),
     method(QXmppTransferJob::NoMethod),
+    priority(QXmppTransferJob::NormalPriority),
     state(QXmppTransferJob::OfferState),
     deviceIsOwn(false),
+    maximumRate(0),
+    rateTokens(0),
+    rateStamp(-1),
+    scheduler(0),
+    requestIndex(0),
     ibbSequence(0),
-    socksSocket(0)
+    ibbMessages(false),
+    ibbWindow(1),
+    socksSocket(0),
+    q(qq)
+{
+}
+
+/// Returns true if \a id is the identifier of a request awaiting an answer.
+
+bool QXmppTransferJobPrivate::hasRequestId(const QString &id) const
 {
+    return requestId == id
+        || ibbPending.contains(id)
+        || (!ibbPingId.isEmpty() && ibbPingId == id);
+}
+
+/// Sets the identifier of the request awaiting an answer from \a jid.
+
+void QXmppTransferJobPrivate::setRequestId(const QString &jid, const QString &id)
+{
+    updateRequestIndex(qMakePair(requestJid, requestId), qMakePair(jid, id));
+    requestJid = jid;
+    requestId = id;
+}
+
+/// Sets the identifier of the ping sent after a window of
+/// in-band data messages.
+
+void QXmppTransferJobPrivate::setIbbPingId(const QString &id)
+{
+    updateRequestIndex(qMakePair(jid, ibbPingId), qMakePair(jid, id));
+    ibbPingId = id;
+}
+
+/// Records the in-band data \a iq as awaiting an acknowledgement.
+
+void QXmppTransferJobPrivate::addIbbPending(const QXmppIbbDataIq &iq)
+{
+    ibbPending.insert(iq.id(), iq);
+    updateRequestIndex(qMakePair(QString(), QString()), qMakePair(jid, iq.id()));
+}
+
+/// Removes and returns the in-band data IQ sent in the request \a id.
+
+QXmppIbbDataIq QXmppTransferJobPrivate::takeIbbPending(const QString &id)
+{
+    updateRequestIndex(qMakePair(jid, id), qMakePair(QString(), QString()));
+    return ibbPending.take(id);
+}
+
+void QXmppTransferJobPrivate::updateRequestIndex(const QPair<QString, QString> &oldKey, const QPair<QString, QString> &newKey)
+{
+    if (!requestIndex)
+        return;
+
+    if (!oldKey.second.isEmpty() && requestIndex->value(oldKey) == q)
+        requestIndex->remove(oldKey);
+    if (!newKey.second.isEmpty())
+        requestIndex->insert(newKey, q);
 }
 
 QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppClient *client, QObject *parent)
     : QXmppLoggable(parent),
-    d(new QXmppTransferJobPrivate)
+    d(new QXmppTransferJobPrivate(this))
 {
     d->client = client;
     d->direction = direction;
@@ -276,6 +480,38 @@ void QXmppTransferJob::accept(const QString &filePath)
     }
 }
 
+/// Call this method if you wish to accept an incoming transfer job,
+/// resuming the transfer from the data already in \a filePath.
+///
+/// If the sender does not support ranged transfers, or if the file
+/// at \a filePath is not a partial copy, the whole file is received.
+
+void QXmppTransferJob::resume(const QString &filePath)
+{
+    if (d->direction == IncomingDirection && d->state == OfferState && !d->iodevice)
+    {
+        QFile *file = new QFile(filePath, this);
+        const qint64 offset = file->exists() ? file->size() : 0;
+        const bool partial = d->fileInfo.isRangeSupported() && offset > 0 && offset < d->fileInfo.size();
+        if (!file->open(partial ? (QIODevice::WriteOnly | QIODevice::Append) : QIODevice::WriteOnly))
+        {
+            warning(QString("Could not write to %1").arg(filePath));
+            abort();
+            return;
+        }
+
+        if (partial) {
+            info(QString("Resuming transfer of %1 at %2").arg(filePath, QString::number(offset)));
+            d->rangeOffset = offset;
+            d->done = offset;
+        }
+
+        d->iodevice = file;
+        setLocalFileUrl(QUrl::fromLocalFile(filePath));
+        setState(QXmppTransferJob::StartState);
+    }
+}
+
 /// Call this method if you wish to accept an incoming transfer job.
 ///
 
@@ -379,6 +615,48 @@ QString QXmppTransferJob::sid() const
     return d->sid;
 }
 
+/// Returns the maximum rate at which the job sends data, in bytes
+/// per second, or 0 if it is not limited.
+///
+
+qint64 QXmppTransferJob::maximumRate() const
+{
+    return d->maximumRate;
+}
+
+/// Sets the maximum rate at which the job sends data, in bytes per second.
+///
+/// The default is 0, which means the job is only limited by
+/// QXmppTransferManager::maximumRate(). Only outgoing jobs are limited.
+///
+
+void QXmppTransferJob::setMaximumRate(qint64 rate)
+{
+    d->maximumRate = qMax(qint64(0), rate);
+    d->rateStamp = -1;
+}
+
+/// Returns the job's priority.
+///
+
+QXmppTransferJob::Priority QXmppTransferJob::priority() const
+{
+    return d->priority;
+}
+
+/// Sets the job's priority.
+///
+/// When QXmppTransferManager::maximumActiveJobs() is reached, queued jobs
+/// with a higher priority are offered first. When the bandwidth is limited
+/// by QXmppTransferManager::maximumRate(), jobs with a higher priority are
+/// served first. The default is NormalPriority.
+///
+
+void QXmppTransferJob::setPriority(QXmppTransferJob::Priority priority)
+{
+    d->priority = priority;
+}
+
 /// Returns the job's transfer speed in bytes per second.
 ///
 /// If the transfer has not started yet or is already finished, returns 0.
@@ -428,6 +706,14 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
     d->error = cause;
     d->state = FinishedState;
 
+    // stop hashing
+    if (d->hasher)
+        d->hasher->cancel();
+
+    // stop waiting for bandwidth
+    if (d->scheduler)
+        d->scheduler->removeJob(this);
+
     // close IO device
     if (d->iodevice && d->deviceIsOwn)
         d->iodevice->close();
@@ -444,17 +730,115 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
 }
 
 /// \cond
+QXmppTransferHasher::QXmppTransferHasher(const QString &filePath, QObject *parent)
+    : QThread(parent)
+    , m_filePath(filePath)
+    , m_cancelled(0)
+{
+}
+
+QXmppTransferHasher::~QXmppTransferHasher()
+{
+    cancel();
+    wait();
+}
+
+void QXmppTransferHasher::cancel()
+{
+    m_cancelled.fetchAndStoreOrdered(1);
+}
+
+/// Returns the MD5 hash of the file, or an empty array if hashing failed.
+
+QByteArray QXmppTransferHasher::md5() const
+{
+    return m_md5;
+}
+
+/// Returns the SHA-256 hash of the file, or an empty array if hashing failed.
+
+QByteArray QXmppTransferHasher::sha256() const
+{
+    return m_sha256;
+}
+
+void QXmppTransferHasher::run()
+{
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    // compute both hashes in a single pass, mapping the file in chunks
+    // rather than copying it through a buffer whenever possible
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    QCryptographicHash sha256(QCryptographicHash::Sha256);
+    QByteArray buffer;
+    const qint64 size = file.size();
+    for (qint64 offset = 0; offset < size; offset += hashChunkSize) {
+        if (m_cancelled.load())
+            return;
+
+        const qint64 length = qMin(hashChunkSize, size - offset);
+        uchar *data = file.map(offset, length);
+        if (data) {
+            md5.addData(reinterpret_cast<const char*>(data), length);
+            sha256.addData(reinterpret_cast<const char*>(data), length);
+            file.unmap(data);
+        } else {
+            if (!file.seek(offset))
+                return;
+            buffer = file.read(length);
+            if (buffer.size() != length)
+                return;
+            md5.addData(buffer);
+            sha256.addData(buffer);
+        }
+    }
+
+    m_md5 = md5.result();
+    m_sha256 = sha256.result();
+}
+
 QXmppTransferIncomingJob::QXmppTransferIncomingJob(const QString& jid, QXmppClient* client, QObject* parent)
     : QXmppTransferJob(jid, IncomingDirection, client, parent)
-    , m_candidateClient(0)
     , m_candidateTimer(0)
 {
 }
 
 void QXmppTransferIncomingJob::checkData()
 {
-    if ((d->fileInfo.size() && d->done != d->fileInfo.size()) ||
-        (!d->fileInfo.hash().isEmpty() && d->hash.result() != d->fileInfo.hash()))
+    bool check;
+    Q_UNUSED(check);
+
+    // the file is already being verified
+    if (d->hasher)
+        return;
+
+    if (d->fileInfo.size() && d->done != d->fileInfo.size()) {
+        terminate(QXmppTransferJob::FileCorruptError);
+        return;
+    }
+
+    // the data received before the transfer was resumed was not hashed,
+    // so verify the whole file in a worker thread
+    const QString filePath = d->localFileUrl.toLocalFile();
+    if (d->rangeOffset > 0 && !filePath.isEmpty() &&
+        (!d->fileInfo.sha256().isEmpty() || !d->fileInfo.hash().isEmpty())) {
+        QFile *file = qobject_cast<QFile*>(d->iodevice);
+        if (file)
+            file->flush();
+
+        d->hasher = new QXmppTransferHasher(filePath, this);
+        check = connect(d->hasher, SIGNAL(finished()),
+                        this, SLOT(_q_hashFinished()));
+        Q_ASSERT(check);
+        d->hasher->start(QThread::LowPriority);
+        return;
+    }
+
+    if (d->rangeOffset == 0 &&
+        ((!d->fileInfo.sha256().isEmpty() && d->sha256.result() != d->fileInfo.sha256()) ||
+         (d->fileInfo.sha256().isEmpty() && !d->fileInfo.hash().isEmpty() && d->hash.result() != d->fileInfo.hash())))
         terminate(QXmppTransferJob::FileCorruptError);
     else
         terminate(QXmppTransferJob::NoError);
@@ -465,7 +849,18 @@ void QXmppTransferIncomingJob::connectToNextHost()
     bool check;
     Q_UNUSED(check);
 
+    if (d->state == QXmppTransferJob::FinishedState) {
+        m_candidateTimer->stop();
+        return;
+    }
+
     if (m_streamCandidates.isEmpty()) {
+        m_candidateTimer->stop();
+
+        // wait for the pending connection attempts
+        if (!m_candidates.isEmpty())
+            return;
+
         // could not connect to any stream host
         QXmppByteStreamIq response;
         response.setId(m_streamOfferId);
@@ -481,37 +876,43 @@ void QXmppTransferIncomingJob::connectToNextHost()
     }
 
     // try next host
-    m_candidateHost = m_streamCandidates.takeFirst();
+    const QXmppByteStreamIq::StreamHost streamHost = m_streamCandidates.takeFirst();
     info(QString("Connecting to streamhost: %1 (%2 %3)").arg(
-            m_candidateHost.jid(),
-            m_candidateHost.host(),
-            QString::number(m_candidateHost.port())));
+            streamHost.jid(),
+            streamHost.host(),
+            QString::number(streamHost.port())));
 
     const QString hostName = streamHash(d->sid,
                                         d->jid,
                                         d->client->configuration().jid());
 
     // try to connect to stream host
-    m_candidateClient = new QXmppSocksClient(m_candidateHost.host(), m_candidateHost.port(), this);
-    m_candidateTimer = new QTimer(this);
+    QXmppSocksClient *candidateClient = new QXmppSocksClient(streamHost.host(), streamHost.port(), this);
+    QTimer *timeoutTimer = new QTimer(this);
+    m_candidates.insert(candidateClient, streamHost);
+    m_candidateTimeouts.insert(candidateClient, timeoutTimer);
 
-    check = connect(m_candidateClient, SIGNAL(disconnected()),
+    check = connect(candidateClient, SIGNAL(disconnected()),
                     this, SLOT(_q_candidateDisconnected()));
     Q_ASSERT(check);
 
-    check = connect(m_candidateClient, SIGNAL(ready()),
+    check = connect(candidateClient, SIGNAL(ready()),
                     this, SLOT(_q_candidateReady()));
     Q_ASSERT(check);
 
-    check = connect(m_candidateTimer, SIGNAL(timeout()),
+    check = connect(timeoutTimer, SIGNAL(timeout()),
                     this, SLOT(_q_candidateDisconnected()));
     Q_ASSERT(check);
 
-    m_candidateTimer->setSingleShot(true);
-    m_candidateTimer->start(socksTimeout);
-    m_candidateClient->connectToHost(hostName, 0);
+    timeoutTimer->setSingleShot(true);
+    timeoutTimer->start(socksTimeout);
+    candidateClient->connectToHost(hostName, 0);
 }
 
+/// Tries the offered stream hosts in parallel, starting a new connection
+/// attempt every socksStagger milliseconds or as soon as an attempt fails,
+/// and keeps the first one to succeed.
+
 void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq)
 {
     bool check;
@@ -521,6 +922,15 @@ void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq)
     m_streamOfferId = iq.id();
     m_streamOfferFrom = iq.from();
 
+    if (!m_candidateTimer) {
+        m_candidateTimer = new QTimer(this);
+        m_candidateTimer->setInterval(socksStagger);
+        check = connect(m_candidateTimer, SIGNAL(timeout()),
+                        this, SLOT(_q_connectToNextHost()));
+        Q_ASSERT(check);
+    }
+    m_candidateTimer->start();
+
     connectToNextHost();
 }
 
@@ -530,30 +940,85 @@ bool QXmppTransferIncomingJob::writeData(const QByteArray &data)
     if (written < 0)
         return false;
     d->done += written;
-    if (!d->fileInfo.hash().isEmpty())
-        d->hash.addData(data);
+
+    // prefer the strongest hash offered by the sender, a resumed
+    // transfer is verified once the whole file has been received
+    if (d->rangeOffset == 0) {
+        if (!d->fileInfo.sha256().isEmpty())
+            d->sha256.addData(data);
+        else if (!d->fileInfo.hash().isEmpty())
+            d->hash.addData(data);
+    }
     progress(d->done, d->fileInfo.size());
     return true;
 }
 
+/// Writes the in-band data block with the given \a sequence number.
+///
+/// Blocks received ahead of sequence, for instance because the sender
+/// had to resend a block, are kept until the missing blocks arrive.
+/// Returns false if the block is too far out of sequence.
+
+bool QXmppTransferIncomingJob::writeIbbData(quint16 sequence, const QByteArray &data)
+{
+    const quint16 offset = sequence - d->ibbSequence;
+    if (offset == 0) {
+        if (!writeData(data))
+            return false;
+        d->ibbSequence++;
+
+        // flush blocks which were received out of sequence
+        while (d->ibbReorder.contains(d->ibbSequence)) {
+            if (!writeData(d->ibbReorder.take(d->ibbSequence)))
+                return false;
+            d->ibbSequence++;
+        }
+        return true;
+    } else if (offset < ibbReorderLimit) {
+        d->ibbReorder.insert(sequence, data);
+        return true;
+    } else if (offset >= 0x8000) {
+        // the block was already received
+        return true;
+    }
+    return false;
+}
+
 void QXmppTransferIncomingJob::_q_candidateReady()
 {
     bool check;
     Q_UNUSED(check);
 
-    if (!m_candidateClient)
+    QXmppSocksClient *candidateClient = qobject_cast<QXmppSocksClient*>(sender());
+    if (!candidateClient || !m_candidates.contains(candidateClient))
         return;
 
+    const QXmppByteStreamIq::StreamHost streamHost = takeCandidate(candidateClient);
+
+    // the job was aborted while connecting
+    if (d->state == QXmppTransferJob::FinishedState) {
+        candidateClient->disconnect(this);
+        candidateClient->deleteLater();
+        return;
+    }
+
     info(QString("Connected to streamhost: %1 (%2 %3)").arg(
-            m_candidateHost.jid(),
-            m_candidateHost.host(),
-            QString::number(m_candidateHost.port())));
+            streamHost.jid(),
+            streamHost.host(),
+            QString::number(streamHost.port())));
+
+    // cancel the other connection attempts
+    m_candidateTimer->stop();
+    m_streamCandidates.clear();
+    foreach (QXmppSocksClient *client, m_candidates.keys()) {
+        takeCandidate(client);
+        client->disconnect(this);
+        client->deleteLater();
+    }
 
     setState(QXmppTransferJob::TransferState);
-    d->socksSocket = m_candidateClient;
-    m_candidateClient = 0;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = 0;
+    d->socksSocket = candidateClient;
+    candidateClient->disconnect(this);
 
     check = connect(d->socksSocket, SIGNAL(readyRead()),
                     this, SLOT(_q_receiveData()));
@@ -568,26 +1033,46 @@ void QXmppTransferIncomingJob::_q_candidateReady()
     ackIq.setTo(m_streamOfferFrom);
     ackIq.setType(QXmppIq::Result);
     ackIq.setSid(d->sid);
-    ackIq.setStreamHostUsed(m_candidateHost.jid());
+    ackIq.setStreamHostUsed(streamHost.jid());
     d->client->sendPacket(ackIq);
 }
 
 void QXmppTransferIncomingJob::_q_candidateDisconnected()
 {
-    if (!m_candidateClient)
+    // the signal comes either from the client or from its timeout timer
+    QXmppSocksClient *candidateClient = qobject_cast<QXmppSocksClient*>(sender());
+    if (!candidateClient)
+        candidateClient = m_candidateTimeouts.key(qobject_cast<QTimer*>(sender()));
+    if (!candidateClient || !m_candidates.contains(candidateClient))
         return;
 
+    const QXmppByteStreamIq::StreamHost streamHost = takeCandidate(candidateClient);
     warning(QString("Failed to connect to streamhost: %1 (%2 %3)").arg(
-            m_candidateHost.jid(),
-            m_candidateHost.host(),
-            QString::number(m_candidateHost.port())));
+            streamHost.jid(),
+            streamHost.host(),
+            QString::number(streamHost.port())));
 
-    m_candidateClient->deleteLater();
-    m_candidateClient = 0;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = 0;
+    candidateClient->disconnect(this);
+    candidateClient->deleteLater();
 
-    // try next host
+    // try next host without waiting
+    connectToNextHost();
+}
+
+// Stops tracking a connection attempt and discards its timeout timer.
+QXmppByteStreamIq::StreamHost QXmppTransferIncomingJob::takeCandidate(QXmppSocksClient *candidateClient)
+{
+    QTimer *timeoutTimer = m_candidateTimeouts.take(candidateClient);
+    if (timeoutTimer) {
+        // the timer may be the sender of the current signal
+        timeoutTimer->stop();
+        timeoutTimer->deleteLater();
+    }
+    return m_candidates.take(candidateClient);
+}
+
+void QXmppTransferIncomingJob::_q_connectToNextHost()
+{
     connectToNextHost();
 }
 
@@ -599,6 +1084,25 @@ void QXmppTransferIncomingJob::_q_disconnected()
     checkData();
 }
 
+void QXmppTransferIncomingJob::_q_hashFinished()
+{
+    QXmppTransferHasher *hasher = d->hasher;
+    if (!hasher)
+        return;
+    d->hasher = 0;
+    hasher->deleteLater();
+
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
+    bool valid;
+    if (!d->fileInfo.sha256().isEmpty())
+        valid = (hasher->sha256() == d->fileInfo.sha256());
+    else
+        valid = (hasher->md5() == d->fileInfo.hash());
+    terminate(valid ? QXmppTransferJob::NoError : QXmppTransferJob::FileCorruptError);
+}
+
 void QXmppTransferIncomingJob::_q_receiveData()
 {
     if (d->state != QXmppTransferJob::TransferState)
@@ -648,6 +1152,184 @@ void QXmppTransferOutgoingJob::connectToProxy()
     socksClient->connectToHost(hostName, 0);
 }
 
+/// Resends the in-band data block which was sent in the request \a id.
+///
+/// Returns false if the block was already resent too many times.
+
+bool QXmppTransferOutgoingJob::resendIbbData(const QString &id)
+{
+    if (!d->ibbPending.contains(id))
+        return false;
+
+    QXmppIbbDataIq dataIq = d->takeIbbPending(id);
+    int &resends = d->ibbResends[dataIq.sequence()];
+    if (resends >= ibbMaxResends)
+        return false;
+    resends++;
+
+    debug(QString("Resending in-band data block %1").arg(dataIq.sequence()));
+    dataIq.setId(QXmppUtils::generateStanzaHash());
+    d->addIbbPending(dataIq);
+    d->client->sendPacket(dataIq);
+    return true;
+}
+
+/// Sends in-band data blocks until the window is full, then closes the
+/// bytestream once all the data has been sent and acknowledged.
+///
+/// Data blocks sent in message stanzas are not acknowledged, so after each
+/// window an XMPP ping is sent to the recipient and the next window is
+/// only sent once it is answered.
+
+void QXmppTransferOutgoingJob::sendIbbData()
+{
+    // rate-limited jobs send smaller blocks, which the block size
+    // negotiated when opening the bytestream allows
+    int blockSize = d->blockSize;
+    const qint64 quantum = d->scheduler ? d->scheduler->quantum(this) : 0;
+    if (quantum)
+        blockSize = qMin(qint64(blockSize), quantum);
+    bool throttled = false;
+
+    if (d->ibbMessages) {
+        if (!d->ibbPingId.isEmpty())
+            return;
+
+        int count = 0;
+        while (count < d->ibbWindow) {
+            if (d->scheduler && !d->scheduler->canSend(this)) {
+                throttled = true;
+                break;
+            }
+
+            const QByteArray buffer = d->iodevice->read(blockSize);
+            if (d->scheduler)
+                d->scheduler->consume(this, buffer.size());
+            if (buffer.isEmpty())
+                break;
+
+            QXmppElement dataElement;
+            dataElement.setTagName("data");
+            dataElement.setAttribute("xmlns", ns_ibb);
+            dataElement.setAttribute("sid", d->sid);
+            dataElement.setAttribute("seq", QString::number(d->ibbSequence++));
+            dataElement.setValue(QString::fromLatin1(buffer.toBase64()));
+
+            // data blocks must not be archived or copied to other
+            // resources, see XEP-0334: Message Processing Hints
+            QXmppElement noStoreElement;
+            noStoreElement.setTagName("no-store");
+            noStoreElement.setAttribute("xmlns", ns_message_processing_hints);
+
+            QXmppElement noCopyElement;
+            noCopyElement.setTagName("no-copy");
+            noCopyElement.setAttribute("xmlns", ns_message_processing_hints);
+
+            QXmppMessage message;
+            message.setTo(d->jid);
+            message.setType(QXmppMessage::Normal);
+            message.setExtensions(QXmppElementList() << dataElement << noStoreElement << noCopyElement);
+            d->client->sendPacket(message);
+
+            d->done += buffer.size();
+            count++;
+        }
+
+        if (count) {
+            emit progress(d->done, fileSize());
+
+            QXmppPingIq ping;
+            ping.setTo(d->jid);
+            d->setIbbPingId(ping.id());
+            d->client->sendPacket(ping);
+            return;
+        }
+    } else {
+        bool sent = false;
+        while (d->ibbPending.size() < d->ibbWindow) {
+            if (d->scheduler && !d->scheduler->canSend(this)) {
+                throttled = true;
+                break;
+            }
+
+            const QByteArray buffer = d->iodevice->read(blockSize);
+            if (d->scheduler)
+                d->scheduler->consume(this, buffer.size());
+            if (buffer.isEmpty())
+                break;
+
+            QXmppIbbDataIq dataIq;
+            dataIq.setTo(d->jid);
+            dataIq.setSid(d->sid);
+            dataIq.setSequence(d->ibbSequence++);
+            dataIq.setPayload(buffer);
+            d->addIbbPending(dataIq);
+            d->client->sendPacket(dataIq);
+
+            d->done += buffer.size();
+            sent = true;
+        }
+
+        if (sent)
+            emit progress(d->done, fileSize());
+        if (!d->ibbPending.isEmpty())
+            return;
+    }
+
+    // the scheduler resumes us once we are allowed to send
+    if (throttled)
+        return;
+
+    // close the bytestream
+    QXmppIbbCloseIq closeIq;
+    closeIq.setTo(d->jid);
+    closeIq.setSid(d->sid);
+    d->setRequestId(d->jid, closeIq.id());
+    d->client->sendPacket(closeIq);
+
+    terminate(QXmppTransferJob::NoError);
+}
+
+/// Resumes sending data once the scheduler allows the job to send.
+
+void QXmppTransferOutgoingJob::sendData()
+{
+    if (d->state != QXmppTransferJob::TransferState)
+        return;
+
+    if (d->method == QXmppTransferJob::InBandMethod) {
+        if (d->iodevice->isOpen())
+            sendIbbData();
+    } else {
+        _q_sendData();
+    }
+}
+
+/// Sends the stream initiation \a offer.
+///
+/// If \a filePath is not empty, the file is first hashed in a worker
+/// thread and the offer is only sent once its hashes are known, as
+/// XEP-0096 offers no way of providing them later.
+
+void QXmppTransferOutgoingJob::sendOffer(const QXmppStreamInitiationIq &offer, const QString &filePath)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_offer = offer;
+    if (filePath.isEmpty()) {
+        d->setRequestId(d->jid, m_offer.id());
+        d->client->sendPacket(m_offer);
+        return;
+    }
+
+    d->hasher = new QXmppTransferHasher(filePath, this);
+    check = connect(d->hasher, SIGNAL(finished()),
+                    this, SLOT(_q_hashFinished()));
+    Q_ASSERT(check);
+    d->hasher->start(QThread::LowPriority);
+}
+
 void QXmppTransferOutgoingJob::startSending()
 {
     bool check;
@@ -671,10 +1353,34 @@ void QXmppTransferOutgoingJob::_q_disconnected()
     if (d->state == QXmppTransferJob::FinishedState)
         return;
 
-    if (fileSize() && d->done != fileSize())
-        terminate(QXmppTransferJob::ProtocolError);
-    else
-        terminate(QXmppTransferJob::NoError);
+    if (fileSize() && d->done != fileSize())
+        terminate(QXmppTransferJob::ProtocolError);
+    else
+        terminate(QXmppTransferJob::NoError);
+}
+
+void QXmppTransferOutgoingJob::_q_hashFinished()
+{
+    QXmppTransferHasher *hasher = d->hasher;
+    if (!hasher)
+        return;
+    d->hasher = 0;
+    hasher->deleteLater();
+
+    if (d->state != QXmppTransferJob::OfferState)
+        return;
+
+    if (hasher->md5().isEmpty()) {
+        warning(QString("Could not hash %1").arg(d->localFileUrl.toLocalFile()));
+        terminate(QXmppTransferJob::FileAccessError);
+        return;
+    }
+
+    d->fileInfo.setHash(hasher->md5());
+    d->fileInfo.setSha256(hasher->sha256());
+    m_offer.setFileInfo(d->fileInfo);
+    d->setRequestId(d->jid, m_offer.id());
+    d->client->sendPacket(m_offer);
 }
 
 void QXmppTransferOutgoingJob::_q_proxyReady()
@@ -686,7 +1392,7 @@ void QXmppTransferOutgoingJob::_q_proxyReady()
     streamIq.setTo(d->socksProxy.jid());
     streamIq.setSid(d->sid);
     streamIq.setActivate(d->jid);
-    d->requestId = streamIq.id();
+    d->setRequestId(d->socksProxy.jid(), streamIq.id());
     d->client->sendPacket(streamIq);
 }
 
@@ -696,33 +1402,204 @@ void QXmppTransferOutgoingJob::_q_sendData()
         return;
 
     // don't saturate the outgoing socket
-    if (d->socksSocket->bytesToWrite() > 2 * d->blockSize)
+    const qint64 pending = d->socksSocket->bytesToWrite();
+    if (pending > 2 * d->blockSize)
         return;
 
     // check whether we have written the whole file
     if (d->fileInfo.size() && d->done >= d->fileInfo.size())
     {
-        if (!d->socksSocket->bytesToWrite())
+        if (!pending)
             terminate(QXmppTransferJob::NoError);
         return;
     }
 
-    char *buffer = new char[d->blockSize];
-    qint64 length = d->iodevice->read(buffer, d->blockSize);
+    // the socket drained completely, grow the block size towards
+    // the size of its send buffer
+    if (!pending && d->blockSize < socksMaxBlockSize)
+    {
+        int limit = socksMaxBlockSize;
+        const int sendBufferSize = d->socksSocket->socketOption(QAbstractSocket::SendBufferSizeSocketOption).toInt();
+        if (sendBufferSize > 0)
+            limit = qMin(limit, sendBufferSize);
+        d->blockSize = qMax(d->blockSize, qMin(2 * d->blockSize, limit));
+    }
+
+    // rate-limited jobs send small blocks so that they do not exceed
+    // their rate or delay other traffic
+    qint64 blockSize = d->blockSize;
+    const qint64 quantum = d->scheduler ? d->scheduler->quantum(this) : 0;
+    if (quantum)
+        blockSize = qMin(blockSize, quantum);
+
+#ifdef QXMPP_USE_SENDFILE
+    // let the kernel copy the file to the socket until its send buffer
+    // is full, data already queued by the socket must be written first
+    if (!pending)
+    {
+        const qint64 start = d->done;
+        qint64 sent;
+        while ((!d->scheduler || d->scheduler->canSend(this)) &&
+               (sent = sendFileToSocket(d->iodevice, d->socksSocket, blockSize)) > 0)
+        {
+            if (d->scheduler)
+                d->scheduler->consume(this, sent);
+            d->done += sent;
+            if (d->fileInfo.size() && d->done >= d->fileInfo.size())
+                break;
+        }
+        if (d->done != start)
+            emit progress(d->done, fileSize());
+
+        if (d->fileInfo.size() && d->done >= d->fileInfo.size())
+        {
+            terminate(QXmppTransferJob::NoError);
+            return;
+        }
+    }
+#endif
+
+    // the scheduler resumes us once we are allowed to send
+    if (d->scheduler && !d->scheduler->canSend(this))
+        return;
+
+    // write one block through the socket, which notifies us once it
+    // has been written
+    if (d->sendBuffer.size() < blockSize)
+        d->sendBuffer.resize(blockSize);
+    const qint64 length = d->iodevice->read(d->sendBuffer.data(), blockSize);
     if (length < 0)
     {
-        delete [] buffer;
         terminate(QXmppTransferJob::FileAccessError);
         return;
     }
     else
     {
-        d->socksSocket->write(buffer, length);
-        delete [] buffer;
+        if (d->scheduler)
+            d->scheduler->consume(this, length);
+        d->socksSocket->write(d->sendBuffer.constData(), length);
         d->done += length;
         emit progress(d->done, fileSize());
     }
 }
+
+QXmppTransferScheduler::QXmppTransferScheduler(QObject *parent)
+    : QObject(parent)
+    , m_rate(0)
+    , m_tokens(0)
+    , m_stamp(-1)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_clock.start();
+
+    m_timer = new QTimer(this);
+    m_timer->setInterval(rateInterval);
+    check = connect(m_timer, SIGNAL(timeout()),
+                    this, SLOT(_q_timeout()));
+    Q_ASSERT(check);
+}
+
+/// Returns true if \a job is allowed to send data now.
+///
+/// Otherwise the job is resumed by calling its sendData() method
+/// once tokens are available.
+
+bool QXmppTransferScheduler::canSend(QXmppTransferJob *job)
+{
+    const qint64 now = m_clock.elapsed();
+    bool allowed = hasJobTokens(job, now);
+    if (allowed && m_rate > 0) {
+        refillBucket(m_tokens, m_stamp, m_rate, now);
+        if (m_tokens <= 0)
+            allowed = false;
+
+        // leave the bandwidth to waiting jobs with a higher priority
+        foreach (QXmppTransferJob *other, m_waiting) {
+            if (other != job &&
+                other->d->priority > job->d->priority &&
+                hasJobTokens(other, now)) {
+                allowed = false;
+                break;
+            }
+        }
+    }
+
+    if (allowed) {
+        m_waiting.removeAll(job);
+        return true;
+    }
+
+    if (!m_waiting.contains(job))
+        m_waiting << job;
+    if (!m_timer->isActive())
+        m_timer->start();
+    return false;
+}
+
+/// Takes the tokens for \a bytes sent by \a job.
+///
+/// The buckets may go into debt, in which case the job waits
+/// until the debt is paid back.
+
+void QXmppTransferScheduler::consume(QXmppTransferJob *job, qint64 bytes)
+{
+    if (job->d->maximumRate > 0)
+        job->d->rateTokens -= bytes;
+    if (m_rate > 0)
+        m_tokens -= bytes;
+}
+
+/// Returns the largest amount of data \a job should send at once,
+/// or 0 if it is not rate-limited.
+
+qint64 QXmppTransferScheduler::quantum(QXmppTransferJob *job) const
+{
+    qint64 rate = m_rate;
+    if (job->d->maximumRate > 0 && (rate <= 0 || job->d->maximumRate < rate))
+        rate = job->d->maximumRate;
+    return rate > 0 ? rateQuantum(rate, rateMinQuantum) : 0;
+}
+
+void QXmppTransferScheduler::removeJob(QXmppTransferJob *job)
+{
+    m_waiting.removeAll(job);
+}
+
+qint64 QXmppTransferScheduler::maximumRate() const
+{
+    return m_rate;
+}
+
+void QXmppTransferScheduler::setMaximumRate(qint64 rate)
+{
+    m_rate = qMax(qint64(0), rate);
+    m_stamp = -1;
+}
+
+bool QXmppTransferScheduler::hasJobTokens(QXmppTransferJob *job, qint64 now)
+{
+    if (job->d->maximumRate <= 0)
+        return true;
+
+    refillBucket(job->d->rateTokens, job->d->rateStamp, job->d->maximumRate, now);
+    return job->d->rateTokens > 0;
+}
+
+void QXmppTransferScheduler::_q_timeout()
+{
+    // resume the waiting jobs, highest priority first, the jobs which
+    // are still not allowed to send are put back in the queue
+    QList<QXmppTransferJob*> jobs = m_waiting;
+    m_waiting.clear();
+    qStableSort(jobs.begin(), jobs.end(), jobHasHigherPriority);
+    foreach (QXmppTransferJob *job, jobs)
+        static_cast<QXmppTransferOutgoingJob*>(job)->sendData();
+
+    if (m_waiting.isEmpty())
+        m_timer->stop();
+}
 /// \endcond
 
 class QXmppTransferManagerPrivate
@@ -733,35 +1610,95 @@ public:
     QXmppTransferIncomingJob *getIncomingJobByRequestId(const QString &jid, const QString &id);
     QXmppTransferIncomingJob *getIncomingJobBySid(const QString &jid, const QString &sid);
     QXmppTransferOutgoingJob *getOutgoingJobByRequestId(const QString &jid, const QString &id);
+    QXmppTransferOutgoingJob *sendFile(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid, const QString &hashFilePath);
+    void addJob(QXmppTransferJob *job);
+    void removeJob(QXmppTransferJob *job);
+    void removeQueuedJob(QXmppTransferJob *job);
+    void startQueuedJobs();
 
     int ibbBlockSize;
+    bool ibbMessageStanzas;
+    int ibbWindowSize;
     QList<QXmppTransferJob*> jobs;
+    QHash<QPair<QString, QString>, QXmppTransferJob*> incomingSessions;
+    QHash<QPair<QString, QString>, QXmppTransferJob*> requests;
+    int maximumActiveJobs;
     QString proxy;
     bool proxyOnly;
+    QXmppTransferScheduler *scheduler;
     QXmppSocksServer *socksServer;
     QXmppTransferJob::Methods supportedMethods;
 
 private:
+    // an outgoing job whose offer is not sent yet
+    struct QueuedJob
+    {
+        QXmppTransferOutgoingJob *job;
+        QXmppStreamInitiationIq offer;
+        QString hashFilePath;
+    };
+
+    int activeJobCount() const;
     QXmppTransferJob *getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id);
+
+    QList<QueuedJob> queuedJobs;
     QXmppTransferManager *q;
 };
 
 QXmppTransferManagerPrivate::QXmppTransferManagerPrivate(QXmppTransferManager *qq)
     : ibbBlockSize(4096)
+    , ibbMessageStanzas(false)
+    , ibbWindowSize(4)
+    , maximumActiveJobs(0)
     , proxyOnly(false)
+    , scheduler(0)
     , socksServer(0)
     , supportedMethods(QXmppTransferJob::AnyMethod)
     , q(qq)
 {
 }
 
+/// Registers \a job and indexes it by session and request identifiers.
+
+void QXmppTransferManagerPrivate::addJob(QXmppTransferJob *job)
+{
+    jobs.append(job);
+
+    job->d->requestIndex = &requests;
+    if (!job->d->requestId.isEmpty())
+        requests.insert(qMakePair(job->d->requestJid, job->d->requestId), job);
+
+    const QPair<QString, QString> session = qMakePair(job->d->jid, job->d->sid);
+    if (job->d->direction == QXmppTransferJob::IncomingDirection &&
+        !incomingSessions.contains(session))
+        incomingSessions.insert(session, job);
+}
+
+/// Unregisters \a job, which may already be partially destroyed.
+
+void QXmppTransferManagerPrivate::removeJob(QXmppTransferJob *job)
+{
+    jobs.removeAll(job);
+
+    QMutableHashIterator<QPair<QString, QString>, QXmppTransferJob*> sessionIt(incomingSessions);
+    while (sessionIt.hasNext())
+        if (sessionIt.next().value() == job)
+            sessionIt.remove();
+
+    QMutableHashIterator<QPair<QString, QString>, QXmppTransferJob*> requestIt(requests);
+    while (requestIt.hasNext())
+        if (requestIt.next().value() == job)
+            requestIt.remove();
+}
+
 QXmppTransferJob* QXmppTransferManagerPrivate::getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id)
 {
-    foreach (QXmppTransferJob *job, jobs)
-        if (job->d->direction == direction &&
-            job->d->jid == jid &&
-            job->d->requestId == id)
-            return job;
+    QXmppTransferJob *job = requests.value(qMakePair(jid, id));
+    if (job &&
+        job->d->direction == direction &&
+        job->d->jid == jid &&
+        job->d->hasRequestId(id))
+        return job;
     return 0;
 }
 
@@ -772,12 +1709,7 @@ QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobByRequestId
 
 QXmppTransferIncomingJob* QXmppTransferManagerPrivate::getIncomingJobBySid(const QString &jid, const QString &sid)
 {
-    foreach (QXmppTransferJob *job, jobs)
-        if (job->d->direction == QXmppTransferJob::IncomingDirection &&
-            job->d->jid == jid &&
-            job->d->sid == sid)
-            return static_cast<QXmppTransferIncomingJob*>(job);
-    return 0;
+    return static_cast<QXmppTransferIncomingJob*>(incomingSessions.value(qMakePair(jid, sid)));
 }
 
 QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId(const QString &jid, const QString &id)
@@ -785,6 +1717,47 @@ QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId
     return static_cast<QXmppTransferOutgoingJob*>(getJobByRequestId(QXmppTransferJob::OutgoingDirection, jid, id));
 }
 
+/// Returns the number of outgoing jobs which were offered and are not finished.
+
+int QXmppTransferManagerPrivate::activeJobCount() const
+{
+    int count = 0;
+    foreach (QXmppTransferJob *job, jobs)
+        if (job->d->direction == QXmppTransferJob::OutgoingDirection &&
+            job->d->state != QXmppTransferJob::FinishedState)
+            count++;
+    foreach (const QueuedJob &queued, queuedJobs)
+        if (queued.job->d->state != QXmppTransferJob::FinishedState)
+            count--;
+    return count;
+}
+
+void QXmppTransferManagerPrivate::removeQueuedJob(QXmppTransferJob *job)
+{
+    for (int i = queuedJobs.size() - 1; i >= 0; --i)
+        if (queuedJobs.at(i).job == job)
+            queuedJobs.removeAt(i);
+}
+
+/// Sends the offers of queued jobs while there are free slots,
+/// the oldest job with the highest priority going first.
+
+void QXmppTransferManagerPrivate::startQueuedJobs()
+{
+    while (!queuedJobs.isEmpty() &&
+           (maximumActiveJobs <= 0 || activeJobCount() < maximumActiveJobs))
+    {
+        int best = 0;
+        for (int i = 1; i < queuedJobs.size(); ++i)
+            if (queuedJobs.at(i).job->d->priority > queuedJobs.at(best).job->d->priority)
+                best = i;
+
+        const QueuedJob queued = queuedJobs.takeAt(best);
+        if (queued.job->d->state != QXmppTransferJob::FinishedState)
+            queued.job->sendOffer(queued.offer, queued.hashFilePath);
+    }
+}
+
 /// Constructs a QXmppTransferManager to handle incoming and outgoing
 /// file transfers.
 
@@ -794,6 +1767,7 @@ QXmppTransferManager::QXmppTransferManager()
     Q_UNUSED(check);
 
     d = new QXmppTransferManagerPrivate(this);
+    d->scheduler = new QXmppTransferScheduler(this);
 
     // start SOCKS server
     d->socksServer = new QXmppSocksServer(this);
@@ -813,16 +1787,14 @@ QXmppTransferManager::~QXmppTransferManager()
 void QXmppTransferManager::byteStreamIqReceived(const QXmppByteStreamIq &iq)
 {
     // handle IQ from proxy
-    foreach (QXmppTransferJob *job, d->jobs)
+    QXmppTransferJob *job = d->requests.value(qMakePair(iq.from(), iq.id()));
+    if (job && job->d->socksProxy.jid() == iq.from() && job->d->requestId == iq.id())
     {
-        if (job->d->socksProxy.jid() == iq.from() && job->d->requestId == iq.id())
+        if (iq.type() == QXmppIq::Result && iq.streamHosts().size() > 0)
         {
-            if (iq.type() == QXmppIq::Result && iq.streamHosts().size() > 0)
-            {
-                job->d->socksProxy = iq.streamHosts().first();
-                socksServerSendOffer(job);
-                return;
-            }
+            job->d->socksProxy = iq.streamHosts().first();
+            socksServerSendOffer(job);
+            return;
         }
     }
 
@@ -915,11 +1887,22 @@ QStringList QXmppTransferManager::discoveryFeatures() const
         << ns_ibb               // XEP-0047: In-Band Bytestreams
         << ns_bytestreams       // XEP-0065: SOCKS5 Bytestreams
         << ns_stream_initiation // XEP-0095: Stream Initiation
-        << ns_stream_initiation_file_transfer; // XEP-0096: SI File Transfer
+        << ns_stream_initiation_file_transfer // XEP-0096: SI File Transfer
+        << ns_hashes            // XEP-0300: Use of Cryptographic Hash Functions
+        << ns_hash_sha256;
 }
 
 bool QXmppTransferManager::handleStanza(const QDomElement &element)
 {
+    // XEP-0047 In-Band Bytestreams, using message stanzas
+    if (element.tagName() == "message")
+    {
+        if (element.firstChildElement("data").namespaceURI() != ns_ibb)
+            return false;
+        ibbDataMessageReceived(element);
+        return true;
+    }
+
     if (element.tagName() != "iq")
         return false;
 
@@ -1024,7 +2007,8 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
         return;
     }
 
-    if (iq.sequence() != job->d->ibbSequence)
+    // write data
+    if (!job->writeIbbData(iq.sequence(), iq.payload()))
     {
         // the packet is out of sequence
         QXmppStanza::Error error(QXmppStanza::Error::Cancel, QXmppStanza::Error::UnexpectedRequest);
@@ -1034,15 +2018,40 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
         return;
     }
 
-    // write data
-    job->writeData(iq.payload());
-    job->d->ibbSequence++;
-
     // acknowledge the packet
     response.setType(QXmppIq::Result);
     client()->sendPacket(response);
 }
 
+void QXmppTransferManager::ibbDataMessageReceived(const QDomElement &element)
+{
+    const QDomElement dataElement = element.firstChildElement("data");
+    const QString sid = dataElement.attribute("sid");
+
+    QXmppTransferIncomingJob *job = d->getIncomingJobBySid(element.attribute("from"), sid);
+    if (!job ||
+        job->method() != QXmppTransferJob::InBandMethod ||
+        job->state() != QXmppTransferJob::TransferState ||
+        !job->d->ibbMessages)
+        return;
+
+    // data blocks are not acknowledged, so we cannot recover from a
+    // missing block
+    const quint16 sequence = dataElement.attribute("seq").toUShort();
+    const QByteArray payload = QByteArray::fromBase64(dataElement.text().toLatin1());
+    if (!job->writeIbbData(sequence, payload))
+    {
+        warning(QString("Received out of sequence in-band data for %1").arg(sid));
+
+        QXmppIbbCloseIq closeIq;
+        closeIq.setTo(job->d->jid);
+        closeIq.setSid(job->d->sid);
+        client()->sendPacket(closeIq);
+
+        job->terminate(QXmppTransferJob::ProtocolError);
+    }
+}
+
 void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
 {
     QXmppIq response;
@@ -1072,6 +2081,7 @@ void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
     }
 
     job->d->blockSize = iq.blockSize();
+    job->d->ibbMessages = (iq.stanzaType() == QXmppIbbOpenIq::MessageStanza);
     job->setState(QXmppTransferJob::TransferState);
 
     // accept transfer
@@ -1081,7 +2091,7 @@ void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
 
 void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
 {
-    QXmppTransferJob *job = d->getOutgoingJobByRequestId(iq.from(), iq.id());
+    QXmppTransferOutgoingJob *job = d->getOutgoingJobByRequestId(iq.from(), iq.id());
     if (!job ||
         job->method() != QXmppTransferJob::InBandMethod ||
         job->state() == QXmppTransferJob::FinishedState)
@@ -1091,41 +2101,32 @@ void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
     if (!job->d->iodevice->isOpen())
         return;
 
-    if (iq.type() == QXmppIq::Result)
+    if (iq.id() == job->d->ibbPingId)
     {
-        const QByteArray buffer = job->d->iodevice->read(job->d->blockSize);
-        job->setState(QXmppTransferJob::TransferState);
-        if (buffer.size())
-        {
-            // send next data block
-            QXmppIbbDataIq dataIq;
-            dataIq.setTo(job->d->jid);
-            dataIq.setSid(job->d->sid);
-            dataIq.setSequence(job->d->ibbSequence++);
-            dataIq.setPayload(buffer);
-            job->d->requestId = dataIq.id();
-            client()->sendPacket(dataIq);
+        // the recipient received the previous window of data messages,
+        // whether or not it supports XMPP ping
+        job->d->setIbbPingId(QString());
+        job->sendIbbData();
+    }
+    else if (iq.type() == QXmppIq::Result)
+    {
+        if (job->d->ibbPending.contains(iq.id()))
+            job->d->ibbResends.remove(job->d->takeIbbPending(iq.id()).sequence());
 
-            job->d->done += buffer.size();
-            job->progress(job->d->done, job->fileSize());
-        } else {
-            // close the bytestream
-            QXmppIbbCloseIq closeIq;
-            closeIq.setTo(job->d->jid);
-            closeIq.setSid(job->d->sid);
-            job->d->requestId = closeIq.id();
-            client()->sendPacket(closeIq);
-
-            job->terminate(QXmppTransferJob::NoError);
-        }
+        job->setState(QXmppTransferJob::TransferState);
+        job->sendIbbData();
     }
     else if (iq.type() == QXmppIq::Error)
     {
+        // the recipient asked us to send the block again later
+        if (iq.error().type() == QXmppStanza::Error::Wait && job->resendIbbData(iq.id()))
+            return;
+
         // close the bytestream
         QXmppIbbCloseIq closeIq;
         closeIq.setTo(job->d->jid);
         closeIq.setSid(job->d->sid);
-        job->d->requestId = closeIq.id();
+        job->d->setRequestId(job->d->jid, closeIq.id());
         client()->sendPacket(closeIq);
 
         job->terminate(QXmppTransferJob::ProtocolError);
@@ -1137,62 +2138,67 @@ void QXmppTransferManager::_q_iqReceived(const QXmppIq &iq)
     bool check;
     Q_UNUSED(check);
 
-    foreach (QXmppTransferJob *ptr, d->jobs)
+    QXmppTransferJob *ptr = d->requests.value(qMakePair(iq.from(), iq.id()));
+    if (!ptr)
+        return;
+
+    // handle IQ from proxy
+    if (ptr->direction() == QXmppTransferJob::OutgoingDirection && ptr->d->socksProxy.jid() == iq.from() && ptr->d->requestId == iq.id())
     {
-        // handle IQ from proxy
-        if (ptr->direction() == QXmppTransferJob::OutgoingDirection && ptr->d->socksProxy.jid() == iq.from() && ptr->d->requestId == iq.id())
+        QXmppTransferOutgoingJob *job = static_cast<QXmppTransferOutgoingJob*>(ptr);
+        if (job->d->socksSocket)
         {
-            QXmppTransferOutgoingJob *job = static_cast<QXmppTransferOutgoingJob*>(ptr);
-            if (job->d->socksSocket)
+            // proxy connection activation result
+            if (iq.type() == QXmppIq::Result)
             {
-                // proxy connection activation result
-                if (iq.type() == QXmppIq::Result)
-                {
-                    // proxy stream activated, start sending data
-                    job->startSending();
-                } else if (iq.type() == QXmppIq::Error) {
-                    // proxy stream not activated, terminate
-                    warning("Could not activate SOCKS5 proxy bytestream");
-                    job->terminate(QXmppTransferJob::ProtocolError);
-                }
-            } else {
-                // we could not get host/port from proxy, proceed without a proxy
-                if (iq.type() == QXmppIq::Error)
-                    socksServerSendOffer(job);
+                // proxy stream activated, start sending data
+                job->startSending();
+            } else if (iq.type() == QXmppIq::Error) {
+                // proxy stream not activated, terminate
+                warning("Could not activate SOCKS5 proxy bytestream");
+                job->terminate(QXmppTransferJob::ProtocolError);
             }
-            return;
+        } else {
+            // we could not get host/port from proxy, proceed without a proxy
+            if (iq.type() == QXmppIq::Error)
+                socksServerSendOffer(job);
         }
+        return;
+    }
 
-        // handle IQ from peer
-        else if (ptr->d->jid == iq.from() && ptr->d->requestId == iq.id())
+    // handle IQ from peer
+    else if (ptr->d->jid == iq.from() && ptr->d->hasRequestId(iq.id()))
+    {
+        QXmppTransferJob *job = ptr;
+        if (job->direction() == QXmppTransferJob::OutgoingDirection &&
+            job->method() == QXmppTransferJob::InBandMethod)
         {
-            QXmppTransferJob *job = ptr;
-            if (job->direction() == QXmppTransferJob::OutgoingDirection &&
-                job->method() == QXmppTransferJob::InBandMethod)
-            {
-                ibbResponseReceived(iq);
-                return;
-            }
-            else if (job->direction() == QXmppTransferJob::IncomingDirection &&
-                     job->method() == QXmppTransferJob::SocksMethod)
-            {
-                byteStreamResponseReceived(iq);
-                return;
-            }
-            else if (job->direction() == QXmppTransferJob::OutgoingDirection &&
-                     iq.type() == QXmppIq::Error)
-            {
-                // remote party cancelled stream initiation
-                job->terminate(QXmppTransferJob::AbortError);
-                return;
-            }
+            ibbResponseReceived(iq);
+            return;
+        }
+        else if (job->direction() == QXmppTransferJob::IncomingDirection &&
+                 job->method() == QXmppTransferJob::SocksMethod)
+        {
+            byteStreamResponseReceived(iq);
+            return;
+        }
+        else if (job->direction() == QXmppTransferJob::OutgoingDirection &&
+                 iq.type() == QXmppIq::Error)
+        {
+            // remote party cancelled stream initiation
+            job->terminate(QXmppTransferJob::AbortError);
+            return;
         }
     }
 }
 
 void QXmppTransferManager::_q_jobDestroyed(QObject *object)
 {
-    d->jobs.removeAll(static_cast<QXmppTransferJob*>(object));
+    QXmppTransferJob *job = static_cast<QXmppTransferJob*>(object);
+    d->removeJob(job);
+    d->scheduler->removeJob(job);
+    d->removeQueuedJob(job);
+    d->startQueuedJobs();
 }
 
 void QXmppTransferManager::_q_jobError(QXmppTransferJob::Error error)
@@ -1209,7 +2215,7 @@ void QXmppTransferManager::_q_jobError(QXmppTransferJob::Error error)
         QXmppIbbCloseIq closeIq;
         closeIq.setTo(job->d->jid);
         closeIq.setSid(job->d->sid);
-        job->d->requestId = closeIq.id();
+        job->d->setRequestId(job->d->jid, closeIq.id());
         client()->sendPacket(closeIq);
     }
 }
@@ -1220,6 +2226,10 @@ void QXmppTransferManager::_q_jobFinished()
     if (!job || !d->jobs.contains(job))
         return;
 
+    // a finished job leaves room for a queued job
+    d->removeQueuedJob(job);
+    d->startQueuedJobs();
+
     emit jobFinished(job);
 }
 
@@ -1279,6 +2289,13 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
     response.setProfile(QXmppStreamInitiationIq::FileTransfer);
     response.setFeatureForm(form);
 
+    // ask the sender to resume the transfer
+    if (job->d->rangeOffset > 0) {
+        QXmppTransferFileInfo fileInfo;
+        fileInfo.setRangeOffset(job->d->rangeOffset);
+        response.setFileInfo(fileInfo);
+    }
+
     client()->sendPacket(response);
 
     // notify user
@@ -1289,6 +2306,9 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
 ///
 /// The remote party will be given the choice to accept or refuse the transfer.
 ///
+/// The file's MD5 and SHA-256 hashes are computed in a worker thread, and
+/// the transfer is offered to the remote party once they are known.
+///
 /// Returns 0 if the \a jid is not valid or if the file at \a filePath cannot be read.
 ///
 /// \note The recipient's \a jid must be a full JID with a resource, for instance "user@host/resource".
@@ -1318,22 +2338,9 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, const QStri
         device = 0;
     }
 
-    // hash file
-    if (device && !device->isSequential())
-    {
-        QCryptographicHash hash(QCryptographicHash::Md5);
-        QByteArray buffer;
-        while (device->bytesAvailable())
-        {
-            buffer = device->read(16384);
-            hash.addData(buffer);
-        }
-        device->reset();
-        fileInfo.setHash(hash.result());
-    }
-
-    // create job
-    QXmppTransferJob *job = sendFile(jid, device, fileInfo);
+    // create job, the file is hashed before the offer is sent
+    const QString hashFilePath = (device && !device->isSequential()) ? filePath : QString();
+    QXmppTransferJob *job = d->sendFile(jid, device, fileInfo, QString(), hashFilePath);
     job->setLocalFileUrl(QUrl::fromLocalFile(filePath));
     job->d->deviceIsOwn = true;
     return job;
@@ -1351,15 +2358,21 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, const QStri
 
 QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid)
 {
-    bool check;
-    Q_UNUSED(check);
-
     if (QXmppUtils::jidToResource(jid).isEmpty()) {
         warning("The file recipient's JID must be a full JID");
         return 0;
     }
 
-    QXmppTransferOutgoingJob *job = new QXmppTransferOutgoingJob(jid, client(), this);
+    return d->sendFile(jid, device, fileInfo, sid, QString());
+}
+
+QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::sendFile(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid, const QString &hashFilePath)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppTransferOutgoingJob *job = new QXmppTransferOutgoingJob(jid, q->client(), q);
+    job->d->scheduler = scheduler;
     if (sid.isEmpty())
         job->d->sid = QXmppUtils::generateStanzaHash();
     else
@@ -1375,7 +2388,7 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
     }
 
     // check we support some methods
-    if (!d->supportedMethods)
+    if (!supportedMethods)
     {
         job->terminate(QXmppTransferJob::ProtocolError);
         return job;
@@ -1387,26 +2400,30 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
 
     QXmppDataForm::Field methodField(QXmppDataForm::Field::ListSingleField);
     methodField.setKey("stream-method");
-    if (d->supportedMethods & QXmppTransferJob::InBandMethod)
+    if (supportedMethods & QXmppTransferJob::InBandMethod)
         methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_ibb)));
-    if (d->supportedMethods & QXmppTransferJob::SocksMethod)
+    if (supportedMethods & QXmppTransferJob::SocksMethod)
         methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_bytestreams)));
     form.setFields(QList<QXmppDataForm::Field>() << methodField);
 
     // start job
-    d->jobs.append(job);
-    check = connect(job, SIGNAL(destroyed(QObject*)),
-                    this, SLOT(_q_jobDestroyed(QObject*)));
+    addJob(job);
+    check = QObject::connect(job, SIGNAL(destroyed(QObject*)),
+                             q, SLOT(_q_jobDestroyed(QObject*)));
     Q_ASSERT(check);
 
-    check = connect(job, SIGNAL(error(QXmppTransferJob::Error)),
-                    this, SLOT(_q_jobError(QXmppTransferJob::Error)));
+    check = QObject::connect(job, SIGNAL(error(QXmppTransferJob::Error)),
+                             q, SLOT(_q_jobError(QXmppTransferJob::Error)));
     Q_ASSERT(check);
 
-    check = connect(job, SIGNAL(finished()),
-                    this, SLOT(_q_jobFinished()));
+    check = QObject::connect(job, SIGNAL(finished()),
+                             q, SLOT(_q_jobFinished()));
     Q_ASSERT(check);
 
+    // seekable devices allow the recipient to resume the transfer
+    if (!device->isSequential())
+        job->d->fileInfo.setRangeSupported(true);
+
     QXmppStreamInitiationIq request;
     request.setType(QXmppIq::Set);
     request.setTo(jid);
@@ -1414,11 +2431,17 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
     request.setFileInfo(job->d->fileInfo);
     request.setFeatureForm(form);
     request.setSiId(job->d->sid);
-    job->d->requestId = request.id();
-    client()->sendPacket(request);
+
+    // the offer waits for a free slot if too many jobs are active
+    QueuedJob queued;
+    queued.job = job;
+    queued.offer = request;
+    queued.hashFilePath = hashFilePath;
+    queuedJobs << queued;
+    startQueuedJobs();
 
     // notify user
-    emit jobStarted(job);
+    emit q->jobStarted(job);
 
     return job;
 }
@@ -1430,6 +2453,14 @@ void QXmppTransferManager::_q_socksServerConnected(QTcpSocket *socket, const QSt
     {
         if (hostName == streamHash(job->d->sid, ownJid, job->jid()) && port == 0)
         {
+            // the target tries our stream hosts in parallel, and they all
+            // share our JID, so keep the first connection and refuse the
+            // others, which the target will then give up on
+            if (job->d->socksSocket) {
+                info(QString("Refusing additional SOCKS5 connection for stream %1").arg(job->d->sid));
+                socket->close();
+                return;
+            }
             job->d->socksSocket = socket;
             return;
         }
@@ -1472,7 +2503,7 @@ void QXmppTransferManager::socksServerSendOffer(QXmppTransferJob *job)
     streamIq.setTo(job->d->jid);
     streamIq.setSid(job->d->sid);
     streamIq.setStreamHosts(streamHosts);
-    job->d->requestId = streamIq.id();
+    job->d->setRequestId(job->d->jid, streamIq.id());
     client()->sendPacket(streamIq);
 }
 
@@ -1503,18 +2534,47 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
         }
     }
 
+    // remote party asked for a range of the file, we only send ranges
+    // which extend to the end of the file
+    const qint64 offset = iq.fileInfo().rangeOffset();
+    const qint64 length = iq.fileInfo().rangeLength();
+    if (length > 0 && offset + length != job->fileSize())
+    {
+        warning(QString("Could not send %1 bytes at %2").arg(
+            QString::number(length), QString::number(offset)));
+        job->terminate(QXmppTransferJob::ProtocolError);
+        return;
+    }
+
+    // remote party asked to resume the transfer
+    if (offset > 0)
+    {
+        if (!job->d->fileInfo.isRangeSupported() ||
+            offset >= job->fileSize() ||
+            !job->d->iodevice->seek(offset))
+        {
+            warning(QString("Could not resume transfer at %1").arg(QString::number(offset)));
+            job->terminate(QXmppTransferJob::ProtocolError);
+            return;
+        }
+        job->d->done = offset;
+    }
+
     // remote party accepted stream initiation
     job->setState(QXmppTransferJob::StartState);
     if (job->method() == QXmppTransferJob::InBandMethod)
     {
         // lower block size for IBB
         job->d->blockSize = d->ibbBlockSize;
+        job->d->ibbMessages = d->ibbMessageStanzas;
+        job->d->ibbWindow = d->ibbWindowSize;
 
         QXmppIbbOpenIq openIq;
         openIq.setTo(job->d->jid);
         openIq.setSid(job->d->sid);
         openIq.setBlockSize(job->d->blockSize);
-        job->d->requestId = openIq.id();
+        openIq.setStanzaType(job->d->ibbMessages ? QXmppIbbOpenIq::MessageStanza : QXmppIbbOpenIq::IqStanza);
+        job->d->setRequestId(job->d->jid, openIq.id());
         client()->sendPacket(openIq);
     } else if (job->method() == QXmppTransferJob::SocksMethod) {
         if (!d->proxy.isEmpty())
@@ -1526,7 +2586,7 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
             streamIq.setType(QXmppIq::Get);
             streamIq.setTo(job->d->socksProxy.jid());
             streamIq.setSid(job->d->sid);
-            job->d->requestId = streamIq.id();
+            job->d->setRequestId(job->d->socksProxy.jid(), streamIq.id());
             client()->sendPacket(streamIq);
         } else {
             socksServerSendOffer(job);
@@ -1613,7 +2673,7 @@ void QXmppTransferManager::streamInitiationSetReceived(const QXmppStreamInitiati
     }
 
     // register job
-    d->jobs.append(job);
+    d->addJob(job);
     check = connect(job, SIGNAL(destroyed(QObject*)),
                     this, SLOT(_q_jobDestroyed(QObject*)));
     Q_ASSERT(check);
@@ -1630,6 +2690,97 @@ void QXmppTransferManager::streamInitiationSetReceived(const QXmppStreamInitiati
     emit fileReceived(job);
 }
 
+/// Returns the number of in-band data blocks which can be sent
+/// before waiting for the recipient's acknowledgement.
+///
+
+int QXmppTransferManager::ibbWindowSize() const
+{
+    return d->ibbWindowSize;
+}
+
+/// Sets the number of in-band data blocks which can be sent
+/// before waiting for the recipient's acknowledgement.
+///
+/// A larger window improves the throughput of In-Band Bytestreams
+/// on links with a high latency. The default is 4, a window of 1
+/// waits for each block to be acknowledged before sending the next.
+///
+
+void QXmppTransferManager::setIbbWindowSize(int windowSize)
+{
+    d->ibbWindowSize = qMax(1, windowSize);
+}
+
+/// Returns the maximum number of outgoing transfer jobs which
+/// are active at the same time, or 0 if it is not limited.
+///
+
+int QXmppTransferManager::maximumActiveJobs() const
+{
+    return d->maximumActiveJobs;
+}
+
+/// Sets the maximum number of outgoing transfer jobs which
+/// are active at the same time.
+///
+/// Once this number is reached, the offers of new jobs are queued until
+/// an active job finishes, jobs with a higher QXmppTransferJob::priority()
+/// being offered first. The default is 0, which means no limit.
+///
+
+void QXmppTransferManager::setMaximumActiveJobs(int count)
+{
+    d->maximumActiveJobs = qMax(0, count);
+    d->startQueuedJobs();
+}
+
+/// Returns the maximum rate at which all outgoing transfer jobs send
+/// data, in bytes per second, or 0 if it is not limited.
+///
+
+qint64 QXmppTransferManager::maximumRate() const
+{
+    return d->scheduler->maximumRate();
+}
+
+/// Sets the maximum rate at which all outgoing transfer jobs send
+/// data, in bytes per second.
+///
+/// Limiting the rate keeps room for other traffic, such as chat messages
+/// which share the connection to the server with In-Band Bytestreams.
+/// The bandwidth is shared between the jobs according to their
+/// QXmppTransferJob::priority(), and each job can be further limited
+/// using QXmppTransferJob::setMaximumRate(). The default is 0, which
+/// means no limit.
+///
+
+void QXmppTransferManager::setMaximumRate(qint64 rate)
+{
+    d->scheduler->setMaximumRate(rate);
+}
+
+/// Returns whether outgoing In-Band Bytestreams send their data
+/// in message stanzas instead of IQ stanzas.
+///
+
+bool QXmppTransferManager::ibbMessageStanzas() const
+{
+    return d->ibbMessageStanzas;
+}
+
+/// Sets whether outgoing In-Band Bytestreams send their data
+/// in message stanzas instead of IQ stanzas.
+///
+/// Message stanzas are not acknowledged individually, which saves
+/// a round trip per block, but a lost block aborts the transfer.
+///
+
+void QXmppTransferManager::setIbbMessageStanzas(bool messageStanzas)
+{
+    d->ibbMessageStanzas = messageStanzas;
+}
+
 /// Return the JID of the bytestream proxy to use for
 /// outgoing transfers.
 ///
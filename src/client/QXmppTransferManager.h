@@ -56,6 +56,9 @@ public:
     QByteArray hash() const;
     void setHash(const QByteArray &hash);
 
+    QByteArray sha256() const;
+    void setSha256(const QByteArray &sha256);
+
     QString name() const;
     void setName(const QString &name);
 
@@ -65,6 +68,15 @@ public:
     qint64 size() const;
     void setSize(qint64 size);
 
+    bool isRangeSupported() const;
+    void setRangeSupported(bool supported);
+
+    qint64 rangeOffset() const;
+    void setRangeOffset(qint64 offset);
+
+    qint64 rangeLength() const;
+    void setRangeLength(qint64 length);
+
     bool isNull() const;
     QXmppTransferFileInfo& operator=(const QXmppTransferFileInfo &other);
     bool operator==(const QXmppTransferFileInfo &other) const;
@@ -86,12 +98,14 @@ private:
 class QXMPP_EXPORT QXmppTransferJob : public QXmppLoggable
 {
     Q_OBJECT
-    Q_ENUMS(Direction Error State)
+    Q_ENUMS(Direction Error Priority State)
     Q_FLAGS(Method Methods)
     Q_PROPERTY(Direction direction READ direction CONSTANT)
     Q_PROPERTY(QUrl localFileUrl READ localFileUrl WRITE setLocalFileUrl NOTIFY localFileUrlChanged)
     Q_PROPERTY(QString jid READ jid CONSTANT)
+    Q_PROPERTY(qint64 maximumRate READ maximumRate WRITE setMaximumRate)
     Q_PROPERTY(Method method READ method CONSTANT)
+    Q_PROPERTY(Priority priority READ priority WRITE setPriority)
     Q_PROPERTY(State state READ state NOTIFY stateChanged)
 
     Q_PROPERTY(QString fileName READ fileName CONSTANT)
@@ -121,10 +135,22 @@ public:
         NoMethod = 0,     ///< No transfer method.
         InBandMethod = 1, ///< XEP-0047: In-Band Bytestreams
         SocksMethod = 2,  ///< XEP-0065: SOCKS5 Bytestreams
-        AnyMethod = 3     ///< Any supported transfer method.
+        AnyMethod = 3,    ///< Any supported transfer method.
+        JingleMethod = 4  ///< XEP-0234: Jingle File Transfer
     };
     Q_DECLARE_FLAGS(Methods, Method)
 
+    /// This enum is used to describe the priority of a transfer job.
+    ///
+    /// Jobs with a higher priority are offered first when jobs are queued,
+    /// and are served first when the bandwidth is limited.
+    enum Priority
+    {
+        LowPriority = 0,    ///< The job only uses bandwidth left over by other jobs.
+        NormalPriority = 1, ///< The default priority.
+        HighPriority = 2    ///< The job is served before other jobs.
+    };
+
     /// This enum is used to describe the state of a transfer job.
     enum State
     {
@@ -144,6 +170,12 @@ public:
     qint64 speed() const;
     QXmppTransferJob::State state() const;
 
+    qint64 maximumRate() const;
+    void setMaximumRate(qint64 rate);
+
+    QXmppTransferJob::Priority priority() const;
+    void setPriority(QXmppTransferJob::Priority priority);
+
     // XEP-0096 : File transfer
     QXmppTransferFileInfo fileInfo() const;
     QUrl localFileUrl() const;
@@ -183,6 +215,7 @@ public slots:
     void abort();
     void accept(const QString &filePath);
     void accept(QIODevice *output);
+    void resume(const QString &filePath);
 
 private slots:
     void _q_terminated();
@@ -193,10 +226,13 @@ private:
     void terminate(QXmppTransferJob::Error error);
 
     QXmppTransferJobPrivate *const d;
+    friend class QXmppJingleFileJob;
+    friend class QXmppJingleFileManager;
     friend class QXmppTransferManager;
     friend class QXmppTransferManagerPrivate;
     friend class QXmppTransferIncomingJob;
     friend class QXmppTransferOutgoingJob;
+    friend class QXmppTransferScheduler;
 };
 
 /// \brief The QXmppTransferManager class provides support for sending and
@@ -219,6 +255,10 @@ private:
 class QXMPP_EXPORT QXmppTransferManager : public QXmppClientExtension
 {
     Q_OBJECT
+    Q_PROPERTY(int ibbWindowSize READ ibbWindowSize WRITE setIbbWindowSize)
+    Q_PROPERTY(bool ibbMessageStanzas READ ibbMessageStanzas WRITE setIbbMessageStanzas)
+    Q_PROPERTY(int maximumActiveJobs READ maximumActiveJobs WRITE setMaximumActiveJobs)
+    Q_PROPERTY(qint64 maximumRate READ maximumRate WRITE setMaximumRate)
     Q_PROPERTY(QString proxy READ proxy WRITE setProxy)
     Q_PROPERTY(bool proxyOnly READ proxyOnly WRITE setProxyOnly)
     Q_PROPERTY(QXmppTransferJob::Methods supportedMethods READ supportedMethods WRITE setSupportedMethods)
@@ -227,6 +267,18 @@ public:
     QXmppTransferManager();
     ~QXmppTransferManager();
 
+    int ibbWindowSize() const;
+    void setIbbWindowSize(int windowSize);
+
+    bool ibbMessageStanzas() const;
+    void setIbbMessageStanzas(bool messageStanzas);
+
+    int maximumActiveJobs() const;
+    void setMaximumActiveJobs(int count);
+
+    qint64 maximumRate() const;
+    void setMaximumRate(qint64 rate);
+
     QString proxy() const;
     void setProxy(const QString &proxyJid);
 
@@ -282,6 +334,7 @@ private:
     void byteStreamSetReceived(const QXmppByteStreamIq&);
     void ibbCloseIqReceived(const QXmppIbbCloseIq&);
     void ibbDataIqReceived(const QXmppIbbDataIq&);
+    void ibbDataMessageReceived(const QDomElement&);
     void ibbOpenIqReceived(const QXmppIbbOpenIq&);
     void ibbResponseReceived(const QXmppIq&);
     void streamInitiationIqReceived(const QXmppStreamInitiationIq&);
@@ -24,7 +24,16 @@
 #ifndef QXMPPTRANSFERMANAGER_P_H
 #define QXMPPTRANSFERMANAGER_P_H
 
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QThread>
+#include <QTime>
+
 #include "QXmppByteStreamIq.h"
+#include "QXmppIbbIq.h"
+#include "QXmppStreamInitiationIq_p.h"
 #include "QXmppTransferManager.h"
 
 //
@@ -40,6 +49,99 @@
 
 class QTimer;
 class QXmppSocksClient;
+class QXmppTransferScheduler;
+
+/// \internal
+///
+/// The QXmppTransferHasher class computes the hashes of a file in a worker
+/// thread, so that offering a large file does not block the event loop.
+///
+
+class QXmppTransferHasher : public QThread
+{
+    Q_OBJECT
+
+public:
+    QXmppTransferHasher(const QString &filePath, QObject *parent);
+    ~QXmppTransferHasher();
+
+    void cancel();
+    QByteArray md5() const;
+    QByteArray sha256() const;
+
+protected:
+    void run();
+
+private:
+    QString m_filePath;
+    QAtomicInt m_cancelled;
+    QByteArray m_md5;
+    QByteArray m_sha256;
+};
+
+class QXmppTransferJobPrivate
+{
+public:
+    QXmppTransferJobPrivate(QXmppTransferJob *qq);
+    bool hasRequestId(const QString &id) const;
+    void setRequestId(const QString &jid, const QString &id);
+    void setIbbPingId(const QString &id);
+    void addIbbPending(const QXmppIbbDataIq &iq);
+    QXmppIbbDataIq takeIbbPending(const QString &id);
+
+    int blockSize;
+    QXmppClient *client;
+    QXmppTransferJob::Direction direction;
+    qint64 done;
+    QXmppTransferJob::Error error;
+    QCryptographicHash hash;
+    QCryptographicHash sha256;
+    QXmppTransferHasher *hasher;
+    QIODevice *iodevice;
+    qint64 rangeOffset;
+    QByteArray sendBuffer;
+    QString offerId;
+    QString jid;
+    QUrl localFileUrl;
+    QString sid;
+    QXmppTransferJob::Method method;
+    QString mimeType;
+    QXmppTransferJob::Priority priority;
+    QString requestId;
+    QString requestJid;
+    QXmppTransferJob::State state;
+    QTime transferStart;
+    bool deviceIsOwn;
+
+    // file meta-data
+    QXmppTransferFileInfo fileInfo;
+
+    // for bandwidth shaping
+    qint64 maximumRate;
+    qreal rateTokens;
+    qint64 rateStamp;
+    QXmppTransferScheduler *scheduler;
+
+    // the manager's index of jobs by recipient and request identifier
+    QHash<QPair<QString, QString>, QXmppTransferJob*> *requestIndex;
+
+    // for in-band bytestreams
+    quint16 ibbSequence;
+    bool ibbMessages;
+    int ibbWindow;
+    QString ibbPingId;
+    QHash<QString, QXmppIbbDataIq> ibbPending;
+    QHash<quint16, int> ibbResends;
+    QHash<quint16, QByteArray> ibbReorder;
+
+    // for socks5 bytestreams
+    QTcpSocket *socksSocket;
+    QXmppByteStreamIq::StreamHost socksProxy;
+
+private:
+    void updateRequestIndex(const QPair<QString, QString> &oldKey, const QPair<QString, QString> &newKey);
+    QXmppTransferJob *q;
+};
 
 class QXmppTransferIncomingJob : public QXmppTransferJob
 {
@@ -50,18 +152,22 @@ public:
     void checkData();
     void connectToHosts(const QXmppByteStreamIq &iq);
     bool writeData(const QByteArray &data);
+    bool writeIbbData(quint16 sequence, const QByteArray &data);
 
 private slots:
     void _q_candidateDisconnected();
     void _q_candidateReady();
+    void _q_connectToNextHost();
     void _q_disconnected();
+    void _q_hashFinished();
     void _q_receiveData();
 
 private:
     void connectToNextHost();
+    QXmppByteStreamIq::StreamHost takeCandidate(QXmppSocksClient *candidateClient);
 
-    QXmppByteStreamIq::StreamHost m_candidateHost;
-    QXmppSocksClient *m_candidateClient;
+    QHash<QXmppSocksClient*, QXmppByteStreamIq::StreamHost> m_candidates;
+    QHash<QXmppSocksClient*, QTimer*> m_candidateTimeouts;
     QTimer *m_candidateTimer;
     QList<QXmppByteStreamIq::StreamHost> m_streamCandidates;
     QString m_streamOfferId;
@@ -75,12 +181,59 @@ class QXmppTransferOutgoingJob : public QXmppTransferJob
 public:
     QXmppTransferOutgoingJob(const QString &jid, QXmppClient *client, QObject *parent);
     void connectToProxy();
+    bool resendIbbData(const QString &id);
+    void sendIbbData();
+    void sendData();
+    void sendOffer(const QXmppStreamInitiationIq &offer, const QString &filePath);
     void startSending();
 
 private slots:
     void _q_disconnected();
+    void _q_hashFinished();
     void _q_proxyReady();
     void _q_sendData();
+
+private:
+    QXmppStreamInitiationIq m_offer;
+};
+
+/// \internal
+///
+/// The QXmppTransferScheduler class shares the outgoing bandwidth between
+/// transfer jobs, using token buckets for the global rate limit and for
+/// the rate limit of each job.
+///
+/// A job which is not allowed to send is resumed by the scheduler once
+/// tokens are available, jobs with a higher priority being resumed first.
+///
+
+class QXmppTransferScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppTransferScheduler(QObject *parent);
+
+    bool canSend(QXmppTransferJob *job);
+    void consume(QXmppTransferJob *job, qint64 bytes);
+    qint64 quantum(QXmppTransferJob *job) const;
+    void removeJob(QXmppTransferJob *job);
+
+    qint64 maximumRate() const;
+    void setMaximumRate(qint64 rate);
+
+private slots:
+    void _q_timeout();
+
+private:
+    bool hasJobTokens(QXmppTransferJob *job, qint64 now);
+
+    QElapsedTimer m_clock;
+    qint64 m_rate;
+    qreal m_tokens;
+    qint64 m_stamp;
+    QTimer *m_timer;
+    QList<QXmppTransferJob*> m_waiting;
 };
 
 #endif
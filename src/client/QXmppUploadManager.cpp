@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
+
+#include "QXmppClient.h"
+#include "QXmppConstants_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppHttpUploadIq.h"
+#include "QXmppUploadManager.h"
+
+class QXmppHttpUploadPrivate
+{
+public:
+    QXmppHttpUploadPrivate();
+
+    qint64 bytesSent;
+    QIODevice *device;
+    QXmppHttpUpload::Error error;
+    QString errorText;
+    QString fileName;
+    qint64 fileSize;
+    QUrl getUrl;
+    bool isFinished;
+    QMimeType mimeType;
+    QPointer<QNetworkReply> reply;
+    QString requestId;
+};
+
+QXmppHttpUploadPrivate::QXmppHttpUploadPrivate()
+    : bytesSent(0)
+    , device(0)
+    , error(QXmppHttpUpload::NoError)
+    , fileSize(0)
+    , isFinished(false)
+{
+}
+
+QXmppHttpUpload::QXmppHttpUpload(QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppHttpUploadPrivate)
+{
+}
+
+QXmppHttpUpload::~QXmppHttpUpload()
+{
+    if (d->reply) {
+        d->reply->disconnect(this);
+        d->reply->abort();
+        d->reply->deleteLater();
+    }
+    delete d;
+}
+
+/// Aborts the upload.
+
+void QXmppHttpUpload::abort()
+{
+    finish(AbortError, QLatin1String("Upload aborted"));
+}
+
+/// Returns the number of bytes which have been uploaded so far.
+
+qint64 QXmppHttpUpload::bytesSent() const
+{
+    return d->bytesSent;
+}
+
+/// Returns the last error that was encountered.
+
+QXmppHttpUpload::Error QXmppHttpUpload::error() const
+{
+    return d->error;
+}
+
+/// Returns a human-readable description of the last error.
+
+QString QXmppHttpUpload::errorText() const
+{
+    return d->errorText;
+}
+
+/// Returns the name under which the file is uploaded.
+
+QString QXmppHttpUpload::fileName() const
+{
+    return d->fileName;
+}
+
+/// Returns the size of the file in bytes.
+
+qint64 QXmppHttpUpload::fileSize() const
+{
+    return d->fileSize;
+}
+
+/// Returns the URL from which the file can be downloaded once the
+/// upload succeeded.
+
+QUrl QXmppHttpUpload::getUrl() const
+{
+    return d->getUrl;
+}
+
+/// Returns true if the upload is finished, whether or not it succeeded.
+
+bool QXmppHttpUpload::isFinished() const
+{
+    return d->isFinished;
+}
+
+void QXmppHttpUpload::finish(QXmppHttpUpload::Error error, const QString &errorText)
+{
+    if (d->isFinished)
+        return;
+
+    if (d->reply) {
+        QNetworkReply *reply = d->reply;
+        d->reply = 0;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    d->error = error;
+    d->errorText = errorText;
+    d->isFinished = true;
+    if (error != NoError) {
+        d->getUrl = QUrl();
+        warning(QString("Upload of %1 failed: %2").arg(d->fileName, errorText));
+    } else {
+        info(QString("Uploaded %1 to %2").arg(d->fileName, d->getUrl.toString()));
+    }
+    emit finished();
+}
+
+/// Finishes the upload once control returns to the event loop, so that
+/// the caller can connect to the finished() signal first.
+
+void QXmppHttpUpload::finishLater(QXmppHttpUpload::Error error, const QString &errorText)
+{
+    d->error = error;
+    d->errorText = errorText;
+    QMetaObject::invokeMethod(this, "_q_finish", Qt::QueuedConnection);
+}
+
+void QXmppHttpUpload::_q_finish()
+{
+    finish(d->error, d->errorText);
+}
+
+void QXmppHttpUpload::_q_replyFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || reply != d->reply)
+        return;
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() != QNetworkReply::NoError) {
+        finish(NetworkError, reply->errorString());
+    } else if (status != 200 && status != 201) {
+        finish(NetworkError, QString("Unexpected HTTP status %1").arg(status));
+    } else {
+        d->bytesSent = d->fileSize;
+        finish(NoError);
+    }
+}
+
+void QXmppHttpUpload::_q_uploadProgress(qint64 done, qint64 total)
+{
+    if (done <= d->bytesSent)
+        return;
+    d->bytesSent = done;
+    emit progress(done, total > 0 ? total : d->fileSize);
+}
+
+class QXmppUploadManagerPrivate
+{
+public:
+    QXmppUploadManagerPrivate();
+
+    void startUpload(QXmppHttpUpload *upload, const QXmppHttpUploadSlotIq &slot);
+
+    QXmppDiscoveryManager *discoveryManager;
+    QStringList discoveryRequests;
+    qint64 maximumFileSize;
+    QNetworkAccessManager *network;
+    QString serviceJid;
+    QList<QXmppHttpUpload*> uploads;
+};
+
+QXmppUploadManagerPrivate::QXmppUploadManagerPrivate()
+    : discoveryManager(0)
+    , maximumFileSize(-1)
+    , network(0)
+{
+}
+
+void QXmppUploadManagerPrivate::startUpload(QXmppHttpUpload *upload, const QXmppHttpUploadSlotIq &slot)
+{
+    QNetworkRequest request(slot.putUrl());
+    request.setHeader(QNetworkRequest::ContentLengthHeader, upload->d->fileSize);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, upload->d->mimeType.name());
+
+    // stream the file from the device instead of buffering it in memory
+    request.setAttribute(QNetworkRequest::DoNotBufferUploadDataAttribute, true);
+
+    const QMap<QString, QString> headers = slot.putHeaders();
+    for (QMap<QString, QString>::const_iterator it = headers.constBegin(); it != headers.constEnd(); ++it)
+        request.setRawHeader(it.key().toLatin1(), it.value().toUtf8());
+
+    bool check;
+    Q_UNUSED(check);
+
+    upload->d->getUrl = slot.getUrl();
+    upload->d->reply = network->put(request, upload->d->device);
+
+    check = QObject::connect(upload->d->reply, SIGNAL(finished()),
+                             upload, SLOT(_q_replyFinished()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(upload->d->reply, SIGNAL(uploadProgress(qint64,qint64)),
+                             upload, SLOT(_q_uploadProgress(qint64,qint64)));
+    Q_ASSERT(check);
+}
+
+/// Constructs a QXmppUploadManager.
+
+QXmppUploadManager::QXmppUploadManager()
+    : d(new QXmppUploadManagerPrivate)
+{
+    d->network = new QNetworkAccessManager(this);
+}
+
+QXmppUploadManager::~QXmppUploadManager()
+{
+    // the network access manager deletes its replies, so abort the
+    // uploads while it still exists
+    qDeleteAll(findChildren<QXmppHttpUpload*>(QString(), Qt::FindDirectChildrenOnly));
+    delete d;
+}
+
+/// Returns the maximum size of a file accepted by the upload service,
+/// or -1 if the service did not advertise a limit.
+
+qint64 QXmppUploadManager::maximumFileSize() const
+{
+    return d->maximumFileSize;
+}
+
+/// Returns the JID of the upload service.
+
+QString QXmppUploadManager::serviceJid() const
+{
+    return d->serviceJid;
+}
+
+/// Sets the JID of the upload service.
+///
+/// \param jid
+
+void QXmppUploadManager::setServiceJid(const QString &jid)
+{
+    d->serviceJid = jid;
+}
+
+/// Uploads the file at the given path.
+///
+/// The caller does not own the returned upload, which is deleted along
+/// with the manager. You may delete it once it is finished.
+///
+/// If the upload cannot be started, it still emits finished() with an
+/// error, once control returns to the event loop.
+///
+/// \param filePath
+
+QXmppHttpUpload *QXmppUploadManager::uploadFile(const QString &filePath)
+{
+    const QFileInfo info(filePath);
+    QFile *file = new QFile(filePath);
+    if (!file->open(QIODevice::ReadOnly)) {
+        QXmppHttpUpload *upload = new QXmppHttpUpload(this);
+        upload->d->fileName = info.fileName();
+        upload->finishLater(QXmppHttpUpload::FileAccessError, file->errorString());
+        delete file;
+        return upload;
+    }
+
+    QXmppHttpUpload *upload = uploadFile(file, info.fileName(), QMimeDatabase().mimeTypeForFile(info));
+    file->setParent(upload);
+    return upload;
+}
+
+/// Uploads the data read from the given device.
+///
+/// The device must remain open and readable until the upload is finished.
+/// If it is sequential, it must report its size with bytesAvailable().
+///
+/// \param device
+/// \param fileName
+/// \param mimeType
+
+QXmppHttpUpload *QXmppUploadManager::uploadFile(QIODevice *device, const QString &fileName, const QMimeType &mimeType)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppHttpUpload *upload = new QXmppHttpUpload(this);
+    upload->d->device = device;
+    upload->d->fileName = fileName;
+    upload->d->fileSize = device->isSequential() ? device->bytesAvailable() : device->size();
+    upload->d->mimeType = mimeType.isValid() ? mimeType : QMimeDatabase().mimeTypeForFile(fileName, QMimeDatabase::MatchExtension);
+
+    if (!device->isReadable()) {
+        upload->finishLater(QXmppHttpUpload::FileAccessError, QLatin1String("Device is not readable"));
+        return upload;
+    }
+    if (d->serviceJid.isEmpty()) {
+        upload->finishLater(QXmppHttpUpload::ServiceError, QLatin1String("No upload service available"));
+        return upload;
+    }
+    if (d->maximumFileSize >= 0 && upload->d->fileSize > d->maximumFileSize) {
+        upload->finishLater(QXmppHttpUpload::ServiceError, QLatin1String("File exceeds the maximum size"));
+        return upload;
+    }
+
+    QXmppHttpUploadRequestIq request;
+    request.setTo(d->serviceJid);
+    request.setContentType(upload->d->mimeType);
+    request.setFileName(fileName);
+    request.setSize(upload->d->fileSize);
+    if (!client()->sendPacket(request)) {
+        upload->finishLater(QXmppHttpUpload::ServiceError, QLatin1String("Could not request an upload slot"));
+        return upload;
+    }
+
+    upload->d->requestId = request.id();
+    d->uploads << upload;
+    check = connect(upload, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(_q_uploadDestroyed(QObject*)));
+    Q_ASSERT(check);
+
+    return upload;
+}
+
+/// \cond
+bool QXmppUploadManager::handleStanza(const QDomElement &element)
+{
+    if (element.tagName() != "iq")
+        return false;
+
+    // only the upload service may answer a slot request
+    const QString id = element.attribute("id");
+    if (element.attribute("from") != d->serviceJid)
+        return false;
+
+    foreach (QXmppHttpUpload *upload, d->uploads) {
+        if (upload->d->requestId != id)
+            continue;
+
+        const QString type = element.attribute("type");
+        if (type != "result" && type != "error")
+            return false;
+
+        d->uploads.removeAll(upload);
+        upload->d->requestId.clear();
+        if (upload->isFinished())
+            return true;
+
+        QXmppHttpUploadSlotIq slot;
+        slot.parse(element);
+        if (slot.type() == QXmppIq::Error) {
+            upload->finish(QXmppHttpUpload::ServiceError, slot.error().text());
+        } else if (!slot.putUrl().isValid() || !slot.getUrl().isValid()) {
+            upload->finish(QXmppHttpUpload::ServiceError, QLatin1String("Invalid upload slot"));
+        } else {
+            d->startUpload(upload, slot);
+        }
+        return true;
+    }
+    return false;
+}
+
+void QXmppUploadManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(connected()),
+                    this, SLOT(_q_connected()));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(disconnected()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+}
+/// \endcond
+
+void QXmppUploadManager::_q_connected()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // the discovery manager may have been added after this extension
+    if (!d->discoveryManager) {
+        d->discoveryManager = client()->findExtension<QXmppDiscoveryManager>();
+        if (!d->discoveryManager)
+            return;
+
+        check = connect(d->discoveryManager, SIGNAL(infoReceived(QXmppDiscoveryIq)),
+                        this, SLOT(_q_infoReceived(QXmppDiscoveryIq)));
+        Q_ASSERT(check);
+
+        check = connect(d->discoveryManager, SIGNAL(itemsReceived(QXmppDiscoveryIq)),
+                        this, SLOT(_q_itemsReceived(QXmppDiscoveryIq)));
+        Q_ASSERT(check);
+    }
+
+    if (d->serviceJid.isEmpty()) {
+        const QString id = d->discoveryManager->requestItems(client()->configuration().domain());
+        if (!id.isEmpty())
+            d->discoveryRequests << id;
+    }
+}
+
+void QXmppUploadManager::_q_disconnected()
+{
+    d->discoveryRequests.clear();
+
+    // pending slot requests will never be answered
+    while (!d->uploads.isEmpty()) {
+        QXmppHttpUpload *upload = d->uploads.takeFirst();
+        upload->d->requestId.clear();
+        upload->finish(QXmppHttpUpload::ServiceError, QLatin1String("Disconnected from server"));
+    }
+}
+
+void QXmppUploadManager::_q_infoReceived(const QXmppDiscoveryIq &iq)
+{
+    if (!d->discoveryRequests.removeAll(iq.id()) || iq.type() != QXmppIq::Result)
+        return;
+    if (!d->serviceJid.isEmpty() || !iq.features().contains(ns_http_upload))
+        return;
+
+    d->serviceJid = iq.from();
+    d->maximumFileSize = -1;
+    foreach (const QXmppDataForm::Field &field, iq.form().fields()) {
+        if (field.key() == "max-file-size") {
+            bool ok;
+            const qint64 size = field.value().toString().toLongLong(&ok);
+            if (ok)
+                d->maximumFileSize = size;
+        }
+    }
+    d->discoveryRequests.clear();
+
+    info(QString("Found HTTP upload service %1").arg(d->serviceJid));
+    emit serviceFound();
+}
+
+void QXmppUploadManager::_q_itemsReceived(const QXmppDiscoveryIq &iq)
+{
+    if (!d->discoveryRequests.removeAll(iq.id()) || iq.type() != QXmppIq::Result)
+        return;
+
+    foreach (const QXmppDiscoveryIq::Item &item, iq.items()) {
+        const QString id = d->discoveryManager->requestInfo(item.jid(), item.node());
+        if (!id.isEmpty())
+            d->discoveryRequests << id;
+    }
+}
+
+void QXmppUploadManager::_q_uploadDestroyed(QObject *object)
+{
+    d->uploads.removeAll(static_cast<QXmppHttpUpload*>(object));
+}
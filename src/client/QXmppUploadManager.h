@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPUPLOADMANAGER_H
+#define QXMPPUPLOADMANAGER_H
+
+#include <QMimeType>
+#include <QUrl>
+
+#include "QXmppClientExtension.h"
+
+class QIODevice;
+class QXmppDiscoveryIq;
+class QXmppHttpUploadPrivate;
+class QXmppUploadManagerPrivate;
+
+/// \brief The QXmppHttpUpload class represents the upload of a file
+/// using XEP-0363: HTTP File Upload.
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppHttpUpload : public QXmppLoggable
+{
+    Q_OBJECT
+    Q_ENUMS(Error)
+    Q_PROPERTY(QString fileName READ fileName CONSTANT)
+    Q_PROPERTY(qint64 fileSize READ fileSize CONSTANT)
+    Q_PROPERTY(QUrl getUrl READ getUrl NOTIFY finished)
+
+public:
+    /// This enum is used to describe the type of error encountered by an upload.
+    enum Error
+    {
+        NoError = 0,      ///< No error occurred.
+        AbortError,       ///< The upload was aborted.
+        FileAccessError,  ///< An error was encountered trying to read the file.
+        ServiceError,     ///< The upload service did not provide a slot.
+        NetworkError      ///< An error was encountered while uploading the file.
+    };
+
+    ~QXmppHttpUpload();
+
+    qint64 bytesSent() const;
+    QXmppHttpUpload::Error error() const;
+    QString errorText() const;
+    QString fileName() const;
+    qint64 fileSize() const;
+    QUrl getUrl() const;
+    bool isFinished() const;
+
+signals:
+    /// This signal is emitted when the upload is finished, whether or not
+    /// it succeeded.
+    void finished();
+
+    /// This signal is emitted to indicate the progress of the upload.
+    void progress(qint64 done, qint64 total);
+
+public slots:
+    void abort();
+
+private slots:
+    void _q_finish();
+    void _q_replyFinished();
+    void _q_uploadProgress(qint64 done, qint64 total);
+
+private:
+    QXmppHttpUpload(QObject *parent);
+    void finish(QXmppHttpUpload::Error error, const QString &errorText = QString());
+    void finishLater(QXmppHttpUpload::Error error, const QString &errorText);
+
+    QXmppHttpUploadPrivate *d;
+    friend class QXmppUploadManager;
+    friend class QXmppUploadManagerPrivate;
+};
+
+/// \brief The QXmppUploadManager class uploads files to an HTTP server,
+/// as defined by XEP-0363: HTTP File Upload.
+///
+/// The manager requests an upload slot from the upload service of the
+/// user's server, then streams the file to the slot with an HTTP PUT
+/// request. Once the upload is finished, the file can be shared with
+/// other users by sending them QXmppHttpUpload::getUrl().
+///
+/// If a QXmppDiscoveryManager is loaded, the upload service is discovered
+/// when the client connects, otherwise it must be set using setServiceJid().
+///
+/// To make use of this manager, you need to instantiate it and load it into
+/// the QXmppClient instance as follows:
+///
+/// \code
+/// QXmppUploadManager *manager = new QXmppUploadManager;
+/// client->addExtension(manager);
+/// \endcode
+///
+/// \ingroup Managers
+
+class QXMPP_EXPORT QXmppUploadManager : public QXmppClientExtension
+{
+    Q_OBJECT
+    Q_PROPERTY(qint64 maximumFileSize READ maximumFileSize)
+    Q_PROPERTY(QString serviceJid READ serviceJid WRITE setServiceJid NOTIFY serviceFound)
+
+public:
+    QXmppUploadManager();
+    ~QXmppUploadManager();
+
+    qint64 maximumFileSize() const;
+
+    QString serviceJid() const;
+    void setServiceJid(const QString &jid);
+
+    QXmppHttpUpload *uploadFile(const QString &filePath);
+    QXmppHttpUpload *uploadFile(QIODevice *device, const QString &fileName, const QMimeType &mimeType = QMimeType());
+
+    /// \cond
+    bool handleStanza(const QDomElement &element);
+    /// \endcond
+
+signals:
+    /// This signal is emitted when the upload service was discovered.
+    void serviceFound();
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_connected();
+    void _q_disconnected();
+    void _q_infoReceived(const QXmppDiscoveryIq &iq);
+    void _q_itemsReceived(const QXmppDiscoveryIq &iq);
+    void _q_uploadDestroyed(QObject *object);
+
+private:
+    QXmppUploadManagerPrivate *d;
+};
+
+#endif
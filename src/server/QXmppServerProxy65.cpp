@@ -0,0 +1,620 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+
+#include "QXmppByteStreamIq.h"
+#include "QXmppByteStream_p.h"
+#include "QXmppConstants_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerProxy65.h"
+#include "QXmppServerProxy65_p.h"
+#include "QXmppSocks.h"
+#include "QXmppUtils.h"
+
+// largest amount of data buffered for each direction of a bytestream (256 KiB)
+const int relayBufferSize = 256 * 1024;
+
+// size of the blocks copied between sockets (64 KiB)
+const int relayBlockSize = 64 * 1024;
+
+// smallest amount of data copied at once by a rate-limited bytestream (4 KiB)
+const qint64 relayMinQuantum = 4096;
+
+// time the initiator has to activate a bytestream (60 seconds)
+const int relayPendingTimeout = 60000;
+
+// time after which an activated bytestream which relays no data
+// is closed (5 minutes)
+const int relayIdleTimeout = 300000;
+
+/// \cond
+QXmppProxy65Channel::QXmppProxy65Channel(QTcpSocket *from, QTcpSocket *to, qint64 rate, QObject *parent)
+    : QObject(parent)
+    , m_buffer(relayBlockSize, 0)
+    , m_finished(false)
+    , m_from(from)
+    , m_lastActivity(0)
+    , m_rate(rate)
+    , m_stamp(0)
+    , m_to(to)
+    , m_tokens(rate > 0 ? rateQuantum(rate, relayMinQuantum) : 0)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_clock.start();
+
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    check = connect(m_timer, SIGNAL(timeout()),
+                    this, SLOT(transfer()));
+    Q_ASSERT(check);
+
+    check = connect(m_from, SIGNAL(readyRead()),
+                    this, SLOT(transfer()));
+    Q_ASSERT(check);
+
+    check = connect(m_from, SIGNAL(disconnected()),
+                    this, SLOT(transfer()));
+    Q_ASSERT(check);
+
+    check = connect(m_to, SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(transfer()));
+    Q_ASSERT(check);
+}
+
+/// Returns the number of milliseconds since data was last copied.
+
+qint64 QXmppProxy65Channel::idleTime() const
+{
+    return m_clock.elapsed() - m_lastActivity;
+}
+
+/// Copies the available data, until the recipient's buffer is full
+/// or the rate limit is reached.
+///
+/// Once the sender has disconnected and all its data has been copied,
+/// the recipient is disconnected.
+
+void QXmppProxy65Channel::transfer()
+{
+    if (m_finished)
+        return;
+
+    while (m_from->bytesAvailable() > 0) {
+        // wait for the recipient to drain its buffer
+        if (m_to->state() == QAbstractSocket::ConnectedState &&
+            m_to->bytesToWrite() >= relayBufferSize)
+            return;
+
+        qint64 length = m_buffer.size();
+        if (m_rate > 0) {
+            const qint64 quantum = rateQuantum(m_rate, relayMinQuantum);
+            const qint64 now = m_clock.elapsed();
+            m_tokens = qMin(qreal(quantum), m_tokens + (now - m_stamp) * m_rate / 1000.0);
+            m_stamp = now;
+            if (m_tokens <= 0) {
+                m_timer->start(qMax(1, int((1 - m_tokens) * 1000 / m_rate)));
+                return;
+            }
+            length = qMin(length, quantum);
+        }
+
+        length = m_from->read(m_buffer.data(), length);
+        if (length <= 0)
+            break;
+        if (m_to->state() == QAbstractSocket::ConnectedState)
+            m_to->write(m_buffer.constData(), length);
+        m_tokens -= length;
+        m_lastActivity = m_clock.elapsed();
+    }
+
+    // forward the end of the bytestream
+    if (m_from->state() == QAbstractSocket::UnconnectedState && !m_from->bytesAvailable()) {
+        m_finished = true;
+        m_to->disconnectFromHost();
+    }
+}
+
+QXmppProxy65Relay::QXmppProxy65Relay()
+    : m_rate(0)
+    , m_server(0)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_clock.start();
+
+    m_expiryTimer = new QTimer(this);
+    m_expiryTimer->setInterval(relayPendingTimeout / 2);
+    check = connect(m_expiryTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_expire()));
+    Q_ASSERT(check);
+}
+
+/// Starts relaying data for the bytestream identified by \a hash, if
+/// both its initiator and its target are connected.
+
+void QXmppProxy65Relay::activate(const QString &hash)
+{
+    const QList<QTcpSocket*> sockets = m_pending.value(hash);
+    if (sockets.size() != 2 ||
+        sockets[0]->state() != QAbstractSocket::ConnectedState ||
+        sockets[1]->state() != QAbstractSocket::ConnectedState) {
+        emit activated(hash, false);
+        return;
+    }
+
+    m_pending.remove(hash);
+    m_pendingSince.remove(hash);
+
+    QTcpSocket *first = sockets[0];
+    QTcpSocket *second = sockets[1];
+    m_peers.insert(first, second);
+    m_peers.insert(second, first);
+
+    // data received before the activation is relayed too
+    QXmppProxy65Channel *forward = new QXmppProxy65Channel(first, second, m_rate, first);
+    QXmppProxy65Channel *backward = new QXmppProxy65Channel(second, first, m_rate, second);
+    QMetaObject::invokeMethod(forward, "transfer", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(backward, "transfer", Qt::QueuedConnection);
+
+    emit activated(hash, true);
+}
+
+/// Starts listening for SOCKS5 connections on \a port.
+
+bool QXmppProxy65Relay::listen(quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (!m_server) {
+        m_server = new QXmppSocksServer(this);
+        check = connect(m_server, SIGNAL(newConnection(QTcpSocket*,QString,quint16)),
+                        this, SLOT(_q_newConnection(QTcpSocket*,QString,quint16)));
+        Q_ASSERT(check);
+    }
+
+    if (!m_server->listen(port))
+        return false;
+
+    m_expiryTimer->start();
+    return true;
+}
+
+/// Sets the maximum rate of each direction of the bytestreams
+/// activated from now on, in bytes per second.
+
+void QXmppProxy65Relay::setMaximumRate(qint64 rate)
+{
+    m_rate = qMax(qint64(0), rate);
+}
+
+void QXmppProxy65Relay::_q_expire()
+{
+    const qint64 now = m_clock.elapsed();
+
+    QList<QTcpSocket*> expired;
+    foreach (const QString &hash, m_pendingSince.keys()) {
+        if (now - m_pendingSince.value(hash) >= relayPendingTimeout) {
+            expired += m_pending.take(hash);
+            m_pendingSince.remove(hash);
+        }
+    }
+
+    foreach (QTcpSocket *socket, expired) {
+        socket->abort();
+        socket->deleteLater();
+    }
+
+    // close the activated bytestreams which relay no data in either direction,
+    // _q_socketDisconnected() releases the sockets
+    QList<QTcpSocket*> idle;
+    for (QHash<QTcpSocket*, QTcpSocket*>::const_iterator it = m_peers.constBegin(); it != m_peers.constEnd(); ++it) {
+        QXmppProxy65Channel *channel = it.key()->findChild<QXmppProxy65Channel*>();
+        QXmppProxy65Channel *peerChannel = it.value()->findChild<QXmppProxy65Channel*>();
+        if (channel && channel->idleTime() >= relayIdleTimeout &&
+            peerChannel && peerChannel->idleTime() >= relayIdleTimeout)
+            idle << it.key();
+    }
+
+    foreach (QTcpSocket *socket, idle)
+        socket->abort();
+}
+
+void QXmppProxy65Relay::_q_newConnection(QTcpSocket *socket, const QString &hostName, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // a bytestream has exactly one initiator and one target
+    if (port != 0 || m_pending.value(hostName).size() >= 2) {
+        socket->disconnectFromHost();
+        socket->deleteLater();
+        return;
+    }
+
+    socket->setParent(this);
+    socket->setReadBufferSize(relayBufferSize);
+    check = connect(socket, SIGNAL(disconnected()),
+                    this, SLOT(_q_socketDisconnected()));
+    Q_ASSERT(check);
+
+    if (!m_pending.contains(hostName))
+        m_pendingSince.insert(hostName, m_clock.elapsed());
+    m_pending[hostName] << socket;
+}
+
+void QXmppProxy65Relay::_q_socketDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+
+    // the bytestream was not activated yet
+    foreach (const QString &hash, m_pending.keys()) {
+        if (m_pending[hash].removeAll(socket)) {
+            if (m_pending[hash].isEmpty()) {
+                m_pending.remove(hash);
+                m_pendingSince.remove(hash);
+            }
+            socket->deleteLater();
+            return;
+        }
+    }
+
+    // the bytestream is finished once both sockets are disconnected
+    QTcpSocket *peer = m_peers.value(socket);
+    if (!peer) {
+        socket->deleteLater();
+    } else if (peer->state() == QAbstractSocket::UnconnectedState) {
+        m_peers.remove(socket);
+        m_peers.remove(peer);
+        socket->deleteLater();
+        peer->deleteLater();
+    }
+}
+/// \endcond
+
+class QXmppServerProxy65Private
+{
+public:
+    QXmppServerProxy65Private();
+    bool isAllowed(const QString &jid, const QString &domain) const;
+
+    QHash<QString, QXmppByteStreamIq> activations;
+    QStringList allowedDomains;
+    QString host;
+    QString jid;
+    qint64 maximumRate;
+    quint16 port;
+    QXmppProxy65Relay *relay;
+    QThread *thread;
+};
+
+QXmppServerProxy65Private::QXmppServerProxy65Private()
+    : maximumRate(0)
+    , port(7777)
+    , relay(0)
+    , thread(0)
+{
+}
+
+/// Returns true if the user with the given \a jid may use the proxy.
+
+bool QXmppServerProxy65Private::isAllowed(const QString &jid, const QString &domain) const
+{
+    const QString jidDomain = QXmppUtils::jidToDomain(jid);
+    return jidDomain == domain || allowedDomains.contains(jidDomain);
+}
+
+/// Constructs a new SOCKS5 Bytestreams proxy.
+
+QXmppServerProxy65::QXmppServerProxy65()
+    : d(new QXmppServerProxy65Private)
+{
+}
+
+QXmppServerProxy65::~QXmppServerProxy65()
+{
+    stop();
+    delete d;
+}
+
+/// Returns the domains, besides the server's own domain, whose
+/// users may use the proxy.
+///
+
+QStringList QXmppServerProxy65::allowedDomains() const
+{
+    return d->allowedDomains;
+}
+
+/// Sets the domains, besides the server's own domain, whose
+/// users may use the proxy.
+///
+
+void QXmppServerProxy65::setAllowedDomains(const QStringList &allowedDomains)
+{
+    d->allowedDomains = allowedDomains;
+}
+
+/// Returns the host name or address which users connect to.
+///
+
+QString QXmppServerProxy65::host() const
+{
+    return d->host;
+}
+
+/// Sets the host name or address which users connect to.
+///
+/// The default is the server's domain.
+///
+
+void QXmppServerProxy65::setHost(const QString &host)
+{
+    d->host = host;
+}
+
+/// Returns the proxy's JID.
+///
+
+QString QXmppServerProxy65::jid() const
+{
+    return d->jid;
+}
+
+/// Sets the proxy's JID.
+///
+/// The default is "proxy." followed by the server's domain.
+///
+
+void QXmppServerProxy65::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// Returns the maximum rate of each direction of a bytestream,
+/// in bytes per second, or 0 if it is not limited.
+///
+
+qint64 QXmppServerProxy65::maximumRate() const
+{
+    return d->maximumRate;
+}
+
+/// Sets the maximum rate of each direction of a bytestream,
+/// in bytes per second.
+///
+/// The limit applies to the bytestreams activated after it is set.
+/// The default is 0, which means no limit.
+///
+
+void QXmppServerProxy65::setMaximumRate(qint64 rate)
+{
+    d->maximumRate = qMax(qint64(0), rate);
+    if (d->relay)
+        QMetaObject::invokeMethod(d->relay, "setMaximumRate", Q_ARG(qint64, d->maximumRate));
+}
+
+/// Returns the TCP port which users connect to.
+///
+
+quint16 QXmppServerProxy65::port() const
+{
+    return d->port;
+}
+
+/// Sets the TCP port which users connect to.
+///
+/// The default is 7777.
+///
+
+void QXmppServerProxy65::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+QStringList QXmppServerProxy65::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppServerProxy65::handleStanza(const QDomElement &element)
+{
+    if (d->jid.isEmpty() || element.attribute("to") != d->jid)
+        return false;
+
+    if (element.tagName() != QLatin1String("iq"))
+        return true;
+
+    if (QXmppDiscoveryIq::isDiscoveryIq(element))
+    {
+        QXmppDiscoveryIq discoIq;
+        discoIq.parse(element);
+
+        if (discoIq.type() == QXmppIq::Get && discoIq.queryType() == QXmppDiscoveryIq::InfoQuery)
+        {
+            QXmppDiscoveryIq::Identity identity;
+            identity.setCategory("proxy");
+            identity.setType("bytestreams");
+            identity.setName("SOCKS5 Bytestreams");
+
+            QXmppDiscoveryIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(discoIq.id());
+            response.setFrom(d->jid);
+            response.setTo(discoIq.from());
+            response.setQueryType(QXmppDiscoveryIq::InfoQuery);
+            response.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+            response.setFeatures(QStringList() << ns_disco_info << ns_bytestreams);
+            server()->sendPacket(response);
+            return true;
+        }
+    }
+    else if (QXmppByteStreamIq::isByteStreamIq(element))
+    {
+        QXmppByteStreamIq bsIq;
+        bsIq.parse(element);
+
+        if (bsIq.type() == QXmppIq::Get || bsIq.type() == QXmppIq::Set)
+        {
+            QXmppIq response(QXmppIq::Error);
+            response.setId(bsIq.id());
+            response.setFrom(d->jid);
+            response.setTo(bsIq.from());
+
+            if (!d->isAllowed(bsIq.from(), server()->domain()))
+            {
+                warning(QString("Refusing bytestream request from %1").arg(bsIq.from()));
+                response.setError(QXmppStanza::Error(QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden));
+                server()->sendPacket(response);
+            }
+            else if (bsIq.type() == QXmppIq::Get)
+            {
+                // advertise the stream host
+                QXmppByteStreamIq::StreamHost streamHost;
+                streamHost.setJid(d->jid);
+                streamHost.setHost(d->host.isEmpty() ? server()->domain() : d->host);
+                streamHost.setPort(d->port);
+
+                QXmppByteStreamIq hostIq;
+                hostIq.setType(QXmppIq::Result);
+                hostIq.setId(bsIq.id());
+                hostIq.setFrom(d->jid);
+                hostIq.setTo(bsIq.from());
+                hostIq.setStreamHosts(QList<QXmppByteStreamIq::StreamHost>() << streamHost);
+                server()->sendPacket(hostIq);
+            }
+            else if (bsIq.sid().isEmpty() || bsIq.activate().isEmpty() || !d->relay)
+            {
+                response.setError(QXmppStanza::Error(QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest));
+                server()->sendPacket(response);
+            }
+            else
+            {
+                // the relay answers through _q_activated()
+                const QString hash = streamHash(bsIq.sid(), bsIq.from(), bsIq.activate());
+                d->activations.insert(hash, bsIq);
+                QMetaObject::invokeMethod(d->relay, "activate", Q_ARG(QString, hash));
+            }
+            return true;
+        }
+    }
+
+    // we do not support the given IQ
+    QXmppIq request;
+    request.parse(element);
+    if (request.type() != QXmppIq::Error && request.type() != QXmppIq::Result)
+    {
+        QXmppIq response(QXmppIq::Error);
+        response.setId(request.id());
+        response.setFrom(d->jid);
+        response.setTo(request.from());
+        response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented));
+        server()->sendPacket(response);
+    }
+    return true;
+}
+
+bool QXmppServerProxy65::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->relay)
+        return true;
+
+    if (d->jid.isEmpty())
+        d->jid = "proxy." + server()->domain();
+
+    // relay data in a worker thread
+    d->thread = new QThread(this);
+    d->relay = new QXmppProxy65Relay;
+    d->relay->setMaximumRate(d->maximumRate);
+    d->relay->moveToThread(d->thread);
+
+    check = connect(d->thread, SIGNAL(finished()),
+                    d->relay, SLOT(deleteLater()));
+    Q_ASSERT(check);
+
+    check = connect(d->relay, SIGNAL(activated(QString,bool)),
+                    this, SLOT(_q_activated(QString,bool)));
+    Q_ASSERT(check);
+
+    d->thread->start();
+
+    bool listening = false;
+    QMetaObject::invokeMethod(d->relay, "listen", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, listening),
+                              Q_ARG(quint16, d->port));
+    if (!listening) {
+        warning(QString("SOCKS5 proxy could not listen on port %1").arg(QString::number(d->port)));
+        stop();
+        return false;
+    }
+
+    info(QString("SOCKS5 proxy %1 listening on port %2").arg(d->jid, QString::number(d->port)));
+    return true;
+}
+
+void QXmppServerProxy65::stop()
+{
+    if (!d->thread)
+        return;
+
+    // the relay is deleted when the thread finishes
+    d->thread->quit();
+    d->thread->wait();
+    delete d->thread;
+    d->thread = 0;
+    d->relay = 0;
+    d->activations.clear();
+}
+
+void QXmppServerProxy65::_q_activated(const QString &hash, bool success)
+{
+    if (!d->activations.contains(hash))
+        return;
+    const QXmppByteStreamIq request = d->activations.take(hash);
+
+    QXmppIq response(success ? QXmppIq::Result : QXmppIq::Error);
+    response.setId(request.id());
+    response.setFrom(d->jid);
+    response.setTo(request.from());
+    if (success) {
+        info(QString("Activated bytestream %1 from %2 to %3").arg(request.sid(), request.from(), request.activate()));
+        updateCounter("proxy65.activated");
+    } else {
+        warning(QString("Could not activate bytestream %1 from %2 to %3").arg(request.sid(), request.from(), request.activate()));
+        response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound));
+    }
+    server()->sendPacket(response);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERPROXY65_H
+#define QXMPPSERVERPROXY65_H
+
+#include <QStringList>
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerProxy65Private;
+
+/// \brief The QXmppServerProxy65 class provides a SOCKS5 Bytestreams proxy
+/// as defined by XEP-0065: SOCKS5 Bytestreams.
+///
+/// The proxy lets users who cannot connect to each other directly, for
+/// instance because they are behind NATs, exchange files through the
+/// server. Data is relayed by a worker thread, so that transfers do not
+/// delay the handling of XMPP stanzas. Bytestreams which relay no data
+/// for five minutes are closed.
+///
+/// \code
+/// QXmppServerProxy65 *proxy = new QXmppServerProxy65;
+/// proxy->setHost("proxy.example.com");
+/// server->addExtension(proxy);
+/// \endcode
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerProxy65 : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "proxy65")
+    Q_PROPERTY(QStringList allowedDomains READ allowedDomains WRITE setAllowedDomains)
+    Q_PROPERTY(QString host READ host WRITE setHost)
+    Q_PROPERTY(QString jid READ jid WRITE setJid)
+    Q_PROPERTY(qint64 maximumRate READ maximumRate WRITE setMaximumRate)
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+
+public:
+    QXmppServerProxy65();
+    ~QXmppServerProxy65();
+
+    QStringList allowedDomains() const;
+    void setAllowedDomains(const QStringList &allowedDomains);
+
+    QString host() const;
+    void setHost(const QString &host);
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    qint64 maximumRate() const;
+    void setMaximumRate(qint64 rate);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    /// \cond
+    QStringList discoveryItems() const;
+    bool handleStanza(const QDomElement &element);
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_activated(const QString &hash, bool success);
+
+private:
+    QXmppServerProxy65Private *d;
+};
+
+#endif
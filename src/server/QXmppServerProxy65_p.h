@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERPROXY65_P_H
+#define QXMPPSERVERPROXY65_P_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerProxy65 class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class QTcpSocket;
+class QTimer;
+class QXmppSocksServer;
+
+/// \internal
+///
+/// The QXmppProxy65Channel class copies the data received by one socket
+/// to another socket, optionally limiting its rate.
+///
+
+class QXmppProxy65Channel : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppProxy65Channel(QTcpSocket *from, QTcpSocket *to, qint64 rate, QObject *parent);
+    qint64 idleTime() const;
+
+public slots:
+    void transfer();
+
+private:
+    QByteArray m_buffer;
+    QElapsedTimer m_clock;
+    bool m_finished;
+    QTcpSocket *m_from;
+    qint64 m_lastActivity;
+    qint64 m_rate;
+    qint64 m_stamp;
+    QTimer *m_timer;
+    QTcpSocket *m_to;
+    qreal m_tokens;
+};
+
+/// \internal
+///
+/// The QXmppProxy65Relay class accepts SOCKS5 connections, pairs the
+/// initiator and target of a bytestream by their stream hash and relays
+/// data between them once the bytestream is activated.
+///
+/// It lives in the proxy's worker thread.
+///
+
+class QXmppProxy65Relay : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppProxy65Relay();
+
+signals:
+    void activated(const QString &hash, bool success);
+
+public slots:
+    void activate(const QString &hash);
+    bool listen(quint16 port);
+    void setMaximumRate(qint64 rate);
+
+private slots:
+    void _q_expire();
+    void _q_newConnection(QTcpSocket *socket, const QString &hostName, quint16 port);
+    void _q_socketDisconnected();
+
+private:
+    QElapsedTimer m_clock;
+    QTimer *m_expiryTimer;
+    QHash<QTcpSocket*, QTcpSocket*> m_peers;
+    QHash<QString, QList<QTcpSocket*> > m_pending;
+    QHash<QString, qint64> m_pendingSince;
+    qint64 m_rate;
+    QXmppSocksServer *m_server;
+};
+
+#endif
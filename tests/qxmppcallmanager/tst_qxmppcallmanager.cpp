@@ -22,68 +22,73 @@
  */
 
 #include <QBuffer>
+#include <QElapsedTimer>
 #include <QObject>
 
 #include "QXmppCallManager.h"
 #include "QXmppClient.h"
+#include "QXmppRtpChannel.h"
 #include "QXmppServer.h"
 #include "util.h"
 
-//Q_DECLARE_METATYPE(QXmppTransferJob::Method)
-
 class tst_QXmppCallManager : public QObject
 {
     Q_OBJECT
 
 private slots:
     void init();
+    void cleanup();
     void testCall();
+    void testCallWithVideo();
 
     void acceptCall(QXmppCall *call);
+    void clearSsrc(QXmppCall *call);
+    void logMessage(QXmppLogger::MessageType type, const QString &text);
 
 private:
+    QXmppCall *connectCall();
+    QString sentStanza(const QString &action) const;
+
+    QXmppLogger logger;
+    TestPasswordChecker passwordChecker;
+    QXmppServer *server;
+    QXmppClient *sender;
+    QXmppCallManager *senderManager;
+    QStringList senderStanzas;
+    QXmppClient *receiver;
+    QXmppCallManager *receiverManager;
     QXmppCall *receiverCall;
 };
 
 void tst_QXmppCallManager::init()
-{
-    receiverCall = 0;
-}
-
-void tst_QXmppCallManager::acceptCall(QXmppCall *call)
-{
-    receiverCall = call;
-    call->accept();
-}
-
-void tst_QXmppCallManager::testCall()
 {
     const QString testDomain("localhost");
     const QHostAddress testHost(QHostAddress::LocalHost);
     const quint16 testPort = 12345;
 
-    QXmppLogger logger;
     logger.setLoggingType(QXmppLogger::StdoutLogging);
+    receiverCall = 0;
+    senderStanzas.clear();
 
     // prepare server
-    TestPasswordChecker passwordChecker;
     passwordChecker.addCredentials("sender", "testpwd");
     passwordChecker.addCredentials("receiver", "testpwd");
 
-    QXmppServer server;
-    server.setDomain(testDomain);
-    server.setPasswordChecker(&passwordChecker);
-    server.listenForClients(testHost, testPort);
+    server = new QXmppServer;
+    server->setDomain(testDomain);
+    server->setPasswordChecker(&passwordChecker);
+    server->listenForClients(testHost, testPort);
 
-    // prepare sender
-    QXmppClient sender;
-    QXmppCallManager *senderManager = new QXmppCallManager;
-    sender.addExtension(senderManager);
-    sender.setLogger(&logger);
+    // prepare sender, recording the stanzas it sends
+    sender = new QXmppClient;
+    senderManager = new QXmppCallManager;
+    sender->addExtension(senderManager);
+    connect(sender, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            this, SLOT(logMessage(QXmppLogger::MessageType,QString)));
 
     QEventLoop senderLoop;
-    connect(&sender, SIGNAL(connected()), &senderLoop, SLOT(quit()));
-    connect(&sender, SIGNAL(disconnected()), &senderLoop, SLOT(quit()));
+    connect(sender, SIGNAL(connected()), &senderLoop, SLOT(quit()));
+    connect(sender, SIGNAL(disconnected()), &senderLoop, SLOT(quit()));
 
     QXmppConfiguration config;
     config.setDomain(testDomain);
@@ -91,35 +96,86 @@ void tst_QXmppCallManager::testCall()
     config.setPort(testPort);
     config.setUser("sender");
     config.setPassword("testpwd");
-    sender.connectToServer(config);
+    sender->connectToServer(config);
     senderLoop.exec();
-    QCOMPARE(sender.isConnected(), true);
+    QCOMPARE(sender->isConnected(), true);
 
     // prepare receiver
-    QXmppClient receiver;
-    QXmppCallManager *receiverManager = new QXmppCallManager;
+    receiver = new QXmppClient;
+    receiverManager = new QXmppCallManager;
     connect(receiverManager, SIGNAL(callReceived(QXmppCall*)),
             this, SLOT(acceptCall(QXmppCall*)));
-    receiver.addExtension(receiverManager);
-    receiver.setLogger(&logger);
+    receiver->addExtension(receiverManager);
+    receiver->setLogger(&logger);
 
     QEventLoop receiverLoop;
-    connect(&receiver, SIGNAL(connected()), &receiverLoop, SLOT(quit()));
-    connect(&receiver, SIGNAL(disconnected()), &receiverLoop, SLOT(quit()));
+    connect(receiver, SIGNAL(connected()), &receiverLoop, SLOT(quit()));
+    connect(receiver, SIGNAL(disconnected()), &receiverLoop, SLOT(quit()));
 
     config.setUser("receiver");
     config.setPassword("testpwd");
-    receiver.connectToServer(config);
+    receiver->connectToServer(config);
     receiverLoop.exec();
-    QCOMPARE(receiver.isConnected(), true);
+    QCOMPARE(receiver->isConnected(), true);
+}
 
-    // connect call
-    qDebug() << "======== CONNECT ========";
+void tst_QXmppCallManager::cleanup()
+{
+    delete receiver;
+    delete sender;
+    delete server;
+}
+
+void tst_QXmppCallManager::acceptCall(QXmppCall *call)
+{
+    receiverCall = call;
+    call->accept();
+}
+
+void tst_QXmppCallManager::clearSsrc(QXmppCall *call)
+{
+    // do not signal the audio SSRC in the offer
+    call->audioChannel()->setLocalSsrc(0);
+}
+
+void tst_QXmppCallManager::logMessage(QXmppLogger::MessageType type, const QString &text)
+{
+    if (type == QXmppLogger::SentMessage)
+        senderStanzas << text;
+    logger.log(type, text);
+}
+
+QXmppCall *tst_QXmppCallManager::connectCall()
+{
     QEventLoop loop;
+    QElapsedTimer setupTimer;
+    setupTimer.start();
     QXmppCall *senderCall = senderManager->call("receiver@localhost/QXmpp");
-    QVERIFY(senderCall);
+    if (!senderCall)
+        return 0;
     connect(senderCall, SIGNAL(connected()), &loop, SLOT(quit()));
+    QTimer::singleShot(10000, &loop, SLOT(quit()));
     loop.exec();
+    qDebug("Call setup took %lld ms", setupTimer.elapsed());
+    return senderCall;
+}
+
+// Returns the first Jingle request with the given action sent by the sender.
+QString tst_QXmppCallManager::sentStanza(const QString &action) const
+{
+    foreach (const QString &stanza, senderStanzas) {
+        if (stanza.contains(QString("action=\"%1\"").arg(action)))
+            return stanza;
+    }
+    return QString();
+}
+
+void tst_QXmppCallManager::testCall()
+{
+    // connect call
+    qDebug() << "======== CONNECT ========";
+    QXmppCall *senderCall = connectCall();
+    QVERIFY(senderCall);
     QVERIFY(receiverCall);
 
     QCOMPARE(senderCall->direction(), QXmppCall::OutgoingDirection);
@@ -128,10 +184,29 @@ void tst_QXmppCallManager::testCall()
     QCOMPARE(receiverCall->direction(), QXmppCall::IncomingDirection);
     QCOMPARE(receiverCall->state(), QXmppCall::ActiveState);
 
+    // the offer multiplexes RTCP with RTP and proposes to BUNDLE contents
+    const QString offer = sentStanza("session-initiate");
+    QVERIFY(offer.contains("<rtcp-mux/>"));
+    QVERIFY(offer.contains("semantics=\"BUNDLE\""));
+
     // exchange some media
     qDebug() << "======== TALK ========";
+    QXmppRtpAudioChannel *senderAudio = senderCall->audioChannel();
+    QXmppRtpAudioChannel *receiverAudio = receiverCall->audioChannel();
+    QVERIFY(senderAudio);
+    QVERIFY(receiverAudio);
+    QVERIFY(senderAudio->isEncrypted());
+    QVERIFY(receiverAudio->isEncrypted());
+    QCOMPARE(receiverAudio->remoteSsrc(), senderAudio->localSsrc());
+    QCOMPARE(senderAudio->remoteSsrc(), receiverAudio->localSsrc());
+
+    QEventLoop loop;
+    const QXmppJinglePayloadType payloadType = senderAudio->payloadType();
+    const QByteArray audio(payloadType.clockrate() * 2, '\x10');
+    senderAudio->write(audio);
     QTimer::singleShot(2000, &loop, SLOT(quit()));
     loop.exec();
+    QVERIFY(receiverAudio->bytesAvailable() > 0);
 
     // hangup call
     qDebug() << "======== HANGUP ========";
@@ -146,5 +221,67 @@ void tst_QXmppCallManager::testCall()
     QCOMPARE(receiverCall->state(), QXmppCall::FinishedState);
 }
 
+void tst_QXmppCallManager::testCallWithVideo()
+{
+    QXmppRtpVideoChannel probe;
+    if (probe.localPayloadTypes().isEmpty())
+        QSKIP("No video codec available");
+
+    // the audio SSRC is not signalled, the receiver must learn it
+    connect(senderManager, SIGNAL(callStarted(QXmppCall*)),
+            this, SLOT(clearSsrc(QXmppCall*)));
+
+    qDebug() << "======== CONNECT ========";
+    QXmppCall *senderCall = connectCall();
+    QVERIFY(senderCall);
+    QVERIFY(receiverCall);
+    QCOMPARE(senderCall->state(), QXmppCall::ActiveState);
+    QCOMPARE(receiverCall->state(), QXmppCall::ActiveState);
+
+    // add a video content, which shares the audio content's transport
+    qDebug() << "======== VIDEO ========";
+    QEventLoop loop;
+    connect(senderCall, SIGNAL(videoModeChanged(QIODevice::OpenMode)), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    senderCall->startVideo();
+    loop.exec();
+    QVERIFY(senderCall->videoMode() & QIODevice::WriteOnly);
+
+    const QString contentAdd = sentStanza("content-add");
+    QVERIFY(contentAdd.contains("semantics=\"BUNDLE\""));
+    QVERIFY(contentAdd.contains("name=\"voice\""));
+    QVERIFY(contentAdd.contains("name=\"webcam\""));
+
+    QXmppRtpAudioChannel *senderAudio = senderCall->audioChannel();
+    QXmppRtpAudioChannel *receiverAudio = receiverCall->audioChannel();
+    QXmppRtpVideoChannel *receiverVideo = receiverCall->videoChannel();
+    QVERIFY(senderAudio);
+    QVERIFY(receiverAudio);
+    QVERIFY(receiverVideo);
+    QCOMPARE(receiverVideo->remoteSsrc(), senderCall->videoChannel()->localSsrc());
+    QCOMPARE(receiverAudio->remoteSsrc(), quint32(0));
+
+    // send audio with an SSRC which was not signalled
+    senderAudio->setLocalSsrc(0x12345678);
+    const QXmppJinglePayloadType payloadType = senderAudio->payloadType();
+    const QByteArray audio(payloadType.clockrate() * 2, '\x10');
+    senderAudio->write(audio);
+    QTimer::singleShot(2000, &loop, SLOT(quit()));
+    loop.exec();
+
+    // the audio is dispatched to the audio channel only
+    QVERIFY(receiverAudio->bytesAvailable() > 0);
+    QCOMPARE(receiverAudio->remoteSsrc(), quint32(0x12345678));
+    QVERIFY(receiverVideo->readFrames().isEmpty());
+
+    // hangup call
+    qDebug() << "======== HANGUP ========";
+    connect(senderCall, SIGNAL(finished()), &loop, SLOT(quit()));
+    senderCall->hangup();
+    loop.exec();
+    QCOMPARE(senderCall->state(), QXmppCall::FinishedState);
+    QCOMPARE(receiverCall->state(), QXmppCall::FinishedState);
+}
+
 QTEST_MAIN(tst_QXmppCallManager)
 #include "tst_qxmppcallmanager.moc"
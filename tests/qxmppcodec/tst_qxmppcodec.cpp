@@ -22,20 +22,103 @@
  */
 
 #include <QObject>
+#include <QtMath>
 #include <QtTest>
 
 #include "QXmppCodec_p.h"
 #include "QXmppRtpChannel.h"
+#include "QXmppRtpPacket.h"
 
 class tst_QXmppCodec : public QObject
 {
     Q_OBJECT
 
 private slots:
+    void testOpusDtx();
+    void testOpusFec();
     void testTheoraDecoder();
     void testTheoraEncoder();
+    void testVpxEncoderDecoder();
 };
 
+#ifdef QXMPP_USE_OPUS
+static QByteArray opusEncode(QXmppOpusCodec *codec, const QByteArray &samples)
+{
+    QByteArray encoded;
+    QDataStream input(samples);
+    QDataStream output(&encoded, QIODevice::WriteOnly);
+    codec->encode(input, output);
+    return encoded;
+}
+
+static QByteArray sineFrame(int frame, int samples)
+{
+    QByteArray pcm;
+    QDataStream stream(&pcm, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < samples; ++i)
+        stream << qint16(8000 * qSin(2 * M_PI * 440 * (frame * samples + i) / 8000.0));
+    return pcm;
+}
+#endif
+
+void tst_QXmppCodec::testOpusDtx()
+{
+#ifdef QXMPP_USE_OPUS
+    const QByteArray silence(320, '\0');
+
+    // without DTX, every frame is sent
+    QXmppOpusCodec codec(8000, 1);
+    for (int i = 0; i < 50; ++i)
+        QVERIFY(!opusEncode(&codec, silence).isEmpty());
+
+    // with DTX, silence is not sent
+    QMap<QString, QString> params;
+    params.insert("usedtx", "1");
+    QXmppOpusCodec dtxCodec(8000, 1);
+    dtxCodec.setParameters(params);
+    int skipped = 0;
+    for (int i = 0; i < 50; ++i) {
+        if (opusEncode(&dtxCodec, silence).isEmpty())
+            skipped++;
+    }
+    QVERIFY(skipped > 10);
+#endif
+}
+
+void tst_QXmppCodec::testOpusFec()
+{
+#ifdef QXMPP_USE_OPUS
+    QMap<QString, QString> params;
+    params.insert("useinbandfec", "1");
+    QXmppOpusCodec encoder(8000, 1);
+    encoder.setParameters(params);
+
+    QList<QByteArray> packets;
+    for (int i = 0; i < 10; ++i) {
+        const QByteArray packet = opusEncode(&encoder, sineFrame(i, 160));
+        QVERIFY(!packet.isEmpty());
+        packets << packet;
+    }
+
+    // decode all packets except the fifth, which is recovered from the sixth
+    QXmppOpusCodec decoder(8000, 1);
+    for (int i = 0; i < packets.size(); ++i) {
+        QByteArray decoded;
+        QDataStream output(&decoded, QIODevice::WriteOnly);
+        if (i == 4)
+            continue;
+        if (i == 5) {
+            QDataStream input(packets[i]);
+            QCOMPARE(decoder.decodeRedundant(input, output), qint64(160));
+            QCOMPARE(decoded.size(), 320);
+        }
+        QDataStream input(packets[i]);
+        QCOMPARE(decoder.decode(input, output), qint64(160));
+    }
+#endif
+}
+
 void tst_QXmppCodec::testTheoraDecoder()
 {
 #ifdef QXMPP_USE_THEORA
@@ -68,5 +151,45 @@ void tst_QXmppCodec::testTheoraEncoder()
 #endif
 }
 
+void tst_QXmppCodec::testVpxEncoderDecoder()
+{
+#ifdef QXMPP_USE_VPX
+    QXmppVideoFormat format;
+    format.setFrameSize(QSize(320, 240));
+    format.setPixelFormat(QXmppVideoFrame::Format_YUYV);
+
+    QXmppVpxEncoder encoder(256000);
+    QVERIFY(encoder.setFormat(format));
+
+    QXmppVideoFrame input(320 * 240 * 2, QSize(320, 240), 320 * 2, QXmppVideoFrame::Format_YUYV);
+    memset(input.bits(), 0x80, input.mappedBytes());
+
+    QXmppVpxDecoder decoder;
+    quint16 sequence = 0;
+    const uchar *previousBits = 0;
+    for (int i = 0; i < 5; ++i) {
+        QList<QXmppVideoFrame> frames;
+        foreach (const QByteArray &payload, encoder.handleFrame(input)) {
+            QXmppRtpPacket packet;
+            packet.setSequence(sequence++);
+            packet.setPayload(payload);
+            frames << decoder.handlePacket(packet);
+        }
+        if (frames.isEmpty())
+            continue;
+
+        const QXmppVideoFrame frame = frames.first();
+        QCOMPARE(frame.size(), QSize(320, 240));
+        QCOMPARE(frame.pixelFormat(), QXmppVideoFrame::Format_YUV420P);
+
+        // once the previous frame is released, its buffer gets reused
+        if (previousBits)
+            QCOMPARE(frame.bits(), previousBits);
+        previousBits = frame.bits();
+    }
+    QVERIFY(previousBits != 0);
+#endif
+}
+
 QTEST_MAIN(tst_QXmppCodec)
 #include "tst_qxmppcodec.moc"
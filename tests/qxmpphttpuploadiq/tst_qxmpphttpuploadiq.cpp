@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *  Manjeet Dahiya
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+
+#include <QMimeDatabase>
+#include <QObject>
+#include "QXmppHttpUploadIq.h"
+#include "util.h"
+
+class tst_QXmppHttpUploadIq : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRequest();
+    void testSlot();
+    void testSlotHeaders();
+};
+
+void tst_QXmppHttpUploadIq::testRequest()
+{
+    const QByteArray xml(
+    "<iq id=\"step_03\" to=\"upload.montague.tld\" from=\"romeo@montague.tld/garden\" type=\"get\">"
+      "<request xmlns=\"urn:xmpp:http:upload:0\" filename=\"tr\xc3\xa8s cool.jpg\" size=\"23456\" content-type=\"image/jpeg\"/>"
+    "</iq>");
+
+    QDomDocument doc;
+    doc.setContent(xml, true);
+    QDomElement element = doc.documentElement();
+    QVERIFY(QXmppHttpUploadRequestIq::isHttpUploadRequestIq(element));
+    QVERIFY(!QXmppHttpUploadSlotIq::isHttpUploadSlotIq(element));
+
+    QXmppHttpUploadRequestIq iq;
+    parsePacket(iq, xml);
+    QCOMPARE(iq.id(), QLatin1String("step_03"));
+    QCOMPARE(iq.type(), QXmppIq::Get);
+    QCOMPARE(iq.fileName(), QString::fromUtf8("tr\xc3\xa8s cool.jpg"));
+    QCOMPARE(iq.size(), qint64(23456));
+    QCOMPARE(iq.contentType().name(), QLatin1String("image/jpeg"));
+    serializePacket(iq, xml);
+
+    // the content type is optional
+    const QByteArray bareXml(
+    "<iq id=\"step_03\" to=\"upload.montague.tld\" type=\"get\">"
+      "<request xmlns=\"urn:xmpp:http:upload:0\" filename=\"notes\" size=\"0\"/>"
+    "</iq>");
+
+    QXmppHttpUploadRequestIq bareIq;
+    parsePacket(bareIq, bareXml);
+    QCOMPARE(bareIq.fileName(), QLatin1String("notes"));
+    QCOMPARE(bareIq.size(), qint64(0));
+    QVERIFY(!bareIq.contentType().isValid());
+    serializePacket(bareIq, bareXml);
+}
+
+void tst_QXmppHttpUploadIq::testSlot()
+{
+    const QByteArray xml(
+    "<iq id=\"step_03\" to=\"romeo@montague.tld/garden\" from=\"upload.montague.tld\" type=\"result\">"
+      "<slot xmlns=\"urn:xmpp:http:upload:0\">"
+        "<put url=\"https://upload.montague.tld/4a771ac1/tr%C3%A8s%20cool.jpg\">"
+          "<header name=\"Authorization\">Basic Base64String==</header>"
+          "<header name=\"Cookie\">foo=bar; user=romeo</header>"
+        "</put>"
+        "<get url=\"https://download.montague.tld/4a771ac1/tr%C3%A8s%20cool.jpg\"/>"
+      "</slot>"
+    "</iq>");
+
+    QDomDocument doc;
+    doc.setContent(xml, true);
+    QDomElement element = doc.documentElement();
+    QVERIFY(QXmppHttpUploadSlotIq::isHttpUploadSlotIq(element));
+    QVERIFY(!QXmppHttpUploadRequestIq::isHttpUploadRequestIq(element));
+
+    QXmppHttpUploadSlotIq iq;
+    parsePacket(iq, xml);
+    QCOMPARE(iq.id(), QLatin1String("step_03"));
+    QCOMPARE(iq.type(), QXmppIq::Result);
+    QCOMPARE(iq.putUrl(), QUrl::fromEncoded("https://upload.montague.tld/4a771ac1/tr%C3%A8s%20cool.jpg"));
+    QCOMPARE(iq.getUrl(), QUrl::fromEncoded("https://download.montague.tld/4a771ac1/tr%C3%A8s%20cool.jpg"));
+    QCOMPARE(iq.putHeaders().size(), 2);
+    QCOMPARE(iq.putHeaders().value("Authorization"), QLatin1String("Basic Base64String=="));
+    QCOMPARE(iq.putHeaders().value("Cookie"), QLatin1String("foo=bar; user=romeo"));
+    serializePacket(iq, xml);
+}
+
+void tst_QXmppHttpUploadIq::testSlotHeaders()
+{
+    // only the headers allowed by the specification are kept
+    const QByteArray xml(
+    "<iq id=\"step_03\" type=\"result\">"
+      "<slot xmlns=\"urn:xmpp:http:upload:0\">"
+        "<put url=\"https://upload.montague.tld/file\">"
+          "<header name=\"Expires\">Tue, 1 Jan 2030 00:00:00 GMT</header>"
+          "<header name=\"Host\">evil.tld</header>"
+        "</put>"
+        "<get url=\"https://download.montague.tld/file\"/>"
+      "</slot>"
+    "</iq>");
+
+    QXmppHttpUploadSlotIq iq;
+    parsePacket(iq, xml);
+    QCOMPARE(iq.putHeaders().size(), 1);
+    QCOMPARE(iq.putHeaders().value("Expires"), QLatin1String("Tue, 1 Jan 2030 00:00:00 GMT"));
+
+    QMap<QString, QString> headers;
+    headers.insert("Authorization", "Basic Zm9v");
+    headers.insert("Content-Length", "10");
+    iq.setPutHeaders(headers);
+    QCOMPARE(iq.putHeaders().keys(), QStringList() << "Authorization");
+}
+
+QTEST_MAIN(tst_QXmppHttpUploadIq)
+#include "tst_qxmpphttpuploadiq.moc"
@@ -21,7 +21,9 @@
  *
  */
 
+#include <QElapsedTimer>
 #include <QHostInfo>
+#include <QSignalSpy>
 #include "QXmppStun.h"
 #include "util.h"
 
@@ -32,7 +34,13 @@ class tst_QXmppIceConnection : public QObject
 private slots:
     void testBind();
     void testBindStun();
+    void testConnect_data();
     void testConnect();
+    void testConsent();
+    void testGatheringTimeout();
+    void testMultiplexer();
+    void testRemoveComponent();
+    void testRestart();
 };
 
 void tst_QXmppIceConnection::testBind()
@@ -105,8 +113,18 @@ void tst_QXmppIceConnection::testBindStun()
     QVERIFY(foundReflexive);
 }
 
+void tst_QXmppIceConnection::testConnect_data()
+{
+    QTest::addColumn<bool>("aggressiveNomination");
+
+    QTest::newRow("aggressive nomination") << true;
+    QTest::newRow("regular nomination") << false;
+}
+
 void tst_QXmppIceConnection::testConnect()
 {
+    QFETCH(bool, aggressiveNomination);
+
     const int componentId = 1024;
 
     QXmppLogger logger;
@@ -116,6 +134,10 @@ void tst_QXmppIceConnection::testConnect()
     connect(&clientL, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
             &logger, SLOT(log(QXmppLogger::MessageType,QString)));
     clientL.setIceControlling(true);
+    clientL.setAggressiveNomination(aggressiveNomination);
+    QCOMPARE(clientL.aggressiveNomination(), aggressiveNomination);
+    clientL.setCheckInterval(20);
+    QCOMPARE(clientL.checkInterval(), 20);
     clientL.addComponent(componentId);
     clientL.bind(QXmppIceComponent::discoverAddresses());
 
@@ -143,14 +165,314 @@ void tst_QXmppIceConnection::testConnect()
     connect(&clientL, SIGNAL(connected()), &loop, SLOT(quit()));
     connect(&clientR, SIGNAL(connected()), &loop, SLOT(quit()));
 
+    QElapsedTimer timer;
+    timer.start();
     clientL.connectToHost();
     clientR.connectToHost();
 
     // check both clients are connected
     loop.exec();
+    if (!clientL.isConnected() || !clientR.isConnected())
+        loop.exec();
+    QVERIFY(clientL.isConnected());
+    QVERIFY(clientR.isConnected());
+    qDebug("ICE connected in %lld ms", timer.elapsed());
+
+    // send a batch of packets
+    QList<QByteArray> datagrams;
+    for (int i = 0; i < 40; ++i)
+        datagrams << (QByteArray("\x80\x00", 2) + QByteArray::number(i));
+    QSignalSpy receivedSpy(clientR.component(componentId), SIGNAL(datagramReceived(QByteArray)));
+    QCOMPARE(clientL.component(componentId)->sendDatagrams(datagrams), datagrams.size());
+    while (receivedSpy.count() < datagrams.size() && receivedSpy.wait(1000))
+        ;
+    QCOMPARE(receivedSpy.count(), datagrams.size());
+    for (int i = 0; i < datagrams.size(); ++i)
+        QCOMPARE(receivedSpy.at(i).at(0).toByteArray(), datagrams.at(i));
+
+    // oversized packets are discarded, whether they are the first packet
+    // read or part of a batch
+    const QByteArray oversized = QByteArray("\x80\x00", 2) + QByteArray(3000, 'x');
+    datagrams.clear();
+    receivedSpy.clear();
+    for (int i = 0; i < 2; ++i) {
+        QCOMPARE(clientL.component(componentId)->sendDatagram(oversized), qint64(oversized.size()));
+        for (int j = 0; j < 4; ++j) {
+            datagrams << (QByteArray("\x80\x00", 2) + QByteArray::number(10 * i + j));
+            QVERIFY(clientL.component(componentId)->sendDatagram(datagrams.last()) > 0);
+        }
+    }
+    while (receivedSpy.count() < datagrams.size() && receivedSpy.wait(1000))
+        ;
+    QTest::qWait(100);
+    QCOMPARE(receivedSpy.count(), datagrams.size());
+    for (int i = 0; i < datagrams.size(); ++i)
+        QCOMPARE(receivedSpy.at(i).at(0).toByteArray(), datagrams.at(i));
+}
+
+void tst_QXmppIceConnection::testConsent()
+{
+    const int componentId = 1024;
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    QXmppIceConnection clientL;
+    connect(&clientL, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    clientL.setIceControlling(true);
+    clientL.setConsentInterval(50);
+    QCOMPARE(clientL.consentInterval(), 50);
+    clientL.setConsentTimeout(400);
+    QCOMPARE(clientL.consentTimeout(), 400);
+    clientL.addComponent(componentId);
+    clientL.bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppIceConnection clientR;
+    connect(&clientR, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    clientR.setIceControlling(false);
+    clientR.setConsentInterval(50);
+    clientR.setConsentTimeout(400);
+    clientR.addComponent(componentId);
+    clientR.bind(QXmppIceComponent::discoverAddresses());
+
+    // exchange credentials
+    clientL.setRemoteUser(clientR.localUser());
+    clientL.setRemotePassword(clientR.localPassword());
+    clientR.setRemoteUser(clientL.localUser());
+    clientR.setRemotePassword(clientL.localPassword());
+
+    // exchange candidates
+    foreach (const QXmppJingleCandidate &candidate, clientR.localCandidates())
+        clientL.addRemoteCandidate(candidate);
+    foreach (const QXmppJingleCandidate &candidate, clientL.localCandidates())
+        clientR.addRemoteCandidate(candidate);
+
+    // start ICE
+    QEventLoop loop;
+    connect(&clientL, SIGNAL(connected()), &loop, SLOT(quit()));
+    connect(&clientR, SIGNAL(connected()), &loop, SLOT(quit()));
+    clientL.connectToHost();
+    clientR.connectToHost();
     loop.exec();
+    if (!clientL.isConnected() || !clientR.isConnected())
+        loop.exec();
     QVERIFY(clientL.isConnected());
     QVERIFY(clientR.isConnected());
+
+    // consent is refreshed while both parties answer
+    QSignalSpy lostSpy(&clientL, SIGNAL(consentLost()));
+    QTest::qWait(1000);
+    QCOMPARE(lostSpy.count(), 0);
+    QVERIFY(clientL.component(componentId)->sendDatagram(QByteArray("\x80\x00", 2)) > 0);
+
+    // consent is lost once the remote party goes away
+    clientR.close();
+    QVERIFY(lostSpy.wait(2000));
+    QCOMPARE(clientL.component(componentId)->sendDatagram(QByteArray("\x80\x00", 2)), qint64(-1));
+}
+
+void tst_QXmppIceConnection::testGatheringTimeout()
+{
+    const int componentId = 1024;
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    QList<QHostAddress> addresses;
+    foreach (const QHostAddress &address, QXmppIceComponent::discoverAddresses()) {
+        if (address.protocol() == QAbstractSocket::IPv4Protocol)
+            addresses << address;
+    }
+    if (addresses.isEmpty())
+        QSKIP("No IPv4 address available");
+
+    // the STUN server never answers
+    QXmppIceConnection client;
+    connect(&client, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    client.setIceControlling(true);
+    client.setStunServer(QHostAddress("192.0.2.1"), 3478);
+    client.setGatheringTimeout(200);
+    QCOMPARE(client.gatheringTimeout(), 200);
+    client.addComponent(componentId);
+
+    QSignalSpy stateSpy(&client, SIGNAL(gatheringStateChanged()));
+    client.bind(addresses);
+    QCOMPARE(client.gatheringState(), QXmppIceConnection::BusyGatheringState);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (client.gatheringState() != QXmppIceConnection::CompleteGatheringState && stateSpy.wait(2000))
+        ;
+    QCOMPARE(client.gatheringState(), QXmppIceConnection::CompleteGatheringState);
+    QVERIFY(timer.elapsed() < 2000);
+    QVERIFY(!client.localCandidates().isEmpty());
+}
+
+void tst_QXmppIceConnection::testMultiplexer()
+{
+    const int componentId = 1;
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    QXmppIceMultiplexer multiplexer;
+    QVERIFY(multiplexer.bind(QXmppIceComponent::discoverAddresses(), 0));
+
+    // shared sockets require a single component
+    QXmppIceConnection invalid;
+    invalid.addComponent(1);
+    invalid.addComponent(2);
+    QVERIFY(!invalid.bind(&multiplexer));
+
+    QXmppIceConnection servers[2];
+    QXmppIceConnection clients[2];
+    for (int i = 0; i < 2; ++i) {
+        QXmppIceConnection *server = &servers[i];
+        connect(server, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+        server->setIceControlling(false);
+        server->addComponent(componentId);
+        QVERIFY(server->bind(&multiplexer));
+
+        QXmppIceConnection *client = &clients[i];
+        connect(client, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+        client->setIceControlling(true);
+        client->addComponent(componentId);
+        client->bind(QXmppIceComponent::discoverAddresses());
+
+        // exchange credentials
+        client->setRemoteUser(server->localUser());
+        client->setRemotePassword(server->localPassword());
+        server->setRemoteUser(client->localUser());
+        server->setRemotePassword(client->localPassword());
+
+        // exchange candidates
+        foreach (const QXmppJingleCandidate &candidate, server->localCandidates())
+            client->addRemoteCandidate(candidate);
+        foreach (const QXmppJingleCandidate &candidate, client->localCandidates())
+            server->addRemoteCandidate(candidate);
+    }
+
+    // the second server also checks the first client's candidates, which
+    // must not steal the route of the first server
+    foreach (const QXmppJingleCandidate &candidate, clients[0].localCandidates())
+        servers[1].addRemoteCandidate(candidate);
+
+    // all the servers share the same candidates
+    QCOMPARE(servers[0].localCandidates().size(), servers[1].localCandidates().size());
+    QCOMPARE(servers[0].localCandidates().first().port(), servers[1].localCandidates().first().port());
+    foreach (const QXmppJingleCandidate &candidate, servers[0].localCandidates())
+        QCOMPARE(candidate.port(), servers[0].localCandidates().first().port());
+
+    // each connection has its own username fragment
+    QVERIFY(servers[0].localUser() != servers[1].localUser());
+
+    // start ICE
+    for (int i = 0; i < 2; ++i) {
+        QSignalSpy serverSpy(&servers[i], SIGNAL(connected()));
+        QSignalSpy clientSpy(&clients[i], SIGNAL(connected()));
+        clients[i].connectToHost();
+        servers[i].connectToHost();
+        QVERIFY(serverSpy.count() || serverSpy.wait(2000));
+        QVERIFY(clientSpy.count() || clientSpy.wait(2000));
+    }
+
+    // check datagrams are dispatched to the right connection
+    QSignalSpy receivedSpy0(servers[0].component(componentId), SIGNAL(datagramReceived(QByteArray)));
+    QSignalSpy receivedSpy1(servers[1].component(componentId), SIGNAL(datagramReceived(QByteArray)));
+    const QByteArray datagram0 = QByteArray("\x80\x00", 2) + "zero";
+    const QByteArray datagram1 = QByteArray("\x80\x00", 2) + "one";
+    QVERIFY(clients[0].component(componentId)->sendDatagram(datagram0) > 0);
+    QVERIFY(clients[1].component(componentId)->sendDatagram(datagram1) > 0);
+    QVERIFY(receivedSpy0.count() || receivedSpy0.wait(1000));
+    QVERIFY(receivedSpy1.count() || receivedSpy1.wait(1000));
+    QCOMPARE(receivedSpy0.size(), 1);
+    QCOMPARE(receivedSpy0.first().at(0).toByteArray(), datagram0);
+    QCOMPARE(receivedSpy1.size(), 1);
+    QCOMPARE(receivedSpy1.first().at(0).toByteArray(), datagram1);
+}
+
+void tst_QXmppIceConnection::testRemoveComponent()
+{
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    QXmppIceConnection client;
+    connect(&client, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    client.setIceControlling(true);
+    client.addComponent(1);
+    client.addComponent(2);
+    client.bind(QXmppIceComponent::discoverAddresses());
+    QVERIFY(client.component(2));
+
+    // RTCP multiplexed with RTP, drop the second component
+    client.removeComponent(2);
+    QVERIFY(client.component(1));
+    QVERIFY(!client.component(2));
+    QCOMPARE(client.gatheringState(), QXmppIceConnection::CompleteGatheringState);
+    QVERIFY(!client.localCandidates().isEmpty());
+    foreach (const QXmppJingleCandidate &c, client.localCandidates())
+        QCOMPARE(c.component(), 1);
+}
+
+void tst_QXmppIceConnection::testRestart()
+{
+    const int componentId = 1024;
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    QXmppIceConnection clientL;
+    connect(&clientL, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    clientL.setIceControlling(true);
+    clientL.addComponent(componentId);
+    clientL.bind(QXmppIceComponent::discoverAddresses());
+
+    QXmppIceConnection clientR;
+    connect(&clientR, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+            &logger, SLOT(log(QXmppLogger::MessageType,QString)));
+    clientR.setIceControlling(false);
+    clientR.addComponent(componentId);
+    clientR.bind(QXmppIceComponent::discoverAddresses());
+
+    for (int i = 0; i < 2; ++i) {
+        // exchange credentials
+        clientL.setRemoteUser(clientR.localUser());
+        clientL.setRemotePassword(clientR.localPassword());
+        clientR.setRemoteUser(clientL.localUser());
+        clientR.setRemotePassword(clientL.localPassword());
+
+        // exchange candidates
+        foreach (const QXmppJingleCandidate &candidate, clientR.localCandidates())
+            clientL.addRemoteCandidate(candidate);
+        foreach (const QXmppJingleCandidate &candidate, clientL.localCandidates())
+            clientR.addRemoteCandidate(candidate);
+
+        // start ICE
+        QSignalSpy connectedL(&clientL, SIGNAL(connected()));
+        QSignalSpy connectedR(&clientR, SIGNAL(connected()));
+        clientL.connectToHost();
+        clientR.connectToHost();
+        QVERIFY(connectedL.count() || connectedL.wait(2000));
+        QVERIFY(connectedR.count() || connectedR.wait(2000));
+        QVERIFY(clientL.isConnected());
+        QVERIFY(clientR.isConnected());
+
+        if (!i) {
+            // restart ICE, the previous pair keeps carrying data
+            const QString user = clientL.localUser();
+            clientL.restart();
+            clientR.restart();
+            QVERIFY(clientL.localUser() != user);
+            QVERIFY(clientL.component(componentId)->sendDatagram(QByteArray("\x80\x00", 2)) > 0);
+        }
+    }
 }
 
 QTEST_MAIN(tst_QXmppIceConnection)
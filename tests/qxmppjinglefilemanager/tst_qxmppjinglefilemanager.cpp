@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QObject>
+#include <QTemporaryDir>
+
+#include "QXmppClient.h"
+#include "QXmppJingleFileManager.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "util.h"
+
+// Server extension which answers the sender's Jingle requests with an
+// error on behalf of another entity, before they reach the receiver.
+class TestAckForger : public QXmppServerExtension
+{
+    Q_OBJECT
+
+public:
+    TestAckForger()
+        : forged(0)
+    {
+    }
+
+    bool handleStanza(const QDomElement &element)
+    {
+        if (element.tagName() == "iq" &&
+            element.attribute("type") == "set" &&
+            element.attribute("from").startsWith("sender@") &&
+            !element.firstChildElement("jingle").isNull()) {
+            QXmppIq response(QXmppIq::Error);
+            response.setId(element.attribute("id"));
+            response.setFrom("intruder@" + server()->domain() + "/QXmpp");
+            response.setTo(element.attribute("from"));
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel,
+                QXmppStanza::Error::ItemNotFound));
+            server()->sendPacket(response);
+            forged++;
+        }
+        return false;
+    }
+
+    int forged;
+};
+
+class tst_QXmppJingleFileManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void testSendFile_data();
+    void testSendFile();
+
+    void acceptFile(QXmppTransferJob *job);
+
+private:
+    QBuffer receiverBuffer;
+    QXmppTransferJob *receiverJob;
+};
+
+void tst_QXmppJingleFileManager::init()
+{
+    receiverBuffer.close();
+    receiverBuffer.setData(QByteArray());
+    receiverJob = 0;
+}
+
+void tst_QXmppJingleFileManager::acceptFile(QXmppTransferJob *job)
+{
+    receiverJob = job;
+    receiverBuffer.open(QIODevice::WriteOnly);
+    job->accept(&receiverBuffer);
+}
+
+void tst_QXmppJingleFileManager::testSendFile_data()
+{
+    QTest::addColumn<bool>("forgeAcks");
+
+    QTest::newRow("normal") << false;
+    QTest::newRow("forged acks") << true;
+}
+
+void tst_QXmppJingleFileManager::testSendFile()
+{
+    QFETCH(bool, forgeAcks);
+
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    QXmppLogger logger;
+    //logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    // prepare file
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString filePath = dir.path() + "/test.bin";
+    QByteArray data;
+    for (int i = 0; i < 256 * 1024; ++i)
+        data.append(char(i % 251));
+    QFile file(filePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(data);
+    file.close();
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    TestAckForger *forger = 0;
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    if (forgeAcks) {
+        forger = new TestAckForger;
+        server.addExtension(forger);
+    }
+    server.listenForClients(testHost, testPort);
+
+    // prepare sender
+    QXmppClient sender;
+    QXmppJingleFileManager *senderManager = new QXmppJingleFileManager;
+    sender.addExtension(senderManager);
+    sender.setLogger(&logger);
+
+    QEventLoop senderLoop;
+    connect(&sender, SIGNAL(connected()), &senderLoop, SLOT(quit()));
+    connect(&sender, SIGNAL(disconnected()), &senderLoop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("sender");
+    config.setPassword("testpwd");
+    sender.connectToServer(config);
+    senderLoop.exec();
+    QCOMPARE(sender.isConnected(), true);
+
+    // prepare receiver
+    QXmppClient receiver;
+    QXmppJingleFileManager *receiverManager = new QXmppJingleFileManager;
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(acceptFile(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+    receiver.setLogger(&logger);
+
+    QEventLoop receiverLoop;
+    connect(&receiver, SIGNAL(connected()), &receiverLoop, SLOT(quit()));
+    connect(&receiver, SIGNAL(disconnected()), &receiverLoop, SLOT(quit()));
+
+    config.setUser("receiver");
+    config.setPassword("testpwd");
+    receiver.connectToServer(config);
+    receiverLoop.exec();
+    QCOMPARE(receiver.isConnected(), true);
+
+    // send file
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", filePath, "test file");
+    QVERIFY(senderJob);
+    QCOMPARE(senderJob->direction(), QXmppTransferJob::OutgoingDirection);
+    QCOMPARE(senderJob->method(), QXmppTransferJob::JingleMethod);
+    connect(senderJob, SIGNAL(finished()), &loop, SLOT(quit()));
+    QTimer::singleShot(30000, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    // errors from another entity do not affect the session
+    if (forger)
+        QVERIFY(forger->forged > 0);
+
+    // finish receiving file
+    QVERIFY(receiverJob);
+    QCOMPARE(receiverJob->direction(), QXmppTransferJob::IncomingDirection);
+    QCOMPARE(receiverJob->fileName(), QString("test.bin"));
+    QCOMPARE(receiverJob->fileSize(), qint64(data.size()));
+    QCOMPARE(receiverJob->fileInfo().description(), QString("test file"));
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, SIGNAL(finished()), &loop, SLOT(quit()));
+        QTimer::singleShot(30000, &loop, SLOT(quit()));
+        loop.exec();
+    }
+    QCOMPARE(receiverJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+
+    // check received file
+    QCOMPARE(receiverBuffer.data(), data);
+    QCOMPARE(receiverJob->fileInfo().sha256(), QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+}
+
+QTEST_MAIN(tst_QXmppJingleFileManager)
+#include "tst_qxmppjinglefilemanager.moc"
@@ -32,12 +32,16 @@ class tst_QXmppJingleIq : public QObject
 private slots:
     void testCandidate();
     void testContent();
+    void testContentCrypto();
+    void testContentFile();
     void testContentFingerprint();
+    void testContentRtcpMux();
     void testContentSdp();
     void testContentSdpReflexive();
     void testContentSdpFingerprint();
     void testContentSdpParameters();
     void testSession();
+    void testSessionBundle();
     void testTerminate();
     void testAudioPayloadType();
     void testVideoPayloadType();
@@ -145,6 +149,99 @@ void tst_QXmppJingleIq::testContent()
     serializePacket(content, xml);
 }
 
+void tst_QXmppJingleIq::testContentCrypto()
+{
+    const QByteArray xml(
+    "<content creator=\"initiator\" name=\"voice\">"
+      "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"audio\">"
+        "<payload-type id=\"0\" name=\"PCMU\"/>"
+        "<encryption>"
+          "<crypto crypto-suite=\"AES_CM_128_HMAC_SHA1_80\""
+                 " key-params=\"inline:WVNfX19zZW1jdGwgKCkgewkyMjA7fQp9CnVubGVz|2^20|1:32\""
+                 " session-params=\"KDR=1 UNENCRYPTED_SRTCP\""
+                 " tag=\"1\"/>"
+          "<crypto crypto-suite=\"AES_CM_128_HMAC_SHA1_32\""
+                 " key-params=\"inline:NzB4d1BINUAvLEw6UzF3WSJ+PSdFcGdUJShpX1Zj\""
+                 " tag=\"2\"/>"
+        "</encryption>"
+      "</description>"
+    "</content>");
+
+    QXmppJingleIq::Content content;
+    parsePacket(content, xml);
+
+    QCOMPARE(content.payloadTypes().size(), 1);
+    QCOMPARE(content.rtpCryptoElements().size(), 2);
+    QCOMPARE(content.rtpCryptoElements()[0].tag(), 1);
+    QCOMPARE(content.rtpCryptoElements()[0].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_80"));
+    QCOMPARE(content.rtpCryptoElements()[0].keyParams(), QLatin1String("inline:WVNfX19zZW1jdGwgKCkgewkyMjA7fQp9CnVubGVz|2^20|1:32"));
+    QCOMPARE(content.rtpCryptoElements()[0].sessionParams(), QLatin1String("KDR=1 UNENCRYPTED_SRTCP"));
+    QCOMPARE(content.rtpCryptoElements()[1].tag(), 2);
+    QCOMPARE(content.rtpCryptoElements()[1].cryptoSuite(), QLatin1String("AES_CM_128_HMAC_SHA1_32"));
+    QCOMPARE(content.rtpCryptoElements()[1].keyParams(), QLatin1String("inline:NzB4d1BINUAvLEw6UzF3WSJ+PSdFcGdUJShpX1Zj"));
+    QCOMPARE(content.rtpCryptoElements()[1].sessionParams(), QString());
+
+    serializePacket(content, xml);
+}
+
+void tst_QXmppJingleIq::testContentRtcpMux()
+{
+    const QByteArray xml(
+    "<content creator=\"initiator\" name=\"voice\">"
+      "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"audio\">"
+        "<payload-type id=\"0\" name=\"PCMU\"/>"
+        "<rtcp-mux/>"
+      "</description>"
+    "</content>");
+
+    QXmppJingleIq::Content content;
+    QCOMPARE(content.isRtpMultiplexingSupported(), false);
+    parsePacket(content, xml);
+    QCOMPARE(content.isRtpMultiplexingSupported(), true);
+    serializePacket(content, xml);
+
+    // SDP round trip
+    const QString sdp = content.toSdp();
+    QVERIFY(sdp.contains(QLatin1String("a=rtcp-mux\r\n")));
+
+    QXmppJingleIq::Content other;
+    QVERIFY(other.parseSdp(sdp));
+    QCOMPARE(other.isRtpMultiplexingSupported(), true);
+}
+
+void tst_QXmppJingleIq::testContentFile()
+{
+    const QByteArray xml(
+    "<content creator=\"initiator\" name=\"file\" senders=\"initiator\">"
+      "<description xmlns=\"urn:xmpp:jingle:apps:file-transfer:5\">"
+        "<file>"
+          "<name>test.txt</name>"
+          "<size>6144</size>"
+          "<desc>This is a test.</desc>"
+          "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=</hash>"
+        "</file>"
+      "</description>"
+      "<transport xmlns=\"urn:xmpp:jingle:transports:ice-udp:1\""
+                 " ufrag=\"8hhy\""
+                 " pwd=\"asd88fgpdd777uzjYhagZg\"/>"
+    "</content>");
+
+    QXmppJingleIq::Content content;
+    parsePacket(content, xml);
+
+    QCOMPARE(content.name(), QLatin1String("file"));
+    QCOMPARE(content.senders(), QLatin1String("initiator"));
+    QCOMPARE(content.fileName(), QLatin1String("test.txt"));
+    QCOMPARE(content.fileSize(), qint64(6144));
+    QCOMPARE(content.fileDescription(), QLatin1String("This is a test."));
+    QCOMPARE(content.fileSha256(), QByteArray::fromBase64("47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU="));
+    QCOMPARE(content.payloadTypes().size(), 0);
+    QCOMPARE(content.transportUser(), QLatin1String("8hhy"));
+    QCOMPARE(content.transportPassword(), QLatin1String("asd88fgpdd777uzjYhagZg"));
+
+    serializePacket(content, xml);
+}
+
 void tst_QXmppJingleIq::testContentFingerprint()
 {
     const QByteArray xml(
@@ -399,6 +496,48 @@ void tst_QXmppJingleIq::testSession()
     QCOMPARE(session.contents()[0].name(), QLatin1String("this-is-a-stub"));
     QCOMPARE(session.reason().text(), QString());
     QCOMPARE(session.reason().type(), QXmppJingleIq::Reason::None);
+    QCOMPARE(session.bundledContents(), QStringList());
+    serializePacket(session, xml);
+}
+
+void tst_QXmppJingleIq::testSessionBundle()
+{
+    const QByteArray xml(
+        "<iq"
+        " id=\"zid615d9\""
+        " to=\"juliet@capulet.lit/balcony\""
+        " from=\"romeo@montague.lit/orchard\""
+        " type=\"set\">"
+        "<jingle xmlns=\"urn:xmpp:jingle:1\""
+        " action=\"session-initiate\""
+        " initiator=\"romeo@montague.lit/orchard\""
+        " sid=\"a73sjjvkla37jfea\">"
+        "<content creator=\"initiator\" name=\"voice\">"
+        "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"audio\">"
+        "<payload-type id=\"0\" name=\"PCMU\"/>"
+        "<rtcp-mux/>"
+        "</description>"
+        "</content>"
+        "<content creator=\"initiator\" name=\"webcam\">"
+        "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"video\">"
+        "<payload-type id=\"96\" name=\"theora\"/>"
+        "<rtcp-mux/>"
+        "</description>"
+        "</content>"
+        "<group xmlns=\"urn:xmpp:jingle:apps:grouping:0\" semantics=\"BUNDLE\">"
+        "<content name=\"voice\"/>"
+        "<content name=\"webcam\"/>"
+        "</group>"
+        "</jingle>"
+        "</iq>");
+
+    QXmppJingleIq session;
+    parsePacket(session, xml);
+    QCOMPARE(session.action(), QXmppJingleIq::SessionInitiate);
+    QCOMPARE(session.contents().size(), 2);
+    QCOMPARE(session.contents()[0].isRtpMultiplexingSupported(), true);
+    QCOMPARE(session.contents()[1].isRtpMultiplexingSupported(), true);
+    QCOMPARE(session.bundledContents(), QStringList() << "voice" << "webcam");
     serializePacket(session, xml);
 }
 
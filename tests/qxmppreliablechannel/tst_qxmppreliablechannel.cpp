@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppReliableChannel_p.h"
+
+// Delivers datagrams from one channel to another through the event loop,
+// dropping one datagram out of every "loss" datagrams.
+class Link : public QObject
+{
+    Q_OBJECT
+
+public:
+    Link(QXmppReliableChannel *to, int loss)
+        : m_count(0)
+        , m_loss(loss)
+        , m_to(to)
+    {
+    }
+
+    int count() const
+    {
+        return m_count;
+    }
+
+public slots:
+    void send(const QByteArray &datagram)
+    {
+        ++m_count;
+        if (m_loss && !(m_count % m_loss))
+            return;
+        QMetaObject::invokeMethod(m_to, "datagramReceived", Qt::QueuedConnection,
+                                  Q_ARG(QByteArray, datagram));
+    }
+
+private:
+    int m_count;
+    int m_loss;
+    QXmppReliableChannel *m_to;
+};
+
+class tst_QXmppReliableChannel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPacket();
+    void testTransfer_data();
+    void testTransfer();
+};
+
+void tst_QXmppReliableChannel::testPacket()
+{
+    QXmppReliableChannel sender;
+    QSignalSpy spy(&sender, SIGNAL(sendDatagram(QByteArray)));
+
+    QCOMPARE(sender.write("hello"), qint64(5));
+    QCOMPARE(sender.bytesToWrite(), qint64(5));
+    QCOMPARE(spy.size(), 1);
+
+    const QByteArray datagram = spy.at(0).at(0).toByteArray();
+    QCOMPARE(datagram.size(), 17);
+    QCOMPARE(quint8(datagram[0]), quint8(0xc0));
+    QCOMPARE(quint8(datagram[1]), quint8(0x00));
+    QCOMPARE(datagram.mid(4, 4), QByteArray::fromHex("00000000"));
+    QCOMPARE(datagram.mid(12), QByteArray("hello"));
+
+    // the receiver acknowledges and delivers the data
+    QXmppReliableChannel receiver;
+    QSignalSpy ackSpy(&receiver, SIGNAL(sendDatagram(QByteArray)));
+    QSignalSpy readSpy(&receiver, SIGNAL(readyRead()));
+    receiver.datagramReceived(datagram);
+    QCOMPARE(readSpy.size(), 1);
+    QCOMPARE(receiver.readAll(), QByteArray("hello"));
+    QCOMPARE(ackSpy.size(), 1);
+
+    const QByteArray ack = ackSpy.at(0).at(0).toByteArray();
+    QCOMPARE(ack.size(), 16);
+    QCOMPARE(quint8(ack[0]), quint8(0xc1));
+    QCOMPARE(ack.mid(4, 4), QByteArray::fromHex("00000001"));
+
+    QSignalSpy writtenSpy(&sender, SIGNAL(bytesWritten(qint64)));
+    sender.datagramReceived(ack);
+    QCOMPARE(writtenSpy.size(), 1);
+    QCOMPARE(writtenSpy.at(0).at(0).toLongLong(), qint64(5));
+    QCOMPARE(sender.bytesToWrite(), qint64(0));
+    QVERIFY(sender.roundTripTime() >= 0);
+
+    // other packets are ignored
+    receiver.datagramReceived(QByteArray::fromHex("80000000"));
+    QCOMPARE(readSpy.size(), 1);
+}
+
+void tst_QXmppReliableChannel::testTransfer_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("loss");
+
+    QTest::newRow("empty") << 0 << 0;
+    QTest::newRow("lossless") << 500000 << 0;
+    QTest::newRow("lossy") << 500000 << 7;
+    QTest::newRow("very lossy") << 100000 << 3;
+}
+
+void tst_QXmppReliableChannel::testTransfer()
+{
+    QFETCH(int, size);
+    QFETCH(int, loss);
+
+    QByteArray data(size, 0);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(qrand() & 0xff);
+
+    QXmppReliableChannel sender;
+    QXmppReliableChannel receiver;
+    Link forward(&receiver, loss);
+    Link backward(&sender, loss);
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &forward, SLOT(send(QByteArray)));
+    connect(&receiver, SIGNAL(sendDatagram(QByteArray)),
+            &backward, SLOT(send(QByteArray)));
+
+    QSignalSpy finishedSpy(&sender, SIGNAL(finished()));
+    QSignalSpy readFinishedSpy(&receiver, SIGNAL(readChannelFinished()));
+
+    QCOMPARE(sender.write(data), qint64(size));
+    sender.finish();
+    QVERIFY(!sender.isFinished());
+    QCOMPARE(sender.write("more"), qint64(-1));
+
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (!sender.isFinished() && timer.elapsed() < 30000) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+        received += receiver.readAll();
+    }
+    received += receiver.readAll();
+
+    QVERIFY(sender.isFinished());
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(readFinishedSpy.size(), 1);
+    QCOMPARE(sender.bytesToWrite(), qint64(0));
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+    if (loss)
+        QVERIFY(forward.count() > size / QXmppReliableChannel::MaximumSegmentSize);
+}
+
+QTEST_MAIN(tst_QXmppReliableChannel)
+#include "tst_qxmppreliablechannel.moc"
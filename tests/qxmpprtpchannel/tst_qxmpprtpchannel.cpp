@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QtMath>
+#include <QtTest>
+
+#include "QXmppRtpChannel.h"
+
+// Relays datagrams from one channel to another, dropping some of them
+// to simulate packet loss. Once the limit is reached, further datagrams
+// are ignored.
+class RtpRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    RtpRelay(int lossInterval, int limit = 0)
+        : forwarded(0)
+        , dropped(0)
+        , m_count(0)
+        , m_limit(limit)
+        , m_lossInterval(lossInterval)
+    {
+    }
+
+    int count() const
+    {
+        return m_count;
+    }
+
+    int forwarded;
+    int dropped;
+
+signals:
+    void datagramReceived(const QByteArray &datagram);
+
+public slots:
+    void sendDatagram(const QByteArray &datagram)
+    {
+        if (m_limit && m_count >= m_limit)
+            return;
+        m_count++;
+        if (m_lossInterval && !(m_count % m_lossInterval)) {
+            dropped++;
+            return;
+        }
+        forwarded++;
+        emit datagramReceived(datagram);
+    }
+
+private:
+    int m_count;
+    int m_limit;
+    int m_lossInterval;
+};
+
+// Generates a sine wave whose amplitude rises over time, so that no two
+// packets carry the same samples.
+static QByteArray sineWave(int clockrate, int samples)
+{
+    QByteArray pcm;
+    QDataStream stream(&pcm, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < samples; ++i)
+        stream << qint16((2000 + 8000 * i / qMax(samples, 1)) * qSin(2 * M_PI * 440 * i / qreal(clockrate)));
+    return pcm;
+}
+
+// Returns the normalised correlation between the input and output samples,
+// for the output delay which matches best. Codecs may delay their output
+// by a few milliseconds.
+static qreal correlation(const QByteArray &input, const QByteArray &output, int maximumDelay)
+{
+    const qint16 *in = reinterpret_cast<const qint16*>(input.constData());
+    const qint16 *out = reinterpret_cast<const qint16*>(output.constData());
+    const int inputSamples = input.size() / 2;
+    const int outputSamples = output.size() / 2;
+
+    qreal best = 0;
+    for (int delay = 0; delay <= maximumDelay && delay < outputSamples; ++delay) {
+        const int samples = qMin(inputSamples, outputSamples - delay);
+        qreal product = 0, inputEnergy = 0, outputEnergy = 0;
+        for (int i = 0; i < samples; ++i) {
+            product += qreal(in[i]) * out[i + delay];
+            inputEnergy += qreal(in[i]) * in[i];
+            outputEnergy += qreal(out[i + delay]) * out[i + delay];
+        }
+        if (inputEnergy > 0 && outputEnergy > 0)
+            best = qMax(best, product / qSqrt(inputEnergy * outputEnergy));
+    }
+    return best;
+}
+
+static void negotiate(QXmppRtpChannel *a, QXmppRtpChannel *b)
+{
+    b->setRemoteCryptoElements(a->localCryptoElements());
+    b->setRemotePayloadTypes(a->localPayloadTypes());
+    a->setRemoteCryptoElements(b->localCryptoElements());
+    a->setRemotePayloadTypes(b->localPayloadTypes());
+}
+
+class tst_QXmppRtpChannel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAudioLoopback_data();
+    void testAudioLoopback();
+    void testAudioPacketCost();
+    void testAudioRemoteSsrc();
+    void testVideoLoopback();
+};
+
+void tst_QXmppRtpChannel::testAudioLoopback_data()
+{
+    QTest::addColumn<int>("lossInterval");
+
+    QTest::newRow("no loss") << 0;
+    QTest::newRow("10% loss") << 10;
+    QTest::newRow("50% loss") << 2;
+}
+
+void tst_QXmppRtpChannel::testAudioLoopback()
+{
+    QFETCH(int, lossInterval);
+
+    QXmppRtpAudioChannel sender;
+    QXmppRtpAudioChannel receiver;
+    negotiate(&sender, &receiver);
+    QCOMPARE(sender.openMode(), QIODevice::ReadWrite);
+    QCOMPARE(receiver.openMode(), QIODevice::ReadWrite);
+    QVERIFY(sender.isEncrypted());
+    QVERIFY(receiver.isEncrypted());
+
+    // relay as many packets as the receiver's jitter buffer can hold
+    // without dropping any, then ignore the silence which follows
+    const int packets = 10;
+    RtpRelay relay(lossInterval, packets);
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &relay, SLOT(sendDatagram(QByteArray)));
+    connect(&relay, SIGNAL(datagramReceived(QByteArray)),
+            &receiver, SLOT(datagramReceived(QByteArray)));
+
+    const QXmppJinglePayloadType payloadType = sender.payloadType();
+    const int clockrate = payloadType.clockrate();
+    const QByteArray audio = sineWave(clockrate, packets * clockrate * payloadType.ptime() / 1000);
+    QElapsedTimer timer;
+    timer.start();
+    QCOMPARE(sender.write(audio), qint64(audio.size()));
+
+    // measure how long it takes for the jitter buffer to fill
+    QEventLoop loop;
+    connect(&receiver, SIGNAL(readyRead()), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.exec();
+    const qint64 bufferDelay = timer.elapsed();
+    QVERIFY(receiver.bytesAvailable() > 0);
+
+    // let the rest of the audio through
+    for (int i = 0; i < 100 && relay.count() < packets; ++i)
+        QTest::qWait(payloadType.ptime());
+    QCOMPARE(relay.count(), packets);
+
+    qDebug("payload %s/%u, jitter buffer delay %lld ms, %d packets forwarded, %d dropped, %lld bytes buffered",
+           qPrintable(payloadType.name()), payloadType.clockrate(), bufferDelay,
+           relay.forwarded, relay.dropped, receiver.bytesAvailable());
+
+    if (lossInterval)
+        QVERIFY(relay.dropped > 0);
+    else
+        QCOMPARE(relay.dropped, 0);
+
+    // the decoded samples must match the input, lost packets are either
+    // replaced with silence or recovered from redundant data
+    QByteArray samples(receiver.bytesAvailable(), '\0');
+    QCOMPARE(receiver.read(samples.data(), samples.size()), qint64(samples.size()));
+    QVERIFY(samples.size() >= audio.size() * (packets - 1) / packets);
+
+    const qreal expected = lossInterval ? 0.9 * qSqrt(1.0 - 1.0 / lossInterval) : 0.9;
+    const qreal actual = correlation(audio, samples, clockrate / 100);
+    qDebug("correlation %.3f, expected at least %.3f", actual, expected);
+    QVERIFY(actual >= expected);
+}
+
+void tst_QXmppRtpChannel::testAudioPacketCost()
+{
+    QXmppRtpAudioChannel sender;
+    QXmppRtpAudioChannel receiver;
+    negotiate(&sender, &receiver);
+    QCOMPARE(sender.openMode(), QIODevice::ReadWrite);
+
+    // capture packets produced by the sender
+    const int packets = 25;
+    const QXmppJinglePayloadType payloadType = sender.payloadType();
+    const QByteArray audio = sineWave(payloadType.clockrate(), packets * payloadType.clockrate() * payloadType.ptime() / 1000);
+    QSignalSpy spy(&sender, SIGNAL(sendDatagram(QByteArray)));
+    sender.write(audio);
+    for (int i = 0; i < 100 && spy.size() < packets; ++i)
+        QTest::qWait(payloadType.ptime());
+    QVERIFY(spy.size() >= packets);
+
+    QList<QByteArray> datagrams;
+    for (int i = 0; i < packets; ++i)
+        datagrams << spy.at(i).at(0).toByteArray();
+
+    // unprotect and decode the packets, SRTP replay protection means
+    // each packet can only be received once
+    QByteArray samples;
+    QSignalSpy readySpy(&receiver, SIGNAL(readyRead()));
+    QBENCHMARK_ONCE {
+        foreach (const QByteArray &datagram, datagrams) {
+            receiver.datagramReceived(datagram);
+            if (!readySpy.isEmpty()) {
+                samples += receiver.read(receiver.bytesAvailable());
+                readySpy.clear();
+            }
+        }
+    }
+    QCOMPARE(samples.size(), audio.size());
+    QVERIFY(correlation(audio, samples, payloadType.clockrate() / 100) >= 0.9);
+}
+
+void tst_QXmppRtpChannel::testAudioRemoteSsrc()
+{
+    QXmppRtpAudioChannel sender;
+    QXmppRtpAudioChannel receiver;
+    QXmppRtpAudioChannel other;
+    negotiate(&sender, &receiver);
+    other.setRemoteCryptoElements(sender.localCryptoElements());
+    other.setRemotePayloadTypes(sender.localPayloadTypes());
+
+    // both receivers share the sender's transport, but only one
+    // expects its SSRC
+    receiver.setRemoteSsrc(sender.localSsrc());
+    other.setRemoteSsrc(sender.localSsrc() + 1);
+    QCOMPARE(receiver.remoteSsrc(), sender.localSsrc());
+
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &receiver, SLOT(datagramReceived(QByteArray)));
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &other, SLOT(datagramReceived(QByteArray)));
+
+    const QXmppJinglePayloadType payloadType = sender.payloadType();
+    const QByteArray audio = sineWave(payloadType.clockrate(), payloadType.clockrate() * payloadType.ptime() / 100);
+    QSignalSpy spy(&sender, SIGNAL(sendDatagram(QByteArray)));
+    sender.write(audio);
+    for (int i = 0; i < 100 && spy.size() < 10; ++i)
+        QTest::qWait(payloadType.ptime());
+    QVERIFY(spy.size() >= 10);
+    QVERIFY(receiver.bytesAvailable() > 0);
+    QCOMPARE(other.bytesAvailable(), qint64(0));
+}
+
+void tst_QXmppRtpChannel::testVideoLoopback()
+{
+    QXmppRtpVideoChannel sender;
+    QXmppRtpVideoChannel receiver;
+    negotiate(&sender, &receiver);
+    if (sender.openMode() != QIODevice::ReadWrite || receiver.openMode() != QIODevice::ReadWrite)
+        QSKIP("No video codec available");
+
+    RtpRelay relay(0);
+    connect(&sender, SIGNAL(sendDatagram(QByteArray)),
+            &relay, SLOT(sendDatagram(QByteArray)));
+    connect(&relay, SIGNAL(datagramReceived(QByteArray)),
+            &receiver, SLOT(datagramReceived(QByteArray)));
+
+    const QXmppVideoFormat format = sender.encoderFormat();
+    const QSize size = format.frameSize();
+    QElapsedTimer timer;
+    timer.start();
+
+    // stream one second of synthetic frames and collect decoded ones
+    int framesReceived = 0;
+    const int framesSent = qRound(format.frameRate());
+    for (int i = 0; i < framesSent; ++i) {
+        QXmppVideoFrame frame(size.width() * size.height() * 3 / 2, size, size.width(), QXmppVideoFrame::Format_YUV420P);
+        memset(frame.bits(), (i * 8) & 0xff, frame.mappedBytes());
+        sender.writeFrame(frame);
+
+        QTest::qWait(1000 / framesSent);
+        framesReceived += receiver.readFrames().size();
+    }
+    for (int i = 0; i < 20 && framesReceived < framesSent; ++i) {
+        QTest::qWait(50);
+        framesReceived += receiver.readFrames().size();
+    }
+
+    qDebug("video %dx%d, %d frames sent, %d frames received, %d packets in %lld ms",
+           size.width(), size.height(), framesSent, framesReceived,
+           relay.forwarded, timer.elapsed());
+    QVERIFY(relay.forwarded > 0);
+    QVERIFY(framesReceived > 0);
+}
+
+QTEST_MAIN(tst_QXmppRtpChannel)
+#include "tst_qxmpprtpchannel.moc"
@@ -33,6 +33,7 @@ private slots:
     void testBad();
     void testSimple();
     void testWithCsrc();
+    void testZeroCopy();
 };
 
 void tst_QXmppRtpPacket::testBad()
@@ -78,5 +79,29 @@ void tst_QXmppRtpPacket::testWithCsrc()
     QCOMPARE(packet.encode(), data);
 }
 
+void tst_QXmppRtpPacket::testZeroCopy()
+{
+    QByteArray data("\x80\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56", 15);
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+
+    // the payload points into the datagram
+    QCOMPARE(packet.payloadSize(), 3);
+    QCOMPARE(packet.payloadData(), data.constData() + 12);
+
+    // encoding into an existing buffer reuses its storage
+    QByteArray buffer;
+    buffer.reserve(1500);
+    const char *storage = buffer.constData();
+    packet.encode(&buffer);
+    QCOMPARE(buffer, data);
+    QCOMPARE(buffer.constData(), storage);
+
+    packet.setPayload(QByteArray("\xab\xcd", 2));
+    packet.encode(&buffer);
+    QCOMPARE(buffer, QByteArray("\x80\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd", 14));
+    QCOMPARE(buffer.constData(), storage);
+}
+
 QTEST_MAIN(tst_QXmppRtpPacket)
 #include "tst_qxmpprtppacket.moc"
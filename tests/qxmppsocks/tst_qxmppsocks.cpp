@@ -23,6 +23,7 @@
 
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QTimer>
 #include "QXmppSocks.h"
 #include "util.h"
 
@@ -33,12 +34,15 @@ class tst_QXmppSocks : public QObject
 private slots:
     void init();
     void newConnectionSlot(QTcpSocket *socket, QString hostName, quint16 port);
+    void rejectConnectionSlot(QTcpSocket *socket);
 
     void testClient_data();
     void testClient();
     void testClientAndServer();
     void testServer_data();
     void testServer();
+    void testServerDisconnected();
+    void testServerRejected();
 
 private:
     QTcpSocket *m_connectionSocket;
@@ -60,6 +64,12 @@ void tst_QXmppSocks::newConnectionSlot(QTcpSocket *socket, QString hostName, qui
     m_connectionPort = port;
 }
 
+void tst_QXmppSocks::rejectConnectionSlot(QTcpSocket *socket)
+{
+    socket->close();
+    socket->deleteLater();
+}
+
 void tst_QXmppSocks::testClient_data()
 {
     QTest::addColumn<QByteArray>("serverHandshake");
@@ -273,5 +283,67 @@ void tst_QXmppSocks::testServer()
     client.disconnectFromHost();
 }
 
+void tst_QXmppSocks::testServerDisconnected()
+{
+    QXmppSocksServer server;
+    QVERIFY(server.listen());
+    QVERIFY(server.serverPort() != 0);
+    connect(&server, SIGNAL(newConnection(QTcpSocket*,QString,quint16)),
+            this, SLOT(newConnectionSlot(QTcpSocket*,QString,quint16)));
+
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY2(client.waitForConnected(), qPrintable(client.errorString()));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(readyRead()), &loop, SLOT(quit()));
+
+    // send client handshake
+    client.write(QByteArray::fromHex("050100"));
+    loop.exec();
+    QCOMPARE(client.readAll(), QByteArray::fromHex("0500"));
+    QCOMPARE(server.findChildren<QTcpSocket*>().size(), 1);
+
+    // disconnect before sending the command
+    client.disconnectFromHost();
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+
+    // the server released the socket
+    QVERIFY(server.findChildren<QTcpSocket*>().isEmpty());
+    QVERIFY(!m_connectionSocket);
+}
+
+void tst_QXmppSocks::testServerRejected()
+{
+    QXmppSocksServer server;
+    QVERIFY(server.listen());
+    QVERIFY(server.serverPort() != 0);
+    connect(&server, SIGNAL(newConnection(QTcpSocket*,QString,quint16)),
+            this, SLOT(rejectConnectionSlot(QTcpSocket*)));
+
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY2(client.waitForConnected(), qPrintable(client.errorString()));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(disconnected()), &loop, SLOT(quit()));
+    connect(&client, SIGNAL(readyRead()), &loop, SLOT(quit()));
+
+    // send client handshake
+    client.write(QByteArray::fromHex("050100"));
+    loop.exec();
+    QCOMPARE(client.readAll(), QByteArray::fromHex("0500"));
+
+    // the connection is closed without a reply
+    client.write(QByteArray::fromHex("050100030e7777772e676f6f676c652e636f6d0050"));
+    loop.exec();
+    if (client.state() != QAbstractSocket::UnconnectedState)
+        loop.exec();
+    QCOMPARE(client.state(), QAbstractSocket::UnconnectedState);
+    QVERIFY(client.readAll().isEmpty());
+}
+
 QTEST_MAIN(tst_QXmppSocks)
 #include "tst_qxmppsocks.moc"
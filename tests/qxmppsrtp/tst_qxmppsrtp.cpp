@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppRtpPacket.h"
+#include "QXmppSrtp_p.h"
+
+static const QByteArray masterKey = QByteArray::fromHex("e1f97a0d3e018be0d64fa32c06de41390ec675ad498afeebb6960b3aabe6");
+
+static QByteArray rtpPacket(quint16 sequence, const QByteArray &payload)
+{
+    QXmppRtpPacket packet;
+    packet.setType(15);
+    packet.setSequence(sequence);
+    packet.setStamp(0xdecafbad);
+    packet.setSsrc(0xcafebabe);
+    packet.setPayload(payload);
+    return packet.encode();
+}
+
+class tst_QXmppSrtp : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAes();
+    void testKeyDerivation();
+    void testMasterKey();
+    void testProtect_data();
+    void testProtect();
+    void testReplay();
+    void testRollover();
+    void testTamper();
+    void testSuite();
+    void testThroughput();
+};
+
+void tst_QXmppSrtp::testAes()
+{
+    // FIPS-197, appendix C.1
+    QXmppAesCipher cipher;
+    cipher.setKey(QByteArray::fromHex("000102030405060708090a0b0c0d0e0f"));
+
+    const QByteArray plain = QByteArray::fromHex("00112233445566778899aabbccddeeff");
+    QByteArray encrypted(16, '\0');
+    cipher.encryptBlock(reinterpret_cast<const quint8*>(plain.constData()),
+                        reinterpret_cast<quint8*>(encrypted.data()));
+    QCOMPARE(encrypted.toHex(), QByteArray("69c4e0d86a7b0430d8cdb78070b4c55a"));
+}
+
+void tst_QXmppSrtp::testKeyDerivation()
+{
+    // RFC 3711, appendix B.3
+    const QByteArray key = masterKey.left(16);
+    const QByteArray salt = masterKey.mid(16);
+
+    QCOMPARE(QXmppSrtpContext::deriveSessionKey(key, salt, 0x00, 16).toHex(),
+             QByteArray("c61e7a93744f39ee10734afe3ff7a087"));
+    QCOMPARE(QXmppSrtpContext::deriveSessionKey(key, salt, 0x01, 20).toHex(),
+             QByteArray("cebe321f6ff7716b6fd4ab49af256a156d38baa4"));
+    QCOMPARE(QXmppSrtpContext::deriveSessionKey(key, salt, 0x02, 14).toHex(),
+             QByteArray("30cbbc08863d8c85d49db34a9ae1"));
+}
+
+void tst_QXmppSrtp::testMasterKey()
+{
+    const QByteArray key1 = QXmppSrtpContext::generateMasterKey();
+    const QByteArray key2 = QXmppSrtpContext::generateMasterKey();
+    QCOMPARE(key1.size(), QXmppSrtpContext::masterKeyLength());
+    QCOMPARE(key2.size(), QXmppSrtpContext::masterKeyLength());
+    QVERIFY(key1 != key2);
+
+    QXmppSrtpContext context;
+    QVERIFY(context.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, key1));
+}
+
+void tst_QXmppSrtp::testProtect_data()
+{
+    QTest::addColumn<int>("suite");
+    QTest::addColumn<QByteArray>("protectedPacket");
+
+    QTest::newRow("AES_CM_128_HMAC_SHA1_80")
+        << int(QXmppSrtpContext::AesCm128HmacSha1_80)
+        << QByteArray("800f1234decafbadcafebabe4e55dc4ce79978d88ca4d215949d2402b78d6acc99ea179b8dbb");
+    QTest::newRow("AES_CM_128_HMAC_SHA1_32")
+        << int(QXmppSrtpContext::AesCm128HmacSha1_32)
+        << QByteArray("800f1234decafbadcafebabe4e55dc4ce79978d88ca4d215949d2402b78d6acc99ea179b");
+}
+
+void tst_QXmppSrtp::testProtect()
+{
+    QFETCH(int, suite);
+    QFETCH(QByteArray, protectedPacket);
+
+    const QByteArray plain = rtpPacket(0x1234, QByteArray(16, '\xab'));
+    QCOMPARE(plain.toHex(), QByteArray("800f1234decafbadcafebabeabababababababababababababababab"));
+
+    QXmppSrtpContext sender;
+    QVERIFY(sender.setMasterKey(QXmppSrtpContext::CryptoSuite(suite), masterKey));
+    QByteArray packet = plain;
+    QVERIFY(sender.protect(&packet));
+    QCOMPARE(packet.toHex(), protectedPacket);
+
+    QXmppSrtpContext receiver;
+    QVERIFY(receiver.setMasterKey(QXmppSrtpContext::CryptoSuite(suite), masterKey));
+    QByteArray output;
+    QVERIFY(receiver.unprotect(packet, &output));
+    QCOMPARE(output, plain);
+}
+
+void tst_QXmppSrtp::testReplay()
+{
+    QXmppSrtpContext sender;
+    QXmppSrtpContext receiver;
+    QVERIFY(sender.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+    QVERIFY(receiver.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+
+    QList<QByteArray> packets;
+    for (quint16 sequence = 100; sequence < 110; ++sequence) {
+        QByteArray packet = rtpPacket(sequence, QByteArray(160, char(sequence)));
+        QVERIFY(sender.protect(&packet));
+        packets << packet;
+    }
+
+    // out of order delivery is accepted
+    QByteArray output;
+    QVERIFY(receiver.unprotect(packets[0], &output));
+    QVERIFY(receiver.unprotect(packets[2], &output));
+    QVERIFY(receiver.unprotect(packets[1], &output));
+    QCOMPARE(output, rtpPacket(101, QByteArray(160, char(101))));
+
+    // replayed packets are rejected
+    QVERIFY(!receiver.unprotect(packets[1], &output));
+    QVERIFY(!receiver.unprotect(packets[2], &output));
+    QVERIFY(receiver.unprotect(packets[9], &output));
+    QVERIFY(!receiver.unprotect(packets[9], &output));
+    QVERIFY(receiver.unprotect(packets[5], &output));
+}
+
+void tst_QXmppSrtp::testRollover()
+{
+    QXmppSrtpContext sender;
+    QXmppSrtpContext receiver;
+    QVERIFY(sender.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+    QVERIFY(receiver.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+
+    QByteArray output;
+    for (quint32 i = 0xfffd; i < 0x10003; ++i) {
+        const QByteArray plain = rtpPacket(quint16(i), QByteArray(20, 'x'));
+        QByteArray packet = plain;
+        QVERIFY(sender.protect(&packet));
+        QVERIFY(receiver.unprotect(packet, &output));
+        QCOMPARE(output, plain);
+    }
+}
+
+void tst_QXmppSrtp::testTamper()
+{
+    QXmppSrtpContext sender;
+    QXmppSrtpContext receiver;
+    QVERIFY(sender.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+    QVERIFY(receiver.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+
+    QByteArray packet = rtpPacket(1, QByteArray(160, 'x'));
+    QVERIFY(sender.protect(&packet));
+
+    QByteArray output;
+    QByteArray modified = packet;
+    modified[20] = modified[20] ^ 0x01;
+    QVERIFY(!receiver.unprotect(modified, &output));
+
+    modified = packet;
+    modified[modified.size() - 1] = modified[modified.size() - 1] ^ 0x01;
+    QVERIFY(!receiver.unprotect(modified, &output));
+
+    QVERIFY(!receiver.unprotect(packet.left(8), &output));
+    QVERIFY(receiver.unprotect(packet, &output));
+
+    // a different key is rejected
+    QByteArray otherKey = masterKey;
+    otherKey[0] = otherKey[0] ^ 0x01;
+    QXmppSrtpContext other;
+    QVERIFY(other.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, otherKey));
+    QVERIFY(!other.unprotect(packet, &output));
+}
+
+void tst_QXmppSrtp::testSuite()
+{
+    QCOMPARE(QXmppSrtpContext::suiteFromString("AES_CM_128_HMAC_SHA1_80"), QXmppSrtpContext::AesCm128HmacSha1_80);
+    QCOMPARE(QXmppSrtpContext::suiteFromString("AES_CM_128_HMAC_SHA1_32"), QXmppSrtpContext::AesCm128HmacSha1_32);
+    QCOMPARE(QXmppSrtpContext::suiteFromString("AEAD_AES_128_GCM"), QXmppSrtpContext::NoCryptoSuite);
+    QCOMPARE(QXmppSrtpContext::suiteToString(QXmppSrtpContext::AesCm128HmacSha1_32), QString("AES_CM_128_HMAC_SHA1_32"));
+
+    QXmppSrtpContext context;
+    QCOMPARE(context.cryptoSuite(), QXmppSrtpContext::NoCryptoSuite);
+    QVERIFY(!context.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey.left(16)));
+    QCOMPARE(context.cryptoSuite(), QXmppSrtpContext::NoCryptoSuite);
+
+    QByteArray packet = rtpPacket(1, QByteArray(160, 'x'));
+    QVERIFY(!context.protect(&packet));
+}
+
+void tst_QXmppSrtp::testThroughput()
+{
+    QXmppSrtpContext sender;
+    QXmppSrtpContext receiver;
+    QVERIFY(sender.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+    QVERIFY(receiver.setMasterKey(QXmppSrtpContext::AesCm128HmacSha1_80, masterKey));
+
+    const QByteArray plain = rtpPacket(0, QByteArray(1200, 'x'));
+    QByteArray packet;
+    packet.reserve(1500);
+    QByteArray output;
+    output.reserve(1500);
+    quint16 sequence = 0;
+
+    QBENCHMARK {
+        packet.resize(plain.size());
+        memcpy(packet.data(), plain.constData(), plain.size());
+        packet.data()[2] = char(sequence >> 8);
+        packet.data()[3] = char(sequence & 0xff);
+        sequence++;
+        QVERIFY(sender.protect(&packet));
+        QVERIFY(receiver.unprotect(packet, &output));
+    }
+}
+
+QTEST_MAIN(tst_QXmppSrtp)
+#include "tst_qxmppsrtp.moc"
@@ -34,6 +34,7 @@ private slots:
     void testFileInfo_data();
     void testFileInfo();
     void testOffer();
+    void testRange();
     void testResult();
 };
 
@@ -43,6 +44,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
     QTest::addColumn<QDateTime>("date");
     QTest::addColumn<QString>("description");
     QTest::addColumn<QByteArray>("hash");
+    QTest::addColumn<QByteArray>("sha256");
     QTest::addColumn<QString>("name");
     QTest::addColumn<qint64>("size");
 
@@ -51,6 +53,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QDateTime()
         << QString()
         << QByteArray()
+        << QByteArray()
         << QString("test.txt")
         << qint64(1022);
 
@@ -65,8 +68,22 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QDateTime(QDate(1969, 7, 21), QTime(2, 56, 15), Qt::UTC)
         << QString("This is a test. If this were a real file...")
         << QByteArray::fromHex("552da749930852c69ae5d2141d3766b1")
+        << QByteArray()
         << QString("test.txt")
         << qint64(1022);
+
+    QTest::newRow("sha-256")
+        << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" "
+            "hash=\"d41d8cd98f00b204e9800998ecf8427e\" "
+            "name=\"empty.txt\">"
+                "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=</hash>"
+            "</file>")
+        << QDateTime()
+        << QString()
+        << QByteArray::fromHex("d41d8cd98f00b204e9800998ecf8427e")
+        << QByteArray::fromHex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855")
+        << QString("empty.txt")
+        << qint64(0);
 }
 
 void tst_QXmppStreamInitiationIq::testFileInfo()
@@ -75,6 +92,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QFETCH(QDateTime, date);
     QFETCH(QString, description);
     QFETCH(QByteArray, hash);
+    QFETCH(QByteArray, sha256);
     QFETCH(QString, name);
     QFETCH(qint64, size);
 
@@ -83,6 +101,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QCOMPARE(info.date(), date);
     QCOMPARE(info.description(), description);
     QCOMPARE(info.hash(), hash);
+    QCOMPARE(info.sha256(), sha256);
     QCOMPARE(info.name(), name);
     QCOMPARE(info.size(), size);
     serializePacket(info, xml);
@@ -113,6 +132,40 @@ void tst_QXmppStreamInitiationIq::testOffer()
     serializePacket(iq, xml);
 }
 
+void tst_QXmppStreamInitiationIq::testRange()
+{
+    // the sender supports ranged transfers
+    const QByteArray offerXml(
+        "<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.txt\" size=\"1022\">"
+            "<range/>"
+        "</file>");
+
+    QXmppTransferFileInfo offer;
+    parsePacket(offer, offerXml);
+    QVERIFY(offer.isRangeSupported());
+    QCOMPARE(offer.rangeOffset(), qint64(0));
+    QCOMPARE(offer.rangeLength(), qint64(0));
+    serializePacket(offer, offerXml);
+
+    // the recipient asks to resume the transfer
+    const QByteArray resultXml(
+        "<iq id=\"offer1\" to=\"sender@jabber.org/resource\" type=\"result\">"
+          "<si xmlns=\"http://jabber.org/protocol/si\">"
+            "<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+              "<range offset=\"128\" length=\"256\"/>"
+            "</file>"
+          "</si>"
+        "</iq>");
+
+    QXmppStreamInitiationIq iq;
+    parsePacket(iq, resultXml);
+    QVERIFY(!iq.fileInfo().isNull());
+    QVERIFY(iq.fileInfo().isRangeSupported());
+    QCOMPARE(iq.fileInfo().rangeOffset(), qint64(128));
+    QCOMPARE(iq.fileInfo().rangeLength(), qint64(256));
+    serializePacket(iq, resultXml);
+}
+
 void tst_QXmppStreamInitiationIq::testResult()
 {
     QByteArray xml(
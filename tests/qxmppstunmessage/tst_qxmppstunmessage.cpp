@@ -21,6 +21,7 @@
  *
  */
 
+#include <QMessageAuthenticationCode>
 #include <QObject>
 #include "QXmppStun.h"
 #include "util.h"
@@ -30,6 +31,8 @@ class tst_QXmppStunMessage : public QObject
     Q_OBJECT
 
 private slots:
+    void testBindingCost();
+    void testEncodeBuffer();
     void testFingerprint();
     void testIntegrity();
     void testIPv4Address();
@@ -38,6 +41,52 @@ private slots:
     void testXorIPv6Address();
 };
 
+void tst_QXmppStunMessage::testBindingCost()
+{
+    const QByteArray key("somesecret");
+
+    QXmppStunMessage msg;
+    msg.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
+    msg.setId(QByteArray("0123456789ab"));
+    msg.setPriority(1862270975);
+    msg.setUsername(QLatin1String("bar:foo"));
+    msg.iceControlling = QByteArray(8, 'x');
+    msg.useCandidate = true;
+
+    QBENCHMARK {
+        const QByteArray packet = msg.encode(key);
+        QXmppStunMessage msg2;
+        QVERIFY(msg2.decode(packet, key));
+    }
+}
+
+void tst_QXmppStunMessage::testEncodeBuffer()
+{
+    const QByteArray key("somesecret");
+
+    QXmppStunMessage msg;
+    msg.setType(0x0001);
+    msg.setUsername(QLatin1String("bar:foo"));
+    const QByteArray expected = msg.encode(key);
+    QCOMPARE(expected.size(), 64);
+
+    // buffer too small
+    char buffer[64];
+    QCOMPARE(msg.encode(buffer, 10, key), 64);
+
+    // exact buffer
+    QCOMPARE(msg.encode(buffer, sizeof(buffer), key), 64);
+    QCOMPARE(QByteArray(buffer, sizeof(buffer)), expected);
+
+    // large DATA attribute does not fit on the stack
+    msg.setData(QByteArray(4000, 'x'));
+    const QByteArray packet = msg.encode(key);
+    QCOMPARE(packet.size(), 4068);
+    QXmppStunMessage msg2;
+    QVERIFY(msg2.decode(packet, key));
+    QCOMPARE(msg2.data(), QByteArray(4000, 'x'));
+}
+
 void tst_QXmppStunMessage::testFingerprint()
 {
     // without fingerprint
@@ -49,6 +98,15 @@ void tst_QXmppStunMessage::testFingerprint()
     // with fingerprint
     QCOMPARE(msg.encode(QByteArray(), true),
              QByteArray("\x00\x01\x00\x08\x21\x12\xA4\x42\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x80\x28\x00\x04\xB2\xAA\xF9\xF6", 28));
+
+    // decode
+    QByteArray packet = msg.encode(QByteArray(), true);
+    QXmppStunMessage msg2;
+    QVERIFY(msg2.decode(packet));
+
+    // bad fingerprint
+    packet[27] = 0;
+    QVERIFY(!msg2.decode(packet));
 }
 
 void tst_QXmppStunMessage::testIntegrity()
@@ -57,6 +115,34 @@ void tst_QXmppStunMessage::testIntegrity()
     msg.setType(0x0001);
     QCOMPARE(msg.encode(QByteArray("somesecret"), false),
              QByteArray("\x00\x01\x00\x18\x21\x12\xA4\x42\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x08\x00\x14\x96\x4B\x40\xD1\x84\x67\x6A\xFD\xB5\xE0\x7C\xC5\x1F\xFB\xBD\xA2\x61\xAF\xB1\x26", 44));
+
+    // encode into a buffer
+    char buffer[44];
+    QCOMPARE(msg.encode(buffer, sizeof(buffer), QByteArray("somesecret"), false), 44);
+    QCOMPARE(QByteArray(buffer, sizeof(buffer)), msg.encode(QByteArray("somesecret"), false));
+
+    // decode
+    QByteArray packet = msg.encode(QByteArray("somesecret"));
+    QXmppStunMessage msg2;
+    QVERIFY(msg2.decode(packet, QByteArray("somesecret")));
+    QVERIFY(!msg2.decode(packet, QByteArray("othersecret")));
+
+    // bad integrity
+    packet[30] = packet[30] ^ 0x01;
+    QVERIFY(!msg2.decode(packet, QByteArray("somesecret")));
+
+    // missing integrity
+    QVERIFY(msg2.decode(msg.encode(QByteArray())));
+    QVERIFY(!msg2.decode(msg.encode(QByteArray()), QByteArray("somesecret")));
+
+    // reuse the same code for several messages
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha1, QByteArray("somesecret"));
+    QCOMPARE(msg.encode(buffer, sizeof(buffer), &mac, false), 44);
+    QCOMPARE(QByteArray(buffer, sizeof(buffer)), msg.encode(QByteArray("somesecret"), false));
+    QVERIFY(!msg2.decode(packet, &mac));
+    packet[30] = packet[30] ^ 0x01;
+    QVERIFY(msg2.decode(packet, &mac));
+    QVERIFY(msg2.decode(packet, &mac));
 }
 
 void tst_QXmppStunMessage::testIPv4Address()
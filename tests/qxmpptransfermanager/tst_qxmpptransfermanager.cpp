@@ -22,15 +22,175 @@
  */
 
 #include <QBuffer>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
 #include <QObject>
+#include <QTemporaryDir>
 
 #include "QXmppClient.h"
+#include "QXmppMessage.h"
 #include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppServerProxy65.h"
 #include "QXmppTransferManager.h"
 #include "util.h"
 
 Q_DECLARE_METATYPE(QXmppTransferJob::Method)
 
+// Server extension which tampers with the in-band data blocks sent to
+// the receiver.
+class TestIbbTamperer : public QXmppServerExtension
+{
+    Q_OBJECT
+
+public:
+    enum Mode {
+        Resend,     // ask the sender to resend the second block
+        Reorder,    // deliver the first block after the second one
+        Wrap        // shift sequence numbers so that they wrap around
+    };
+
+    TestIbbTamperer(Mode mode)
+        : m_mode(mode)
+        , m_resent(false)
+    {
+    }
+
+    bool handleStanza(const QDomElement &element)
+    {
+        const QDomElement dataElement = element.firstChildElement("data");
+        if (dataElement.namespaceURI() != "http://jabber.org/protocol/ibb" ||
+            !element.attribute("to").startsWith("receiver@"))
+            return false;
+
+        const quint16 sequence = dataElement.attribute("seq").toUShort();
+        sequences << sequence;
+        if (element.tagName() == "message") {
+            messageTypes << element.attribute("type");
+            hinted << (!element.firstChildElement("no-store").isNull() &&
+                       !element.firstChildElement("no-copy").isNull());
+        }
+
+        switch (m_mode) {
+        case Resend:
+            if (sequence == 1 && !m_resent) {
+                m_resent = true;
+                QXmppIq response(QXmppIq::Error);
+                response.setId(element.attribute("id"));
+                response.setFrom(element.attribute("to"));
+                response.setTo(element.attribute("from"));
+                response.setError(QXmppStanza::Error(QXmppStanza::Error::Wait,
+                    QXmppStanza::Error::ResourceConstraint));
+                server()->sendPacket(response);
+                return true;
+            }
+            return false;
+        case Reorder:
+            if (sequence == 0) {
+                m_held = element.cloneNode(true).toElement();
+                return true;
+            } else if (sequence == 1 && !m_held.isNull()) {
+                server()->sendElement(element);
+                server()->sendElement(m_held);
+                m_held = QDomElement();
+                return true;
+            }
+            return false;
+        case Wrap: {
+            // fill the receiver's sequence with empty blocks
+            if (sequence == 0) {
+                for (int i = 0; i < wrapOffset; ++i) {
+                    QXmppElement emptyElement;
+                    emptyElement.setTagName("data");
+                    emptyElement.setAttribute("xmlns", "http://jabber.org/protocol/ibb");
+                    emptyElement.setAttribute("sid", dataElement.attribute("sid"));
+                    emptyElement.setAttribute("seq", QString::number(i));
+
+                    QXmppMessage message;
+                    message.setFrom(element.attribute("from"));
+                    message.setTo(element.attribute("to"));
+                    message.setType(QXmppMessage::Normal);
+                    message.setExtensions(QXmppElementList() << emptyElement);
+                    server()->sendPacket(message);
+                }
+            }
+            QDomElement copy = element.cloneNode(true).toElement();
+            copy.firstChildElement("data").setAttribute("seq", QString::number(quint16(sequence + wrapOffset)));
+            server()->sendElement(copy);
+            return true;
+        }
+        }
+        return false;
+    }
+
+    static const int wrapOffset = 65534;
+
+    QList<quint16> sequences;
+    QStringList messageTypes;
+    QList<bool> hinted;
+
+private:
+    Mode m_mode;
+    bool m_resent;
+    QDomElement m_held;
+};
+
+Q_DECLARE_METATYPE(TestIbbTamperer::Mode)
+
+// Server extension which records the identifiers of the stream
+// initiation offers.
+class TestOfferRecorder : public QXmppServerExtension
+{
+    Q_OBJECT
+
+public:
+    bool handleStanza(const QDomElement &element)
+    {
+        if (element.tagName() == "iq" && element.attribute("type") == "set" &&
+            element.firstChildElement("si").namespaceURI() == "http://jabber.org/protocol/si")
+            offerIds << element.attribute("id");
+        return false;
+    }
+
+    QStringList offerIds;
+};
+
+// Server extension which offers an unreachable stream host to the
+// receiver before the sender's own stream hosts.
+class TestStreamHostTamperer : public QXmppServerExtension
+{
+    Q_OBJECT
+
+public:
+    TestStreamHostTamperer()
+        : tampered(false)
+    {
+    }
+
+    bool handleStanza(const QDomElement &element)
+    {
+        const QDomElement queryElement = element.firstChildElement("query");
+        if (element.tagName() != "iq" || element.attribute("type") != "set" ||
+            queryElement.namespaceURI() != "http://jabber.org/protocol/bytestreams" ||
+            queryElement.firstChildElement("streamhost").isNull() ||
+            !element.attribute("to").startsWith("receiver@"))
+            return false;
+
+        QDomElement copy = element.cloneNode(true).toElement();
+        QDomElement copyQuery = copy.firstChildElement("query");
+        QDomElement bogusElement = copy.ownerDocument().createElement("streamhost");
+        bogusElement.setAttribute("jid", "bogus.localhost");
+        bogusElement.setAttribute("host", "192.0.2.1");
+        bogusElement.setAttribute("port", "1");
+        copyQuery.insertBefore(bogusElement, copyQuery.firstChildElement("streamhost"));
+        server()->sendElement(copy);
+        tampered = true;
+        return true;
+    }
+
+    bool tampered;
+};
+
 class tst_QXmppTransferManager : public QObject
 {
     Q_OBJECT
@@ -39,12 +199,37 @@ private slots:
     void init();
     void testSendFile_data();
     void testSendFile();
+    void testSendIbb_data();
+    void testSendIbb();
+    void testSocksFallback();
+    void testRequestLookup();
+    void testResume_data();
+    void testResume();
+    void testScheduler_data();
+    void testScheduler();
 
     void acceptFile(QXmppTransferJob *job);
+    void acceptScheduledFile(QXmppTransferJob *job);
+    void offeredFile(QXmppTransferJob *job);
+    void resumeFile(QXmppTransferJob *job);
+    void scheduledFileFinished(QXmppTransferJob *job);
+    void scheduledJobStateChanged();
 
 private:
+    bool connectClient(QXmppClient *client, const QString &user);
+
+    QXmppLogger logger;
+    TestPasswordChecker passwordChecker;
     QBuffer receiverBuffer;
     QXmppTransferJob *receiverJob;
+    QString receiverPath;
+
+    // for scheduled jobs
+    QList<QXmppTransferJob*> senderJobs;
+    int senderMaximumActiveCount;
+    int senderFinishedCount;
+    QStringList receiverOffered;
+    QStringList receiverFinished;
 };
 
 void tst_QXmppTransferManager::init()
@@ -52,6 +237,31 @@ void tst_QXmppTransferManager::init()
     receiverBuffer.close();
     receiverBuffer.setData(QByteArray());
     receiverJob = 0;
+    senderJobs.clear();
+    senderMaximumActiveCount = 0;
+    senderFinishedCount = 0;
+    receiverOffered.clear();
+    receiverFinished.clear();
+}
+
+bool tst_QXmppTransferManager::connectClient(QXmppClient *client, const QString &user)
+{
+    passwordChecker.addCredentials(user, "testpwd");
+
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()), &loop, SLOT(quit()));
+    connect(client, SIGNAL(disconnected()), &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    client->setLogger(&logger);
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
 }
 
 void tst_QXmppTransferManager::acceptFile(QXmppTransferJob *job)
@@ -61,29 +271,83 @@ void tst_QXmppTransferManager::acceptFile(QXmppTransferJob *job)
     job->accept(&receiverBuffer);
 }
 
+void tst_QXmppTransferManager::acceptScheduledFile(QXmppTransferJob *job)
+{
+    receiverOffered << job->fileName();
+
+    QBuffer *buffer = new QBuffer(job);
+    buffer->open(QIODevice::WriteOnly);
+    job->accept(buffer);
+}
+
+void tst_QXmppTransferManager::offeredFile(QXmppTransferJob *job)
+{
+    receiverJob = job;
+}
+
+void tst_QXmppTransferManager::scheduledFileFinished(QXmppTransferJob *job)
+{
+    if (job->direction() == QXmppTransferJob::OutgoingDirection)
+        senderFinishedCount++;
+    else if (job->error() == QXmppTransferJob::NoError)
+        receiverFinished << job->fileName();
+}
+
+void tst_QXmppTransferManager::scheduledJobStateChanged()
+{
+    int count = 0;
+    foreach (QXmppTransferJob *job, senderJobs) {
+        if (job->state() == QXmppTransferJob::StartState ||
+            job->state() == QXmppTransferJob::TransferState)
+            count++;
+    }
+    senderMaximumActiveCount = qMax(senderMaximumActiveCount, count);
+}
+
+void tst_QXmppTransferManager::resumeFile(QXmppTransferJob *job)
+{
+    receiverJob = job;
+    job->resume(receiverPath);
+}
+
 void tst_QXmppTransferManager::testSendFile_data()
 {
     QTest::addColumn<QXmppTransferJob::Method>("senderMethods");
     QTest::addColumn<QXmppTransferJob::Method>("receiverMethods");
+    QTest::addColumn<bool>("ibbMessageStanzas");
+    QTest::addColumn<int>("ibbWindowSize");
+    QTest::addColumn<int>("maximumRate");
+    QTest::addColumn<bool>("proxy");
     QTest::addColumn<bool>("works");
 
-    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << false << 4 << 0 << false << true;
+    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << false << 4 << 0 << false << true;
+    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << false << 4 << 0 << false << true;
 
-    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false;
+    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << false << 4 << 0 << false << true;
+    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << false << 4 << 0 << false << true;
+    QTest::newRow("inband - inband - window 1") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << false << 1 << 0 << false << true;
+    QTest::newRow("inband - inband - messages") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true << 4 << 0 << false << true;
+    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false << 4 << 0 << false << false;
 
-    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false;
-    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << false << 4 << 0 << false << true;
+    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false << 4 << 0 << false << false;
+    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << false << 4 << 0 << false << true;
+
+    QTest::newRow("inband - inband - rate limited") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << false << 4 << 1000 << false << true;
+    QTest::newRow("socks - socks - rate limited") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << false << 4 << 1000 << false << true;
+
+    QTest::newRow("socks - socks - proxy") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << false << 4 << 0 << true << true;
 }
 
 void tst_QXmppTransferManager::testSendFile()
 {
     QFETCH(QXmppTransferJob::Method, senderMethods);
     QFETCH(QXmppTransferJob::Method, receiverMethods);
+    QFETCH(bool, ibbMessageStanzas);
+    QFETCH(int, ibbWindowSize);
+    QFETCH(int, maximumRate);
+    QFETCH(bool, proxy);
     QFETCH(bool, works);
 
     const QString testDomain("localhost");
@@ -102,12 +366,25 @@ void tst_QXmppTransferManager::testSendFile()
     server.setDomain(testDomain);
     server.setLogger(&logger);
     server.setPasswordChecker(&passwordChecker);
+    if (proxy) {
+        QXmppServerProxy65 *proxyExtension = new QXmppServerProxy65;
+        proxyExtension->setHost(testHost.toString());
+        proxyExtension->setPort(testPort + 1);
+        server.addExtension(proxyExtension);
+    }
     server.listenForClients(testHost, testPort);
 
     // prepare sender
     QXmppClient sender;
     QXmppTransferManager *senderManager = new QXmppTransferManager;
     senderManager->setSupportedMethods(senderMethods);
+    senderManager->setIbbMessageStanzas(ibbMessageStanzas);
+    senderManager->setIbbWindowSize(ibbWindowSize);
+    senderManager->setMaximumRate(maximumRate);
+    if (proxy) {
+        senderManager->setProxy("proxy." + testDomain);
+        senderManager->setProxyOnly(true);
+    }
     sender.addExtension(senderManager);
     sender.setLogger(&logger);
 
@@ -146,12 +423,19 @@ void tst_QXmppTransferManager::testSendFile()
 
     // send file
     QEventLoop loop;
+    QElapsedTimer timer;
+    timer.start();
     QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
     QVERIFY(senderJob);
     QCOMPARE(senderJob->localFileUrl(), QUrl::fromLocalFile(":/test.svg"));
     connect(senderJob, SIGNAL(finished()), &loop, SLOT(quit()));
     loop.exec();
 
+    // the file is sent in blocks of 1 KiB, the first two blocks
+    // are sent immediately and the last one after a second
+    if (maximumRate)
+        QVERIFY(timer.elapsed() >= 1000);
+
     if (works) {
         QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
         QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
@@ -179,5 +463,413 @@ void tst_QXmppTransferManager::testSendFile()
     }
 }
 
+void tst_QXmppTransferManager::testSendIbb_data()
+{
+    QTest::addColumn<TestIbbTamperer::Mode>("mode");
+    QTest::addColumn<bool>("ibbMessageStanzas");
+
+    QTest::newRow("resend") << TestIbbTamperer::Resend << false;
+    QTest::newRow("reorder") << TestIbbTamperer::Reorder << false;
+    QTest::newRow("reorder - messages") << TestIbbTamperer::Reorder << true;
+    QTest::newRow("wrap - messages") << TestIbbTamperer::Wrap << true;
+}
+
+void tst_QXmppTransferManager::testSendIbb()
+{
+    QFETCH(TestIbbTamperer::Mode, mode);
+    QFETCH(bool, ibbMessageStanzas);
+
+    // prepare server
+    TestIbbTamperer *tamperer = new TestIbbTamperer(mode);
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(tamperer);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    // prepare sender
+    QXmppClient sender;
+    QXmppTransferManager *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    senderManager->setIbbMessageStanzas(ibbMessageStanzas);
+    senderManager->setIbbWindowSize(4);
+    sender.addExtension(senderManager);
+    QVERIFY(connectClient(&sender, "sender"));
+
+    // prepare receiver
+    QXmppClient receiver;
+    QXmppTransferManager *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(acceptFile(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+    QVERIFY(connectClient(&receiver, "receiver"));
+
+    // send five blocks of data
+    QByteArray data;
+    for (int i = 0; i < 4 * 4096 + 100; ++i)
+        data.append(char(i % 251));
+    QBuffer senderBuffer(&data);
+    QVERIFY(senderBuffer.open(QIODevice::ReadOnly));
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setName("test.bin");
+    fileInfo.setSize(data.size());
+
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", &senderBuffer, fileInfo);
+    QVERIFY(senderJob);
+    connect(senderJob, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(receiverJob);
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, SIGNAL(finished()), &loop, SLOT(quit()));
+        loop.exec();
+    }
+    QCOMPARE(receiverJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    QCOMPARE(receiverBuffer.data(), data);
+
+    // check the data blocks went through the tampered path
+    if (mode == TestIbbTamperer::Resend) {
+        QCOMPARE(tamperer->sequences.size(), 6);
+        QCOMPARE(tamperer->sequences.count(1), 2);
+    } else {
+        QCOMPARE(tamperer->sequences, QList<quint16>() << 0 << 1 << 2 << 3 << 4);
+    }
+
+    // data messages are neither carbon-copied nor archived
+    if (ibbMessageStanzas) {
+        QCOMPARE(tamperer->messageTypes, QStringList() << "normal" << "normal" << "normal" << "normal" << "normal");
+        QVERIFY(!tamperer->hinted.contains(false));
+    }
+}
+
+void tst_QXmppTransferManager::testSocksFallback()
+{
+    // prepare server
+    TestStreamHostTamperer *tamperer = new TestStreamHostTamperer;
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(tamperer);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    // prepare sender
+    QXmppClient sender;
+    QXmppTransferManager *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    sender.addExtension(senderManager);
+    QVERIFY(connectClient(&sender, "sender"));
+
+    // prepare receiver
+    QXmppClient receiver;
+    QXmppTransferManager *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(acceptFile(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+    QVERIFY(connectClient(&receiver, "receiver"));
+
+    // send file, the first stream host offered to the receiver fails
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+    QVERIFY(senderJob);
+    connect(senderJob, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QVERIFY(tamperer->tampered);
+    QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(receiverJob);
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, SIGNAL(finished()), &loop, SLOT(quit()));
+        loop.exec();
+    }
+    QCOMPARE(receiverJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    QCOMPARE(receiverJob->method(), QXmppTransferJob::SocksMethod);
+
+    QFile expectedFile(":/test.svg");
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    QCOMPARE(receiverBuffer.data(), expectedFile.readAll());
+}
+
+void tst_QXmppTransferManager::testRequestLookup()
+{
+    // prepare server
+    TestOfferRecorder *recorder = new TestOfferRecorder;
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(recorder);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    // prepare sender
+    QXmppClient sender;
+    QXmppTransferManager *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    sender.addExtension(senderManager);
+    QVERIFY(connectClient(&sender, "sender"));
+
+    // prepare receiver, which does not accept offers right away
+    QXmppClient receiver;
+    QXmppTransferManager *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(offeredFile(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+    QVERIFY(connectClient(&receiver, "receiver"));
+
+    // prepare a third party
+    QXmppClient other;
+    QVERIFY(connectClient(&other, "other"));
+
+    // send a file
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+    QVERIFY(senderJob);
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)), &loop, SLOT(quit()));
+    loop.exec();
+    QVERIFY(receiverJob);
+    QCOMPARE(recorder->offerIds.size(), 1);
+
+    // an answer from the third party with the same identifier is ignored
+    QXmppIq forged(QXmppIq::Error);
+    forged.setId(recorder->offerIds.first());
+    forged.setTo("sender@localhost/QXmpp");
+    forged.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Forbidden));
+    QVERIFY(other.sendPacket(forged));
+    QTest::qWait(100);
+    QCOMPARE(senderJob->state(), QXmppTransferJob::OfferState);
+
+    // the answer from the receiver is handled
+    connect(senderJob, SIGNAL(finished()), &loop, SLOT(quit()));
+    acceptFile(receiverJob);
+    loop.exec();
+    QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    // the answer to a destroyed job is ignored
+    receiverJob = 0;
+    senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+    QVERIFY(senderJob);
+    loop.exec();
+    QVERIFY(receiverJob);
+    QCOMPARE(recorder->offerIds.size(), 2);
+    delete senderJob;
+
+    QXmppTransferJob *incomingJob = receiverJob;
+    receiverBuffer.close();
+    receiverBuffer.setData(QByteArray());
+    acceptFile(incomingJob);
+    QTest::qWait(100);
+    QCOMPARE(incomingJob->state(), QXmppTransferJob::StartState);
+    incomingJob->abort();
+}
+
+void tst_QXmppTransferManager::testResume_data()
+{
+    QTest::addColumn<QXmppTransferJob::Method>("method");
+    QTest::addColumn<bool>("corrupt");
+
+    QTest::newRow("inband") << QXmppTransferJob::InBandMethod << false;
+    QTest::newRow("inband - corrupt") << QXmppTransferJob::InBandMethod << true;
+    QTest::newRow("socks") << QXmppTransferJob::SocksMethod << false;
+    QTest::newRow("socks - corrupt") << QXmppTransferJob::SocksMethod << true;
+}
+
+void tst_QXmppTransferManager::testResume()
+{
+    QFETCH(QXmppTransferJob::Method, method);
+    QFETCH(bool, corrupt);
+
+    QByteArray data;
+    for (int i = 0; i < 3 * 4096 + 100; ++i)
+        data.append(char(i % 251));
+    const qint64 offset = 5000;
+
+    // the receiver already has the beginning of the file
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    receiverPath = dir.path() + "/test.bin";
+    QFile partialFile(receiverPath);
+    QVERIFY(partialFile.open(QIODevice::WriteOnly));
+    QByteArray partialData = data.left(offset);
+    if (corrupt)
+        partialData[100] = partialData[100] + 1;
+    partialFile.write(partialData);
+    partialFile.close();
+
+    // prepare server
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    // prepare sender
+    QXmppClient sender;
+    QXmppTransferManager *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(method);
+    sender.addExtension(senderManager);
+    QVERIFY(connectClient(&sender, "sender"));
+
+    // prepare receiver
+    QXmppClient receiver;
+    QXmppTransferManager *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(method);
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(resumeFile(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+    QVERIFY(connectClient(&receiver, "receiver"));
+
+    // send file
+    QBuffer senderBuffer(&data);
+    QVERIFY(senderBuffer.open(QIODevice::ReadOnly));
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setName("test.bin");
+    fileInfo.setSize(data.size());
+    fileInfo.setSha256(QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", &senderBuffer, fileInfo);
+    QVERIFY(senderJob);
+    connect(senderJob, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(receiverJob);
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, SIGNAL(finished()), &loop, SLOT(quit()));
+        loop.exec();
+    }
+    QCOMPARE(receiverJob->state(), QXmppTransferJob::FinishedState);
+
+    // only the missing data was sent
+    QFile receivedFile(receiverPath);
+    QVERIFY(receivedFile.open(QIODevice::ReadOnly));
+    const QByteArray receivedData = receivedFile.readAll();
+    QCOMPARE(receivedData.size(), data.size());
+    QCOMPARE(receivedData.left(offset), partialData);
+    QCOMPARE(receivedData.mid(offset), data.mid(offset));
+
+    // the whole file is verified against the offered hash
+    if (corrupt) {
+        QCOMPARE(receiverJob->error(), QXmppTransferJob::FileCorruptError);
+    } else {
+        QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+        QCOMPARE(QCryptographicHash::hash(receivedData, QCryptographicHash::Sha256), fileInfo.sha256());
+    }
+}
+
+void tst_QXmppTransferManager::testScheduler_data()
+{
+    QTest::addColumn<int>("maximumActiveJobs");
+    QTest::addColumn<int>("maximumRate");
+
+    QTest::newRow("queued") << 1 << 0;
+    QTest::newRow("rate limited") << 0 << 20000;
+}
+
+void tst_QXmppTransferManager::testScheduler()
+{
+    QFETCH(int, maximumActiveJobs);
+    QFETCH(int, maximumRate);
+
+    // prepare server
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    // prepare sender
+    QXmppClient sender;
+    QXmppTransferManager *senderManager = new QXmppTransferManager;
+    senderManager->setMaximumActiveJobs(maximumActiveJobs);
+    senderManager->setMaximumRate(maximumRate);
+    sender.addExtension(senderManager);
+    QVERIFY(connectClient(&sender, "sender"));
+
+    // prepare receiver
+    QXmppClient receiver;
+    QXmppTransferManager *receiverManager = new QXmppTransferManager;
+    connect(receiverManager, SIGNAL(fileReceived(QXmppTransferJob*)),
+            this, SLOT(acceptScheduledFile(QXmppTransferJob*)));
+    connect(receiverManager, SIGNAL(jobFinished(QXmppTransferJob*)),
+            this, SLOT(scheduledFileFinished(QXmppTransferJob*)));
+    receiver.addExtension(receiverManager);
+    QVERIFY(connectClient(&receiver, "receiver"));
+
+    // send a normal priority job, then a low and a high priority job
+    QByteArray data;
+    for (int i = 0; i < 8 * 1024; ++i)
+        data.append(char(i % 251));
+
+    const QStringList names = QStringList() << "normal" << "low" << "high";
+    const QList<QXmppTransferJob::Priority> priorities = QList<QXmppTransferJob::Priority>()
+        << QXmppTransferJob::NormalPriority
+        << QXmppTransferJob::LowPriority
+        << QXmppTransferJob::HighPriority;
+    for (int i = 0; i < names.size(); ++i) {
+        QBuffer *buffer = new QBuffer(&sender);
+        buffer->setData(data);
+        QVERIFY(buffer->open(QIODevice::ReadOnly));
+
+        QXmppTransferFileInfo fileInfo;
+        fileInfo.setName(names[i]);
+        fileInfo.setSize(data.size());
+
+        QXmppTransferJob *job = senderManager->sendFile("receiver@localhost/QXmpp", buffer, fileInfo);
+        QVERIFY(job);
+        job->setPriority(priorities[i]);
+        connect(job, SIGNAL(stateChanged(QXmppTransferJob::State)),
+                this, SLOT(scheduledJobStateChanged()));
+        senderJobs << job;
+    }
+
+    // wait for the transfers to finish
+    QEventLoop loop;
+    connect(senderManager, SIGNAL(jobFinished(QXmppTransferJob*)),
+            this, SLOT(scheduledFileFinished(QXmppTransferJob*)));
+    connect(senderManager, SIGNAL(jobFinished(QXmppTransferJob*)),
+            &loop, SLOT(quit()));
+    connect(receiverManager, SIGNAL(jobFinished(QXmppTransferJob*)),
+            &loop, SLOT(quit()));
+    QElapsedTimer timer;
+    timer.start();
+    while ((senderFinishedCount < names.size() || receiverFinished.size() < names.size()) &&
+           timer.elapsed() < 10000) {
+        QTimer::singleShot(1000, &loop, SLOT(quit()));
+        loop.exec();
+    }
+
+    QCOMPARE(receiverFinished.size(), 3);
+    foreach (QXmppTransferJob *job, senderJobs) {
+        QCOMPARE(job->state(), QXmppTransferJob::FinishedState);
+        QCOMPARE(job->error(), QXmppTransferJob::NoError);
+    }
+
+    if (maximumActiveJobs) {
+        // queued jobs are offered one at a time, highest priority first
+        QCOMPARE(senderMaximumActiveCount, 1);
+        QCOMPARE(receiverOffered, QStringList() << "normal" << "high" << "low");
+    } else {
+        // all the jobs are active, the low priority job only gets the
+        // bandwidth left over by the others
+        QCOMPARE(senderMaximumActiveCount, 3);
+        QCOMPARE(receiverFinished.last(), QString("low"));
+    }
+}
+
 QTEST_MAIN(tst_QXmppTransferManager)
 #include "tst_qxmpptransfermanager.moc"
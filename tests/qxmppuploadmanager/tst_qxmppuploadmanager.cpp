@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2008-2019 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *  Manjeet Dahiya
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+
+#include <QBuffer>
+#include <QObject>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "QXmppClient.h"
+#include "QXmppDataForm.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppHttpUploadIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppUploadManager.h"
+#include "util.h"
+
+// Minimal HTTP server which accepts a single PUT request per connection.
+class TestHttpServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    TestHttpServer()
+    {
+        connect(this, SIGNAL(newConnection()),
+                this, SLOT(_q_newConnection()));
+    }
+
+    QByteArray body;
+    QMap<QByteArray, QByteArray> headers;
+    QByteArray requestLine;
+
+private slots:
+    void _q_newConnection()
+    {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            connect(socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_readyRead()));
+            connect(socket, SIGNAL(disconnected()),
+                    socket, SLOT(deleteLater()));
+        }
+    }
+
+    void _q_readyRead()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        m_buffer += socket->readAll();
+
+        const int headerEnd = m_buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        if (requestLine.isEmpty()) {
+            const QList<QByteArray> lines = m_buffer.left(headerEnd).split('\n');
+            requestLine = lines.first().trimmed();
+            for (int i = 1; i < lines.size(); ++i) {
+                const int colon = lines[i].indexOf(':');
+                if (colon > 0)
+                    headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+            }
+        }
+
+        const int length = headers.value("content-length").toInt();
+        if (m_buffer.size() - headerEnd - 4 < length)
+            return;
+
+        body = m_buffer.mid(headerEnd + 4, length);
+        socket->write("HTTP/1.1 201 Created\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+    }
+
+private:
+    QByteArray m_buffer;
+};
+
+// Upload service answering discovery and slot requests.
+class TestUploadService : public QXmppServerExtension
+{
+    Q_OBJECT
+
+public:
+    TestUploadService(quint16 httpPort)
+        : forgeSlots(false)
+        , m_httpPort(httpPort)
+    {
+    }
+
+    bool handleStanza(const QDomElement &element)
+    {
+        const QString domain = server()->domain();
+        const QString jid = "upload." + domain;
+        if (element.tagName() != "iq" || element.attribute("type") != "get")
+            return false;
+
+        if (element.attribute("to") == domain && QXmppDiscoveryIq::isDiscoveryIq(element)) {
+            QXmppDiscoveryIq request;
+            request.parse(element);
+            if (request.queryType() != QXmppDiscoveryIq::ItemsQuery)
+                return false;
+
+            QXmppDiscoveryIq::Item item;
+            item.setJid(jid);
+
+            QXmppDiscoveryIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(domain);
+            response.setTo(request.from());
+            response.setQueryType(QXmppDiscoveryIq::ItemsQuery);
+            response.setItems(QList<QXmppDiscoveryIq::Item>() << item);
+            server()->sendPacket(response);
+            return true;
+        }
+
+        if (element.attribute("to") != jid)
+            return false;
+
+        if (QXmppDiscoveryIq::isDiscoveryIq(element)) {
+            QXmppDiscoveryIq request;
+            request.parse(element);
+
+            QXmppDataForm::Field typeField(QXmppDataForm::Field::HiddenField);
+            typeField.setKey("FORM_TYPE");
+            typeField.setValue("urn:xmpp:http:upload:0");
+
+            QXmppDataForm::Field sizeField;
+            sizeField.setKey("max-file-size");
+            sizeField.setValue("1000000");
+
+            QXmppDataForm form(QXmppDataForm::Result);
+            form.setFields(QList<QXmppDataForm::Field>() << typeField << sizeField);
+
+            QXmppDiscoveryIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(jid);
+            response.setTo(request.from());
+            response.setQueryType(QXmppDiscoveryIq::InfoQuery);
+            response.setFeatures(QStringList() << "http://jabber.org/protocol/disco#info" << "urn:xmpp:http:upload:0");
+            response.setForm(form);
+            server()->sendPacket(response);
+            return true;
+        }
+
+        if (QXmppHttpUploadRequestIq::isHttpUploadRequestIq(element)) {
+            QXmppHttpUploadRequestIq request;
+            request.parse(element);
+            lastRequest = request;
+
+            const QString base = QString("http://127.0.0.1:%1/%2/").arg(QString::number(m_httpPort), request.id());
+            QMap<QString, QString> headers;
+            headers.insert("Authorization", "Basic dGVzdA==");
+
+            // another entity tries to hijack the upload
+            if (forgeSlots) {
+                QXmppHttpUploadSlotIq forged;
+                forged.setType(QXmppIq::Result);
+                forged.setId(request.id());
+                forged.setFrom("intruder." + domain);
+                forged.setTo(request.from());
+                forged.setPutUrl(QUrl(base + "forged/" + request.fileName()));
+                forged.setGetUrl(QUrl(base + "forged/get/" + request.fileName()));
+                server()->sendPacket(forged);
+            }
+
+            QXmppHttpUploadSlotIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(jid);
+            response.setTo(request.from());
+            response.setPutUrl(QUrl(base + request.fileName()));
+            response.setPutHeaders(headers);
+            response.setGetUrl(QUrl(base + "get/" + request.fileName()));
+            server()->sendPacket(response);
+            return true;
+        }
+        return false;
+    }
+
+    bool forgeSlots;
+    QXmppHttpUploadRequestIq lastRequest;
+
+private:
+    quint16 m_httpPort;
+};
+
+class tst_QXmppUploadManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testDestroyedClient();
+    void testDiscovery();
+    void testFileSizeExceeded();
+    void testNoService();
+    void testUpload_data();
+    void testUpload();
+
+private:
+    QXmppClient *client;
+    TestHttpServer *httpServer;
+    QXmppUploadManager *manager;
+    QXmppServer *server;
+    TestPasswordChecker passwordChecker;
+    TestUploadService *service;
+};
+
+void tst_QXmppUploadManager::init()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    QXmppLogger *logger = new QXmppLogger(this);
+    //logger->setLoggingType(QXmppLogger::StdoutLogging);
+
+    httpServer = new TestHttpServer;
+    QVERIFY(httpServer->listen(testHost));
+
+    passwordChecker.addCredentials("sender", "testpwd");
+
+    server = new QXmppServer;
+    service = new TestUploadService(httpServer->serverPort());
+    server->addExtension(service);
+    server->setDomain(testDomain);
+    server->setLogger(logger);
+    server->setPasswordChecker(&passwordChecker);
+    server->listenForClients(testHost, testPort);
+
+    client = new QXmppClient;
+    client->setLogger(logger);
+    manager = new QXmppUploadManager;
+    client->addExtension(manager);
+
+    QEventLoop loop;
+    connect(manager, SIGNAL(serviceFound()),
+            &loop, SLOT(quit()));
+    connect(client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("sender");
+    config.setPassword("testpwd");
+    client->connectToServer(config);
+    loop.exec();
+    QVERIFY(client->isConnected());
+}
+
+void tst_QXmppUploadManager::cleanup()
+{
+    delete client;
+    delete server;
+    delete httpServer;
+}
+
+void tst_QXmppUploadManager::testDestroyedClient()
+{
+    QByteArray data(500000, 'x');
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QSignalSpy connectionSpy(httpServer, SIGNAL(newConnection()));
+    QPointer<QXmppHttpUpload> upload = manager->uploadFile(&buffer, "test.txt");
+    QVERIFY(connectionSpy.wait());
+
+    // destroy the client while the file is being uploaded
+    delete client;
+    client = 0;
+    QVERIFY(upload.isNull());
+    QTest::qWait(100);
+}
+
+void tst_QXmppUploadManager::testDiscovery()
+{
+    QCOMPARE(manager->serviceJid(), QLatin1String("upload.localhost"));
+    QCOMPARE(manager->maximumFileSize(), qint64(1000000));
+}
+
+void tst_QXmppUploadManager::testFileSizeExceeded()
+{
+    QByteArray data(1000001, 'x');
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QXmppHttpUpload *upload = manager->uploadFile(&buffer, "big.bin");
+    QVERIFY(!upload->isFinished());
+
+    // the failure is reported once the caller can connect to finished()
+    QSignalSpy finishedSpy(upload, SIGNAL(finished()));
+    QVERIFY(finishedSpy.wait());
+    QCOMPARE(finishedSpy.size(), 1);
+    QVERIFY(upload->isFinished());
+    QCOMPARE(upload->error(), QXmppHttpUpload::ServiceError);
+    QVERIFY(upload->getUrl().isEmpty());
+    QVERIFY(httpServer->requestLine.isEmpty());
+}
+
+void tst_QXmppUploadManager::testNoService()
+{
+    manager->setServiceJid(QString());
+
+    QByteArray data("hello");
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QXmppHttpUpload *upload = manager->uploadFile(&buffer, "hello.txt");
+    QVERIFY(!upload->isFinished());
+
+    // the failure is reported once the caller can connect to finished()
+    QSignalSpy finishedSpy(upload, SIGNAL(finished()));
+    QVERIFY(finishedSpy.wait());
+    QCOMPARE(finishedSpy.size(), 1);
+    QVERIFY(upload->isFinished());
+    QCOMPARE(upload->error(), QXmppHttpUpload::ServiceError);
+}
+
+void tst_QXmppUploadManager::testUpload_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("forgeSlots");
+
+    QTest::newRow("empty") << 0 << false;
+    QTest::newRow("small") << 1000 << false;
+    QTest::newRow("large") << 500000 << false;
+    QTest::newRow("forged slot") << 1000 << true;
+}
+
+void tst_QXmppUploadManager::testUpload()
+{
+    QFETCH(int, size);
+    QFETCH(bool, forgeSlots);
+
+    service->forgeSlots = forgeSlots;
+
+    QByteArray data(size, 0);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(qrand() & 0xff);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QXmppHttpUpload *upload = manager->uploadFile(&buffer, "test.txt");
+    QVERIFY(!upload->isFinished());
+    QCOMPARE(upload->fileName(), QLatin1String("test.txt"));
+    QCOMPARE(upload->fileSize(), qint64(size));
+
+    QSignalSpy progressSpy(upload, SIGNAL(progress(qint64,qint64)));
+    QEventLoop loop;
+    connect(upload, SIGNAL(finished()),
+            &loop, SLOT(quit()));
+    loop.exec();
+
+    QVERIFY(upload->isFinished());
+    QCOMPARE(upload->error(), QXmppHttpUpload::NoError);
+    QCOMPARE(upload->bytesSent(), qint64(size));
+
+    // check the slot request
+    QCOMPARE(service->lastRequest.fileName(), QLatin1String("test.txt"));
+    QCOMPARE(service->lastRequest.size(), qint64(size));
+    QCOMPARE(service->lastRequest.contentType().name(), QLatin1String("text/plain"));
+
+    // check the PUT request
+    const QString id = service->lastRequest.id();
+    QCOMPARE(httpServer->requestLine, QString("PUT /%1/test.txt HTTP/1.1").arg(id).toLatin1());
+    QCOMPARE(httpServer->headers.value("authorization"), QByteArray("Basic dGVzdA=="));
+    QCOMPARE(httpServer->headers.value("content-type"), QByteArray("text/plain"));
+    QCOMPARE(httpServer->headers.value("content-length"), QByteArray::number(size));
+    QCOMPARE(httpServer->body.size(), data.size());
+    QVERIFY(httpServer->body == data);
+
+    QCOMPARE(upload->getUrl(), QUrl(QString("http://127.0.0.1:%1/%2/get/test.txt").arg(QString::number(httpServer->serverPort()), id)));
+    if (size) {
+        QVERIFY(!progressSpy.isEmpty());
+        QCOMPARE(progressSpy.last().at(0).toLongLong(), qint64(size));
+    }
+}
+
+QTEST_MAIN(tst_QXmppUploadManager)
+#include "tst_qxmppuploadmanager.moc"
@@ -45,6 +45,11 @@ void tst_QXmppUtils::testCrc32()
 
     crc = QXmppUtils::generateCrc32(QByteArray("Hi There"));
     QCOMPARE(crc, 0xDB143BBEu);
+
+    // chained
+    crc = QXmppUtils::generateCrc32("Hi ", 3);
+    crc = QXmppUtils::generateCrc32("There", 5, crc);
+    QCOMPARE(crc, 0xDB143BBEu);
 }
 
 void tst_QXmppUtils::testHmac()